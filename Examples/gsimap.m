@@ -0,0 +1,70 @@
+/* Compare the speed of the chained and open addressing GSIMap layouts.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: gsimap [count [repeats]]
+   Times adding count integer keys to a map, looking up each of them
+   (and a key which is absent), and enumerating the map, for maps of
+   several sizes up to count, with each layout of the map. */
+
+#define	GSI_MAP_OPEN	0
+#define	GSIMAP_BENCH	GSIMapBenchChained
+
+#include "gsimap_bench.h"
+
+extern void GSIMapBenchOpen(const NSUInteger *keys, NSUInteger count,
+  unsigned repeats, double *times);
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSUInteger	count = 1000000;
+  unsigned	repeats = 5;
+  NSUInteger	*keys;
+  NSUInteger	size;
+  NSUInteger	i;
+
+  if (argc > 1)
+    {
+      count = atoi(argv[1]);
+    }
+  if (argc > 2)
+    {
+      repeats = atoi(argv[2]);
+    }
+
+  /* Distinct, scattered, even keys.
+   */
+  keys = malloc(count * sizeof(NSUInteger));
+  for (i = 0; i < count; i++)
+    {
+      keys[i] = ((i * 2654435761U) & 0x7fffffff) << 1;
+    }
+
+  printf("%10s %-8s %12s %12s %12s\n",
+    "size", "layout", "insert ns", "lookup ns", "iterate ns");
+  for (size = 16; size <= count; size *= 8)
+    {
+      unsigned	r = repeats * (unsigned)(count / size);
+      double	chained[3];
+      double	open[3];
+
+      GSIMapBenchChained(keys, size, r, chained);
+      GSIMapBenchOpen(keys, size, r, open);
+      printf("%10lu %-8s %12.1f %12.1f %12.1f\n", (unsigned long)size,
+	"chained", chained[0] * 1e9 / size, chained[1] * 1e9 / (2 * size),
+	chained[2] * 1e9 / size);
+      printf("%10lu %-8s %12.1f %12.1f %12.1f\n", (unsigned long)size,
+	"open", open[0] * 1e9 / size, open[1] * 1e9 / (2 * size),
+	open[2] * 1e9 / size);
+    }
+
+  free(keys);
+  DESTROY(pool);
+  return 0;
+}
@@ -0,0 +1,88 @@
+/* Timing loops shared by the GSIMap layout benchmarks.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   This is included by gsimap.m and gsimap_open.m after GSI_MAP_OPEN
+   and GSIMAP_BENCH (the name of the function to define) are set, so that
+   the same loops are compiled against each layout of the map. */
+
+#define	GSI_MAP_KTYPES	GSUNION_NSINT
+#define	GSI_MAP_VTYPES	GSUNION_NSINT
+#define	GSI_MAP_RETAIN_KEY(M, X)
+#define	GSI_MAP_RELEASE_KEY(M, X)
+#define	GSI_MAP_RETAIN_VAL(M, X)
+#define	GSI_MAP_RELEASE_VAL(M, X)
+#define	GSI_MAP_HASH(M, X)	((X).nsu)
+#define	GSI_MAP_EQUAL(M, X, Y)	((X).nsu == (Y).nsu)
+#define	GSI_MAP_NOCLEAN	1
+
+#include <Foundation/Foundation.h>
+#include <GNUstepBase/GSIMap.h>
+
+/* Adds count keys to a map, then looks each of them up along with as many
+ * absent keys, then enumerates the map, repeating each step repeats times
+ * and storing the average time in seconds taken by each step in times.
+ */
+void
+GSIMAP_BENCH(const NSUInteger *keys, NSUInteger count, unsigned repeats,
+  double *times)
+{
+  NSUInteger	found = 0;
+  unsigned	r;
+
+  times[0] = times[1] = times[2] = 0.0;
+  for (r = 0; r < repeats; r++)
+    {
+      GSIMapTable_t	map;
+      GSIMapEnumerator_t	e;
+      GSIMapNode	node;
+      NSDate		*start;
+      NSUInteger	i;
+
+      GSIMapInitWithZoneAndCapacity(&map, NSDefaultMallocZone(), 0);
+      start = [NSDate date];
+      for (i = 0; i < count; i++)
+	{
+	  GSIMapAddPair(&map, (GSIMapKey)keys[i], (GSIMapVal)i);
+	}
+      times[0] += -[start timeIntervalSinceNow];
+
+      start = [NSDate date];
+      for (i = 0; i < count; i++)
+	{
+	  if (GSIMapNodeForKey(&map, (GSIMapKey)keys[i]) != 0)
+	    {
+	      found++;
+	    }
+	  /* Keys are all even, so this is never present.
+	   */
+	  if (GSIMapNodeForKey(&map, (GSIMapKey)(keys[i] + 1)) != 0)
+	    {
+	      found++;
+	    }
+	}
+      times[1] += -[start timeIntervalSinceNow];
+
+      start = [NSDate date];
+      e = GSIMapEnumeratorForMap(&map);
+      while ((node = GSIMapEnumeratorNextNode(&e)) != 0)
+	{
+	  found += node->value.nsu & 1;
+	}
+      GSIMapEndEnumerator(&e);
+      times[2] += -[start timeIntervalSinceNow];
+
+      GSIMapEmptyMap(&map);
+    }
+  times[0] /= repeats;
+  times[1] /= repeats;
+  times[2] /= repeats;
+  if (found == 0)
+    {
+      fprintf(stderr, "no keys found\n");
+    }
+}
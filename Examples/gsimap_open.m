@@ -0,0 +1,12 @@
+/* The GSIMap benchmark loops compiled against the open addressing layout.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved. */
+
+#define	GSI_MAP_OPEN	1
+#define	GSIMAP_BENCH	GSIMapBenchOpen
+
+#include "gsimap_bench.h"
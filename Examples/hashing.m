@@ -0,0 +1,192 @@
+/* Measure the quality and speed of string hashing.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: hashing [count [repeats]]
+   Builds sets of count keys like those used in typical programs
+   (identifiers, numbers, paths and URLs, and longer text) and, for each
+   set, reports how evenly -hash spreads the keys over a table of
+   buckets compared with the byte at a time hash previously used by
+   the library, and the time taken to hash each key. */
+
+#include <Foundation/Foundation.h>
+
+/* The hash used before, over the UTF-16 characters of a string.
+ */
+static uint32_t
+oldHash(NSString *s)
+{
+  unichar	buf[1024];
+  NSUInteger	len = [s length];
+  const uint8_t	*p = (const uint8_t*)buf;
+  uint32_t	h = 0;
+  NSUInteger	i;
+
+  if (len > 1024)
+    {
+      len = 1024;
+    }
+  [s getCharacters: buf range: NSMakeRange(0, len)];
+  for (i = 0; i < len * sizeof(unichar); i++)
+    {
+      h = (h << 5) + h + p[i];
+    }
+  return h & 0x0fffffff;
+}
+
+/* Returns the number of pairs of keys which share a bucket when the
+ * hashes are used to pick one of size (a power of two) buckets, divided
+ * by the number expected of a random hash.
+ */
+static double
+collisions(uint32_t *hashes, NSUInteger count, NSUInteger size)
+{
+  unsigned	*buckets = calloc(size, sizeof(unsigned));
+  double	pairs = 0.0;
+  double	expected;
+  NSUInteger	i;
+
+  for (i = 0; i < count; i++)
+    {
+      buckets[hashes[i] & (size - 1)]++;
+    }
+  for (i = 0; i < size; i++)
+    {
+      pairs += buckets[i] * (buckets[i] - 1.0) / 2.0;
+    }
+  free(buckets);
+  expected = count * (count - 1.0) / 2.0 / size;
+  return pairs / expected;
+}
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSArray	*names;
+  NSMutableArray	*sets;
+  NSUInteger	count = 200000;
+  unsigned	repeats = 5;
+  NSUInteger	size = 1;
+  uint32_t	*hashes;
+  NSUInteger	i;
+  NSUInteger	s;
+
+  if (argc > 1)
+    {
+      count = atoi(argv[1]);
+    }
+  if (argc > 2)
+    {
+      repeats = atoi(argv[2]);
+    }
+  while (size < count)
+    {
+      size <<= 1;
+    }
+  hashes = malloc(count * sizeof(uint32_t));
+
+  names = [NSArray arrayWithObjects:
+    @"identifiers", @"numbers", @"paths", @"urls", @"text", nil];
+  sets = [NSMutableArray array];
+  for (s = 0; s < [names count]; s++)
+    {
+      NSMutableArray	*keys = [NSMutableArray arrayWithCapacity: count];
+
+      for (i = 0; i < count; i++)
+	{
+	  NSString	*k;
+
+	  switch (s)
+	    {
+	      case 0:
+		k = [NSString stringWithFormat: @"key%lu", (unsigned long)i];
+		break;
+	      case 1:
+		k = [NSString stringWithFormat: @"%lu", (unsigned long)i * 10];
+		break;
+	      case 2:
+		k = [NSString stringWithFormat:
+		  @"/usr/local/share/data/%02lu/file%lu.txt",
+		  (unsigned long)(i % 97), (unsigned long)i];
+		break;
+	      case 3:
+		k = [NSString stringWithFormat:
+		  @"https://www.example.com/api/v2/items/%lu?lang=en",
+		  (unsigned long)i];
+		break;
+	      default:
+		k = [NSString stringWithFormat: @"%@ (%lu) %C%@",
+		  @"The quick brown fox jumps over the lazy dog, then"
+		  @" sleeps for a while in the afternoon sun",
+		  (unsigned long)i, (unichar)(0x3b1 + i % 24),
+		  @" before running home again."];
+		break;
+	    }
+	  [keys addObject: k];
+	}
+      [sets addObject: keys];
+    }
+
+  printf("%-12s %8s %14s %14s %10s\n", "keys", "length",
+    "spread new", "spread old", "ns/hash");
+  for (s = 0; s < [sets count]; s++)
+    {
+      NSArray		*keys = [sets objectAtIndex: s];
+      NSTimeInterval	with = 0.0;
+      NSTimeInterval	without = 0.0;
+      double		spreadNew;
+      double		spreadOld;
+      unsigned		r;
+
+      for (i = 0; i < count; i++)
+	{
+	  hashes[i] = [[keys objectAtIndex: i] hash];
+	}
+      spreadNew = collisions(hashes, count, size);
+      for (i = 0; i < count; i++)
+	{
+	  hashes[i] = oldHash([keys objectAtIndex: i]);
+	}
+      spreadOld = collisions(hashes, count, size);
+
+      /* Strings cache their hash, so each pass times hashing new copies
+       * of the keys, less the time taken to make the copies.
+       */
+      for (r = 0; r < repeats; r++)
+	{
+	  NSDate	*start;
+
+	  start = [NSDate date];
+	  for (i = 0; i < count; i++)
+	    {
+	      NSString	*c = [[keys objectAtIndex: i] mutableCopy];
+
+	      [c release];
+	    }
+	  without += -[start timeIntervalSinceNow];
+
+	  start = [NSDate date];
+	  for (i = 0; i < count; i++)
+	    {
+	      NSString	*c = [[keys objectAtIndex: i] mutableCopy];
+
+	      hashes[i] = [c hash];
+	      [c release];
+	    }
+	  with += -[start timeIntervalSinceNow];
+	}
+      printf("%-12s %8lu %14.3f %14.3f %10.1f\n",
+	[[names objectAtIndex: s] UTF8String],
+	(unsigned long)[[keys lastObject] length], spreadNew, spreadOld,
+	(with - without) * 1e9 / repeats / count);
+    }
+
+  free(hashes);
+  DESTROY(pool);
+  return 0;
+}
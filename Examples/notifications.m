@@ -0,0 +1,137 @@
+/* Measure notification posting throughput with multiple threads.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: notifications [posts-per-thread [churn]]
+   For 1, 2, 4 ... up to twice the number of processors, starts that many
+   threads, each posting a notification with its own name (observed by one
+   observer) the given number of times, and reports the total rate.
+   If a second argument is given, an extra thread continually adds and
+   removes observers of other notifications while the posting goes on. */
+
+#include <Foundation/Foundation.h>
+
+static unsigned		posts = 100000;
+static volatile unsigned	running = 0;
+static volatile BOOL	stop = NO;
+static NSLock		*lock = nil;
+
+@interface	Bench : NSObject
+- (void) churn: (id)ignored;
+- (void) observe: (NSNotification*)n;
+- (void) post: (NSString*)name;
+@end
+
+@implementation	Bench
+- (void) churn: (id)ignored
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  unsigned		count = 0;
+
+  while (NO == stop)
+    {
+      NSString	*name = [NSString stringWithFormat: @"Churn%u", count++ % 100];
+
+      [nc addObserver: self
+	     selector: @selector(observe:)
+		 name: name
+	       object: nil];
+      [nc removeObserver: self name: name object: nil];
+      if (count % 1000 == 0)
+	{
+	  DESTROY(pool);
+	  pool = [NSAutoreleasePool new];
+	}
+    }
+  DESTROY(pool);
+}
+
+- (void) observe: (NSNotification*)n
+{
+}
+
+- (void) post: (NSString*)name
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  unsigned		i;
+
+  for (i = 0; i < posts; i++)
+    {
+      [nc postNotificationName: name object: nil];
+    }
+  [lock lock];
+  running--;
+  [lock unlock];
+  DESTROY(pool);
+}
+@end
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  Bench			*bench = AUTORELEASE([Bench new]);
+  unsigned		max;
+  unsigned		threads;
+
+  if (argc > 1)
+    {
+      posts = atoi(argv[1]);
+    }
+  lock = [NSLock new];
+  max = [[NSProcessInfo processInfo] activeProcessorCount] * 2;
+  if (argc > 2)
+    {
+      [NSThread detachNewThreadSelector: @selector(churn:)
+			       toTarget: bench
+			     withObject: nil];
+    }
+  for (threads = 1; threads <= max; threads *= 2)
+    {
+      NSMutableArray	*names = [NSMutableArray array];
+      NSDate		*start;
+      NSTimeInterval	elapsed;
+      unsigned		i;
+
+      for (i = 0; i < threads; i++)
+	{
+	  NSString	*name = [NSString stringWithFormat: @"Bench%u", i];
+
+	  [names addObject: name];
+	  [nc addObserver: bench
+		 selector: @selector(observe:)
+		     name: name
+		   object: nil];
+	}
+      running = threads;
+      start = [NSDate date];
+      for (i = 0; i < threads; i++)
+	{
+	  [NSThread detachNewThreadSelector: @selector(post:)
+				   toTarget: bench
+				 withObject: [names objectAtIndex: i]];
+	}
+      while (running > 0)
+	{
+	  [NSThread sleepForTimeInterval: 0.001];
+	}
+      elapsed = -[start timeIntervalSinceNow];
+      for (i = 0; i < threads; i++)
+	{
+	  [nc removeObserver: bench name: [names objectAtIndex: i] object: nil];
+	}
+      printf("%3u threads: %12.0f posts per second\n",
+	threads, threads * posts / elapsed);
+    }
+  stop = YES;
+  DESTROY(lock);
+  DESTROY(pool);
+  return 0;
+}
@@ -0,0 +1,129 @@
+/* Measure the speed of filtering an array with a predicate.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: predicates [count [repeats]]
+   Builds an array of count records and filters it with a few typical
+   predicates, reporting the time taken by -filteredArrayUsingPredicate:
+   and by calling -evaluateWithObject: for each record. */
+
+#include <Foundation/Foundation.h>
+
+@interface	Record : NSObject
+{
+  int		age;
+  double	score;
+  NSString	*name;
+}
+- (id) initWithAge: (int)a score: (double)s name: (NSString*)n;
+- (int) age;
+- (NSString*) name;
+- (double) score;
+@end
+
+@implementation	Record
+- (id) initWithAge: (int)a score: (double)s name: (NSString*)n
+{
+  if ((self = [super init]) != nil)
+    {
+      age = a;
+      score = s;
+      name = [n copy];
+    }
+  return self;
+}
+- (int) age
+{
+  return age;
+}
+- (void) dealloc
+{
+  [name release];
+  [super dealloc];
+}
+- (NSString*) name
+{
+  return name;
+}
+- (double) score
+{
+  return score;
+}
+@end
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSArray		*formats;
+  NSMutableArray	*records;
+  unsigned		count = 1000000;
+  unsigned		repeats = 3;
+  unsigned		i;
+
+  if (argc > 1)
+    {
+      count = atoi(argv[1]);
+    }
+  if (argc > 2)
+    {
+      repeats = atoi(argv[2]);
+    }
+
+  records = [NSMutableArray arrayWithCapacity: count];
+  for (i = 0; i < count; i++)
+    {
+      NSString	*n = [NSString stringWithFormat: @"Name%u", i % 1000];
+      Record	*r;
+
+      r = [[Record alloc] initWithAge: i % 100 score: (i % 37) / 3.0 name: n];
+      [records addObject: r];
+      [r release];
+    }
+
+  formats = [NSArray arrayWithObjects:
+    @"age > 50",
+    @"age >= 18 AND score < 4.5",
+    @"name BEGINSWITH 'Name9' AND age > 10",
+    @"name == 'Name7' OR age == 3 OR score > 2 * 5",
+    nil];
+
+  for (i = 0; i < [formats count]; i++)
+    {
+      NSString		*f = [formats objectAtIndex: i];
+      NSPredicate	*p = [NSPredicate predicateWithFormat: f];
+      NSTimeInterval	filtered = 0.0;
+      NSTimeInterval	single = 0.0;
+      NSUInteger	matched = 0;
+      unsigned		r;
+
+      for (r = 0; r < repeats; r++)
+	{
+	  CREATE_AUTORELEASE_POOL(inner);
+	  NSDate	*start;
+	  NSUInteger	j;
+
+	  start = [NSDate date];
+	  matched = [[records filteredArrayUsingPredicate: p] count];
+	  filtered += -[start timeIntervalSinceNow];
+
+	  start = [NSDate date];
+	  for (j = 0; j < count; j++)
+	    {
+	      [p evaluateWithObject: [records objectAtIndex: j]];
+	    }
+	  single += -[start timeIntervalSinceNow];
+	  DESTROY(inner);
+	}
+      printf("%-48s %8lu matched  filter %.3fs  evaluate %.3fs\n",
+	[f UTF8String], (unsigned long)matched,
+	filtered / repeats, single / repeats);
+    }
+
+  DESTROY(pool);
+  return 0;
+}
@@ -0,0 +1,95 @@
+/* Measure retain/release throughput with multiple threads.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: retain [pairs-per-thread]
+   For 1, 2, 4 ... up to twice the number of processors, starts that many
+   threads, each sending retain and release to an object the given number
+   of times, and reports the total rate.  This is done first with every
+   thread using its own object, then with all the threads sharing a single
+   object (so that they contend for its reference count). */
+
+#include <Foundation/Foundation.h>
+
+static unsigned		pairs = 1000000;
+static volatile unsigned	running = 0;
+static NSLock		*lock = nil;
+
+@interface	Bench : NSObject
+- (void) run: (id)object;
+@end
+
+@implementation	Bench
+- (void) run: (id)object
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  unsigned	i;
+
+  for (i = 0; i < pairs; i++)
+    {
+      [object retain];
+      [object release];
+    }
+  [lock lock];
+  running--;
+  [lock unlock];
+  DESTROY(pool);
+}
+@end
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  Bench		*bench = AUTORELEASE([Bench new]);
+  NSObject	*shared = AUTORELEASE([NSObject new]);
+  unsigned	max;
+  unsigned	threads;
+  int		contended;
+
+  if (argc > 1)
+    {
+      pairs = atoi(argv[1]);
+    }
+  lock = [NSLock new];
+  max = [[NSProcessInfo processInfo] activeProcessorCount] * 2;
+  for (contended = 0; contended < 2; contended++)
+    {
+      printf("%s\n", contended ? "One shared object" : "One object per thread");
+      for (threads = 1; threads <= max; threads *= 2)
+	{
+	  NSMutableArray	*objects = [NSMutableArray array];
+	  NSDate		*start;
+	  NSTimeInterval	elapsed;
+	  unsigned		i;
+
+	  for (i = 0; i < threads; i++)
+	    {
+	      [objects addObject: contended ? shared
+		: AUTORELEASE([NSObject new])];
+	    }
+	  running = threads;
+	  start = [NSDate date];
+	  for (i = 0; i < threads; i++)
+	    {
+	      [NSThread detachNewThreadSelector: @selector(run:)
+				       toTarget: bench
+				     withObject: [objects objectAtIndex: i]];
+	    }
+	  while (running > 0)
+	    {
+	      [NSThread sleepForTimeInterval: 0.001];
+	    }
+	  elapsed = -[start timeIntervalSinceNow];
+	  printf("%3u threads: %12.0f retain/release pairs per second\n",
+	    threads, threads * pairs / elapsed);
+	}
+    }
+  DESTROY(lock);
+  DESTROY(pool);
+  return 0;
+}
@@ -0,0 +1,104 @@
+/* Measure how concurrent sorting scales with the number of threads.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: sorting [count]
+   Sorts an array of count (default 1000000) random numbers stably and
+   unstably with NSSortConcurrent, and reports the time taken using 1, 2,
+   4 ... up to the number of processors.  The number of threads used for
+   concurrent work is fixed when the library first needs it, so for each
+   thread count the program runs itself again with GNUSTEP_WORKER_THREADS
+   set in the environment. */
+
+#include <Foundation/Foundation.h>
+
+#ifndef __has_feature
+#define __has_feature(x) 0
+#endif
+
+#if __has_feature(blocks)
+static NSTimeInterval
+timeSort(NSArray *numbers, NSSortOptions options)
+{
+  NSDate	*start = [NSDate date];
+
+  [numbers sortedArrayWithOptions: options
+		  usingComparator: ^ NSComparisonResult (id a, id b) {
+    return [a compare: b];
+  }];
+  return -[start timeIntervalSinceNow];
+}
+
+static void
+measure(unsigned count)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSMutableArray	*numbers = [NSMutableArray arrayWithCapacity: count];
+  unsigned		i;
+
+  srandom(1);
+  for (i = 0; i < count; i++)
+    {
+      [numbers addObject: [NSNumber numberWithLong: random()]];
+    }
+  printf("%3s threads: stable %8.3fs  unstable %8.3fs\n",
+    getenv("GNUSTEP_WORKER_THREADS"),
+    timeSort(numbers, NSSortConcurrent | NSSortStable),
+    timeSort(numbers, NSSortConcurrent));
+  DESTROY(pool);
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  unsigned	count = 1000000;
+
+  if (argc > 1)
+    {
+      count = atoi(argv[1]);
+    }
+#if __has_feature(blocks)
+  if (getenv("GNUSTEP_WORKER_THREADS") != 0)
+    {
+      measure(count);
+    }
+  else
+    {
+      NSProcessInfo	*info = [NSProcessInfo processInfo];
+      NSUInteger	max = [info activeProcessorCount];
+      NSUInteger	threads;
+
+      printf("Sorting %u numbers\n", count);
+      for (threads = 1; threads <= max; threads *= 2)
+	{
+	  NSMutableDictionary	*env;
+	  NSTask		*task;
+
+	  env = [[[info environment] mutableCopy] autorelease];
+	  [env setObject: [NSString stringWithFormat: @"%lu",
+	    (unsigned long)threads] forKey: @"GNUSTEP_WORKER_THREADS"];
+	  task = [[NSTask new] autorelease];
+	  [task setLaunchPath: [[NSBundle mainBundle] executablePath]];
+	  [task setArguments: [NSArray arrayWithObject:
+	    [NSString stringWithFormat: @"%u", count]]];
+	  [task setEnvironment: env];
+	  [task launch];
+	  [task waitUntilExit];
+	  if (threads < max && threads * 2 > max)
+	    {
+	      threads = max / 2;	/* Finish with all the processors.	*/
+	    }
+	}
+    }
+#else
+  printf("Concurrent sorting needs a compiler with blocks support\n");
+#endif
+  DESTROY(pool);
+  return 0;
+}
@@ -0,0 +1,99 @@
+/* Measure the cost of run loop iterations as the number of timers grows.
+
+  Copyright (C) 2026 Free Software Foundation
+
+  Copying and distribution of this file, with or without modification,
+  are permitted in any medium without royalty provided the copyright
+  notice and this notice are preserved.
+
+   Usage: timers [iterations]
+   For each of a range of timer counts, schedules that many timers far in
+   the future plus one which repeats rapidly, then times the run loop
+   while the repeating timer fires the given number of times.  With the
+   timers held in a heap the cost per iteration should grow only slowly
+   with the number of timers. */
+
+#include <Foundation/Foundation.h>
+
+@interface	Ticker : NSObject
+{
+@public
+  unsigned	ticks;
+}
+- (void) tick: (NSTimer*)t;
+- (void) idle: (NSTimer*)t;
+@end
+
+@implementation	Ticker
+- (void) tick: (NSTimer*)t
+{
+  ticks++;
+}
+- (void) idle: (NSTimer*)t
+{
+}
+@end
+
+int
+main(int argc, char **argv)
+{
+  CREATE_AUTORELEASE_POOL(pool);
+  NSRunLoop	*loop = [NSRunLoop currentRunLoop];
+  unsigned	iterations = 10000;
+  unsigned	counts[] = { 0, 10, 100, 1000, 10000, 100000 };
+  unsigned	c;
+
+  if (argc > 1)
+    {
+      iterations = atoi(argv[1]);
+    }
+  for (c = 0; c < sizeof(counts)/sizeof(*counts); c++)
+    {
+      CREATE_AUTORELEASE_POOL(arp);
+      NSMutableArray	*idle;
+      Ticker		*ticker;
+      NSTimer		*t;
+      NSDate		*start;
+      NSTimeInterval	elapsed;
+      unsigned		i;
+
+      ticker = AUTORELEASE([Ticker new]);
+      idle = [NSMutableArray arrayWithCapacity: counts[c]];
+      for (i = 0; i < counts[c]; i++)
+	{
+	  t = [NSTimer timerWithTimeInterval: 1000.0 + i
+				      target: ticker
+				    selector: @selector(idle:)
+				    userInfo: nil
+				     repeats: NO];
+	  [loop addTimer: t forMode: NSDefaultRunLoopMode];
+	  [idle addObject: t];
+	}
+      t = [NSTimer timerWithTimeInterval: 0.000001
+				  target: ticker
+				selector: @selector(tick:)
+				userInfo: nil
+				 repeats: YES];
+      [loop addTimer: t forMode: NSDefaultRunLoopMode];
+
+      start = [NSDate date];
+      while (ticker->ticks < iterations)
+	{
+	  [loop runMode: NSDefaultRunLoopMode
+	     beforeDate: [NSDate distantFuture]];
+	}
+      elapsed = -[start timeIntervalSinceNow];
+
+      [t invalidate];
+      [idle makeObjectsPerformSelector: @selector(invalidate)];
+      /* Let the loop discard the invalidated timers.
+       */
+      [loop limitDateForMode: NSDefaultRunLoopMode];
+
+      printf("%8u timers: %10.3f microseconds per iteration\n",
+	counts[c], elapsed * 1000000.0 / iterations);
+      DESTROY(arp);
+    }
+  DESTROY(pool);
+  return 0;
+}
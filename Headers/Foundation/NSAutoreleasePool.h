@@ -61,7 +61,9 @@ typedef struct autorelease_thread_vars
   unsigned total_objects_count;
 
   /* A cache of NSAutoreleasePool's already alloc'ed.  Caching old pools
-     instead of deallocating and re-allocating them will save time. */
+     instead of deallocating and re-allocating them will save time.
+     The same allocation also holds a cache of the (page sized) arrays
+     in which pools store their objects. */
   __unsafe_unretained id *pool_cache;
   int pool_cache_size;
   int pool_cache_count;
@@ -326,6 +328,27 @@ NS_AUTOMATED_REFCOUNT_UNAVAILABLE
 #endif
 @end
 
+#if OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+/**
+ * Creates a new autorelease pool and makes it the current pool of the
+ * calling thread, returning an opaque token for it.<br />
+ * This is equivalent to [NSAutoreleasePool+new] but, since no messages
+ * are sent, is cheaper for code which creates many short lived pools.
+ */
+GS_EXPORT void *
+GSAutoreleasePoolPush(void);
+
+/**
+ * Destroys the pool identified by a token returned from
+ * GSAutoreleasePoolPush() (and any pools created after it in the same
+ * thread), releasing the objects in it.<br />
+ * This is equivalent to sending -drain to the pool, and must be called
+ * in the thread which created the pool.
+ */
+GS_EXPORT void
+GSAutoreleasePoolPop(void *pool);
+#endif
+
 #if	defined(__cplusplus)
 }
 #endif
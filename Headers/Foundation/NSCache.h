@@ -40,29 +40,25 @@ extern "C" {
 
 @interface NSCache : NSObject
 {
-#if GS_EXPOSE(NSCache)
-  @private
-  /** The maximum total cost of all cache objects. */
-  NSUInteger _costLimit;
-  /** Total cost of currently-stored objects. */
-  NSUInteger _totalCost;
-  /** The maximum number of objects in the cache. */
-  NSUInteger _countLimit;
-  /** The delegate object, notified when objects are about to be evicted. */
-  id _delegate;
-  /** Flag indicating whether discarded objects should be evicted */
-  BOOL _evictsObjectsWithDiscardedContent;
-  /** Name of this cache. */
-  NSString *_name;
-  /** The mapping from names to objects in this cache. */
-  NSMutableDictionary *_objects;
-  /** LRU ordering of all potentially-evictable objects in this cache. */
-  NSMutableArray *_accesses;
-  /** Total number of accesses to objects */
-  int64_t _totalAccesses;
-#endif
-#if     GS_NONFRAGILE
+#if	GS_NONFRAGILE
+#  if	defined(GS_NSCache_IVARS)
+@public GS_NSCache_IVARS
+#  endif
 #else
+  /* The instance variables of earlier versions of the class, no longer
+   * used but kept so that the instance layout is unchanged for subclasses
+   * compiled against those versions.
+   */
+  @private
+  NSUInteger _costLimit GS_UNUSED_IVAR;
+  NSUInteger _totalCost GS_UNUSED_IVAR;
+  NSUInteger _countLimit GS_UNUSED_IVAR;
+  id _delegate GS_UNUSED_IVAR;
+  BOOL _evictsObjectsWithDiscardedContent GS_UNUSED_IVAR;
+  NSString *_name GS_UNUSED_IVAR;
+  NSMutableDictionary *_objects GS_UNUSED_IVAR;
+  NSMutableArray *_accesses GS_UNUSED_IVAR;
+  int64_t _totalAccesses GS_UNUSED_IVAR;
   /* Pointer to private additional data used to avoid breaking ABI
    * when we don't have the non-fragile ABI available.
    * Use this mechanism rather than changing the instance variable
@@ -134,8 +130,10 @@ extern "C" {
 
 /**
  * Adds an object and its associated cost.  The cache will endeavor to keep the
- * total cost below the value set with -setTotalCostLimit: by discarding the
- * contents of objects which implement the NSDiscardableContent protocol.
+ * total cost below the value set with -setTotalCostLimit: (and the number of
+ * objects below the value set with -setCountLimit:) by removing the least
+ * recently used objects, or by discarding the contents of those which
+ * implement the NSDiscardableContent protocol.
  */
 - (void) setObject: (id)obj forKey: (id)key cost: (NSUInteger)num;
 
@@ -150,6 +148,29 @@ extern "C" {
  * limit of 0 is used to indicate no limit; this is the default.
  */
 - (void) setTotalCostLimit: (NSUInteger)lim;
+
+/**
+ * Returns the maximum total cost for objects stored in this cache.
+ */
+- (NSUInteger) totalCostLimit;
+
+#if	OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+/**
+ * Returns the number of objects removed from the cache (or whose content
+ * was discarded) to keep it within its count and cost limits.
+ */
+- (NSUInteger) evictionCount;
+
+/**
+ * Returns the number of times -objectForKey: found an object.
+ */
+- (NSUInteger) hitCount;
+
+/**
+ * Returns the number of times -objectForKey: found no object.
+ */
+- (NSUInteger) missCount;
+#endif
 @end
 
 /**
@@ -78,6 +78,9 @@ typedef enum _NSPredicateOperatorType
   NSPredicateOperatorType	_type;
 #endif
 #if     GS_NONFRAGILE
+#  if	defined(GS_NSComparisonPredicate_IVARS)
+@public GS_NSComparisonPredicate_IVARS
+#  endif
 #else
   /* Pointer to private additional data used to avoid breaking ABI
    * when we don't have the non-fragile ABI available.
@@ -316,6 +316,12 @@ GS_EXPORT NSString * const NSFileHandleOperationException;
  *   information for certificates issued by our trusted authorites but
  *   no longer valid.
  *   </desc>
+ *   <term>GSTLSServerAddress</term>
+ *   <desc>A string (host:port) identifying the server we are connecting to.
+ *   A session made to the same server with the same options is resumed
+ *   (avoiding a full handshake) if possible.  If this is not specified,
+ *   the socket address and service of the connection are used.
+ *   </desc>
  *   <term>GSTLSVerify</term>
  *   <desc>A boolean specifying whether we should require the remote end to
  *   supply a valid certificate in order to establish an encrypted connection.
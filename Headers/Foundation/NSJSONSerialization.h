@@ -1,9 +1,11 @@
 #import "Foundation/NSObject.h"
 
+@class NSArray;
 @class NSData;
 @class NSError;
 @class NSInputStream;
 @class NSOutputStream;
+@class NSString;
 
 enum
 {
@@ -61,3 +63,103 @@ typedef NSUInteger NSJSONReadingOptions;
                      options:(NSJSONWritingOptions)opt
                        error:(NSError **)error;
 @end
+
+#if OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+
+/**
+ * The kinds of token returned by -[GSJSONReader nextToken].
+ */
+typedef enum
+{
+  GSJSONTokenNone = 0,		/** End of input, or an error */
+  GSJSONTokenStartObject,	/** The opening brace of an object */
+  GSJSONTokenEndObject,		/** The closing brace of an object */
+  GSJSONTokenStartArray,	/** The opening bracket of an array */
+  GSJSONTokenEndArray,		/** The closing bracket of an array */
+  GSJSONTokenKey,		/** A key within an object */
+  GSJSONTokenString,		/** A string value */
+  GSJSONTokenNumber,		/** A numeric value */
+  GSJSONTokenBoolean,		/** true or false */
+  GSJSONTokenNull		/** null */
+} GSJSONToken;
+
+/**
+ * <p>A pull parser for JSON, which returns the document one token at a
+ * time instead of building the whole object graph.  Only the values of
+ * the tokens actually returned are ever created, so a large document (or
+ * a stream of many documents) can be processed in memory proportional to
+ * the size of its largest token rather than to the size of the document.
+ * </p>
+ * <p>When the input contains several top level values (for instance
+ * newline delimited JSON, with one document per line) they are returned
+ * one after another, and GSJSONTokenNone is returned only at the end of
+ * the input.
+ * </p>
+ */
+@interface GSJSONReader : NSObject
+{
+@private
+  void	*_state;
+}
+
+/** Initialises the receiver to read JSON in any of the unicode encodings
+ * permitted by RFC4627 from data.
+ */
+- (id) initWithData: (NSData*)data
+	    options: (NSJSONReadingOptions)opt;
+
+/** Initialises the receiver to read JSON from an (open) input stream.<br />
+ * A UTF-8 stream is read incrementally, a buffer at a time.  The other
+ * encodings are read completely before parsing.
+ */
+- (id) initWithStream: (NSInputStream*)stream
+	      options: (NSJSONReadingOptions)opt;
+
+/** Returns the number of containers enclosing the current position.
+ */
+- (NSUInteger) depth;
+
+/** Returns the error which stopped parsing, or nil if there was none.
+ */
+- (NSError*) error;
+
+/** Returns the key of the current token if it is a key or a member of
+ * an object, nil otherwise.
+ */
+- (NSString*) key;
+
+/** Returns the keys of the objects enclosing the current token, joined
+ * by dots.  Elements of an array have the key path of the array.
+ */
+- (NSString*) keyPath;
+
+/** Parses and returns the next token, or GSJSONTokenNone at the end of
+ * the input or on error.
+ */
+- (GSJSONToken) nextToken;
+
+/** Returns the complete value starting at the current token.<br />
+ * For a start token this parses the whole container (and the matching
+ * end token is not returned by -nextToken), for any other token it is
+ * the same as -value.
+ */
+- (id) readValue;
+
+/** Restricts the tokens returned to those at or within the given key
+ * paths (as returned by -keyPath).  Any other values are skipped without
+ * being created.  A nil or empty array removes the restriction.<br />
+ * This should be called before the first token is read.
+ */
+- (void) setKeyPaths: (NSArray*)paths;
+
+/** Skips the container begun by the current start token without creating
+ * any of its contents.  The matching end token is not returned.
+ */
+- (void) skipValue;
+
+/** Returns the value of the current key or scalar token.
+ */
+- (id) value;
+@end
+
+#endif
@@ -209,6 +209,27 @@ enum {
    NSOperationQueueDefaultMaxConcurrentOperationCount = -1
 };
 
+#if	OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+/** The mechanisms a queue may use to run its non-concurrent operations.
+ * <deflist>
+ *   <term>GSOperationQueueSchedulerPool</term>
+ *   <desc>The default ... a small pool of threads takes operations
+ *   from a single list in priority order.</desc>
+ *   <term>GSOperationQueueSchedulerWorkStealing</term>
+ *   <desc>One worker thread per active processor, each with its own
+ *   deque of operations, idle workers stealing work from busy ones.
+ *   This has much lower overheads for large numbers of small operations,
+ *   but operations of equal priority are not guaranteed to start in the
+ *   order in which they were added.</desc>
+ * </deflist>
+ */
+enum {
+  GSOperationQueueSchedulerPool = 0,
+  GSOperationQueueSchedulerWorkStealing = 1
+};
+typedef NSUInteger GSOperationQueueScheduler;
+#endif
+
 @interface NSOperationQueue : NSObject
 {
 #if	GS_NONFRAGILE
@@ -257,6 +278,14 @@ enum {
  */
 - (NSInteger) maxConcurrentOperationCount;
 
+#if	OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+/** Returns the mechanism used to run non-concurrent operations in the
+ * receiver (GSOperationQueueSchedulerPool unless changed using the
+ * -setScheduler: method).
+ */
+- (GSOperationQueueScheduler) scheduler;
+#endif
+
 #if OS_API_VERSION(MAC_OS_X_VERSION_10_6, GS_API_LATEST)
 /** Return the name of this operation queue.
  */
@@ -284,6 +313,15 @@ enum {
 - (void) setName: (NSString*)s;
 #endif
 
+#if	OS_API_VERSION(GS_API_NONE, GS_API_NONE)
+/** Sets the mechanism used to run non-concurrent operations added to the
+ * receiver after this call.<br />
+ * If the platform lacks the atomic operations needed by the work stealing
+ * scheduler, the receiver continues to use GSOperationQueueSchedulerPool.
+ */
+- (void) setScheduler: (GSOperationQueueScheduler)s;
+#endif
+
 /** Marks the receiver as suspended ... while suspended an operation queue
  * will not start any more operations.
  */
@@ -155,7 +155,10 @@ typedef enum
 /**
  * Returns the receiver initialised with the specified capacities
  * (in bytes) and using the specified location on disk for persistent
- * storage.
+ * storage.<br />
+ * A relative path is taken to be within the user's caches directory.
+ * Responses stored on disk by an earlier instance using the same path
+ * are available to the receiver.
  */
 - (id) initWithMemoryCapacity: (NSUInteger)memoryCapacity
 		 diskCapacity: (NSUInteger)diskCapacity
@@ -189,7 +192,11 @@ typedef enum
 
 /**
  * Stores cachedResponse in the cache, keyed on request.<br />
- * Replaces any existing response with the same key.
+ * Replaces any existing response with the same key.<br />
+ * Only responses to GET requests are cached, and a response whose
+ * Cache-Control header contains no-store is not cached.  The response
+ * is written to disk (if its storage policy allows that) in the
+ * background, so this method does not wait for the disk.
  */
 - (void) storeCachedResponse: (NSCachedURLResponse *)cachedResponse
 		  forRequest: (NSURLRequest *)request;
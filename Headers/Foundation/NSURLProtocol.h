@@ -37,6 +37,7 @@ extern "C" {
 #import	<Foundation/NSURLCache.h>
 
 @class NSCachedURLResponse;
+@class NSDictionary;
 @class NSError;
 @class NSMutableURLRequest;
 @class NSURLAuthenticationChallenge;
@@ -224,6 +225,46 @@ extern "C" {
 
 @end
 
+#if	OS_API_VERSION(GS_API_NONE,GS_API_NONE)
+/**
+ * GNUstep extensions to control and monitor the pool of persistent
+ * connections used by the HTTP and HTTPS protocols.  When a response
+ * has been read completely from a server which keeps the connection
+ * open, the connection is kept for reuse by a later request to the
+ * same host and port.
+ */
+@interface	NSURLProtocol (GSConnectionPool)
+
+/**
+ * Returns counts of connection pool activity as NSNumber values.<br />
+ * The 'hits' are requests sent on a reused connection and the 'misses'
+ * requests needing a new connection.  The 'waits' are the times a request
+ * was delayed because its host had the maximum number of connections open.
+ * The 'expired' are idle connections closed after the idle timeout, and
+ * the 'stale' are reused connections found to have been closed by the
+ * server (the request being retried on another connection).<br />
+ * The 'idle' and 'active' values are the numbers of connections currently
+ * pooled and in use.
+ */
++ (NSDictionary*) connectionPoolStatistics;
+
+/**
+ * Sets the longest time (default 30 seconds) for which an idle connection
+ * is kept for reuse.  A server may ask for a shorter time in a Keep-Alive
+ * header.  Setting zero stops connections being reused.
+ */
++ (void) setConnectionPoolIdleTimeout: (NSTimeInterval)seconds;
+
+/**
+ * Sets the maximum number of connections (default 6) open to any one host
+ * and port at the same time.  Further requests wait for one of those
+ * connections to be free.
+ */
++ (void) setConnectionPoolMaximumPerHost: (NSUInteger)max;
+
+@end
+#endif
+
 #if	defined(__cplusplus)
 }
 #endif
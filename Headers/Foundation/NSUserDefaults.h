@@ -214,7 +214,7 @@ GS_EXPORT NSString* const GSLocale;
   NSMutableDictionary	*_tempDomains;   // Contains volatile defaults info;
   NSMutableArray	*_changedDomains; /* ..after first time that persistent 
 					    user defaults are changed */
-  NSDictionary		*_dictionaryRep; // Cached dictionary representation
+  NSDictionary		*_dictionaryRep; // Snapshot of merged domains
   NSString		*_defaultsDatabase;
   NSDate		*_lastSync;
   NSRecursiveLock	*_lock;
@@ -80,11 +80,12 @@ struct _NSZone
 
 /**
  * Creates a new zone of start bytes, which will grow and shrink by
- * granularity bytes.  If canFree is 0, memory in zone is allocated but
- * never freed, meaning allocation will be very fast.  The whole zone can
- * still be freed with NSRecycleZone(), and you should still call NSZoneFree
- * on memory in the zone that is no longer needed, since a count of allocated
- * pointers is kept and must reach zero before freeing the zone.<br />
+ * granularity bytes.  If canFree is 0, the zone is an arena: memory in
+ * it is allocated (very quickly, and without locking) but never freed,
+ * so NSZoneFree() does nothing.  All the memory is returned to the system
+ * at once by NSRecycleZone(), which makes such a zone suitable for a group
+ * of objects (allocated using +allocWithZone:) which are all discarded
+ * together.<br />
  * If Garbage Collection is enabled, this function does nothing other than
  * log a warning and return the same value as the NSDefaultMallocZone()
  * function.
@@ -145,11 +146,12 @@ GS_EXPORT void*
 NSZoneRealloc (NSZone *zone, void *ptr, NSUInteger size);
 
 /**
- * Return memory for an entire zone to system.  In fact, this will not be done
- * unless all memory in the zone has been explicitly freed (by calls to
- * NSZoneFree()).  For "non-freeable" zones, the number of NSZoneFree() calls
- * must simply equal the number of allocation calls.  The default zone, on the
- * other hand, cannot be recycled.<br />
+ * Return memory for an entire zone to system.  For a zone created with
+ * canFree set, this will not be done until all memory in the zone has been
+ * explicitly freed (by calls to NSZoneFree()).  A "non-freeable" zone is
+ * returned to the system immediately, so nothing in it may be used (or
+ * deallocated) afterwards.  The default zone, on the other hand, cannot be
+ * recycled.<br />
  * If Garbage Collection is enabled, this function has not effect.
  */
 GS_EXPORT void
@@ -112,8 +112,20 @@ extern "C" {
  *      GSI_MAP_ZEROED()
  *              Define this macro to check whether a map uses keys which may
  *              be zeroed weak pointers.  
+ *
+ *	GSI_MAP_OPEN
+ *		Define this to a non-zero integer value to store the map in
+ *		a single open addressed array probed a group of slots at a
+ *		time, rather than in chained buckets.  This makes lookups
+ *		faster and uses less memory, but the bucket functions are
+ *		not available and node pointers are only valid until the
+ *		next addition to the map.
  */
 
+#ifndef	GSI_MAP_OPEN
+#define	GSI_MAP_OPEN	0
+#endif
+
 #ifndef	GSI_MAP_HAS_VALUE
 #define	GSI_MAP_HAS_VALUE	1
 #endif
@@ -202,65 +214,861 @@ extern "C" {
 #endif
 
 
-#if (GSI_MAP_KTYPES) & GSUNION_OBJ
-#define GSI_MAP_CLEAR_KEY(node)  GSI_MAP_WRITE_KEY(map, &node->key, (GSIMapKey)(id)nil)
-#elif  (GSI_MAP_KTYPES) & GSUNION_PTR
-#define GSI_MAP_CLEAR_KEY(node)  GSI_MAP_WRITE_KEY(map, &node->key, (GSIMapKey)(void *)NULL)
-#else
-#define GSI_MAP_CLEAR_KEY(node)  
+#if (GSI_MAP_KTYPES) & GSUNION_OBJ
+#define GSI_MAP_CLEAR_KEY(node)  GSI_MAP_WRITE_KEY(map, &node->key, (GSIMapKey)(id)nil)
+#elif  (GSI_MAP_KTYPES) & GSUNION_PTR
+#define GSI_MAP_CLEAR_KEY(node)  GSI_MAP_WRITE_KEY(map, &node->key, (GSIMapKey)(void *)NULL)
+#else
+#define GSI_MAP_CLEAR_KEY(node)  
+#endif
+
+/*
+ *      If there is no bitmask defined to supply the types that
+ *      may be used as values in the map, default to none.
+ */
+#ifndef GSI_MAP_VTYPES
+#define GSI_MAP_VTYPES        0
+#endif
+
+/*
+ *	Set up the name of the union to store map values.
+ */
+#ifdef	GSUNION
+#undef	GSUNION
+#endif
+#define	GSUNION	GSIMapVal
+
+/*
+ *	Set up the types that will be storable in the union.
+ *	See 'GSUnion.h' for further information.
+ */
+#ifdef	GSUNION_TYPES
+#undef	GSUNION_TYPES
+#endif
+#define	GSUNION_TYPES	GSI_MAP_VTYPES
+#ifdef	GSUNION_EXTRA
+#undef	GSUNION_EXTRA
+#endif
+#ifdef	GSI_MAP_VEXTRA
+#define	GSUNION_EXTRA	GSI_MAP_VEXTRA
+#endif
+
+#ifndef	GSI_MAP_SIMPLE
+#define	GSI_MAP_SIMPLE	0
+#endif
+
+/*
+ *	Generate the union typedef
+ */
+#if	defined(GNUSTEP_BASE_INTERNAL)
+#include "GNUstepBase/GSUnion.h"
+#else
+#include <GNUstepBase/GSUnion.h>
+#endif
+
+#if (GSI_MAP_VTYPES) & GSUNION_OBJ
+#define GSI_MAP_CLEAR_VAL(node)  GSI_MAP_WRITE_VAL(map, &node->value, (GSIMapVal)(id)nil)
+#elif  (GSI_MAP_VTYPES) & GSUNION_PTR
+#define GSI_MAP_CLEAR_VAL(node)  GSI_MAP_WRITE_VAL(map, &node->value, (GSIMapVal)(void *)NULL)
+#else
+#define GSI_MAP_CLEAR_VAL(node)  
+#endif
+
+#if	GSI_MAP_OPEN
+/*
+ *  Description of the open addressing datastructure
+ *  ------------------------------------------------
+ *  When GSI_MAP_OPEN is defined non-zero, the nodes of the map are not
+ *  linked into buckets.  Instead the map holds a single array of nodes
+ *  (slots), whose size is a power of two, and an array of control bytes
+ *  with one byte per slot.  The control byte of a slot is GSI_MAP_EMPTY
+ *  if the slot has never been used, GSI_MAP_DELETED if the node in it
+ *  has been removed, or otherwise seven bits of the hash of the key in
+ *  the slot.
+ *
+ *  A key is looked for starting at the slot chosen by the rest of its
+ *  hash.  The control bytes of GSI_MAP_GROUP consecutive slots are
+ *  examined at once (with SSE2 or NEON instructions where available) and
+ *  keys are only compared in slots whose control byte matches.  If the
+ *  group contains an empty slot the search stops, otherwise it moves on
+ *  to further groups.  So a lookup usually touches one cache line of
+ *  control bytes and one node, rather than following a linked list.
+ *
+ *  The control byte array has GSI_MAP_GROUP extra bytes at its end,
+ *  copying those at its start, so that a group may start at any slot.
+ *
+ *   This is the map               control bytes         nodes
+ *   +---------------+            +--------------+      +---------------+
+ *   | _GSIMapTable  |      /---->| 0x80 (empty) | ...  | key/value     |
+ *   |---------------|     /      | 0x2c (hash)  | ...  | key/value     |
+ *   | ctrl       ---+----/       | 0xfe (gone)  | ...  | ...           |
+ *   | nodes      ---+------------+--------------+----->|               |
+ *   | bucketCount  =| slots      | copy of 0-15 |      +---------------+
+ *   +---------------+            +--------------+
+ *
+ *  Maps using this layout are used through the same functions as the
+ *  chained layout, except for those which deal with buckets, and the
+ *  node most recently returned by an enumerator may still be removed
+ *  without affecting the enumeration.  However, nodes move when the map
+ *  grows, so a node pointer is only valid until the next addition to the
+ *  map.
+ */
+
+#define	GSI_MAP_GROUP	16		/* Slots examined at once.	*/
+#define	GSI_MAP_EMPTY	((uint8_t)0x80)	/* A never used slot.		*/
+#define	GSI_MAP_DELETED	((uint8_t)0xfe)	/* A slot whose node was removed. */
+
+#if	defined(__SSE2__)
+#include <emmintrin.h>
+#elif	(defined(__ARM_NEON) || defined(__ARM_NEON__)) \
+  && defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#include <arm_neon.h>
+#define	GSI_MAP_NEON	1
+#endif
+
+#if	!defined(GSI_MAP_TABLE_T)
+typedef struct _GSIMapNode GSIMapNode_t;
+
+typedef GSIMapNode_t *GSIMapNode;
+#endif
+
+struct	_GSIMapNode {
+  GSIMapKey	key;
+#if	GSI_MAP_HAS_VALUE
+  GSIMapVal	value;
+#endif
+};
+
+#if	defined(GSI_MAP_TABLE_T)
+typedef GSI_MAP_TABLE_T	*GSIMapTable;
+#else
+typedef struct _GSIMapTable GSIMapTable_t;
+typedef GSIMapTable_t *GSIMapTable;
+
+struct	_GSIMapTable {
+  NSZone	*zone;
+  uintptr_t	nodeCount;	/* Number of used nodes in map.	*/
+  uintptr_t	bucketCount;	/* Number of slots in map.	*/
+  uint8_t	*ctrl;		/* Control byte of each slot.	*/
+  GSIMapNode	nodes;		/* Array of slots.		*/
+  uintptr_t	growthLeft;	/* Additions before resizing.	*/
+#ifdef	GSI_MAP_EXTRA
+  GSI_MAP_EXTRA	extra;
+#endif
+};
+#endif
+
+typedef struct	_GSIMapEnumerator {
+  GSIMapTable	map;		/* the map being enumerated.	*/
+  GSIMapNode	node;		/* The next node to use.	*/
+  uintptr_t	bucket;		/* The slot of the next node.	*/
+} *_GSIE;
+
+#ifdef	GSI_MAP_ENUMERATOR
+typedef GSI_MAP_ENUMERATOR	GSIMapEnumerator_t;
+#else
+typedef struct _GSIMapEnumerator GSIMapEnumerator_t;
+#endif
+typedef GSIMapEnumerator_t	*GSIMapEnumerator;
+
+/*
+ * A mask of the slots in a group which satisfy some test.  Each slot has
+ * GSI_MAP_MASK_BITS bits, all set if the slot satisfies the test, with
+ * the first slot of the group in the least significant bits.
+ */
+#if	defined(GSI_MAP_NEON)
+typedef uint64_t	GSIMapMask;
+#define	GSI_MAP_MASK_BITS	4
+#else
+typedef uint32_t	GSIMapMask;
+#define	GSI_MAP_MASK_BITS	1
+#endif
+
+#if	defined(GSI_MAP_NEON)
+static INLINE GSIMapMask
+GSIMapNarrowMask(uint8x16_t m)
+{
+  return vget_lane_u64(vreinterpret_u64_u8(
+    vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+#endif
+
+/*
+ * Returns the slots in the group starting at ctrl whose control byte is b.
+ */
+static INLINE GSIMapMask
+GSIMapGroupMatch(const uint8_t *ctrl, uint8_t b)
+{
+#if	defined(__SSE2__)
+  __m128i	g = _mm_loadu_si128((const __m128i*)(const void*)ctrl);
+
+  return (GSIMapMask)_mm_movemask_epi8(
+    _mm_cmpeq_epi8(g, _mm_set1_epi8((char)b)));
+#elif	defined(GSI_MAP_NEON)
+  return GSIMapNarrowMask(vceqq_u8(vld1q_u8(ctrl), vdupq_n_u8(b)));
+#else
+  GSIMapMask	m = 0;
+  unsigned	i;
+
+  for (i = 0; i < GSI_MAP_GROUP; i++)
+    {
+      if (ctrl[i] == b)
+	{
+	  m |= ((GSIMapMask)1 << i);
+	}
+    }
+  return m;
+#endif
+}
+
+/*
+ * Returns the slots in the group starting at ctrl which are empty or
+ * deleted (those whose control byte has its top bit set).
+ */
+static INLINE GSIMapMask
+GSIMapGroupFree(const uint8_t *ctrl)
+{
+#if	defined(__SSE2__)
+  return (GSIMapMask)_mm_movemask_epi8(
+    _mm_loadu_si128((const __m128i*)(const void*)ctrl));
+#elif	defined(GSI_MAP_NEON)
+  return GSIMapNarrowMask(vtstq_u8(vld1q_u8(ctrl), vdupq_n_u8(0x80)));
+#else
+  GSIMapMask	m = 0;
+  unsigned	i;
+
+  for (i = 0; i < GSI_MAP_GROUP; i++)
+    {
+      if (ctrl[i] & 0x80)
+	{
+	  m |= ((GSIMapMask)1 << i);
+	}
+    }
+  return m;
+#endif
+}
+
+/*
+ * Returns the slots in the group starting at ctrl which contain nodes.
+ */
+static INLINE GSIMapMask
+GSIMapGroupFull(const uint8_t *ctrl)
+{
+#if	defined(GSI_MAP_NEON)
+  return ~GSIMapGroupFree(ctrl);
+#else
+  return ~GSIMapGroupFree(ctrl) & 0xffff;
+#endif
+}
+
+/*
+ * Returns the position within its group of the first slot in a mask.
+ */
+static INLINE unsigned
+GSIMapMaskFirst(GSIMapMask m)
+{
+#if	defined(__GNUC__)
+  return __builtin_ctzll((unsigned long long)m) / GSI_MAP_MASK_BITS;
+#else
+  unsigned	i = 0;
+
+  while ((m & 1) == 0)
+    {
+      m >>= 1;
+      i++;
+    }
+  return i / GSI_MAP_MASK_BITS;
+#endif
+}
+
+/*
+ * Returns a mask with the first slot removed.
+ */
+static INLINE GSIMapMask
+GSIMapMaskRest(GSIMapMask m)
+{
+#if	GSI_MAP_MASK_BITS == 1
+  return m & (m - 1);
+#else
+  return m & ~((m & (~m + 1)) * 0xf);
+#endif
+}
+
+/*
+ * Spreads the bits of a hash, as many hash methods produce values which
+ * differ only in a few bits (addresses, small integers).
+ */
+static INLINE uintptr_t
+GSIMapMixHash(uintptr_t h)
+{
+#if	UINTPTR_MAX > 0xffffffffUL
+  h *= (uintptr_t)0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 32);
+#else
+  h *= (uintptr_t)0x9e3779b9UL;
+  return h ^ (h >> 16);
+#endif
+}
+
+/*
+ * The number of nodes a map with size slots may hold (seven eighths).
+ */
+static INLINE uintptr_t
+GSIMapMaxLoad(uintptr_t size)
+{
+  return size - size / 8;
+}
+
+static INLINE void
+GSIMapSetCtrl(GSIMapTable map, uintptr_t slot, uint8_t b)
+{
+  map->ctrl[slot] = b;
+  if (slot < GSI_MAP_GROUP)
+    {
+      map->ctrl[map->bucketCount + slot] = b;
+    }
+}
+
+/*
+ * Returns the first empty or deleted slot in the probe sequence for a
+ * (mixed) hash.  There is always one, as the map is never full.
+ */
+static INLINE uintptr_t
+GSIMapFreeSlot(GSIMapTable map, uintptr_t hash)
+{
+  uintptr_t	mask = map->bucketCount - 1;
+  uintptr_t	pos = (hash >> 7) & mask;
+  uintptr_t	step = 0;
+
+  for (;;)
+    {
+      GSIMapMask	m = GSIMapGroupFree(map->ctrl + pos);
+
+      if (m != 0)
+	{
+	  return (pos + GSIMapMaskFirst(m)) & mask;
+	}
+      step += GSI_MAP_GROUP;
+      pos = (pos + step) & mask;
+    }
+}
+
+static INLINE void
+GSIMapFreeNode(GSIMapTable map, GSIMapNode node)
+{
+  GSI_MAP_RELEASE_KEY(map, node->key);
+  GSI_MAP_CLEAR_KEY(node);
+#if	GSI_MAP_HAS_VALUE
+  GSI_MAP_RELEASE_VAL(map, node->value);
+  GSI_MAP_CLEAR_VAL(node);
+#endif
+}
+
+/**
+ * Removes a node from the map and releases its key and value.
+ */
+static INLINE void
+GSIMapRemoveNode(GSIMapTable map, GSIMapNode node)
+{
+  GSIMapSetCtrl(map, node - map->nodes, GSI_MAP_DELETED);
+  map->nodeCount--;
+  GSIMapFreeNode(map, node);
+}
+
+/*
+ * Moves the nodes of the map into new arrays with size slots (a power of
+ * two which is big enough for them all), discarding deleted slots and
+ * any nodes with zeroed weak keys or values.
+ */
+static INLINE void
+GSIMapRehash(GSIMapTable map, uintptr_t size)
+{
+  uint8_t	*old_ctrl = map->ctrl;
+  GSIMapNode	old_nodes = map->nodes;
+  uintptr_t	old_size = map->bucketCount;
+  uintptr_t	count = 0;
+  uintptr_t	i;
+  uint8_t	*ctrl;
+  GSIMapNode	nodes;
+
+#if     GS_WITH_GC
+  ctrl = (uint8_t*)NSAllocateCollectable(size + GSI_MAP_GROUP, 0);
+  nodes = GSI_MAP_NODES(map, size);
+#else
+  ctrl = (uint8_t*)NSZoneMalloc(map->zone, size + GSI_MAP_GROUP);
+  nodes = (GSIMapNode)NSZoneCalloc(map->zone, size, sizeof(GSIMapNode_t));
+#endif
+  if (ctrl == 0 || nodes == 0)
+    {
+      [NSException raise: NSMallocException format: @"No memory for nodes"];
+    }
+  memset(ctrl, GSI_MAP_EMPTY, size + GSI_MAP_GROUP);
+  map->ctrl = ctrl;
+  map->nodes = nodes;
+  map->bucketCount = size;
+
+  for (i = 0; i < old_size; i++)
+    {
+      GSIMapNode	old;
+      GSIMapNode	node;
+      uintptr_t		h;
+
+      if (old_ctrl[i] & 0x80)
+	{
+	  continue;
+	}
+      old = old_nodes + i;
+      if (GSI_MAP_ZEROED(map) && GSI_MAP_NODE_IS_EMPTY(map, old))
+	{
+	  GSIMapFreeNode(map, old);
+	  continue;
+	}
+      h = GSIMapMixHash((uintptr_t)GSI_MAP_HASH(map, old->key));
+      node = nodes + GSIMapFreeSlot(map, h);
+      GSIMapSetCtrl(map, node - nodes, (uint8_t)(h & 0x7f));
+      GSI_MAP_WRITE_KEY(map, &node->key, GSI_MAP_READ_KEY(map, &old->key));
+#if	GSI_MAP_HAS_VALUE
+      GSI_MAP_WRITE_VAL(map, &node->value,
+	GSI_MAP_READ_VALUE(map, &old->value));
+#endif
+      count++;
+    }
+  map->nodeCount = count;
+  map->growthLeft = GSIMapMaxLoad(size) - count;
+
+#if     !GS_WITH_GC
+  if (old_ctrl != 0)
+    {
+      NSZoneFree(map->zone, old_ctrl);
+      NSZoneFree(map->zone, old_nodes);
+    }
+#endif
+}
+
+/**
+ * Resizes the map so that it can hold at least new_capacity nodes
+ * (and at least the nodes it already holds) without further resizing.
+ */
+static INLINE void
+GSIMapResize(GSIMapTable map, uintptr_t new_capacity)
+{
+  uintptr_t	size = GSI_MAP_GROUP;
+
+  if (new_capacity < map->nodeCount)
+    {
+      new_capacity = map->nodeCount;
+    }
+  while (GSIMapMaxLoad(size) <= new_capacity)
+    {
+      size <<= 1;
+    }
+  GSIMapRehash(map, size);
+}
+
+static INLINE void
+GSIMapRightSizeMap(GSIMapTable map, uintptr_t capacity)
+{
+  if (capacity >= map->nodeCount + map->growthLeft)
+    {
+      GSIMapResize(map, capacity);
+    }
+}
+
+/*
+ * Claims a slot for a new node with the given key (which must not
+ * already be in the map) and returns the node.
+ */
+static INLINE GSIMapNode
+GSIMapNewNode(GSIMapTable map, GSIMapKey key)
+{
+  uintptr_t	h = GSIMapMixHash((uintptr_t)GSI_MAP_HASH(map, key));
+  uintptr_t	slot = 0;
+
+  if (map->bucketCount > 0)
+    {
+      slot = GSIMapFreeSlot(map, h);
+    }
+  if (map->growthLeft == 0
+    && (map->bucketCount == 0 || map->ctrl[slot] != GSI_MAP_DELETED))
+    {
+      /* Grow the map unless it is mostly deleted slots, in which case
+       * rebuilding it at the same size is enough.
+       */
+      if (map->bucketCount == 0)
+	{
+	  GSIMapRehash(map, GSI_MAP_GROUP);
+	}
+      else if (map->nodeCount >= GSIMapMaxLoad(map->bucketCount) / 2)
+	{
+	  GSIMapRehash(map, map->bucketCount * 2);
+	}
+      else
+	{
+	  GSIMapRehash(map, map->bucketCount);
+	}
+      slot = GSIMapFreeSlot(map, h);
+    }
+  if (map->ctrl[slot] == GSI_MAP_EMPTY)
+    {
+      map->growthLeft--;
+    }
+  GSIMapSetCtrl(map, slot, (uint8_t)(h & 0x7f));
+  map->nodeCount++;
+  return map->nodes + slot;
+}
+
+static INLINE void
+GSIMapRemoveWeak(GSIMapTable map)
+{
+  if (GSI_MAP_ZEROED(map))
+    {
+      uintptr_t	i;
+
+      for (i = 0; i < map->bucketCount; i++)
+	{
+	  if ((map->ctrl[i] & 0x80) == 0
+	    && GSI_MAP_NODE_IS_EMPTY(map, (map->nodes + i)))
+	    {
+	      GSIMapRemoveNode(map, map->nodes + i);
+	    }
+	}
+    }
+}
+
+static INLINE GSIMapNode
+GSIMapNodeForKey(GSIMapTable map, GSIMapKey key)
+{
+  uintptr_t	h;
+  uintptr_t	mask;
+  uintptr_t	pos;
+  uintptr_t	step = 0;
+  uint8_t	h2;
+
+  if (map->nodeCount == 0)
+    {
+      return 0;
+    }
+  h = GSIMapMixHash((uintptr_t)GSI_MAP_HASH(map, key));
+  h2 = (uint8_t)(h & 0x7f);
+  mask = map->bucketCount - 1;
+  pos = (h >> 7) & mask;
+  for (;;)
+    {
+      const uint8_t	*group = map->ctrl + pos;
+      GSIMapMask	m = GSIMapGroupMatch(group, h2);
+
+      while (m != 0)
+	{
+	  GSIMapNode	node = map->nodes + ((pos + GSIMapMaskFirst(m)) & mask);
+
+	  if (GSI_MAP_ZEROED(map) && GSI_MAP_NODE_IS_EMPTY(map, node))
+	    {
+	      GSIMapRemoveNode(map, node);
+	    }
+	  else if (GSI_MAP_EQUAL(map, GSI_MAP_READ_KEY(map, &node->key), key))
+	    {
+	      return node;
+	    }
+	  m = GSIMapMaskRest(m);
+	}
+      if (GSIMapGroupMatch(group, GSI_MAP_EMPTY) != 0)
+	{
+	  return 0;
+	}
+      step += GSI_MAP_GROUP;
+      pos = (pos + step) & mask;
+    }
+}
+
+#if     (GSI_MAP_KTYPES & GSUNION_INT)
+/*
+ * Specialized lookup for the case where keys are known to be simple integer
+ * or pointer values that are their own hash values (when converted to unsigned
+ * integers) and can be compared with a test for integer equality.
+ */
+static INLINE GSIMapNode
+GSIMapNodeForSimpleKey(GSIMapTable map, GSIMapKey key)
+{
+  uintptr_t	h;
+  uintptr_t	mask;
+  uintptr_t	pos;
+  uintptr_t	step = 0;
+  uint8_t	h2;
+
+  if (map->nodeCount == 0)
+    {
+      return 0;
+    }
+  h = GSIMapMixHash((uintptr_t)(unsigned)key.addr);
+  h2 = (uint8_t)(h & 0x7f);
+  mask = map->bucketCount - 1;
+  pos = (h >> 7) & mask;
+  for (;;)
+    {
+      const uint8_t	*group = map->ctrl + pos;
+      GSIMapMask	m = GSIMapGroupMatch(group, h2);
+
+      while (m != 0)
+	{
+	  GSIMapNode	node = map->nodes + ((pos + GSIMapMaskFirst(m)) & mask);
+
+	  if (GSI_MAP_ZEROED(map) && GSI_MAP_NODE_IS_EMPTY(map, node))
+	    {
+	      GSIMapRemoveNode(map, node);
+	    }
+	  else if (GSI_MAP_READ_KEY(map, &node->key).addr == key.addr)
+	    {
+	      return node;
+	    }
+	  m = GSIMapMaskRest(m);
+	}
+      if (GSIMapGroupMatch(group, GSI_MAP_EMPTY) != 0)
+	{
+	  return 0;
+	}
+      step += GSI_MAP_GROUP;
+      pos = (pos + step) & mask;
+    }
+}
+#endif
+
+/*
+ * Returns the first node in a slot at or after *slot and sets *slot to
+ * the slot it is in, or returns 0 and sets *slot to the number of slots.
+ * Nodes with zeroed weak keys or values are removed as they are found.
+ */
+static INLINE GSIMapNode
+GSIMapNodeFromSlot(GSIMapTable map, uintptr_t *slot)
+{
+  uintptr_t	size = map->bucketCount;
+  uintptr_t	i = *slot;
+
+  while (i < size)
+    {
+      GSIMapMask	m = GSIMapGroupFull(map->ctrl + i);
+
+      if (size - i < GSI_MAP_GROUP)
+	{
+	  /* Ignore the copies of the first control bytes.
+	   */
+	  m &= ((GSIMapMask)1 << ((size - i) * GSI_MAP_MASK_BITS)) - 1;
+	}
+      while (m != 0)
+	{
+	  GSIMapNode	node = map->nodes + i + GSIMapMaskFirst(m);
+
+	  if (GSI_MAP_ZEROED(map) && GSI_MAP_NODE_IS_EMPTY(map, node))
+	    {
+	      GSIMapRemoveNode(map, node);
+	      m = GSIMapMaskRest(m);
+	      continue;
+	    }
+	  *slot = node - map->nodes;
+	  return node;
+	}
+      i += GSI_MAP_GROUP;
+    }
+  *slot = size;
+  return 0;
+}
+
+static INLINE GSIMapNode
+GSIMapFirstNode(GSIMapTable map)
+{
+  uintptr_t	slot = 0;
+
+  if (map->nodeCount == 0)
+    {
+      return 0;
+    }
+  return GSIMapNodeFromSlot(map, &slot);
+}
+
+/** Enumerating **/
+
+/* As with the chained layout, once a node has been returned by
+ * `GSIMapEnumeratorNextNode()', it may be removed from the map without
+ * effecting the rest of the current enumeration.  Removal never moves
+ * other nodes.
+ */
+
+/**
+ * Create an return an enumerator for the specified map.<br />
+ * You must call GSIMapEndEnumerator() when you have finished
+ * with the enumerator.<br />
+ * <strong>WARNING</strong> You should not add to a map while an enumeration
+ * is in progress, as that may move the nodes.
+ */
+static INLINE GSIMapEnumerator_t
+GSIMapEnumeratorForMap(GSIMapTable map)
+{
+  GSIMapEnumerator_t	enumerator;
+
+  enumerator.map = map;
+  enumerator.bucket = 0;
+  enumerator.node = GSIMapNodeFromSlot(map, &enumerator.bucket);
+  return enumerator;
+}
+
+/**
+ * Returns the next node in the map, or a nul pointer if at the end.
+ */
+static INLINE GSIMapNode
+GSIMapEnumeratorNextNode(GSIMapEnumerator enumerator)
+{
+  GSIMapNode	node = ((_GSIE)enumerator)->node;
+  GSIMapTable	map = ((_GSIE)enumerator)->map;
+  uintptr_t	slot;
+
+  if (node == 0)
+    {
+      return 0;
+    }
+  if (GSI_MAP_ZEROED(map) && GSI_MAP_NODE_IS_EMPTY(map, node))
+    {
+      /* Zeroed since it was found ... look again from its slot.
+       */
+      node = GSIMapNodeFromSlot(map, &((_GSIE)enumerator)->bucket);
+      if (node == 0)
+	{
+	  ((_GSIE)enumerator)->node = 0;
+	  return 0;
+	}
+    }
+  slot = ((_GSIE)enumerator)->bucket + 1;
+  ((_GSIE)enumerator)->node = GSIMapNodeFromSlot(map, &slot);
+  ((_GSIE)enumerator)->bucket = slot;
+  return node;
+}
+
+#if	GSI_MAP_HAS_VALUE
+static INLINE GSIMapNode
+GSIMapAddPairNoRetain(GSIMapTable map, GSIMapKey key, GSIMapVal value)
+{
+  GSIMapNode	node = GSIMapNewNode(map, key);
+
+  GSI_MAP_WRITE_KEY(map, &node->key, key);
+  GSI_MAP_WRITE_VAL(map, &node->value, value);
+  return node;
+}
+
+static INLINE GSIMapNode
+GSIMapAddPair(GSIMapTable map, GSIMapKey key, GSIMapVal value)
+{
+  GSIMapNode	node = GSIMapNewNode(map, key);
+
+  GSI_MAP_WRITE_KEY(map, &node->key, key);
+  GSI_MAP_RETAIN_KEY(map, node->key);
+  GSI_MAP_WRITE_VAL(map, &node->value, value);
+  GSI_MAP_RETAIN_VAL(map, node->value);
+  return node;
+}
+#else
+static INLINE GSIMapNode
+GSIMapAddKeyNoRetain(GSIMapTable map, GSIMapKey key)
+{
+  GSIMapNode	node = GSIMapNewNode(map, key);
+
+  GSI_MAP_WRITE_KEY(map, &node->key, key);
+  return node;
+}
+
+static INLINE GSIMapNode
+GSIMapAddKey(GSIMapTable map, GSIMapKey key)
+{
+  GSIMapNode	node = GSIMapNewNode(map, key);
+
+  GSI_MAP_WRITE_KEY(map, &node->key, key);
+  GSI_MAP_RETAIN_KEY(map, node->key);
+  return node;
+}
 #endif
 
-/*
- *      If there is no bitmask defined to supply the types that
- *      may be used as values in the map, default to none.
+/**
+ * Removes the item for the specified key from the map.
+ * If the key was present, returns YES, otherwise returns NO.
  */
-#ifndef GSI_MAP_VTYPES
-#define GSI_MAP_VTYPES        0
-#endif
+static INLINE BOOL
+GSIMapRemoveKey(GSIMapTable map, GSIMapKey key)
+{
+  GSIMapNode	node = GSIMapNodeForKey(map, key);
 
-/*
- *	Set up the name of the union to store map values.
- */
-#ifdef	GSUNION
-#undef	GSUNION
-#endif
-#define	GSUNION	GSIMapVal
+  if (node != 0)
+    {
+      GSIMapRemoveNode(map, node);
+      return YES;
+    }
+  return NO;
+}
 
-/*
- *	Set up the types that will be storable in the union.
- *	See 'GSUnion.h' for further information.
- */
-#ifdef	GSUNION_TYPES
-#undef	GSUNION_TYPES
-#endif
-#define	GSUNION_TYPES	GSI_MAP_VTYPES
-#ifdef	GSUNION_EXTRA
-#undef	GSUNION_EXTRA
-#endif
-#ifdef	GSI_MAP_VEXTRA
-#define	GSUNION_EXTRA	GSI_MAP_VEXTRA
-#endif
+static INLINE void
+GSIMapCleanMap(GSIMapTable map)
+{
+  if (map->bucketCount > 0)
+    {
+      uintptr_t	i;
 
-#ifndef	GSI_MAP_SIMPLE
-#define	GSI_MAP_SIMPLE	0
-#endif
+      if (map->nodeCount > 0)
+	{
+	  for (i = 0; i < map->bucketCount; i++)
+	    {
+	      if ((map->ctrl[i] & 0x80) == 0)
+		{
+		  GSIMapFreeNode(map, map->nodes + i);
+		}
+	    }
+	}
+      memset(map->ctrl, GSI_MAP_EMPTY, map->bucketCount + GSI_MAP_GROUP);
+      map->nodeCount = 0;
+      map->growthLeft = GSIMapMaxLoad(map->bucketCount);
+    }
+}
 
-/*
- *	Generate the union typedef
- */
-#if	defined(GNUSTEP_BASE_INTERNAL)
-#include "GNUstepBase/GSUnion.h"
+static INLINE void
+GSIMapEmptyMap(GSIMapTable map)
+{
+#ifdef	GSI_MAP_NOCLEAN
+  if (GSI_MAP_NOCLEAN)
+    {
+      map->nodeCount = 0;
+    }
+  else
+    {
+      GSIMapCleanMap(map);
+    }
 #else
-#include <GNUstepBase/GSUnion.h>
+  GSIMapCleanMap(map);
 #endif
-
-#if (GSI_MAP_VTYPES) & GSUNION_OBJ
-#define GSI_MAP_CLEAR_VAL(node)  GSI_MAP_WRITE_VAL(map, &node->value, (GSIMapVal)(id)nil)
-#elif  (GSI_MAP_VTYPES) & GSUNION_PTR
-#define GSI_MAP_CLEAR_VAL(node)  GSI_MAP_WRITE_VAL(map, &node->value, (GSIMapVal)(void *)NULL)
-#else
-#define GSI_MAP_CLEAR_VAL(node)  
+  if (map->ctrl != 0)
+    {
+#if	!GS_WITH_GC
+      NSZoneFree(map->zone, map->ctrl);
+      NSZoneFree(map->zone, map->nodes);
 #endif
+      map->ctrl = 0;
+      map->nodes = 0;
+      map->bucketCount = 0;
+    }
+  map->growthLeft = 0;
+  map->zone = 0;
+}
+
+static INLINE void
+GSIMapInitWithZoneAndCapacity(GSIMapTable map, NSZone *zone, uintptr_t capacity)
+{
+  map->zone = zone;
+  map->nodeCount = 0;
+  map->bucketCount = 0;
+  map->ctrl = 0;
+  map->nodes = 0;
+  map->growthLeft = 0;
+  if (capacity > 0)
+    {
+      GSIMapResize(map, capacity);
+    }
+}
+
+#else	/* GSI_MAP_OPEN */
 
 /*
  *  Description of the datastructure
@@ -890,17 +1698,6 @@ GSIMapEnumeratorForMap(GSIMapTable map)
   return enumerator;
 }
 
-/**
- * Tidies up after map enumeration ... effectively destroys the enumerator.
- */
-static INLINE void
-GSIMapEndEnumerator(GSIMapEnumerator enumerator)
-{
-  ((_GSIE)enumerator)->map = 0;
-  ((_GSIE)enumerator)->node = 0;
-  ((_GSIE)enumerator)->bucket = 0;
-}
-
 /**
  * Returns the bucket from which the next node in the enumeration will
  * come.  Once the next node has been enumerated, you can use the
@@ -996,66 +1793,6 @@ GSIMapEnumeratorNextNode(GSIMapEnumerator enumerator)
   return node;
 }
 
-/**
- * Used to implement fast enumeration methods in classes that use GSIMap for
- * their data storage.
- */
-static INLINE NSUInteger 
-GSIMapCountByEnumeratingWithStateObjectsCount(GSIMapTable map,
-                                              NSFastEnumerationState *state,
-                                              id *stackbuf,
-                                              NSUInteger len)
-{
-  NSInteger count;
-  NSInteger i;
-
-  /* We can store a GSIMapEnumerator inside the extra buffer in state on all
-   * platforms that don't suck beyond belief (i.e. everything except win64),
-   * but we can't on anything where long is 32 bits and pointers are 64 bits,
-   * so we have to construct it here to avoid breaking on that platform.
-   */
-  struct GSPartMapEnumerator
-    {
-      GSIMapNode node;
-      uintptr_t bucket;
-    };
-  GSIMapEnumerator_t enumerator;
-
-  count = MIN(len, map->nodeCount - state->state);
-
-  /* Construct the real enumerator */
-  if (0 == state->state)
-    {
-        enumerator = GSIMapEnumeratorForMap(map);
-    }
-  else
-    {
-      enumerator.map = map;
-      enumerator.node = ((struct GSPartMapEnumerator*)(state->extra))->node; 
-      enumerator.bucket = ((struct GSPartMapEnumerator*)(state->extra))->bucket;
-    }
-  /* Get the next count objects and put them in the stack buffer. */
-  for (i = 0; i < count; i++)
-    {
-      GSIMapNode node = GSIMapEnumeratorNextNode(&enumerator);
-      if (0 != node)
-        {
-          /* UGLY HACK: Lets this compile with any key type.  Fast enumeration
-           * will only work with things that are id-sized, however, so don't
-           * try using it with non-object collections.
-           */
-          stackbuf[i] = (id)GSI_MAP_READ_KEY(map, &node->key).addr;
-        }
-    }
-  /* Store the important bits of the enumerator in the caller. */
-  ((struct GSPartMapEnumerator*)(state->extra))->node = enumerator.node;
-  ((struct GSPartMapEnumerator*)(state->extra))->bucket = enumerator.bucket;
-  /* Update the rest of the state. */
-  state->state += count;
-  state->itemsPtr = stackbuf;
-  return count;
-}
-
 #if	GSI_MAP_HAS_VALUE
 static INLINE GSIMapNode
 GSIMapAddPairNoRetain(GSIMapTable map, GSIMapKey key, GSIMapVal value)
@@ -1258,6 +1995,79 @@ GSIMapInitWithZoneAndCapacity(GSIMapTable map, NSZone *zone, uintptr_t capacity)
   GSIMapMoreNodes(map, capacity);
 }
 
+#endif	/* GSI_MAP_OPEN */
+
+/**
+ * Tidies up after map enumeration ... effectively destroys the enumerator.
+ */
+static INLINE void
+GSIMapEndEnumerator(GSIMapEnumerator enumerator)
+{
+  ((_GSIE)enumerator)->map = 0;
+  ((_GSIE)enumerator)->node = 0;
+  ((_GSIE)enumerator)->bucket = 0;
+}
+
+/**
+ * Used to implement fast enumeration methods in classes that use GSIMap for
+ * their data storage.
+ */
+static INLINE NSUInteger 
+GSIMapCountByEnumeratingWithStateObjectsCount(GSIMapTable map,
+                                              NSFastEnumerationState *state,
+                                              id *stackbuf,
+                                              NSUInteger len)
+{
+  NSInteger count;
+  NSInteger i;
+
+  /* We can store a GSIMapEnumerator inside the extra buffer in state on all
+   * platforms that don't suck beyond belief (i.e. everything except win64),
+   * but we can't on anything where long is 32 bits and pointers are 64 bits,
+   * so we have to construct it here to avoid breaking on that platform.
+   */
+  struct GSPartMapEnumerator
+    {
+      GSIMapNode node;
+      uintptr_t bucket;
+    };
+  GSIMapEnumerator_t enumerator;
+
+  count = MIN(len, map->nodeCount - state->state);
+
+  /* Construct the real enumerator */
+  if (0 == state->state)
+    {
+        enumerator = GSIMapEnumeratorForMap(map);
+    }
+  else
+    {
+      enumerator.map = map;
+      enumerator.node = ((struct GSPartMapEnumerator*)(state->extra))->node; 
+      enumerator.bucket = ((struct GSPartMapEnumerator*)(state->extra))->bucket;
+    }
+  /* Get the next count objects and put them in the stack buffer. */
+  for (i = 0; i < count; i++)
+    {
+      GSIMapNode node = GSIMapEnumeratorNextNode(&enumerator);
+      if (0 != node)
+        {
+          /* UGLY HACK: Lets this compile with any key type.  Fast enumeration
+           * will only work with things that are id-sized, however, so don't
+           * try using it with non-object collections.
+           */
+          stackbuf[i] = (id)GSI_MAP_READ_KEY(map, &node->key).addr;
+        }
+    }
+  /* Store the important bits of the enumerator in the caller. */
+  ((struct GSPartMapEnumerator*)(state->extra))->node = enumerator.node;
+  ((struct GSPartMapEnumerator*)(state->extra))->bucket = enumerator.bucket;
+  /* Update the rest of the state. */
+  state->state += count;
+  state->itemsPtr = stackbuf;
+  return count;
+}
+
 #if	defined(__cplusplus)
 }
 #endif
@@ -29,6 +29,8 @@
 #import <GNUstepBase/GSVersionMacros.h>
 #import <Foundation/NSStream.h>
 
+@class	NSDictionary;
+
 #if	defined(__cplusplus)
 extern "C" {
 #endif
@@ -61,6 +63,29 @@ extern "C" {
                 outputStream: (NSOutputStream **)outputStream;
 @end
 
+/**
+ * TLS/SSL session resumption for network streams.<br />
+ * An outgoing TLS/SSL connection keeps the session negotiated with the
+ * server (identified by its address and port, or by the
+ * <code>GSTLSServerAddress</code> property of the stream) and resumes it
+ * for later connections to the same server with the same options,
+ * avoiding the cost of a full handshake.  Server streams issue session
+ * tickets and session IDs so that their clients can do the same.
+ */
+@interface NSStream (GSTLSSessionCache)
+
+/**
+ * Returns counts of TLS/SSL handshakes as NSNumber values.<br />
+ * The 'clientResumed' and 'clientFull' values are the numbers of outgoing
+ * connections which resumed an earlier session and which needed a full
+ * handshake, and 'serverResumed' and 'serverFull' are the same for
+ * incoming connections.  The 'cached' value is the number of sessions
+ * currently held for resumption.
+ */
++ (NSDictionary*) tlsSessionStatistics;
+
+@end
+
 /**
  * GSServerStream is a subclass of NSStream that encapsulate a "server"
  * stream; that is a stream that binds to a socket and accepts incoming
@@ -853,9 +853,142 @@ wordData(NSString *word)
 - (BOOL) _decodeBody: (NSData*)d;
 - (NSString*) _decodeHeader;
 - (NSRange) _endOfHeaders: (NSData*)newData;
+- (BOOL) _scanHeader: (NSData**)raw base: (NSUInteger*)base;
 - (BOOL) _scanHeaderParameters: (NSScanner*)scanner into: (GSMimeHeader*)info;
 @end
 
+/* Header names the parser knows about.  Those marked as structured need
+ * the full parsing done by -parseHeader: (and checks done in it), the
+ * others may be scanned directly from the raw bytes of the header.
+ */
+typedef enum {
+  GSKnownPlain,			// Value is the rest of the line
+  GSKnownToken,			// Value is a single lowercase token
+  GSKnownStructured		// Value must be parsed by -parseHeader:
+} GSKnownKind;
+
+typedef struct {
+  const char	*lower;
+  const char	*canonical;
+  NSString	*name;		// Lowercase name
+  NSString	*canonicalName;
+  GSKnownKind	kind;
+} GSKnownHeader;
+
+static GSKnownHeader	knownHeaders[] = {
+  { "accept-ranges", "Accept-Ranges",
+    @"accept-ranges", @"Accept-Ranges", GSKnownPlain },
+  { "cache-control", "Cache-Control",
+    @"cache-control", @"Cache-Control", GSKnownPlain },
+  { "connection", "Connection",
+    @"connection", @"Connection", GSKnownPlain },
+  { "content-disposition", "Content-Disposition",
+    @"content-disposition", @"Content-Disposition", GSKnownStructured },
+  { "content-encoding", "Content-Encoding",
+    @"content-encoding", @"Content-Encoding", GSKnownPlain },
+  { "content-length", "Content-Length",
+    @"content-length", @"Content-Length", GSKnownPlain },
+  { "content-transfer-encoding", "Content-Transfer-Encoding",
+    @"content-transfer-encoding", @"Content-Transfer-Encoding",
+    GSKnownStructured },
+  { "content-type", "Content-Type",
+    @"content-type", @"Content-Type", GSKnownStructured },
+  { "date", "Date",
+    @"date", @"Date", GSKnownPlain },
+  { "etag", "ETag",
+    @"etag", @"ETag", GSKnownPlain },
+  { "expires", "Expires",
+    @"expires", @"Expires", GSKnownPlain },
+  { "http", "HTTP",
+    @"http", @"HTTP", GSKnownStructured },
+  { "keep-alive", "Keep-Alive",
+    @"keep-alive", @"Keep-Alive", GSKnownPlain },
+  { "last-modified", "Last-Modified",
+    @"last-modified", @"Last-Modified", GSKnownPlain },
+  { "location", "Location",
+    @"location", @"Location", GSKnownPlain },
+  { "mime-version", "MIME-Version",
+    @"mime-version", @"MIME-Version", GSKnownStructured },
+  { "server", "Server",
+    @"server", @"Server", GSKnownPlain },
+  { "set-cookie", "Set-Cookie",
+    @"set-cookie", @"Set-Cookie", GSKnownPlain },
+  { "transfer-encoding", "Transfer-Encoding",
+    @"transfer-encoding", @"Transfer-Encoding", GSKnownToken },
+  { "unknown", "Unknown",
+    @"unknown", @"Unknown", GSKnownStructured },
+  { "vary", "Vary",
+    @"vary", @"Vary", GSKnownPlain },
+};
+
+/* A perfect hash of the known header names (checked when the table is
+ * built in +[GSMimeParser initialize]), using the length and the first
+ * two characters of the name.
+ */
+#define	KNOWN_SIZE	64
+static GSKnownHeader	*knownTable[KNOWN_SIZE];
+
+/* The standard header parsing methods.  The raw bytes of headers are
+ * only scanned directly if a subclass has not overridden these.
+ */
+static IMP		parseHeaderImp = 0;
+static IMP		scanHeaderBodyImp = 0;
+
+static inline unsigned
+knownHash(const unsigned char *name, unsigned length)
+{
+  return (length + tolower(name[0]) + 3 * tolower(name[1]))
+    & (KNOWN_SIZE - 1);
+}
+
+static GSKnownHeader *
+knownHeader(const unsigned char *name, unsigned length)
+{
+  GSKnownHeader	*k;
+
+  if (length < 2)
+    {
+      return 0;
+    }
+  k = knownTable[knownHash(name, length)];
+  if (k != 0 && strlen(k->lower) == length
+    && strncasecmp(k->lower, (const char*)name, length) == 0)
+    {
+      return k;
+    }
+  return 0;
+}
+
+/* Token characters as used by GSMimeHeader to make header names.
+ */
+static inline BOOL
+isToken(unsigned char c)
+{
+  return (c > 32 && c < 127 && strchr("()<>@,;:\\\"/[]?=", c) == 0)
+    ? YES : NO;
+}
+
+/* A header scanned directly from the raw bytes of a document.  It keeps
+ * the bytes of the header section and creates the name and value strings
+ * only when they are asked for.  The parser still creates one of these
+ * for each header line; it is only the strings which are deferred.
+ */
+@interface	GSMimeRawHeader : GSMimeHeader
+{
+  NSData	*raw;
+  NSString	*lower;
+  NSRange	nameRange;
+  NSRange	valueRange;
+  BOOL		latin1;
+  BOOL		lowercaseValue;
+}
+- (id) initWithData: (NSData*)d
+	       name: (NSRange)n
+	      value: (NSRange)v
+	      known: (GSKnownHeader*)k
+	     latin1: (BOOL)l;
+@end
+
 /**
  * <p>
  *   This class provides support for parsing MIME messages
@@ -918,6 +1051,24 @@ wordData(NSString *word)
     {
       documentClass = [GSMimeDocument class];
     }
+  if (parseHeaderImp == 0)
+    {
+      unsigned	i;
+
+      parseHeaderImp = [GSMimeParser
+	instanceMethodForSelector: @selector(parseHeader:)];
+      scanHeaderBodyImp = [GSMimeParser
+	instanceMethodForSelector: @selector(scanHeaderBody:into:)];
+      for (i = 0; i < sizeof(knownHeaders) / sizeof(*knownHeaders); i++)
+	{
+	  GSKnownHeader	*k = &knownHeaders[i];
+	  unsigned	h;
+
+	  h = knownHash((const unsigned char*)k->lower, strlen(k->lower));
+	  NSAssert(knownTable[h] == 0, @"known header hash is not perfect");
+	  knownTable[h] = k;
+	}
+    }
 }
 
 /**
@@ -1513,6 +1664,9 @@ wordData(NSString *word)
   GSMimeHeader	*hdr;
   NSRange	r;
   NSUInteger	l = [d length];
+  NSData	*raw = nil;
+  NSUInteger	base = 0;
+  BOOL		fast;
 
   if (flags.complete == 1 || flags.inBody == 1)
     {
@@ -1575,10 +1729,17 @@ wordData(NSString *word)
 	}
     }
 
+  fast = ([self methodForSelector: @selector(parseHeader:)] == parseHeaderImp
+    && [self methodForSelector: @selector(scanHeaderBody:into:)]
+    == scanHeaderBodyImp) ? YES : NO;
   while (flags.inBody == 0)
     {
       NSString		*header;
 
+      if (YES == fast && YES == [self _scanHeader: &raw base: &base])
+	{
+	  continue;
+	}
       header = [self _decodeHeader];
       if (header == nil)
 	{
@@ -3223,6 +3384,114 @@ unfold(const unsigned char *src, const unsigned char *end, BOOL *folded)
   return NSMakeRange(NSNotFound, 0);
 }
 
+/* Scan a header line directly from the raw bytes at the input position,
+ * adding a GSMimeRawHeader to the document, or mark the end of the headers
+ * if the line is empty.  Returns NO (having consumed nothing) if the line
+ * needs the full parsing in -parseHeader: or if there is not enough data
+ * to tell where it ends; the caller then uses the normal mechanism.
+ * The first header scanned makes a copy of the remaining raw header bytes
+ * in *raw (with *base set to the input position of its start) to be
+ * shared by all the headers scanned from it.
+ */
+- (BOOL) _scanHeader: (NSData**)raw base: (NSUInteger*)base
+{
+  const unsigned char	*beg = &bytes[input];
+  const unsigned char	*end = &bytes[dataEnd];
+  const unsigned char	*src = beg;
+  const unsigned char	*colon;
+  const unsigned char	*val;
+  const unsigned char	*eol;
+  GSKnownHeader		*k;
+  GSMimeRawHeader	*h;
+
+  if (src >= end)
+    {
+      return NO;
+    }
+  if ('\r' == *src && src + 1 < end && '\n' == src[1])
+    {
+      src++;
+    }
+  if ('\n' == *src)
+    {
+      flags.inBody = 1;		// Empty line at end of headers.
+      input = src + 1 - bytes;
+      return YES;
+    }
+
+  while (src < end && YES == isToken(*src))
+    {
+      src++;
+    }
+  if (src == beg || src >= end || *src != ':')
+    {
+      return NO;		// Not a simple name (or the HTTP status).
+    }
+  colon = src;
+  k = knownHeader(beg, colon - beg);
+  if (k != 0 && GSKnownStructured == k->kind)
+    {
+      return NO;
+    }
+
+  src++;
+  while (src < end && (' ' == *src || '\t' == *src))
+    {
+      src++;
+    }
+  val = src;
+  while (src < end && *src != '\n')
+    {
+      if ('=' == *src && src + 1 < end && '?' == src[1])
+	{
+	  return NO;		// RFC2047 encoded word.
+	}
+      if (*src > 127 && 0 == flags.isHttp)
+	{
+	  return NO;		// Not ASCII.
+	}
+      if (k != 0 && GSKnownToken == k->kind && !isalnum(*src) && *src != '-'
+	&& !('\r' == *src && src + 1 < end && '\n' == src[1]))
+	{
+	  return NO;		// Not a simple token.
+	}
+      src++;
+    }
+  if (src + 1 >= end)
+    {
+      return NO;		// Can't tell if the line is folded.
+    }
+  if (isspace(src[1]) && src[1] != '\r' && src[1] != '\n')
+    {
+      return NO;		// Folded line.
+    }
+  eol = src;
+  if (eol > val && '\r' == eol[-1])
+    {
+      eol--;
+    }
+  if (k != 0 && GSKnownToken == k->kind && eol == val)
+    {
+      return NO;		// Missing value.
+    }
+
+  if (nil == *raw)
+    {
+      *base = input;
+      *raw = [NSData dataWithBytes: beg length: end - beg];
+    }
+  h = [GSMimeRawHeader alloc];
+  h = [h initWithData: *raw
+		 name: NSMakeRange(beg - bytes - *base, colon - beg)
+		value: NSMakeRange(val - bytes - *base, eol - val)
+		known: k
+	       latin1: (1 == flags.isHttp) ? YES : NO];
+  [document addHeader: h];
+  RELEASE(h);
+  input = src + 1 - bytes;
+  return YES;
+}
+
 - (BOOL) _scanHeaderParameters: (NSScanner*)scanner into: (GSMimeHeader*)info
 {
   [self scanPastSpace: scanner];
@@ -3997,6 +4266,135 @@ appendString(NSMutableData *m, NSUInteger offset, NSUInteger fold,
 }
 @end
 
+
+@implementation	GSMimeRawHeader
+
+- (void) dealloc
+{
+  RELEASE(raw);
+  TEST_RELEASE(lower);
+  [super dealloc];
+}
+
+- (NSString*) fullValue
+{
+  [self value];
+  return [super fullValue];
+}
+
+- (id) initWithData: (NSData*)d
+	       name: (NSRange)n
+	      value: (NSRange)v
+	      known: (GSKnownHeader*)k
+	     latin1: (BOOL)l
+{
+  if (nil == (self = [super init]))
+    {
+      return nil;
+    }
+  /* Discard the placeholder name and value so that the real ones are
+   * created from the raw bytes when first asked for.
+   */
+  DESTROY(name);
+  DESTROY(value);
+  raw = RETAIN(d);
+  nameRange = n;
+  valueRange = v;
+  latin1 = l;
+  if (k != 0)
+    {
+      /* The shared name strings serve for any header whose name is
+       * spelt in the usual way.
+       */
+      lower = RETAIN(k->name);
+      if (strncmp(k->canonical, (const char*)[raw bytes] + n.location,
+	n.length) == 0)
+	{
+	  name = RETAIN(k->canonicalName);
+	}
+      lowercaseValue = (GSKnownToken == k->kind) ? YES : NO;
+    }
+  return self;
+}
+
+- (NSString*) namePreservingCase: (BOOL)preserve
+{
+  if (nil == name)
+    {
+      NSString	*s = [NSStringClass allocWithZone: NSDefaultMallocZone()];
+
+      s = [s initWithBytes: (const char*)[raw bytes] + nameRange.location
+		    length: nameRange.length
+		  encoding: NSASCIIStringEncoding];
+      if (NO == __sync_bool_compare_and_swap(&name, (NSString*)nil, s))
+	{
+	  RELEASE(s);
+	}
+    }
+  if (YES == preserve)
+    {
+      return name;
+    }
+  if (nil == lower)
+    {
+      NSString	*s = [[name lowercaseString] copy];
+
+      if (NO == __sync_bool_compare_and_swap(&lower, (NSString*)nil, s))
+	{
+	  RELEASE(s);
+	}
+    }
+  return lower;
+}
+
+- (NSMutableData*) rawMimeDataPreservingCase: (BOOL)preserve
+                                    foldedAt: (NSUInteger)fold
+{
+  [self namePreservingCase: YES];
+  [self value];
+  return [super rawMimeDataPreservingCase: preserve foldedAt: fold];
+}
+
+- (void) setName: (NSString*)s
+{
+  DESTROY(lower);
+  [super setName: s];
+}
+
+- (NSString*) value
+{
+  if (nil == value)
+    {
+      NSString	*s;
+
+      if (0 == valueRange.length)
+	{
+	  s = @"";
+	}
+      else
+	{
+	  s = [NSStringClass allocWithZone: NSDefaultMallocZone()];
+	  s = [s initWithBytes: (const char*)[raw bytes] + valueRange.location
+			length: valueRange.length
+		      encoding: (YES == latin1) ? NSISOLatin1StringEncoding
+			: NSASCIIStringEncoding];
+	  if (YES == lowercaseValue)
+	    {
+	      NSString	*l = [[s lowercaseString] copy];
+
+	      RELEASE(s);
+	      s = l;
+	    }
+	}
+      if (NO == __sync_bool_compare_and_swap(&value, (NSString*)nil, s))
+	{
+	  RELEASE(s);
+	}
+    }
+  return value;
+}
+@end
+
 
 
 /**
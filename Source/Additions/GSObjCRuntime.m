@@ -563,6 +563,7 @@ GSObjCAddMethods(Class cls, Method *list, BOOL replace)
           BDBGPrintf("    skipped %c%s\n", c, sel_getName(n));
 	}
     }
+  GSPrivateKVCFlush();
 }
 
 GSMethod
@@ -60,6 +60,15 @@ NSString * const GSStreamRemotePortKey
 
 @end
 
+@implementation NSStream (GSTLSSessionCache)
+
++ (NSDictionary*) tlsSessionStatistics
+{
+  return [self notImplemented: _cmd];
+}
+
+@end
+
 @implementation GSServerStream
 
 + (id) allocWithZone: (NSZone*)z
@@ -45,7 +45,6 @@
  */
 
 #import "common.h"
-#import "GNUstepBase/GSLock.h"
 #import "GNUstepBase/NSMutableString+GNUstepBase.h"
 #import "Foundation/NSAttributedString.h"
 #import "Foundation/NSException.h"
@@ -56,16 +55,47 @@
 #import "Foundation/NSProxy.h"
 #import "Foundation/NSThread.h"
 #import "Foundation/NSNotification.h"
+#import "GSFastEnumeration.h"
+
+#include <pthread.h>
 
 #define		SANITY_CHECKS	0
 
-static	NSDictionary	*blank;
 
+/*
+ * Attribute dictionaries are interned, so that all the runs (in all
+ * attributed strings) with equal attributes share a single immutable
+ * copy of the dictionary.  Each copy is held in a GSAttrEntry which
+ * counts the runs using it.
+ */
+typedef struct GSAttrEntry {
+  struct GSAttrEntry	*next;
+  NSDictionary		*attrs;
+  NSUInteger		fingerprint;
+  NSUInteger		refs;
+} GSAttrEntry;
+
+/*
+ * The runs of an attributed string are kept in an array in order of
+ * location, each run extending up to the location of the next one (or
+ * the end of the string).  The first run is always at location zero.
+ */
+typedef struct {
+  unsigned	loc;
+  GSAttrEntry	*entry;
+} GSAttrRun;
+
+typedef struct {
+  GSAttrRun	*items;
+  unsigned	count;
+  unsigned	capacity;
+  NSZone	*zone;
+} GSAttrRuns;
 
 @interface GSAttributedString : NSAttributedString
 {
   NSString		*_textChars;
-  NSMutableArray	*_infoArray;
+  GSAttrRuns		_runs;
 }
 
 - (id) initWithString: (NSString*)aString
@@ -73,13 +103,14 @@ static	NSDictionary	*blank;
 - (NSString*) string;
 - (NSDictionary*) attributesAtIndex: (NSUInteger)index
 		     effectiveRange: (NSRange*)aRange;
+- (GSAttrRuns*) _attrRuns;
 
 @end
 
 @interface GSMutableAttributedString : NSMutableAttributedString
 {
   NSMutableString	*_textChars;
-  NSMutableArray	*_infoArray;
+  GSAttrRuns		_runs;
   NSString		*_textProxy;
 }
 
@@ -92,368 +123,377 @@ static	NSDictionary	*blank;
 		 range: (NSRange)range;
 - (void) replaceCharactersInRange: (NSRange)range
 		       withString: (NSString*)aString;
+- (GSAttrRuns*) _attrRuns;
 
 @end
 
 
 
-#define	GSI_MAP_RETAIN_KEY(M, X)	
-#define	GSI_MAP_RELEASE_KEY(M, X)	
-#define	GSI_MAP_RETAIN_VAL(M, X)	
-#define	GSI_MAP_RELEASE_VAL(M, X)	
-#define	GSI_MAP_EQUAL(M, X,Y)	[(X).obj isEqualToDictionary: (Y).obj]
-#define GSI_MAP_KTYPES	GSUNION_OBJ
-#define GSI_MAP_VTYPES	GSUNION_NSINT
-#define	GSI_MAP_NOCLEAN	1
-
-#if	GS_WITH_GC
-#include	<gc/gc_typed.h>
-static GC_descr	nodeDesc;	// Type descriptor for map node.
-#define	GSI_MAP_NODES(M, X) \
-(GSIMapNode)GC_calloc_explicitly_typed(X, sizeof(GSIMapNode_t), nodeDesc)
-#endif
+/*
+ * The interned dictionaries are spread over a number of shards, each with
+ * its own lock and hash table, so that threads building attributed strings
+ * rarely contend for a lock.  The shard and bucket for a dictionary are
+ * chosen using a fingerprint computed from the hashes of its keys and
+ * values, which is stored in the entry so it need only be computed for
+ * the dictionary being looked up.
+ */
+#define	ATTR_SHARDS	16
 
-#include "GNUstepBase/GSIMap.h"
+typedef struct {
+  pthread_mutex_t	lock;
+  GSAttrEntry		**buckets;
+  NSUInteger		mask;
+  NSUInteger		count;
+} GSAttrShard;
 
-static NSLock		*attrLock = nil;
-static GSIMapTable_t	attrMap;
-static SEL		lockSel;
-static SEL		unlockSel;
-static IMP		lockImp;
-static IMP		unlockImp;
+static GSAttrShard	attrShards[ATTR_SHARDS];
+static GSAttrEntry	*blank = 0;
 
-#define	ALOCK()	if (attrLock != nil) (*lockImp)(attrLock, lockSel)
-#define	AUNLOCK() if (attrLock != nil) (*unlockImp)(attrLock, unlockSel)
+#define	SHARD(F)	(&attrShards[(F) % ATTR_SHARDS])
+#define	BUCKET(S, F)	(&(S)->buckets[((F) / ATTR_SHARDS) & (S)->mask])
 
 /*
- * Add a dictionary to the cache - if it was not already there, return
- * the copy added to the cache, if it was, count it and return retained
- * object that was there.
+ * Return a fingerprint for the dictionary ... equal dictionaries have equal
+ * fingerprints.  The hash of each key is combined with that of its value,
+ * and the results are summed so that the order of enumeration is unimportant.
  */
-static NSDictionary*
-cacheAttributes(NSDictionary *attrs)
+static NSUInteger
+attrFingerprint(NSDictionary *attrs)
 {
-  GSIMapNode	node;
+  NSUInteger	fp = [attrs count];
 
-  ALOCK();
-  node = GSIMapNodeForKey(&attrMap, (GSIMapKey)((id)attrs));
-  if (node == 0)
+  FOR_IN(id, key, attrs)
     {
-      /*
-       * Shallow copy of dictionary, without copying objects ... results
-       * in an immutable dictionary that can safely be cached.
-       */
-      attrs = [[NSDictionary alloc] initWithDictionary: attrs copyItems: NO];
-      GSIMapAddPair(&attrMap, (GSIMapKey)((id)attrs), (GSIMapVal)(NSUInteger)1);
-    }
-  else
-    {
-      node->value.nsu++;
-      attrs = RETAIN(node->key.obj);
+      NSUInteger	h;
+
+      h = [key hash] * 31 + [[attrs objectForKey: key] hash];
+      h *= 0x9e3779b1;
+      fp += h ^ (h >> 16);
     }
-  AUNLOCK();
-  return attrs;
+  END_FOR_IN(attrs)
+  fp *= 0x85ebca6b;
+  return fp ^ (fp >> 13);
 }
 
 static void
-unCacheAttributes(NSDictionary *attrs)
+attrShardGrow(GSAttrShard *s)
 {
-  GSIMapBucket       bucket;
+  GSAttrEntry	**old = s->buckets;
+  NSUInteger	size = s->mask + 1;
+  NSUInteger	i;
 
-  ALOCK();
-  bucket = GSIMapBucketForKey(&attrMap, (GSIMapKey)((id)attrs));
-  if (bucket != 0)
+  s->mask = size * 2 - 1;
+  s->buckets = (GSAttrEntry**)NSZoneCalloc(NSDefaultMallocZone(),
+    size * 2, sizeof(GSAttrEntry*));
+  for (i = 0; i < size; i++)
     {
-      GSIMapNode     node;
+      GSAttrEntry	*e = old[i];
 
-      node = GSIMapNodeForKeyInBucket(&attrMap, bucket, (GSIMapKey)((id)attrs));
-      if (node != 0)
+      while (e != 0)
 	{
-	  if (--node->value.nsu == 0)
-	    {
-	      GSIMapRemoveNodeFromMap(&attrMap, bucket, node);
-	      GSIMapFreeNode(&attrMap, node);
-	    }
+	  GSAttrEntry	*next = e->next;
+	  GSAttrEntry	**b = BUCKET(s, e->fingerprint);
+
+	  e->next = *b;
+	  *b = e;
+	  e = next;
 	}
     }
-  AUNLOCK();
+  NSZoneFree(NSDefaultMallocZone(), old);
 }
 
-
-
-@interface	GSAttrInfo : NSObject
+/*
+ * Find the entry for a dictionary in the cache, adding a copy of the
+ * dictionary if it was not already there, and count a reference to it.
+ */
+static GSAttrEntry*
+cacheAttributes(NSDictionary *attrs)
 {
-@public
-  unsigned	loc;
-  NSDictionary	*attrs;
-}
-
-+ (GSAttrInfo*) newWithZone: (NSZone*)z value: (NSDictionary*)a at: (unsigned)l;
+  NSUInteger	fp = attrFingerprint(attrs);
+  GSAttrShard	*s = SHARD(fp);
+  GSAttrEntry	**b;
+  GSAttrEntry	*e;
 
-@end
-
-@implementation	GSAttrInfo
+  pthread_mutex_lock(&s->lock);
+  b = BUCKET(s, fp);
+  for (e = *b; e != 0; e = e->next)
+    {
+      if (e->fingerprint == fp && [e->attrs isEqualToDictionary: attrs])
+	{
+	  e->refs++;
+	  pthread_mutex_unlock(&s->lock);
+	  return e;
+	}
+    }
+  /*
+   * Shallow copy of dictionary, without copying objects ... results
+   * in an immutable dictionary that can safely be cached.
+   */
+  e = (GSAttrEntry*)NSZoneMalloc(NSDefaultMallocZone(), sizeof(GSAttrEntry));
+  e->attrs = [[NSDictionary alloc] initWithDictionary: attrs copyItems: NO];
+  e->fingerprint = fp;
+  e->refs = 1;
+  e->next = *b;
+  *b = e;
+  if (++s->count > s->mask)
+    {
+      attrShardGrow(s);
+    }
+  pthread_mutex_unlock(&s->lock);
+  return e;
+}
 
 /*
- * Called to record attributes at a particular location - the given attributes
- * dictionary must have been produced by 'cacheAttributes()' so that it is
- * already copied/retained and this method doesn't need to do it.
+ * Count another reference to an entry already in the cache.
  */
-+ (GSAttrInfo*) newWithZone: (NSZone*)z value: (NSDictionary*)a at: (unsigned)l;
+static inline GSAttrEntry*
+retainAttributes(GSAttrEntry *e)
 {
-  GSAttrInfo	*info = (GSAttrInfo*)NSAllocateObject(self, 0, z);
+  GSAttrShard	*s = SHARD(e->fingerprint);
 
-  info->loc = l;
-  info->attrs = a;
-  return info;
+  pthread_mutex_lock(&s->lock);
+  e->refs++;
+  pthread_mutex_unlock(&s->lock);
+  return e;
 }
 
-- (void) dealloc
+/*
+ * Remove a reference to an entry, removing it from the cache (and
+ * releasing its dictionary) when it is no longer used.
+ */
+static void
+unCacheAttributes(GSAttrEntry *e)
 {
-  [self finalize];
-  [super dealloc];
+  GSAttrShard	*s = SHARD(e->fingerprint);
+
+  pthread_mutex_lock(&s->lock);
+  if (--e->refs == 0)
+    {
+      GSAttrEntry	**b = BUCKET(s, e->fingerprint);
+
+      while (*b != e)
+	{
+	  b = &(*b)->next;
+	}
+      *b = e->next;
+      s->count--;
+    }
+  else
+    {
+      e = 0;
+    }
+  pthread_mutex_unlock(&s->lock);
+  if (e != 0)
+    {
+      RELEASE(e->attrs);
+      NSZoneFree(NSDefaultMallocZone(), e);
+    }
 }
 
-- (NSString*) description
+
+
+static void
+runsInit(GSAttrRuns *runs, NSZone *z)
 {
-  return [NSString stringWithFormat: @"Attributes at %u are - %@",
-    loc, attrs];
+  runs->zone = z;
+  runs->count = 0;
+  runs->capacity = 1;
+  runs->items = (GSAttrRun*)NSZoneMalloc(z, sizeof(GSAttrRun));
 }
 
-- (void) encodeWithCoder: (NSCoder*)aCoder
+/*
+ * Insert a run at index ... the reference to entry is taken over by the run.
+ */
+static void
+runsInsert(GSAttrRuns *runs, unsigned index, unsigned loc, GSAttrEntry *entry)
 {
-  [aCoder encodeValueOfObjCType: @encode(unsigned) at: &loc];
-  [aCoder encodeValueOfObjCType: @encode(id) at: &attrs];
+  if (runs->count == runs->capacity)
+    {
+      runs->capacity *= 2;
+      runs->items = (GSAttrRun*)NSZoneRealloc(runs->zone, runs->items,
+	runs->capacity * sizeof(GSAttrRun));
+    }
+  if (index < runs->count)
+    {
+      memmove(&runs->items[index + 1], &runs->items[index],
+	(runs->count - index) * sizeof(GSAttrRun));
+    }
+  runs->items[index].loc = loc;
+  runs->items[index].entry = entry;
+  runs->count++;
 }
 
-- (void) finalize
+static void
+runsRemove(GSAttrRuns *runs, unsigned index)
 {
-  unCacheAttributes(attrs);
-  DESTROY(attrs);
+  unCacheAttributes(runs->items[index].entry);
+  runs->count--;
+  if (index < runs->count)
+    {
+      memmove(&runs->items[index], &runs->items[index + 1],
+	(runs->count - index) * sizeof(GSAttrRun));
+    }
 }
 
-- (id) initWithCoder: (NSCoder*)aCoder
+static void
+runsEmpty(GSAttrRuns *runs)
 {
-  NSDictionary  *a;
-
-  [aCoder decodeValueOfObjCType: @encode(unsigned) at: &loc];
-  a = [aCoder decodeObject];
-  attrs = cacheAttributes(a);
-  return self;
+  while (runs->count > 0)
+    {
+      unCacheAttributes(runs->items[--runs->count].entry);
+    }
 }
 
-- (id) replacementObjectForPortCoder: (NSPortCoder*)aCoder
+static void
+runsFree(GSAttrRuns *runs)
 {
-  return self;
+  if (runs->items != 0)
+    {
+      runsEmpty(runs);
+      NSZoneFree(runs->zone, runs->items);
+      runs->items = 0;
+    }
 }
 
-@end
 
-
 
 @implementation GSAttributedString
 
-static Class	infCls = 0;
-
-static SEL	infSel;
-static SEL	addSel;
-static SEL	cntSel;
-static SEL	insSel;
-static SEL	oatSel;
-static SEL	remSel;
-
-static IMP	infImp;
-static void	(*addImp)(NSMutableArray*,SEL,id);
-static unsigned (*cntImp)(NSArray*,SEL);
-static void	(*insImp)(NSMutableArray*,SEL,id,unsigned);
-static IMP	oatImp;
-static void	(*remImp)(NSMutableArray*,SEL,unsigned);
-
-#define	NEWINFO(Z,O,L)	((*infImp)(infCls, infSel, (Z), (O), (L)))
-#define	ADDOBJECT(O)	((*addImp)(_infoArray, addSel, (O)))
-#define	INSOBJECT(O,I)	((*insImp)(_infoArray, insSel, (O), (I)))
-#define	OBJECTAT(I)	((*oatImp)(_infoArray, oatSel, (I)))
-#define	REMOVEAT(I)	((*remImp)(_infoArray, remSel, (I)))
+static Class	gsCls = 0;
+static Class	gsmCls = 0;
 
 static void _setup(void)
 {
-  if (infCls == 0)
+  if (gsCls == 0)
     {
-      NSMutableArray	*a;
       NSDictionary	*d;
+      unsigned		i;
 
-#if	GS_WITH_GC
-      /* We create a typed memory descriptor for map nodes.
-       * Only the pointer to the key needs to be scanned.
-       */
-      GC_word	w[GC_BITMAP_SIZE(GSIMapNode_t)] = {0};
-      GC_set_bit(w, GC_WORD_OFFSET(GSIMapNode_t, key));
-      nodeDesc = GC_make_descriptor(w, GC_WORD_LEN(GSIMapNode_t));
-#endif
-      GSIMapInitWithZoneAndCapacity(&attrMap, NSDefaultMallocZone(), 32);
-
-      infSel = @selector(newWithZone:value:at:);
-      addSel = @selector(addObject:);
-      cntSel = @selector(count);
-      insSel = @selector(insertObject:atIndex:);
-      oatSel = @selector(objectAtIndex:);
-      remSel = @selector(removeObjectAtIndex:);
-
-      infCls = [GSAttrInfo class];
-      infImp = [infCls methodForSelector: infSel];
-
-      a = [NSMutableArray allocWithZone: NSDefaultMallocZone()];
-      a = [a initWithCapacity: 1];
-      addImp = (void (*)(NSMutableArray*,SEL,id))[a methodForSelector: addSel];
-      cntImp = (unsigned (*)(NSArray*,SEL))[a methodForSelector: cntSel];
-      insImp = (void (*)(NSMutableArray*,SEL,id,unsigned))
-	[a methodForSelector: insSel];
-      oatImp = [a methodForSelector: oatSel];
-      remImp = (void (*)(NSMutableArray*,SEL,unsigned))
-	[a methodForSelector: remSel];
-      RELEASE(a);
+      for (i = 0; i < ATTR_SHARDS; i++)
+	{
+	  pthread_mutex_init(&attrShards[i].lock, NULL);
+	  attrShards[i].mask = 15;
+	  attrShards[i].count = 0;
+	  attrShards[i].buckets = (GSAttrEntry**)NSZoneCalloc(
+	    NSDefaultMallocZone(), 16, sizeof(GSAttrEntry*));
+	}
       d = [NSDictionary new];
       blank = cacheAttributes(d);
       RELEASE(d);
+      gsmCls = [GSMutableAttributedString class];
+      gsCls = [GSAttributedString class];
+    }
+}
+
+inline static GSAttrEntry*
+_attributesAtIndexEffectiveRange(
+  unsigned int index,
+  NSRange *aRange,
+  unsigned int tmpLength,
+  GSAttrRuns *runs,
+  unsigned int *foundIndex)
+{
+  unsigned	low, high, mid, nextLoc;
+
+  NSCAssert(runs->count > 0, NSInternalInconsistencyException);
+  if (index > tmpLength)
+    {
+      [NSException raise: NSRangeException
+		  format: @"index is out of range in function "
+			  @"_attributesAtIndexEffectiveRange()"];
     }
+
+  /*
+   * Binary search for the last run starting at or before the index
+   * (the last run if we are at the end of the string).
+   */
+  low = 0;
+  high = runs->count - 1;
+  while (low < high)
+    {
+      mid = (low + high + 1) / 2;
+      if (runs->items[mid].loc <= index)
+	{
+	  low = mid;
+	}
+      else
+	{
+	  high = mid - 1;
+	}
+    }
+  nextLoc = (low + 1 < runs->count) ? runs->items[low + 1].loc : tmpLength;
+  if (aRange != 0)
+    {
+      aRange->location = runs->items[low].loc;
+      aRange->length = nextLoc - runs->items[low].loc;
+    }
+  if (foundIndex != 0)
+    {
+      *foundIndex = low;
+    }
+  return runs->items[low].entry;
 }
 
 static void
 _setAttributesFrom(
   NSAttributedString *attributedString,
   NSRange aRange,
-  NSMutableArray *_infoArray)
+  GSAttrRuns *runs)
 {
-  NSZone	*z = [_infoArray zone];
+  Class		c = object_getClass(attributedString);
   NSRange	range;
   NSDictionary	*attr;
-  GSAttrInfo	*info;
   unsigned	loc;
 
   /*
    * remove any old attributes of the string.
    */
-  [_infoArray removeAllObjects];
+  runsEmpty(runs);
 
   if (aRange.length == 0)
     {
-      attr = blank;
-      range = aRange; /* Set to satisfy the loop condition below. */
-    }
-  else
-    {
-      attr = [attributedString attributesAtIndex: aRange.location
-				  effectiveRange: &range];
+      runsInsert(runs, 0, 0, retainAttributes(blank));
+      return;
     }
-  attr = cacheAttributes(attr);
-  info = NEWINFO(z, attr, 0);
-  ADDOBJECT(info);
-  RELEASE(info);
 
-  while ((loc = NSMaxRange(range)) < NSMaxRange(aRange))
+  if (c == gsCls || c == gsmCls)
     {
-      attr = [attributedString attributesAtIndex: loc
-				  effectiveRange: &range];
-      attr = cacheAttributes(attr);
-      info = NEWINFO(z, attr, loc - aRange.location);
-      ADDOBJECT(info);
-      RELEASE(info);
-    }
-}
+      GSAttrRuns	*src = [(GSAttributedString*)attributedString _attrRuns];
+      unsigned		i;
 
-inline static NSDictionary*
-_attributesAtIndexEffectiveRange(
-  unsigned int index,
-  NSRange *aRange,
-  unsigned int tmpLength,
-  NSMutableArray *_infoArray,
-  unsigned int *foundIndex)
-{
-  unsigned	low, high, used, cnt, nextLoc;
-  GSAttrInfo	*found = nil;
-
-  used = (*cntImp)(_infoArray, cntSel);
-  NSCAssert(used > 0, NSInternalInconsistencyException);
-  high = used - 1;
-
-  if (index >= tmpLength)
-    {
-      if (index == tmpLength)
+      /*
+       * Copying from one of our own strings, we can share the entries of
+       * the runs without looking the dictionaries up again.
+       */
+      _attributesAtIndexEffectiveRange(aRange.location, 0,
+	[attributedString length], src, &i);
+      while (i < src->count && src->items[i].loc < NSMaxRange(aRange))
 	{
-	  found = OBJECTAT(high);
-	  if (foundIndex != 0)
-	    {
-	      *foundIndex = high;
-	    }
-	  if (aRange != 0)
-	    {
-	      aRange->location = found->loc;
-	      aRange->length = tmpLength - found->loc;
-	    }
-	  return found->attrs;
+	  loc = src->items[i].loc;
+	  loc = (loc > aRange.location) ? loc - aRange.location : 0;
+	  runsInsert(runs, runs->count, loc,
+	    retainAttributes(src->items[i].entry));
+	  i++;
 	}
-      [NSException raise: NSRangeException
-		  format: @"index is out of range in function "
-			  @"_attributesAtIndexEffectiveRange()"];
+      return;
     }
 
-  /*
-   * Binary search for efficiency in huge attributed strings
-   */
-  low = 0;
-  while (low <= high)
-    {
-      cnt = (low + high) / 2;
-      found = OBJECTAT(cnt);
-      if (found->loc > index)
-	{
-	  high = cnt - 1;
-	}
-      else
-	{
-	  if (cnt >= used - 1)
-	    {
-	      nextLoc = tmpLength;
-	    }
-	  else
-	    {
-	      GSAttrInfo	*inf = OBJECTAT(cnt + 1);
+  attr = [attributedString attributesAtIndex: aRange.location
+			      effectiveRange: &range];
+  runsInsert(runs, 0, 0, cacheAttributes(attr));
 
-	      nextLoc = inf->loc;
-	    }
-	  if (found->loc == index || index < nextLoc)
-	    {
-	      //Found
-	      if (aRange != 0)
-		{
-		  aRange->location = found->loc;
-		  aRange->length = nextLoc - found->loc;
-		}
-	      if (foundIndex != 0)
-		{
-		  *foundIndex = cnt;
-		}
-	      return found->attrs;
-	    }
-	  else
-	    {
-	      low = cnt + 1;
-	    }
-	}
+  while ((loc = NSMaxRange(range)) < NSMaxRange(aRange))
+    {
+      attr = [attributedString attributesAtIndex: loc
+				  effectiveRange: &range];
+      runsInsert(runs, runs->count, loc - aRange.location,
+	cacheAttributes(attr));
     }
-  NSCAssert(NO,@"Error in binary search algorithm");
-  return nil;
 }
 
 + (void) initialize
 {
   _setup();
-
-  attrLock = [GSLazyLock new];
-  lockSel = @selector(lock);
-  unlockSel = @selector(unlock);
-  lockImp = [attrLock methodForSelector: lockSel];
-  unlockImp = [attrLock methodForSelector: unlockSel];
 }
 
 - (id) initWithString: (NSString*)aString
@@ -472,7 +512,7 @@ _attributesAtIndexEffectiveRange(
 		  format: @"aString object passed to -[GSAttributedString initWithString:attributes:] does not respond to -length"];
     }
 
-  _infoArray = [[NSMutableArray allocWithZone: z] initWithCapacity: 1];
+  runsInit(&_runs, z);
   if (aString != nil && [aString isKindOfClass: [NSAttributedString class]])
     {
       NSAttributedString	*as = (NSAttributedString*)aString;
@@ -480,20 +520,15 @@ _attributesAtIndexEffectiveRange(
 
       aString = [as string];
       len = [aString length];
-      _setAttributesFrom(as, NSMakeRange(0, len), _infoArray);
+      _setAttributesFrom(as, NSMakeRange(0, len), &_runs);
+    }
+  else if (attributes == nil)
+    {
+      runsInsert(&_runs, 0, 0, retainAttributes(blank));
     }
   else
     {
-      GSAttrInfo	*info;
-
-      if (attributes == nil)
-	{
-	  attributes = blank;
-	}
-      attributes = cacheAttributes(attributes);
-      info = NEWINFO(z, attributes, 0);
-      ADDOBJECT(info);
-      RELEASE(info);
+      runsInsert(&_runs, 0, 0, cacheAttributes(attributes));
     }
   if (aString == nil)
     _textChars = @"";
@@ -511,16 +546,21 @@ _attributesAtIndexEffectiveRange(
 		     effectiveRange: (NSRange*)aRange
 {
   return _attributesAtIndexEffectiveRange(
-    index, aRange, [_textChars length], _infoArray, NULL);
+    index, aRange, [_textChars length], &_runs, NULL)->attrs;
 }
 
 - (void) dealloc
 {
   RELEASE(_textChars);
-  RELEASE(_infoArray);
+  runsFree(&_runs);
   [super dealloc];
 }
 
+- (GSAttrRuns*) _attrRuns
+{
+  return &_runs;
+}
+
 
 // The superclass implementation is correct but too slow
 - (NSUInteger) length
@@ -545,21 +585,18 @@ _attributesAtIndexEffectiveRange(
  * regression test cases.  */
 - (void) _sanity
 {
-  GSAttrInfo	*info;
   unsigned	i;
   unsigned	l = 0;
   unsigned	len = [_textChars length];
-  unsigned	c = (*cntImp)(_infoArray, cntSel);
+  unsigned	c = _runs.count;
 
   NSAssert(c > 0, NSInternalInconsistencyException);
-  info = OBJECTAT(0);
-  NSAssert(info->loc == 0, NSInternalInconsistencyException);
+  NSAssert(_runs.items[0].loc == 0, NSInternalInconsistencyException);
   for (i = 1; i < c; i++)
     {
-      info = OBJECTAT(i);
-      NSAssert(info->loc > l, NSInternalInconsistencyException);
-      NSAssert(info->loc < len, NSInternalInconsistencyException);
-      l = info->loc;
+      NSAssert(_runs.items[i].loc > l, NSInternalInconsistencyException);
+      NSAssert(_runs.items[i].loc < len, NSInternalInconsistencyException);
+      l = _runs.items[i].loc;
     }
 }
 
@@ -584,26 +621,21 @@ _attributesAtIndexEffectiveRange(
 		  format: @"aString object passed to -[GSAttributedString initWithString:attributes:] does not respond to -length"];
     }
 
-  _infoArray = [[NSMutableArray allocWithZone: z] initWithCapacity: 1];
+  runsInit(&_runs, z);
   if (aString != nil && [aString isKindOfClass: [NSAttributedString class]])
     {
       NSAttributedString	*as = (NSAttributedString*)aString;
 
       aString = [as string];
-      _setAttributesFrom(as, NSMakeRange(0, [aString length]), _infoArray);
+      _setAttributesFrom(as, NSMakeRange(0, [aString length]), &_runs);
+    }
+  else if (attributes == nil)
+    {
+      runsInsert(&_runs, 0, 0, retainAttributes(blank));
     }
   else
     {
-      GSAttrInfo	*info;
-
-      if (attributes == nil)
-        {
-          attributes = blank;
-        }
-      attributes = cacheAttributes(attributes);
-      info = NEWINFO(z, attributes, 0);
-      ADDOBJECT(info);
-      RELEASE(info);
+      runsInsert(&_runs, 0, 0, cacheAttributes(attributes));
     }
 /* WARNING ... NSLayoutManager depends on the fact that we create the
  * _textChars instance variable by copying the aString argument to get
@@ -632,9 +664,13 @@ SANITY();
 - (NSDictionary*) attributesAtIndex: (NSUInteger)index
 		     effectiveRange: (NSRange*)aRange
 {
-  unsigned	dummy;
   return _attributesAtIndexEffectiveRange(
-    index, aRange, [_textChars length], _infoArray, &dummy);
+    index, aRange, [_textChars length], &_runs, NULL)->attrs;
+}
+
+- (GSAttrRuns*) _attrRuns
+{
+  return &_runs;
 }
 
 /*
@@ -656,24 +692,27 @@ SANITY();
   unsigned	arraySize;
   NSRange	effectiveRange = NSMakeRange(0, NSNotFound);
   unsigned	afterRangeLoc, beginRangeLoc;
-  NSDictionary	*attrs;
-  NSZone	*z = [self zone];
-  GSAttrInfo	*info;
+  GSAttrEntry	*attrs;
+  GSAttrEntry	*entry;
+  GSAttrRun	*run;
 
   if (range.length == 0)
     {
       NSWarnMLog(@"Attempt to set attribute for zero-length range");
       return;
     }
+  tmpLength = [_textChars length];
+  GS_RANGE_CHECK(range, tmpLength);
   if (attributes == nil)
     {
-      attributes = blank;
+      entry = retainAttributes(blank);
+    }
+  else
+    {
+      entry = cacheAttributes(attributes);
     }
-  attributes = cacheAttributes(attributes);
 SANITY();
-  tmpLength = [_textChars length];
-  GS_RANGE_CHECK(range, tmpLength);
-  arraySize = (*cntImp)(_infoArray, cntSel);
+  arraySize = _runs.count;
   beginRangeLoc = range.location;
   afterRangeLoc = NSMaxRange(range);
   if (afterRangeLoc < tmpLength)
@@ -682,8 +721,8 @@ SANITY();
        * Locate the first range that extends beyond our range.
        */
       attrs = _attributesAtIndexEffectiveRange(
-	afterRangeLoc, &effectiveRange, tmpLength, _infoArray, &arrayIndex);
-      if (attrs == attributes)
+	afterRangeLoc, &effectiveRange, tmpLength, &_runs, &arrayIndex);
+      if (attrs == entry)
         {
           /*
            * The located range has the same attributes as us - so we can
@@ -705,8 +744,7 @@ SANITY();
 	  /*
 	   * The located range also starts at or after our range.
 	   */
-	  info = OBJECTAT(arrayIndex);
-	  info->loc = afterRangeLoc;
+	  _runs.items[arrayIndex].loc = afterRangeLoc;
 	  arrayIndex--;
 	}
       else if (NSMaxRange(effectiveRange) > afterRangeLoc)
@@ -715,11 +753,8 @@ SANITY();
 	   * The located range ends after our range.
 	   * Create a subrange to go from our end to the end of the old range.
 	   */
-	  info = NEWINFO(z, cacheAttributes(attrs), afterRangeLoc);
-	  arrayIndex++;
-	  INSOBJECT(info, arrayIndex);
-	  RELEASE(info);
-	  arrayIndex--;
+	  runsInsert(&_runs, arrayIndex + 1, afterRangeLoc,
+	    retainAttributes(attrs));
 	}
     }
   else
@@ -732,10 +767,9 @@ SANITY();
    */
   while (arrayIndex > 0)
     {
-      info = OBJECTAT(arrayIndex-1);
-      if (info->loc < beginRangeLoc)
+      if (_runs.items[arrayIndex - 1].loc < beginRangeLoc)
 	break;
-      REMOVEAT(arrayIndex);
+      runsRemove(&_runs, arrayIndex);
       arrayIndex--;
     }
 
@@ -743,33 +777,27 @@ SANITY();
    * Use the location/attribute info in the current slot if possible,
    * otherwise, add a new slot and use that.
    */
-  info = OBJECTAT(arrayIndex);
-  if (info->loc >= beginRangeLoc)
+  run = &_runs.items[arrayIndex];
+  if (run->loc >= beginRangeLoc)
     {
-      info->loc = beginRangeLoc;
-      if (info->attrs == attributes)
+      run->loc = beginRangeLoc;
+      if (run->entry == entry)
 	{
-	  unCacheAttributes(attributes);
-	  RELEASE(attributes);
+	  unCacheAttributes(entry);
 	}
       else
 	{
-	  unCacheAttributes(info->attrs);
-	  RELEASE(info->attrs);
-	  info->attrs = attributes;
+	  unCacheAttributes(run->entry);
+	  run->entry = entry;
 	}
     }
-  else if (info->attrs == attributes)
+  else if (run->entry == entry)
     {
-      unCacheAttributes(attributes);
-      RELEASE(attributes);
+      unCacheAttributes(entry);
     }
   else
     {
-      arrayIndex++;
-      info = NEWINFO(z, attributes, beginRangeLoc);
-      INSOBJECT(info, arrayIndex);
-      RELEASE(info);
+      runsInsert(&_runs, arrayIndex + 1, beginRangeLoc, entry);
     }
 
 SANITY();
@@ -782,7 +810,6 @@ SANITY();
   unsigned	arrayIndex = 0;
   unsigned	arraySize;
   NSRange	effectiveRange = NSMakeRange(0, NSNotFound);
-  GSAttrInfo	*info;
   int		moveLocations;
   unsigned	start;
 
@@ -803,7 +830,7 @@ SANITY();
       goto finish;
     }
 
-  arraySize = (*cntImp)(_infoArray, cntSel);
+  arraySize = _runs.count;
   if (arraySize == 1)
     {
       /*
@@ -825,7 +852,7 @@ SANITY();
   else
     start = range.location;
   _attributesAtIndexEffectiveRange(start, &effectiveRange,
-    tmpLength, _infoArray, &arrayIndex);
+    tmpLength, &_runs, &arrayIndex);
 
   moveLocations = [aString length] - range.length;
 
@@ -837,33 +864,22 @@ SANITY();
        * we are replacing.  Adjust the start point of a range that
        * extends beyond ours.
        */
-      info = OBJECTAT(arrayIndex);
-      if (info->loc < NSMaxRange(range))
+      if (_runs.items[arrayIndex].loc < NSMaxRange(range))
 	{
-	  unsigned int	next = arrayIndex + 1;
-
-	  while (next < arraySize)
+	  while (arrayIndex + 1 < arraySize
+	    && _runs.items[arrayIndex + 1].loc <= NSMaxRange(range))
 	    {
-	      GSAttrInfo	*n = OBJECTAT(next);
-	      if (n->loc <= NSMaxRange(range))
-		{
-		  REMOVEAT(arrayIndex);
-		  arraySize--;
-		  info = n;
-		}
-	      else
-		{
-		  break;
-		}
+	      runsRemove(&_runs, arrayIndex);
+	      arraySize--;
 	    }
 	}
       if (NSMaxRange(range) < [_textChars length])
 	{
-	  info->loc = NSMaxRange(range);
+	  _runs.items[arrayIndex].loc = NSMaxRange(range);
 	}
       else
 	{
-	  REMOVEAT(arrayIndex);
+	  runsRemove(&_runs, arrayIndex);
 	  arraySize--;
 	}
     }
@@ -876,7 +892,7 @@ SANITY();
   if ((moveLocations + range.length) == 0)
     {
       _attributesAtIndexEffectiveRange(start, &effectiveRange,
-        tmpLength, _infoArray, &arrayIndex);
+        tmpLength, &_runs, &arrayIndex);
       arrayIndex++;
 
       if (effectiveRange.location == range.location
@@ -885,19 +901,14 @@ SANITY();
 	  arrayIndex--;
 	  if (arrayIndex!=0 || arraySize > 1)
 	    {
-	      REMOVEAT(arrayIndex);
+	      runsRemove(&_runs, arrayIndex);
 	      arraySize--;
 	    }
 	  else
 	    {
-	      NSDictionary	*d = blank;
-
-	      info = OBJECTAT(0);
-	      unCacheAttributes(info->attrs);
-	      DESTROY(info->attrs);
-	      d = cacheAttributes(d);
-	      info->attrs = d;
-	      info->loc = NSMaxRange(range);
+	      unCacheAttributes(_runs.items[0].entry);
+	      _runs.items[0].entry = retainAttributes(blank);
+	      _runs.items[0].loc = NSMaxRange(range);
 	    }
 	}
     }
@@ -907,8 +918,7 @@ SANITY();
    */
   while (arrayIndex < arraySize)
     {
-      info = OBJECTAT(arrayIndex);
-      info->loc += moveLocations;
+      _runs.items[arrayIndex].loc += moveLocations;
       arrayIndex++;
     }
   [_textChars replaceCharactersInRange: range withString: aString];
@@ -920,7 +930,7 @@ SANITY();
 {
   [_textProxy release];
   RELEASE(_textChars);
-  RELEASE(_infoArray);
+  runsFree(&_runs);
   [super dealloc];
 }
 
@@ -0,0 +1,668 @@
+/* Implementation of concurrent sorting for GNUStep
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNUstep Base Library.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02111 USA.
+   */
+
+#import "common.h"
+#import "Foundation/NSSortDescriptor.h"
+#import "Foundation/NSException.h"
+#import "GSSorting.h"
+#import "GSPrivate.h"
+
+/* Arrays smaller than this are sorted on the calling thread alone, since
+ * the cost of handing work to other threads would outweigh the gain.
+ */
+#define	PARALLEL_THRESHOLD	8192
+
+/* Ranges up to this size are sorted by insertion.
+ */
+#define	INSERTION_THRESHOLD	32
+
+/* The number of sample elements taken for each bucket of a samplesort.
+ */
+#define	OVERSAMPLE		8
+
+/* State shared by the threads working on one sort.
+ */
+typedef struct {
+  id			*buffer;	/* The objects being sorted.	*/
+  id			*temp;		/* Scratch space, same size.	*/
+  NSUInteger		count;
+  id			entity;		/* Comparison descriptor etc.	*/
+  GSComparisonType	type;
+  void			*context;
+  /* Merge sort state.
+   */
+  NSUInteger		*bounds;	/* Start of each sorted chunk.	*/
+  NSUInteger		chunks;
+  NSUInteger		runChunks;	/* Chunks in each run to merge.	*/
+  NSUInteger		pieces;		/* Tasks for each merge.	*/
+  id			*src;
+  id			*dst;
+  /* Samplesort state.
+   */
+  id			*splitters;
+  NSUInteger		nsplit;
+  NSUInteger		nbuckets;
+  NSUInteger		nblocks;
+  uint16_t		*bucketOf;	/* Bucket of each element.	*/
+  NSUInteger		*offsets;	/* Per block/bucket positions.	*/
+  NSUInteger		*starts;	/* Start of each bucket.	*/
+} GSSortInfo;
+
+static inline NSComparisonResult
+compare(GSSortInfo *info, id a, id b)
+{
+  return GSCompareUsingDescriptorOrComparator(a, b,
+    info->entity, info->type, info->context);
+}
+
+/* Stable insertion sort of the count objects at a.
+ */
+static void
+insertionSort(GSSortInfo *info, id *a, NSUInteger count)
+{
+  NSUInteger	i;
+
+  for (i = 1; i < count; i++)
+    {
+      id		o = a[i];
+      NSUInteger	j = i;
+
+      while (j > 0 && compare(info, a[j - 1], o) == NSOrderedDescending)
+	{
+	  a[j] = a[j - 1];
+	  j--;
+	}
+      a[j] = o;
+    }
+}
+
+/* Stable merge of the sorted ranges a and b into out.  An object from b
+ * is only taken when it is strictly less than the next one from a.
+ */
+static void
+merge(GSSortInfo *info, id *a, NSUInteger lenA, id *b, NSUInteger lenB,
+  id *out)
+{
+  NSUInteger	i = 0;
+  NSUInteger	j = 0;
+
+  if (lenA > 0 && lenB > 0
+    && compare(info, a[lenA - 1], b[0]) != NSOrderedDescending)
+    {
+      /* Already in order.
+       */
+      memcpy(out, a, lenA * sizeof(id));
+      memcpy(out + lenA, b, lenB * sizeof(id));
+      return;
+    }
+  while (i < lenA && j < lenB)
+    {
+      if (compare(info, a[i], b[j]) == NSOrderedDescending)
+	{
+	  *out++ = b[j++];
+	}
+      else
+	{
+	  *out++ = a[i++];
+	}
+    }
+  if (i < lenA)
+    {
+      memcpy(out, a + i, (lenA - i) * sizeof(id));
+    }
+  if (j < lenB)
+    {
+      memcpy(out, b + j, (lenB - j) * sizeof(id));
+    }
+}
+
+/* Stable bottom-up merge sort of the count objects at a, using the
+ * same number of slots at tmp as scratch space.
+ */
+static void
+mergeSort(GSSortInfo *info, id *a, id *tmp, NSUInteger count)
+{
+  NSUInteger	width;
+  NSUInteger	i;
+  id		*src = a;
+  id		*dst = tmp;
+
+  for (i = 0; i < count; i += INSERTION_THRESHOLD)
+    {
+      insertionSort(info, a + i, MIN(INSERTION_THRESHOLD, count - i));
+    }
+  for (width = INSERTION_THRESHOLD; width < count; width *= 2)
+    {
+      id	*t;
+
+      for (i = 0; i < count; i += 2 * width)
+	{
+	  NSUInteger	mid = MIN(i + width, count);
+	  NSUInteger	end = MIN(i + 2 * width, count);
+
+	  merge(info, src + i, mid - i, src + mid, end - mid, dst + i);
+	}
+      t = src;
+      src = dst;
+      dst = t;
+    }
+  if (src != a)
+    {
+      memcpy(a, src, count * sizeof(id));
+    }
+}
+
+/* Return the number of objects taken from a in the first pos objects of
+ * the stable merge of a and b.
+ */
+static NSUInteger
+coRank(GSSortInfo *info, NSUInteger pos, id *a, NSUInteger lenA,
+  id *b, NSUInteger lenB)
+{
+  NSUInteger	lo = (pos > lenB) ? pos - lenB : 0;
+  NSUInteger	hi = MIN(pos, lenA);
+
+  while (lo < hi)
+    {
+      NSUInteger	i = (lo + hi) / 2;
+      NSUInteger	j = pos - i;
+
+      if (compare(info, b[j - 1], a[i]) != NSOrderedAscending)
+	{
+	  lo = i + 1;		/* a[i] comes before b[j-1]	*/
+	}
+      else
+	{
+	  hi = i;
+	}
+    }
+  return lo;
+}
+
+static void
+sortChunk(void *context, NSUInteger index)
+{
+  GSSortInfo	*info = (GSSortInfo*)context;
+  NSUInteger	start = info->bounds[index];
+  NSUInteger	count = info->bounds[index + 1] - start;
+
+  mergeSort(info, info->buffer + start, info->temp + start, count);
+}
+
+/* Merge one piece of a pair of runs.  Each pair is split into pieces of
+ * (almost) equal output size so that all the threads have work to do
+ * even in the last rounds where there are few pairs.
+ */
+static void
+mergePiece(void *context, NSUInteger index)
+{
+  GSSortInfo	*info = (GSSortInfo*)context;
+  NSUInteger	pair = index / info->pieces;
+  NSUInteger	piece = index % info->pieces;
+  NSUInteger	first = pair * 2 * info->runChunks;
+  NSUInteger	start = info->bounds[first];
+  NSUInteger	mid = info->bounds[first + info->runChunks];
+  NSUInteger	end = info->bounds[first + 2 * info->runChunks];
+  id		*a = info->src + start;
+  id		*b = info->src + mid;
+  NSUInteger	lenA = mid - start;
+  NSUInteger	lenB = end - mid;
+  NSUInteger	from = (lenA + lenB) * piece / info->pieces;
+  NSUInteger	to = (lenA + lenB) * (piece + 1) / info->pieces;
+  NSUInteger	i0 = coRank(info, from, a, lenA, b, lenB);
+  NSUInteger	i1 = coRank(info, to, a, lenA, b, lenB);
+
+  merge(info, a + i0, i1 - i0, b + (from - i0), (to - i1) - (from - i0),
+    info->dst + start + from);
+}
+
+/* Stable parallel merge sort.  The array is split into a power of two
+ * number of chunks which are sorted concurrently, then pairs of runs are
+ * merged concurrently until one run remains.
+ */
+static void
+parallelMergeSort(GSSortInfo *info, NSUInteger threads)
+{
+  NSUInteger	chunks = 1;
+  NSUInteger	i;
+
+  while (chunks < threads)
+    {
+      chunks *= 2;
+    }
+  info->chunks = chunks;
+  info->bounds = malloc(sizeof(NSUInteger) * (chunks + 1));
+  for (i = 0; i <= chunks; i++)
+    {
+      info->bounds[i] = info->count * i / chunks;
+    }
+  GSPrivateParallelApply(chunks, info, sortChunk);
+
+  info->src = info->buffer;
+  info->dst = info->temp;
+  for (info->runChunks = 1; info->runChunks < chunks; info->runChunks *= 2)
+    {
+      id	*t;
+
+      info->pieces = 2 * info->runChunks;
+      GSPrivateParallelApply(chunks, info, mergePiece);
+      t = info->src;
+      info->src = info->dst;
+      info->dst = t;
+    }
+  if (info->src != info->buffer)
+    {
+      memcpy(info->buffer, info->src, info->count * sizeof(id));
+    }
+  free(info->bounds);
+  info->bounds = 0;
+}
+
+/* Unstable introspective sort: quicksort with median of three pivots,
+ * falling back to heapsort when the recursion gets too deep and to
+ * insertion sort for small ranges.
+ */
+static void
+siftDown(GSSortInfo *info, id *a, NSUInteger root, NSUInteger count)
+{
+  id	o = a[root];
+
+  for (;;)
+    {
+      NSUInteger	child = 2 * root + 1;
+
+      if (child >= count)
+	{
+	  break;
+	}
+      if (child + 1 < count
+	&& compare(info, a[child], a[child + 1]) == NSOrderedAscending)
+	{
+	  child++;
+	}
+      if (compare(info, o, a[child]) != NSOrderedAscending)
+	{
+	  break;
+	}
+      a[root] = a[child];
+      root = child;
+    }
+  a[root] = o;
+}
+
+static void
+heapSort(GSSortInfo *info, id *a, NSUInteger count)
+{
+  NSUInteger	i;
+
+  for (i = count / 2; i > 0; i--)
+    {
+      siftDown(info, a, i - 1, count);
+    }
+  for (i = count - 1; i > 0; i--)
+    {
+      id	t = a[0];
+
+      a[0] = a[i];
+      a[i] = t;
+      siftDown(info, a, 0, i);
+    }
+}
+
+static void
+introSortLoop(GSSortInfo *info, id *a, NSUInteger count, NSUInteger depth)
+{
+  while (count > INSERTION_THRESHOLD)
+    {
+      NSUInteger	mid = count / 2;
+      NSUInteger	i;
+      NSUInteger	j;
+      id		pivot;
+      id		t;
+
+      if (0 == depth--)
+	{
+	  heapSort(info, a, count);
+	  return;
+	}
+
+      /* Order the first, middle and last objects, then use the median
+       * as the pivot.  The first and last objects then act as sentinels.
+       */
+      if (compare(info, a[mid], a[0]) == NSOrderedAscending)
+	{
+	  t = a[mid]; a[mid] = a[0]; a[0] = t;
+	}
+      if (compare(info, a[count - 1], a[mid]) == NSOrderedAscending)
+	{
+	  t = a[count - 1]; a[count - 1] = a[mid]; a[mid] = t;
+	  if (compare(info, a[mid], a[0]) == NSOrderedAscending)
+	    {
+	      t = a[mid]; a[mid] = a[0]; a[0] = t;
+	    }
+	}
+      pivot = a[mid];
+      i = 0;
+      j = count - 1;
+      for (;;)
+	{
+	  while (compare(info, a[++i], pivot) == NSOrderedAscending)
+	    ;
+	  while (compare(info, pivot, a[--j]) == NSOrderedAscending)
+	    ;
+	  if (i >= j)
+	    {
+	      break;
+	    }
+	  t = a[i]; a[i] = a[j]; a[j] = t;
+	}
+
+      /* Recurse into the smaller part and loop on the larger one to
+       * bound the stack depth.
+       */
+      if (i < count - i)
+	{
+	  introSortLoop(info, a, i, depth);
+	  a += i;
+	  count -= i;
+	}
+      else
+	{
+	  introSortLoop(info, a + i, count - i, depth);
+	  count = i;
+	}
+    }
+  insertionSort(info, a, count);
+}
+
+static void
+introSort(GSSortInfo *info, id *a, NSUInteger count)
+{
+  NSUInteger	depth = 0;
+  NSUInteger	n;
+
+  for (n = count; n > 1; n /= 2)
+    {
+      depth += 2;
+    }
+  introSortLoop(info, a, count, depth);
+}
+
+/* Return the bucket of an object.  There are buckets for the objects
+ * between each pair of splitters (even numbers) and for the objects equal
+ * to each splitter (odd numbers).  Equal buckets need no further sorting,
+ * which keeps arrays with many duplicates from producing huge buckets.
+ */
+static inline NSUInteger
+bucketFor(GSSortInfo *info, id o)
+{
+  NSUInteger	lo = 0;
+  NSUInteger	hi = info->nsplit;
+
+  while (lo < hi)
+    {
+      NSUInteger	m = (lo + hi) / 2;
+
+      if (compare(info, o, info->splitters[m]) == NSOrderedDescending)
+	{
+	  lo = m + 1;
+	}
+      else
+	{
+	  hi = m;
+	}
+    }
+  if (lo < info->nsplit
+    && compare(info, o, info->splitters[lo]) == NSOrderedSame)
+    {
+      return 2 * lo + 1;
+    }
+  return 2 * lo;
+}
+
+static void
+classifyBlock(void *context, NSUInteger index)
+{
+  GSSortInfo	*info = (GSSortInfo*)context;
+  NSUInteger	start = info->count * index / info->nblocks;
+  NSUInteger	end = info->count * (index + 1) / info->nblocks;
+  NSUInteger	*counts = info->offsets + index * info->nbuckets;
+  NSUInteger	i;
+
+  for (i = start; i < end; i++)
+    {
+      NSUInteger	b = bucketFor(info, info->buffer[i]);
+
+      info->bucketOf[i] = (uint16_t)b;
+      counts[b]++;
+    }
+}
+
+static void
+scatterBlock(void *context, NSUInteger index)
+{
+  GSSortInfo	*info = (GSSortInfo*)context;
+  NSUInteger	start = info->count * index / info->nblocks;
+  NSUInteger	end = info->count * (index + 1) / info->nblocks;
+  NSUInteger	*offsets = info->offsets + index * info->nbuckets;
+  NSUInteger	i;
+
+  for (i = start; i < end; i++)
+    {
+      info->temp[offsets[info->bucketOf[i]]++] = info->buffer[i];
+    }
+}
+
+static void
+sortBucket(void *context, NSUInteger index)
+{
+  GSSortInfo	*info = (GSSortInfo*)context;
+  NSUInteger	start = info->starts[index];
+  NSUInteger	count = info->starts[index + 1] - start;
+
+  memcpy(info->buffer + start, info->temp + start, count * sizeof(id));
+  if (0 == (index & 1))
+    {
+      introSort(info, info->buffer + start, count);
+    }
+}
+
+/* Unstable parallel samplesort.  Splitters are picked from a sorted
+ * sample of the array, then the objects are classified into buckets and
+ * moved to their final bucket concurrently, and finally the buckets are
+ * sorted concurrently.
+ */
+static void
+parallelSampleSort(GSSortInfo *info, NSUInteger threads)
+{
+  NSUInteger	want = 4 * threads;
+  NSUInteger	samples = want * OVERSAMPLE;
+  id		*sample;
+  NSUInteger	seed = 0x2545f491;
+  NSUInteger	total;
+  NSUInteger	b;
+  NSUInteger	i;
+
+  /* Sample with a fixed seed so that the result for a given input is
+   * repeatable.
+   */
+  sample = malloc(sizeof(id) * samples);
+  for (i = 0; i < samples; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      sample[i] = info->buffer[(seed >> 8) % info->count];
+    }
+  introSort(info, sample, samples);
+  info->splitters = malloc(sizeof(id) * want);
+  info->nsplit = 0;
+  for (i = OVERSAMPLE; i < samples; i += OVERSAMPLE)
+    {
+      if (0 == info->nsplit || compare(info,
+	info->splitters[info->nsplit - 1], sample[i]) == NSOrderedAscending)
+	{
+	  info->splitters[info->nsplit++] = sample[i];
+	}
+    }
+  free(sample);
+
+  info->nbuckets = 2 * info->nsplit + 1;
+  info->nblocks = 4 * threads;
+  info->bucketOf = malloc(sizeof(uint16_t) * info->count);
+  info->offsets = calloc(info->nblocks * info->nbuckets, sizeof(NSUInteger));
+  info->starts = malloc(sizeof(NSUInteger) * (info->nbuckets + 1));
+  GSPrivateParallelApply(info->nblocks, info, classifyBlock);
+
+  /* Turn the per block counts into the position in the scratch space at
+   * which each block places the objects in each bucket.
+   */
+  total = 0;
+  for (b = 0; b < info->nbuckets; b++)
+    {
+      info->starts[b] = total;
+      for (i = 0; i < info->nblocks; i++)
+	{
+	  NSUInteger	*o = info->offsets + i * info->nbuckets + b;
+	  NSUInteger	c = *o;
+
+	  *o = total;
+	  total += c;
+	}
+    }
+  info->starts[info->nbuckets] = total;
+
+  GSPrivateParallelApply(info->nblocks, info, scatterBlock);
+  GSPrivateParallelApply(info->nbuckets, info, sortBucket);
+
+  free(info->splitters);
+  free(info->bucketOf);
+  free(info->offsets);
+  free(info->starts);
+  info->splitters = 0;
+  info->bucketOf = 0;
+  info->offsets = 0;
+  info->starts = 0;
+}
+
+static void
+_GSParallelStableSort(id *buffer, NSRange range, id comparisonEntity,
+  GSComparisonType type, void *context)
+{
+  GSSortInfo	info;
+  NSUInteger	threads;
+
+  if (range.length < 2)
+    {
+      return;
+    }
+  memset(&info, '\0', sizeof(info));
+  info.buffer = buffer + range.location;
+  info.count = range.length;
+  info.entity = comparisonEntity;
+  info.type = type;
+  info.context = context;
+  info.temp = malloc(sizeof(id) * range.length);
+  if (0 == info.temp)
+    {
+      [NSException raise: NSMallocException
+		  format: @"Unable to allocate sort buffer"];
+    }
+  threads = GSPrivateParallelism();
+  NS_DURING
+    {
+      if (threads < 2 || range.length < PARALLEL_THRESHOLD)
+	{
+	  mergeSort(&info, info.buffer, info.temp, info.count);
+	}
+      else
+	{
+	  parallelMergeSort(&info, threads);
+	}
+    }
+  NS_HANDLER
+    {
+      free(info.bounds);
+      free(info.temp);
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  free(info.temp);
+}
+
+static void
+_GSParallelUnstableSort(id *buffer, NSRange range, id comparisonEntity,
+  GSComparisonType type, void *context)
+{
+  GSSortInfo	info;
+  NSUInteger	threads;
+
+  if (range.length < 2)
+    {
+      return;
+    }
+  memset(&info, '\0', sizeof(info));
+  info.buffer = buffer + range.location;
+  info.count = range.length;
+  info.entity = comparisonEntity;
+  info.type = type;
+  info.context = context;
+  threads = GSPrivateParallelism();
+  if (threads < 2 || range.length < PARALLEL_THRESHOLD)
+    {
+      introSort(&info, info.buffer, info.count);
+      return;
+    }
+  if (threads > 4096)
+    {
+      threads = 4096;	/* Keep bucket numbers within 16 bits.	*/
+    }
+  info.temp = malloc(sizeof(id) * range.length);
+  if (0 == info.temp)
+    {
+      [NSException raise: NSMallocException
+		  format: @"Unable to allocate sort buffer"];
+    }
+  NS_DURING
+    {
+      parallelSampleSort(&info, threads);
+    }
+  NS_HANDLER
+    {
+      free(info.splitters);
+      free(info.bucketOf);
+      free(info.offsets);
+      free(info.starts);
+      free(info.temp);
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  free(info.temp);
+}
+
+@interface GSParallelSortPlaceHolder : NSObject
+@end
+
+@implementation GSParallelSortPlaceHolder
++ (void) load
+{
+  _GSSortStableConcurrent = _GSParallelStableSort;
+  _GSSortUnstableConcurrent = _GSParallelUnstableSort;
+}
+@end
@@ -272,6 +272,7 @@ typedef enum {
 @class  NSRunLoop;
 @class  NSLock;
 @class  NSThread;
+@class  NSTimer;
 
 /* Used to handle events performed in one thread from another.
  */
@@ -407,6 +408,12 @@ void GSPrivateNotifyIdle(NSString *mode) GS_ATTRIB_PRIVATE;
  */
 BOOL GSPrivateNotifyMore(NSString *mode) GS_ATTRIB_PRIVATE;
 
+/* Function used by NSTimer to tell run loops that a timer has been
+ * invalidated (flag is YES) or has had its fire date moved earlier
+ * (flag is NO), so that they can tidy up or reorder their timers.
+ */
+void GSPrivateTimerChanged(NSTimer *t, BOOL invalidated) GS_ATTRIB_PRIVATE;
+
 /* Function to return the function for searching in a string for a range.
  */
 typedef NSRange (*GSRSFunc)(id, id, unsigned, NSRange);
@@ -517,28 +524,116 @@ GSPrivateIsCollectable(const void *ptr) GS_ATTRIB_PRIVATE;
 NSZone*
 GSAtomicMallocZone (void);
 
+/* Discards the accessors cached for key-value coding.  Called when
+ * GNUstep adds methods to (or replaces methods in) a class; changes made
+ * in other ways are found when a cached accessor is next used.
+ */
+void
+GSPrivateKVCFlush(void) GS_ATTRIB_PRIVATE;
+
+/* How key-value coding gets the value of a key from an object.
+ */
+typedef struct {
+  SEL		sel;		/* Accessor method or 0 for a variable.	*/
+  IMP		imp;		/* Implementation of the method.	*/
+  char		kind;		/* First character of the value type.	*/
+  const char	*type;		/* The type of a variable.		*/
+  unsigned	size;		/* The size of a variable.		*/
+  int		offset;		/* The offset of a variable.		*/
+} GSKVCAccessor;
+
+/* Finds the accessor method or instance variable which -valueForKey: of
+ * NSObject uses to get the value for key (a UTF-8 string of length bytes)
+ * from obj, using the same cache.  Returns YES if there is one, NO if the
+ * key is undefined or its method is forwarded.
+ */
+BOOL
+GSPrivateKVCGetter(id obj, const char *key, unsigned length,
+  GSKVCAccessor *a) GS_ATTRIB_PRIVATE;
+
 /* Generate a 32bit hash from supplied byte data.
  */
 uint32_t
 GSPrivateHash(uint32_t seed, const void *bytes, int length)
   GS_ATTRIB_PRIVATE;
 
-/* Incorporate 'l' bytes of data from the buffer pointed to by 'b' into
- * the hash state information pointed to by p0 and p1.
- * The hash state variables should have been initialised to zero before
- * the first call to this function, and the result should be produced
- * by calling the GSPrivateFinishHash() function.
+/* Generate a 32bit hash from 'count' UTF-16 characters.  This is the hash
+ * used for the contents of strings.
+ */
+uint32_t
+GSPrivateHashCharacters(uint32_t seed, const unichar *chars, int count)
+  GS_ATTRIB_PRIVATE;
+
+/* Generate a 32bit hash from 'count' 8-bit (ISO Latin-1) characters.
+ * The result is the same as that of GSPrivateHashCharacters() for the
+ * same characters stored as UTF-16, but the characters are not copied.
+ */
+uint32_t
+GSPrivateHashLatin1(uint32_t seed, const unsigned char *chars, int count)
+  GS_ATTRIB_PRIVATE;
+
+/* State for hashing characters which are not available all at once.
+ */
+typedef struct {
+  uint64_t	s0;
+  uint64_t	s1;
+  uint64_t	length;
+  unsigned	pending;
+  unichar	buffer[16];
+} GSPrivateHashState;
+
+/* Initialise the state for an incremental hash.
+ */
+void
+GSPrivateHashInit(GSPrivateHashState *state, uint32_t seed)
+  GS_ATTRIB_PRIVATE;
+
+/* Incorporate 'count' UTF-16 characters into the hash state.
  */
 void
-GSPrivateIncrementalHash(uint32_t *p0, uint32_t *p1, const void *b, int l)
+GSPrivateHashAddCharacters(GSPrivateHashState *state,
+  const unichar *chars, int count)
   GS_ATTRIB_PRIVATE;
 
-/* Generate a 32bit hash from supplied state variables resulting from
- * calls to the GSPrivateIncrementalHash() function.
+/* Generate a 32bit hash from the state resulting from calls to the
+ * GSPrivateHashAddCharacters() function.  This is the same as the
+ * value GSPrivateHashCharacters() would produce for all the characters
+ * and the seed given to GSPrivateHashInit().
  */
 uint32_t
-GSPrivateFinishHash(uint32_t s0, uint32_t s1, uint32_t totalLength)
+GSPrivateHashFinish(GSPrivateHashState *state)
   GS_ATTRIB_PRIVATE;
 
+/* Return the number of threads (including the calling thread) used by
+ * GSPrivateParallelApply() to run work concurrently.
+ */
+NSUInteger
+GSPrivateParallelism(void) GS_ATTRIB_PRIVATE;
+
+/* Call function(context, index) for each index from zero to count-1,
+ * running the calls concurrently on the shared pool of worker threads
+ * (or libdispatch where that is available) as well as the calling thread.
+ * Returns when all the calls have completed.  If any call raises an
+ * exception, the first such exception is raised again in the caller
+ * once all the calls have completed.
+ */
+void
+GSPrivateParallelApply(NSUInteger count, void *context,
+  void (*function)(void *context, NSUInteger index)) GS_ATTRIB_PRIVATE;
+
+/* Call test(context, position, stop) for each position from zero to
+ * count-1, splitting the positions into contiguous chunks which are run
+ * concurrently by GSPrivateParallelApply().  Each chunk records the
+ * positions for which test returned YES in a buffer of its own (so there
+ * is no locking), and the buffers are joined in position order once all
+ * the chunks are done.  No more positions are tested once *stop is YES.
+ * Returns a buffer (to be released with free()) of the positions found
+ * and sets *found to their number, or returns NULL if none were found.
+ */
+NSUInteger *
+GSPrivateParallelFilter(NSUInteger count, void *context,
+  BOOL (*test)(void *context, NSUInteger position, BOOL *stop),
+  BOOL *stop, NSUInteger *found) GS_ATTRIB_PRIVATE;
+
 #endif /* _GSPrivate_h_ */
 
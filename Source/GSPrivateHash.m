@@ -23,316 +23,426 @@
 
 #import "GSPrivate.h"
 
-uint32_t
-GSPrivateHash(uint32_t seed, const void *bytes, int length)
-{
-  uint32_t      carry = 0;
+#if	defined(__SSE2__)
+#include <emmintrin.h>
+#elif	(defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define	HASH_NEON	1
+#endif
 
-  GSPrivateIncrementalHash(&seed, &carry, bytes, length);
-  return GSPrivateFinishHash(seed, carry, length);
-}
- 
 #ifndef OLDHASH
-#define OLDHASH     1
+#define OLDHASH     0
 #endif
 
 #if     OLDHASH
 
 /* Very fast, simple hash.  Poor distribution properties though.
+ * Kept for comparison with the default hash.
  */
-void
-GSPrivateIncrementalHash(uint32_t *p0, uint32_t *p1, const void *b, int l)
+static inline uint32_t
+oldHash(uint32_t h, const uint8_t *b, unsigned l)
 {
   unsigned   i;
 
   for (i = 0; i < l; i++)
     {
-      *p0 = (*p0 << 5) + *p0 + ((const uint8_t*)b)[i];
+      h = (h << 5) + h + b[i];
     }
+  return h;
 }
 
 uint32_t
-GSPrivateFinishHash(uint32_t s0, uint32_t s1, uint32_t totalLength)
+GSPrivateHash(uint32_t seed, const void *bytes, int length)
 {
-  return s0;
+  return oldHash(seed, (const uint8_t*)bytes, length);
 }
 
-#else   /* OLDHASH */
-
-/*-----------------------------------------------------------------------------
- * MurmurHash3 was written by Austin Appleby, and is placed in the public
- * domain.
- *
- * This implementation was written by Shane Day, and is also public domain.
- *
- * This is a portable ANSI C implementation of MurmurHash3_x86_32 (Murmur3A)
- * with support for progressive processing.
- */
+uint32_t
+GSPrivateHashCharacters(uint32_t seed, const unichar *chars, int count)
+{
+  return oldHash(seed, (const uint8_t*)chars, count * sizeof(unichar));
+}
 
-/*-----------------------------------------------------------------------------
- 
-If you want to understand the MurmurHash algorithm you would be much better
-off reading the original source. Just point your browser at:
-http://code.google.com/p/smhasher/source/browse/trunk/MurmurHash3.cpp
+uint32_t
+GSPrivateHashLatin1(uint32_t seed, const unsigned char *chars, int count)
+{
+  int	i;
 
+  for (i = 0; i < count; i++)
+    {
+      unichar	u = chars[i];
 
-What this version provides?
+      seed = oldHash(seed, (const uint8_t*)&u, sizeof(u));
+    }
+  return seed;
+}
 
-1. Progressive data feeding. Useful when the entire payload to be hashed
-does not fit in memory or when the data is streamed through the application.
-Also useful when hashing a number of strings with a common prefix. A partial
-hash of a prefix string can be generated and reused for each suffix string.
+void
+GSPrivateHashInit(GSPrivateHashState *state, uint32_t seed)
+{
+  state->s0 = seed;
+}
 
-2. Portability. Plain old C so that it should compile on any old compiler.
-Both CPU endian and access-alignment neutral, but avoiding inefficient code
-when possible depending on CPU capabilities.
+void
+GSPrivateHashAddCharacters(GSPrivateHashState *state,
+  const unichar *chars, int count)
+{
+  state->s0 = oldHash((uint32_t)state->s0,
+    (const uint8_t*)chars, count * sizeof(unichar));
+}
 
-3. Drop in. I personally like nice self contained public domain code, making it
-easy to pilfer without loads of refactoring to work properly in the existing
-application code & makefile structure and mucking around with licence files.
-Just copy PMurHash.h and PMurHash.c and you're ready to go.
+uint32_t
+GSPrivateHashFinish(GSPrivateHashState *state)
+{
+  return (uint32_t)state->s0;
+}
 
+#else   /* OLDHASH */
 
-How does it work?
+/* A hash in the style of wyhash (by Wang Yi, public domain): each step
+ * multiplies two 64-bit words of the input, xored with constants and
+ * the running state, into a 128-bit product and folds its halves
+ * together.  This consumes 32 bytes per step (as two independent lanes
+ * so that the multiplies overlap) and every bit of the input affects
+ * every bit of the result.
+ *
+ * The input is treated as a sequence of little-endian 64-bit words.
+ * Strings are hashed as their UTF-16 characters, packed four to a word,
+ * and the functions which hash strings stored as 8-bit (ISO Latin-1)
+ * characters produce the same words by widening the characters in
+ * registers, so a string hashes to the same value whichever way it is
+ * stored, without copying it.
+ */
 
-We can only process entire 32 bit chunks of input, except for the very end
-that may be shorter. So along with the partial hash we need to give back to
-the caller a carry containing up to 3 bytes that we were unable to process.
-This carry also needs to record the number of bytes the carry holds. I use
-the low 2 bits as a count (0..3) and the carry bytes are shifted into the
-high byte in stream order.
+#define	P0	0xa0761d6478bd642fULL
+#define	P1	0xe7037ed1a0b428dbULL
+#define	P2	0x8ebc6af09c88c6e3ULL
+#define	P3	0x589965cc75374cc3ULL
+
+#if	defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
+#  if	__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#    define	HASH_LITTLE_ENDIAN	1
+#  endif
+#elif	defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) \
+  || defined(_M_X64)
+#  define	HASH_LITTLE_ENDIAN	1
+#endif
 
-To handle endianess I simply use a macro that reads a uint32_t and define
-that macro to be a direct read on little endian machines, a read and swap
-on big endian machines, or a byte-by-byte read if the endianess is unknown.
+static inline uint64_t
+mum(uint64_t a, uint64_t b)
+{
+#if	defined(__SIZEOF_INT128__)
+  __uint128_t	r = (__uint128_t)a * b;
 
------------------------------------------------------------------------------*/
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+  uint64_t	ha = a >> 32;
+  uint64_t	hb = b >> 32;
+  uint64_t	la = (uint32_t)a;
+  uint64_t	lb = (uint32_t)b;
+  uint64_t	rh = ha * hb;
+  uint64_t	rm0 = ha * lb;
+  uint64_t	rm1 = hb * la;
+  uint64_t	rl = la * lb;
+  uint64_t	t = rl + (rm0 << 32);
+  uint64_t	c = t < rl;
+  uint64_t	lo = t + (rm1 << 32);
+
+  c += lo < t;
+  return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
 
+/* Reads the word formed by n (at most 8) bytes.
+ */
+static inline uint64_t
+readBytes(const uint8_t *p, unsigned n)
+{
+#if	defined(HASH_LITTLE_ENDIAN)
+  if (8 == n)
+    {
+      uint64_t	w;
 
-/* MSVC warnings we choose to ignore */
-#if defined(_MSC_VER)
-  #pragma warning(disable: 4127) /* conditional expression is constant */
+      memcpy(&w, p, 8);
+      return w;
+    }
+  else
 #endif
+    {
+      uint64_t	w = 0;
 
-/*-----------------------------------------------------------------------------
- * Endianess, misalignment capabilities and util macros
- *
- * The following 3 macros are defined in this section. The other macros defined
- * are only needed to help derive these 3.
- *
- * READ_UINT32(x)   Read a little endian unsigned 32-bit int
- * UNALIGNED_SAFE   Defined if READ_UINT32 works on non-word boundaries
- * ROTL32(x,r)      Rotate x left by r bits
+      while (n-- > 0)
+	{
+	  w = (w << 8) | p[n];
+	}
+      return w;
+    }
+}
+
+/* Reads the word formed by n (at most 4) UTF-16 characters.
  */
+static inline uint64_t
+readChars(const unichar *p, unsigned n)
+{
+#if	defined(HASH_LITTLE_ENDIAN)
+  if (4 == n)
+    {
+      uint64_t	w;
 
-/* Convention is to define __BYTE_ORDER == to one of these values */
-#if !defined(__BIG_ENDIAN)
-  #define __BIG_ENDIAN 4321
-#endif
-#if !defined(__LITTLE_ENDIAN)
-  #define __LITTLE_ENDIAN 1234
+      memcpy(&w, p, 8);
+      return w;
+    }
+  else
 #endif
+    {
+      uint64_t	w = 0;
 
-/* I386 */
-#if defined(_M_IX86) || defined(__i386__) || defined(__i386) || defined(i386)
-  #define __BYTE_ORDER __LITTLE_ENDIAN
-  #define UNALIGNED_SAFE
-#endif
+      while (n-- > 0)
+	{
+	  w = (w << 16) | p[n];
+	}
+      return w;
+    }
+}
 
-/* gcc 'may' define __LITTLE_ENDIAN__ or __BIG_ENDIAN__ to 1 (Note the trailing __),
- * or even _LITTLE_ENDIAN or _BIG_ENDIAN (Note the single _ prefix) */
-#if !defined(__BYTE_ORDER)
-  #if defined(__LITTLE_ENDIAN__) && __LITTLE_ENDIAN__==1 || defined(_LITTLE_ENDIAN) && _LITTLE_ENDIAN==1
-    #define __BYTE_ORDER __LITTLE_ENDIAN
-  #elif defined(__BIG_ENDIAN__) && __BIG_ENDIAN__==1 || defined(_BIG_ENDIAN) && _BIG_ENDIAN==1
-    #define __BYTE_ORDER __BIG_ENDIAN
-  #endif
-#endif
+/* Reads the word formed by n (at most 4) 8-bit characters, widening each
+ * of them to 16 bits.
+ */
+static inline uint64_t
+readLatin1(const uint8_t *p, unsigned n)
+{
+  uint64_t	w;
 
-/* gcc (usually) defines xEL/EB macros for ARM and MIPS endianess */
-#if !defined(__BYTE_ORDER)
-  #if defined(__ARMEL__) || defined(__MIPSEL__)
-    #define __BYTE_ORDER __LITTLE_ENDIAN
-  #endif
-  #if defined(__ARMEB__) || defined(__MIPSEB__)
-    #define __BYTE_ORDER __BIG_ENDIAN
-  #endif
-#endif
+  if (4 == n)
+    {
+#if	defined(HASH_LITTLE_ENDIAN)
+      uint32_t	v;
 
-/* Now find best way we can to READ_UINT32 */
-#if __BYTE_ORDER==__LITTLE_ENDIAN
-  /* CPU endian matches murmurhash algorithm, so read 32-bit word directly */
-  #define READ_UINT32(ptr)   (*((uint32_t*)(ptr)))
-#elif __BYTE_ORDER==__BIG_ENDIAN
-  /* TODO: Add additional cases below where a compiler provided bswap32 is available */
-  #if defined(__GNUC__) && (__GNUC__>4 || (__GNUC__==4 && __GNUC_MINOR__>=3))
-    #define READ_UINT32(ptr)   (__builtin_bswap32(*((uint32_t*)(ptr))))
-  #else
-    /* Without a known fast bswap32 we're just as well off doing this */
-    #define READ_UINT32(ptr)   (ptr[0]|ptr[1]<<8|ptr[2]<<16|ptr[3]<<24)
-    #define UNALIGNED_SAFE
-  #endif
+      memcpy(&v, p, 4);
+      w = v;
 #else
-  /* Unknown endianess so last resort is to read individual bytes */
-  #define READ_UINT32(ptr)   (ptr[0]|ptr[1]<<8|ptr[2]<<16|ptr[3]<<24)
-
-  /* Since we're not doing word-reads we can skip the messing about with realignment */
-  #define UNALIGNED_SAFE
+      w = (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+	| ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 #endif
+    }
+  else
+    {
+      w = 0;
+      while (n-- > 0)
+	{
+	  w = (w << 8) | p[n];
+	}
+    }
+  w = (w | (w << 16)) & 0x0000ffff0000ffffULL;
+  w = (w | (w << 8)) & 0x00ff00ff00ff00ffULL;
+  return w;
+}
 
-/* Find best way to ROTL32 */
-#if defined(_MSC_VER)
-  #include <stdlib.h>  /* Microsoft put _rotl declaration in here */
-  #define ROTL32(x,r)  _rotl(x,r)
+/* Reads the four words formed by 16 8-bit characters.
+ */
+static inline void
+readLatin1Block(const uint8_t *p, uint64_t *w)
+{
+#if	defined(__SSE2__)
+  __m128i	v = _mm_loadu_si128((const __m128i*)(const void*)p);
+  __m128i	z = _mm_setzero_si128();
+
+  _mm_storeu_si128((__m128i*)(void*)w, _mm_unpacklo_epi8(v, z));
+  _mm_storeu_si128((__m128i*)(void*)(w + 2), _mm_unpackhi_epi8(v, z));
+#elif	defined(HASH_NEON) && defined(HASH_LITTLE_ENDIAN)
+  uint8x16_t	v = vld1q_u8(p);
+
+  vst1q_u16((uint16_t*)(void*)w, vmovl_u8(vget_low_u8(v)));
+  vst1q_u16((uint16_t*)(void*)(w + 2), vmovl_u8(vget_high_u8(v)));
 #else
-  /* gcc recognises this code and generates a rotate instruction for CPUs with one */
-  #define ROTL32(x,r)  (((uint32_t)x << r) | ((uint32_t)x >> (32 - r)))
+  w[0] = readLatin1(p, 4);
+  w[1] = readLatin1(p + 4, 4);
+  w[2] = readLatin1(p + 8, 4);
+  w[3] = readLatin1(p + 12, 4);
 #endif
+}
 
+static inline void
+start(GSPrivateHashState *state, uint32_t seed)
+{
+  state->s0 = mum(seed ^ P0, P1);
+  state->s1 = state->s0;
+  state->length = 0;
+  state->pending = 0;
+}
 
-/*-----------------------------------------------------------------------------
- * Core murmurhash algorithm macros */
-
-#define C1  (0xcc9e2d51)
-#define C2  (0x1b873593)
-
-/* This is the main processing body of the algorithm. It operates
- * on each full 32-bits of input. */
-#define DOBLOCK(h1, k1) do{ \
-        k1 *= C1; \
-        k1 = ROTL32(k1,15); \
-        k1 *= C2; \
-        \
-        h1 ^= k1; \
-        h1 = ROTL32(h1,13); \
-        h1 = h1*5+0xe6546b64; \
-    }while(0)
-
-
-/* Append unaligned bytes to carry, forcing hash churn if we have 4 bytes */
-/* cnt=bytes to process, h1=name of h1 var, c=carry, n=bytes in c, ptr/len=payload */
-#define DOBYTES(cnt, h1, c, n, ptr, len) do{ \
-    int _i = cnt; \
-    while(_i--) { \
-        c = c>>8 | *ptr++<<24; \
-        n++; len--; \
-        if(n==4) { \
-            DOBLOCK(h1, c); \
-            n = 0; \
-        } \
-    } }while(0)
-
-/*---------------------------------------------------------------------------*/
-
-/* Main hashing function. Initialise carry to 0 and h1 to 0 or an initial seed
- * if wanted. Both ph1 and pcarry are required arguments. */
-void
-GSPrivateIncrementalHash(
-  uint32_t *ph1, uint32_t *pcarry, const void *key, int len)
+static inline void
+block(GSPrivateHashState *state, const uint64_t *w)
 {
-  uint32_t h1 = *ph1;
-  uint32_t c = *pcarry;
-
-  const uint8_t *ptr = (uint8_t*)key;
-  const uint8_t *end;
-
-  /* Extract carry count from low 2 bits of c value */
-  int n = c & 3;
-
-#if defined(UNALIGNED_SAFE)
-  /* This CPU handles unaligned word access */
-
-  /* Consume any carry bytes */
-  int i = (4-n) & 3;
-  if(i && i <= len) {
-    DOBYTES(i, h1, c, n, ptr, len);
-  }
-
-  /* Process 32-bit chunks */
-  end = ptr + len/4*4;
-  for( ; ptr < end ; ptr+=4) {
-    uint32_t k1 = READ_UINT32(ptr);
-    DOBLOCK(h1, k1);
-  }
-
-#else /*UNALIGNED_SAFE*/
-  /* This CPU does not handle unaligned word access */
-
-  /* Consume enough so that the next data byte is word aligned */
-  int i = -(long)ptr & 3;
-  if(i && i <= len) {
-      DOBYTES(i, h1, c, n, ptr, len);
-  }
-
-  /* We're now aligned. Process in aligned blocks. Specialise for each possible carry count */
-  end = ptr + len/4*4;
-  switch(n) { /* how many bytes in c */
-  case 0: /* c=[----]  w=[3210]  b=[3210]=w            c'=[----] */
-    for( ; ptr < end ; ptr+=4) {
-      uint32_t k1 = READ_UINT32(ptr);
-      DOBLOCK(h1, k1);
+  state->s0 = mum(w[0] ^ P1, w[1] ^ state->s0);
+  state->s1 = mum(w[2] ^ P2, w[3] ^ state->s1);
+}
+
+/* Finishes a hash given the words formed by the last (at most 32) bytes
+ * of the input, of which there are n.
+ */
+static inline uint32_t
+finish(GSPrivateHashState *state, const uint64_t *w, unsigned n)
+{
+  uint64_t	s0 = state->s0;
+  uint64_t	a;
+  uint64_t	b;
+  uint64_t	h;
+
+  if (n > 16)
+    {
+      s0 = mum(w[0] ^ P1, w[1] ^ s0);
+      w += 2;
+      n -= 16;
+    }
+  a = (n > 0) ? w[0] : 0;
+  b = (n > 8) ? w[1] : 0;
+  h = mum(a ^ P1 ^ state->s1, b ^ s0 ^ P3);
+  h = mum(h ^ state->length ^ P0, P1);
+  return (uint32_t)(h ^ (h >> 32));
+}
+
+uint32_t
+GSPrivateHash(uint32_t seed, const void *bytes, int length)
+{
+  const uint8_t		*p = (const uint8_t*)bytes;
+  GSPrivateHashState	state;
+  uint64_t		w[4];
+  unsigned		n = (unsigned)length;
+  unsigned		i;
+
+  start(&state, seed);
+  state.length = n;
+  while (n > 32)
+    {
+      w[0] = readBytes(p, 8);
+      w[1] = readBytes(p + 8, 8);
+      w[2] = readBytes(p + 16, 8);
+      w[3] = readBytes(p + 24, 8);
+      block(&state, w);
+      p += 32;
+      n -= 32;
     }
-    break;
-  case 1: /* c=[0---]  w=[4321]  b=[3210]=c>>24|w<<8   c'=[4---] */
-    for( ; ptr < end ; ptr+=4) {
-      uint32_t k1 = c>>24;
-      c = READ_UINT32(ptr);
-      k1 |= c<<8;
-      DOBLOCK(h1, k1);
+  for (i = 0; i < 4; i++)
+    {
+      unsigned	c = (n > i * 8) ? n - i * 8 : 0;
+
+      w[i] = readBytes(p + i * 8, c < 8 ? c : 8);
     }
-    break;
-  case 2: /* c=[10--]  w=[5432]  b=[3210]=c>>16|w<<16  c'=[54--] */
-    for( ; ptr < end ; ptr+=4) {
-      uint32_t k1 = c>>16;
-      c = READ_UINT32(ptr);
-      k1 |= c<<16;
-      DOBLOCK(h1, k1);
+  return finish(&state, w, n);
+}
+
+uint32_t
+GSPrivateHashCharacters(uint32_t seed, const unichar *chars, int count)
+{
+  GSPrivateHashState	state;
+  uint64_t		w[4];
+  unsigned		n = (unsigned)count;
+  unsigned		i;
+
+  start(&state, seed);
+  state.length = n * sizeof(unichar);
+  while (n > 16)
+    {
+      w[0] = readChars(chars, 4);
+      w[1] = readChars(chars + 4, 4);
+      w[2] = readChars(chars + 8, 4);
+      w[3] = readChars(chars + 12, 4);
+      block(&state, w);
+      chars += 16;
+      n -= 16;
     }
-    break;
-  case 3: /* c=[210-]  w=[6543]  b=[3210]=c>>8|w<<24   c'=[654-] */
-    for( ; ptr < end ; ptr+=4) {
-      uint32_t k1 = c>>8;
-      c = READ_UINT32(ptr);
-      k1 |= c<<24;
-      DOBLOCK(h1, k1);
+  for (i = 0; i < 4; i++)
+    {
+      unsigned	c = (n > i * 4) ? n - i * 4 : 0;
+
+      w[i] = readChars(chars + i * 4, c < 4 ? c : 4);
     }
-  }
-#endif /*UNALIGNED_SAFE*/
+  return finish(&state, w, n * sizeof(unichar));
+}
 
-  /* Advance over whole 32-bit chunks, possibly leaving 1..3 bytes */
-  len -= len/4*4;
+uint32_t
+GSPrivateHashLatin1(uint32_t seed, const unsigned char *chars, int count)
+{
+  GSPrivateHashState	state;
+  uint64_t		w[4];
+  unsigned		n = (unsigned)count;
+  unsigned		i;
+
+  start(&state, seed);
+  state.length = n * sizeof(unichar);
+  while (n > 16)
+    {
+      readLatin1Block(chars, w);
+      block(&state, w);
+      chars += 16;
+      n -= 16;
+    }
+  for (i = 0; i < 4; i++)
+    {
+      unsigned	c = (n > i * 4) ? n - i * 4 : 0;
 
-  /* Append any remaining bytes into carry */
-  DOBYTES(len, h1, c, n, ptr, len);
+      w[i] = readLatin1(chars + i * 4, c < 4 ? c : 4);
+    }
+  return finish(&state, w, n * sizeof(unichar));
+}
 
-  /* Copy out new running hash and carry */
-  *ph1 = h1;
-  *pcarry = (c & ~0xff) | n;
-} 
+void
+GSPrivateHashInit(GSPrivateHashState *state, uint32_t seed)
+{
+  start(state, seed);
+}
 
-/*---------------------------------------------------------------------------*/
+void
+GSPrivateHashAddCharacters(GSPrivateHashState *state,
+  const unichar *chars, int count)
+{
+  unsigned	n = (unsigned)count;
+  uint64_t	w[4];
+
+  state->length += n * sizeof(unichar);
+  /* A block is only hashed once we know that more characters follow it,
+   * as the last (up to 16) characters are hashed by GSPrivateHashFinish().
+   */
+  while (n > 0)
+    {
+      unsigned	c;
+
+      if (16 == state->pending)
+	{
+	  w[0] = readChars(state->buffer, 4);
+	  w[1] = readChars(state->buffer + 4, 4);
+	  w[2] = readChars(state->buffer + 8, 4);
+	  w[3] = readChars(state->buffer + 12, 4);
+	  block(state, w);
+	  state->pending = 0;
+	}
+      c = 16 - state->pending;
+      if (c > n)
+	{
+	  c = n;
+	}
+      memcpy(state->buffer + state->pending, chars, c * sizeof(unichar));
+      state->pending += c;
+      chars += c;
+      n -= c;
+    }
+}
 
-/* Finalize a hash. To match the original Murmur3A the total_length must be provided */
 uint32_t
-GSPrivateFinishHash(uint32_t h, uint32_t carry, uint32_t total_length)
+GSPrivateHashFinish(GSPrivateHashState *state)
 {
-  uint32_t k1;
-  int n = carry & 3;
-  if(n) {
-    k1 = carry >> (4-n)*8;
-    k1 *= C1; k1 = ROTL32(k1,15); k1 *= C2; h ^= k1;
-  }
-  h ^= total_length;
-
-  /* fmix */
-  h ^= h >> 16;
-  h *= 0x85ebca6b;
-  h ^= h >> 13;
-  h *= 0xc2b2ae35;
-  h ^= h >> 16;
+  unsigned	n = state->pending;
+  uint64_t	w[4];
+  unsigned	i;
 
-  return h;
+  for (i = 0; i < 4; i++)
+    {
+      unsigned	c = (n > i * 4) ? n - i * 4 : 0;
+
+      w[i] = readChars(state->buffer + i * 4, c < 4 ? c : 4);
+    }
+  return finish(state, w, n * sizeof(unichar));
 }
 
 #endif  /* OLDHASH */
-
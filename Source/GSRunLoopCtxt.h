@@ -27,6 +27,7 @@
 
 #import "common.h"
 #import "Foundation/NSException.h"
+#import "Foundation/NSHashTable.h"
 #import "Foundation/NSMapTable.h"
 #import "Foundation/NSRunLoop.h"
 
@@ -54,8 +55,22 @@ typedef struct{
 #endif
 
 @class NSString;
+@class NSTimer;
 @class GSRunLoopWatcher;
 
+/* An entry in the heap of timers for a context.  The 'when' field is the
+ * fire date of the timer at the point when it was positioned in the heap,
+ * and the 'seq' field gives the order in which timers were added so that
+ * timers with the same date are fired in order of addition.  An entry
+ * whose 'seq' is not the one recorded for its timer in the context's
+ * timerMap is stale (the timer has been moved) and is discarded.
+ */
+typedef struct {
+  NSTimer		*timer;
+  NSTimeInterval	when;
+  unsigned		seq;
+} GSTimerHeapEntry;
+
 @interface	GSRunLoopCtxt : NSObject
 {
 @public
@@ -63,8 +78,13 @@ typedef struct{
   NSString	*mode;		/** The mode for this context.		*/
   GSIArray	performers;	/** The actions to perform regularly.	*/
   unsigned	maxPerformers;
-  GSIArray	timers;		/** The timers set for the runloop mode */
-  unsigned	maxTimers;
+  GSTimerHeapEntry *timers;	/** Heap of timers for the runloop mode */
+  unsigned	timerCount;	/** Number of timers in the heap	*/
+  unsigned	timerCapacity;	/** Allocated size of the heap		*/
+  unsigned	timerSerial;	/** Sequence number for next timer	*/
+  unsigned	timerMoves;	/** Reschedule count at last check	*/
+  unsigned	timerSweeps;	/** Invalidation count at last sweep	*/
+  NSMapTable	*timerMap;	/** Current heap entry seq of timers	*/
   GSIArray	watchers;	/** The inputs set for the runloop mode */
   unsigned	maxWatchers;
   NSTimer	*housekeeper;	/** Housekeeping timer for loop.	*/
@@ -85,6 +105,19 @@ typedef struct{
   unsigned int	pollfds_count;
   struct pollfd	*pollfds;
 #endif
+#ifdef	HAVE_EPOLL
+  int		_epfd;		// The epoll instance for this mode.
+  NSMapTable	*_efdStatic;	// Persistent watchers by descriptor ...
+  NSMapTable	*_rfdStatic;	// ... always registered with the epoll
+  NSMapTable	*_wfdStatic;	// ... instance while they are present.
+  GSIArray	_dynamic;	// Watchers to be checked at each poll.
+  NSMapTable	*_epollWant;	// Events wanted by dynamic watchers.
+  NSMapTable	*_epollHad;	// Ditto at the previous poll.
+  NSMapTable	*_epollMask;	// Events registered with _epfd.
+  NSMapTable	*_epollFiles;	// Descriptors epoll can't handle.
+  unsigned	_epollCapacity;
+  struct epoll_event	*_epollEvents;
+#endif
 }
 /* Check to see of the thread has been awakened, blocking until it
  * does get awakened or until the limit date has been reached.
@@ -92,6 +125,13 @@ typedef struct{
  * immediate return.
  */
 + (BOOL) awakenedBefore: (NSDate*)when;
+#ifdef	HAVE_EPOLL
+/* Tell the context about a watcher added to/removed from its mode, so
+ * it can update the set of descriptors registered with epoll.
+ */
+- (void) addWatcher: (GSRunLoopWatcher*)watcher;
+- (void) removeWatcher: (GSRunLoopWatcher*)watcher;
+#endif
 - (void) endEvent: (void*)data
               for: (GSRunLoopWatcher*)watcher;
 - (void) endPoll;
@@ -438,6 +438,7 @@ static NSArray  *keys = nil;
         GSTLSPriority,
         GSTLSRemoteHosts,
         GSTLSRevokeFile,
+        GSTLSServerAddress,
         GSTLSVerify,
         nil];
     }
@@ -517,7 +518,9 @@ static NSArray  *keys = nil;
   NSUInteger            count;
   BOOL		        server;
 
-  server = [[o propertyForKey: @"IsServer"] boolValue];
+  str = [o propertyForKey: @"IsServer"];
+  if (nil == str) str = [i propertyForKey: @"IsServer"];
+  server = [str boolValue];
 
   str = [o propertyForKey: NSStreamSocketSecurityLevelKey];
   if (nil == str) str = [i propertyForKey: NSStreamSocketSecurityLevelKey];
@@ -567,7 +570,37 @@ static NSArray  *keys = nil;
       if (nil == str) str = [i propertyForKey: key];
       if (nil != str) [opts setObject: str forKey: key];
     }
-  
+
+  /* Identify the server we are connecting to, so that the session can
+   * resume an earlier one with the same server.  If we went through a
+   * SOCKS proxy the remote address and port have been set as properties,
+   * otherwise we use the address we are connecting to.
+   */
+  if (NO == server && nil == [opts objectForKey: GSTLSServerAddress])
+    {
+      NSString          *h = [i propertyForKey: GSStreamRemoteAddressKey];
+      NSString          *p = [i propertyForKey: GSStreamRemotePortKey];
+      struct sockaddr   *sa = [i _address];
+
+      if (nil != h && nil != p)
+        {
+          str = [NSString stringWithFormat: @"%@:%@", h, p];
+        }
+      else if (AF_INET == sa->sa_family
+#if     defined(AF_INET6)
+        || AF_INET6 == sa->sa_family
+#endif
+        )
+        {
+          str = GSPrivateSockaddrName(sa);
+        }
+      else
+        {
+          str = nil;
+        }
+      if (nil != str) [opts setObject: str forKey: GSTLSServerAddress];
+    }
+
   session = [[GSTLSSession alloc] initWithOptions: opts
                                         direction: (server ? NO : YES)
                                         transport: (void*)self
@@ -681,6 +714,19 @@ static NSArray  *keys = nil;
 
 #endif   /* HAVE_GNUTLS */
 
+@implementation NSStream (GSTLSSessionCache)
+
++ (NSDictionary*) tlsSessionStatistics
+{
+#if     defined(HAVE_GNUTLS)
+  return [GSTLSSession resumptionStatistics];
+#else
+  return [NSDictionary dictionary];
+#endif
+}
+
+@end
+
 
 
 /*
@@ -1587,7 +1633,16 @@ setNonBlocking(SOCKET fd)
   if ([self _isOpened])
     return;
   if (_passive || (_sibling && [_sibling _isOpened]))
-    goto open_ok;
+    {
+      /* A stream accepted by a server stream may have had TLS/SSL
+       * properties set before it was opened.
+       */
+      if (_passive && _handler == nil)
+        {
+          [GSTLSHandler tryInput: self output: _sibling];
+        }
+      goto open_ok;
+    }
   // check sibling status, avoid double connect
   if (_sibling && [_sibling streamStatus] == NSStreamStatusOpening)
     {
@@ -2058,7 +2113,16 @@ setNonBlocking(SOCKET fd)
   if ([self _isOpened])
     return;
   if (_passive || (_sibling && [_sibling _isOpened]))
-    goto open_ok;
+    {
+      /* A stream accepted by a server stream may have had TLS/SSL
+       * properties set before it was opened.
+       */
+      if (_passive && _handler == nil)
+        {
+          [GSTLSHandler tryInput: _sibling output: self];
+        }
+      goto open_ok;
+    }
   // check sibling status, avoid double connect
   if (_sibling && [_sibling streamStatus] == NSStreamStatusOpening)
     {
@@ -3376,41 +3376,29 @@ transmute(GSStr self, NSString *aString)
 	{
 	  if (self->_flags.wide)
 	    {
-	      const unichar	*p = self->_contents.u;
-
-              ret = GSPrivateHash(0, p, len * sizeof(unichar));
+              ret = GSPrivateHashCharacters(0, self->_contents.u, len);
 	    }
-	  else if (len > 64)
-            {
-              return (self->_flags.hash = [super hash]);
-            }
           else
 	    {
-              unichar                   buf[64];
-              unsigned	                index;
 	      const unsigned char	*p = self->_contents.c;
 
-	      if (internalEncoding == NSISOLatin1StringEncoding)
-		{
-                  for (index = 0; index < len; index++)
-                    {
-                      buf[index] = p[index];
-                    }
-                }
-	      else
+	      /* Characters in the internal encoding are the same as their
+	       * unicode values if the encoding is ISO Latin-1 or they are
+	       * all ASCII, so the bytes can be hashed as they are.
+	       */
+	      if (internalEncoding != NSISOLatin1StringEncoding)
 		{
+                  unsigned	index;
+
                   for (index = 0; index < len; index++)
                     {
-		      unichar	u = p[index];
-
-                      if (u > 127)
+                      if (p[index] > 127)
                         {
                           return (self->_flags.hash = [super hash]);
                         }
-                      buf[index] = u;
                     }
 		}
-              ret = GSPrivateHash(0, buf, len * sizeof(unichar));
+              ret = GSPrivateHashLatin1(0, p, len);
 	    }
 
 	  /*
@@ -5549,22 +5537,20 @@ literalIsEqual(NXConstantString *self, id anObject)
 {
   if (nxcslen > 0)
     {
-      uint32_t  s0 = 0;
-      uint32_t  s1 = 0;
-      unichar   chunk[64];
-      uint32_t	ret;
-      unichar	n = 0;
-      unsigned	i = 0;
-      int       l = 0;
-      uint32_t  t = 0;
+      GSPrivateHashState	state;
+      unichar   		chunk[64];
+      uint32_t			ret;
+      unichar			n = 0;
+      unsigned			i = 0;
+      int       		l = 0;
 
+      GSPrivateHashInit(&state, 0);
       while (i < nxcslen)
 	{
 	  chunk[l++] = nextUTF8((const uint8_t *)nxcsptr, nxcslen, &i, &n);
 	  if (64 == l)
             {
-              GSPrivateIncrementalHash(&s0, &s1, chunk, l * sizeof(unichar));
-              t += l;
+              GSPrivateHashAddCharacters(&state, chunk, l);
               l = 0;
             }
 	}
@@ -5574,10 +5560,9 @@ literalIsEqual(NXConstantString *self, id anObject)
 	}
       if (l > 0)
         {
-          GSPrivateIncrementalHash(&s0, &s1, chunk, l * sizeof(unichar));
-          t += l;
+          GSPrivateHashAddCharacters(&state, chunk, l);
         }
-      ret = GSPrivateFinishHash(s0, s1, t * sizeof(unichar));
+      ret = GSPrivateHashFinish(&state);
       ret &= 0x0fffffff;
       if (ret == 0)
 	{
@@ -36,6 +36,7 @@ extern NSString * const GSTLSDebug;
 extern NSString * const GSTLSPriority;
 extern NSString * const GSTLSRemoteHosts;
 extern NSString * const GSTLSRevokeFile;
+extern NSString * const GSTLSServerAddress;
 extern NSString * const GSTLSVerify;
 
 #if     defined(HAVE_GNUTLS)
@@ -159,6 +160,7 @@ typedef ssize_t (*GSTLSIOW)(gnutls_transport_ptr_t, const void *, size_t);
   BOOL                                  handshake;
   BOOL                                  setup;
   BOOL                                  debug;
+  BOOL                                  cacheable;
 @public
   gnutls_session_t                      session;
 }
@@ -185,6 +187,10 @@ typedef ssize_t (*GSTLSIOW)(gnutls_transport_ptr_t, const void *, size_t);
 
 /* Try to complete a handshake ... return YES if complete, NO if we need
  * to try again (would have to wait for the remote end).<br />
+ * An outgoing session with the GSTLSServerAddress option resumes any
+ * session cached for the same server and options (so the handshake is
+ * abbreviated), and an incoming session may be resumed by a client
+ * presenting a session ticket or a session ID we issued.
  */
 - (BOOL) handshake;
 
@@ -197,6 +203,17 @@ typedef ssize_t (*GSTLSIOW)(gnutls_transport_ptr_t, const void *, size_t);
  */
 - (NSInteger) read: (void*)buf length: (NSUInteger)len;
 
+/* Return YES if the handshake resumed an earlier session rather than
+ * negotiating a new one.
+ */
+- (BOOL) resumed;
+
+/* Return counts of handshakes which resumed an earlier session and
+ * which negotiated a new one, for outgoing (client) and incoming (server)
+ * sessions, along with the number of sessions currently cached.
+ */
++ (NSDictionary*) resumptionStatistics;
+
 /** Get a report of the SSL/TLS status of the current session.
  */
 - (NSString*) sessionInfo;
@@ -36,6 +36,7 @@
 #import "Foundation/NSStream.h"
 #import "Foundation/NSThread.h"
 #import "Foundation/NSUserDefaults.h"
+#import "Foundation/NSValue.h"
 
 #import "GSTLS.h"
 
@@ -51,6 +52,7 @@ NSString * const GSTLSDebug = @"GSTLSDebug";
 NSString * const GSTLSPriority = @"GSTLSPriority";
 NSString * const GSTLSRemoteHosts = @"GSTLSRemoteHosts";
 NSString * const GSTLSRevokeFile = @"GSTLSRevokeFile";
+NSString * const GSTLSServerAddress = @"GSTLSServerAddress";
 NSString * const GSTLSVerify = @"GSTLSVerify";
 
 
@@ -1198,8 +1200,197 @@ static NSMutableDictionary      *credentialsCache = nil;
 
 
 
+/* The client session cache maps the options of an outgoing session
+ * (including the GSTLSServerAddress of the server) to the data needed
+ * to resume a session with that server using the same options.
+ * The server session cache maps the IDs of sessions we have issued to
+ * their data, for clients which resume by session ID rather than by
+ * presenting a session ticket.
+ * Each entry is an array of the data and the time it was stored, and is
+ * purged once it is older than sessionLifetime.
+ */
+static NSLock                   *sessionLock = nil;
+static NSMutableDictionary      *clientSessions = nil;
+static NSMutableDictionary      *serverSessions = nil;
+static NSTimeInterval           sessionLifetime = 3600.0;
+static NSUInteger               sessionMaximum = 1000;
+static NSUInteger               clientResumed = 0;
+static NSUInteger               clientFull = 0;
+static NSUInteger               serverResumed = 0;
+static NSUInteger               serverFull = 0;
+#if GNUTLS_VERSION_NUMBER >= 0x020A00
+static gnutls_datum_t           ticketKey = { 0, 0 };
+#endif
+
+/* Store session data in a cache.  Must be called with sessionLock held.
+ */
+static void
+cacheStore(NSMutableDictionary *cache, id key, NSData *data)
+{
+  NSArray       *a;
+
+  if ([cache count] >= sessionMaximum && nil == [cache objectForKey: key])
+    {
+      /* Full ... discard an arbitrary entry to make room.
+       */
+      [cache removeObjectForKey: [[cache keyEnumerator] nextObject]];
+    }
+  a = [[NSArray alloc] initWithObjects: data,
+    [NSNumber numberWithDouble: [NSDate timeIntervalSinceReferenceDate]],
+    nil];
+  [cache setObject: a forKey: key];
+  [a release];
+}
+
+/* Fetch session data from a cache, or nil if there is none or it is too
+ * old to use.  Must be called with sessionLock held.
+ */
+static NSData *
+cacheFetch(NSMutableDictionary *cache, id key)
+{
+  NSArray       *a = [cache objectForKey: key];
+
+  if (nil != a)
+    {
+      NSTimeInterval    when = [[a objectAtIndex: 1] doubleValue];
+
+      if ([NSDate timeIntervalSinceReferenceDate] - when < sessionLifetime)
+        {
+          return [[[a objectAtIndex: 0] retain] autorelease];
+        }
+      [cache removeObjectForKey: key];
+    }
+  return nil;
+}
+
+/* Remove old entries from a cache.  Must be called with sessionLock held.
+ */
+static void
+cachePurge(NSMutableDictionary *cache, NSTimeInterval now)
+{
+  NSEnumerator  *enumerator;
+  id            key;
+
+  enumerator = [[cache allKeys] objectEnumerator];
+  while (nil != (key = [enumerator nextObject]))
+    {
+      NSArray   *a = [cache objectForKey: key];
+
+      if (now - [[a objectAtIndex: 1] doubleValue] >= sessionLifetime)
+        {
+          [cache removeObjectForKey: key];
+        }
+    }
+}
+
+/* Functions used by gnutls to store, retrieve and remove the data of
+ * server sessions by session ID.
+ */
+static int
+serverStore(void *ptr, gnutls_datum_t key, gnutls_datum_t data)
+{
+  NSData        *k;
+  NSData        *d;
+
+  k = [[NSData alloc] initWithBytes: key.data length: key.size];
+  d = [[NSData alloc] initWithBytes: data.data length: data.size];
+  [sessionLock lock];
+  cacheStore(serverSessions, k, d);
+  [sessionLock unlock];
+  [k release];
+  [d release];
+  return 0;
+}
+
+static gnutls_datum_t
+serverRetrieve(void *ptr, gnutls_datum_t key)
+{
+  gnutls_datum_t        result = { 0, 0 };
+  NSData                *k;
+  NSData                *d;
+
+  k = [[NSData alloc] initWithBytesNoCopy: key.data
+                                   length: key.size
+                             freeWhenDone: NO];
+  [sessionLock lock];
+  d = cacheFetch(serverSessions, k);
+  if (nil != d && (result.data = gnutls_malloc([d length])) != 0)
+    {
+      memcpy(result.data, [d bytes], [d length]);
+      result.size = [d length];
+    }
+  [sessionLock unlock];
+  [k release];
+  return result;
+}
+
+static int
+serverRemove(void *ptr, gnutls_datum_t key)
+{
+  NSData        *k;
+
+  k = [[NSData alloc] initWithBytesNoCopy: key.data
+                                   length: key.size
+                             freeWhenDone: NO];
+  [sessionLock lock];
+  [serverSessions removeObjectForKey: k];
+  [sessionLock unlock];
+  [k release];
+  return 0;
+}
+
 @implementation GSTLSSession
 
+/* Method to purge older sessions from the caches.
+ */
++ (void) housekeeping: (NSNotification*)n
+{
+  NSTimeInterval        now;
+
+  now = [NSDate timeIntervalSinceReferenceDate];
+  [sessionLock lock];
+  cachePurge(clientSessions, now);
+  cachePurge(serverSessions, now);
+  [sessionLock unlock];
+}
+
++ (void) initialize
+{
+  if (nil == sessionLock)
+    {
+      sessionLock = [NSLock new];
+      clientSessions = [NSMutableDictionary new];
+      serverSessions = [NSMutableDictionary new];
+#if GNUTLS_VERSION_NUMBER >= 0x020A00
+      /* The key used to encrypt the session tickets we issue as a server.
+       * It lasts for the life of the process.
+       */
+      gnutls_session_ticket_key_generate(&ticketKey);
+#endif
+
+      [[NSNotificationCenter defaultCenter] addObserver: self
+	selector: @selector(housekeeping:)
+	name: @"GSHousekeeping" object: nil];
+    }
+}
+
++ (NSDictionary*) resumptionStatistics
+{
+  NSDictionary  *d;
+
+  [sessionLock lock];
+  d = [NSDictionary dictionaryWithObjectsAndKeys:
+    [NSNumber numberWithUnsignedInteger: clientResumed], @"clientResumed",
+    [NSNumber numberWithUnsignedInteger: clientFull], @"clientFull",
+    [NSNumber numberWithUnsignedInteger: serverResumed], @"serverResumed",
+    [NSNumber numberWithUnsignedInteger: serverFull], @"serverFull",
+    [NSNumber numberWithUnsignedInteger:
+      [clientSessions count] + [serverSessions count]], @"cached",
+    nil];
+  [sessionLock unlock];
+  return d;
+}
+
 + (GSTLSSession*) sessionWithOptions: (NSDictionary*)options
                            direction: (BOOL)isOutgoing
                            transport: (void*)handle
@@ -1230,10 +1421,46 @@ static NSMutableDictionary      *credentialsCache = nil;
   [super dealloc];
 }
 
+/* Store the data needed to resume this (active, outgoing) session in the
+ * client session cache.  Under TLS 1.3 the data only exists once the
+ * server has sent a session ticket, which may be after the handshake,
+ * so this is done again when the session is disconnected.
+ */
+- (void) _storeSession
+{
+  gnutls_datum_t        data;
+
+  if (NO == cacheable || NO == active)
+    {
+      return;
+    }
+#if GNUTLS_VERSION_NUMBER >= 0x030603
+  if (GNUTLS_TLS1_3 == gnutls_protocol_get_version(session)
+    && 0 == (gnutls_session_get_flags(session) & GNUTLS_SFLAGS_SESSION_TICKET))
+    {
+      return;
+    }
+#endif
+  if (gnutls_session_get_data2(session, &data) == 0)
+    {
+      NSData    *d;
+
+      d = [[NSData alloc] initWithBytes: data.data length: data.size];
+      gnutls_free(data.data);
+      [sessionLock lock];
+      cacheStore(clientSessions, opts, d);
+      [sessionLock unlock];
+      [d release];
+    }
+}
+
 - (void) disconnect
 {
+  BOOL  wasActive = active;
+
   if (YES == active || YES == handshake)
     {
+      [self _storeSession];
       active = NO;
       handshake = NO;
       gnutls_bye(session, GNUTLS_SHUT_RDWR);
@@ -1241,7 +1468,12 @@ static NSMutableDictionary      *credentialsCache = nil;
   if (YES == setup)
     {
       setup = NO;
-      gnutls_db_remove_session(session);
+      /* A session which was never established must not be resumed.
+       */
+      if (NO == wasActive)
+        {
+          gnutls_db_remove_session(session);
+        }
       gnutls_deinit(session);
     }
 }
@@ -1306,6 +1538,18 @@ static NSMutableDictionary      *credentialsCache = nil;
       else
         {
           gnutls_init(&session, GNUTLS_SERVER);
+
+          /* Let clients resume sessions by ID or by session ticket.
+           */
+          gnutls_db_set_retrieve_function(session, serverRetrieve);
+          gnutls_db_set_store_function(session, serverStore);
+          gnutls_db_set_remove_function(session, serverRemove);
+#if GNUTLS_VERSION_NUMBER >= 0x020A00
+          if (ticketKey.size > 0)
+            {
+              gnutls_session_ticket_enable_server(session, &ticketKey);
+            }
+#endif
           if (NO == verify)
             {
               /* We don't want to request/verify the client certificate,
@@ -1444,6 +1688,23 @@ static NSMutableDictionary      *credentialsCache = nil;
       gnutls_transport_set_pull_function(session, pullFunc);
       gnutls_transport_set_push_function(session, pushFunc);
       gnutls_transport_set_ptr(session, (gnutls_transport_ptr_t)handle);
+
+      /* If we know which server we are connecting to, try to resume an
+       * earlier session with it (made with the same options).
+       */
+      if (YES == outgoing && nil != [opts objectForKey: GSTLSServerAddress])
+        {
+          NSData        *d;
+
+          cacheable = YES;
+          [sessionLock lock];
+          d = cacheFetch(clientSessions, opts);
+          [sessionLock unlock];
+          if (nil != d)
+            {
+              gnutls_session_set_data(session, [d bytes], [d length]);
+            }
+        }
     }
 
   return self;
@@ -1489,6 +1750,14 @@ static NSMutableDictionary      *credentialsCache = nil;
               ASSIGN(problem, p);
               NSLog(@"%@", p);
             }
+          if (YES == cacheable)
+            {
+              /* Don't try to resume the session with this server again.
+               */
+              [sessionLock lock];
+              [clientSessions removeObjectForKey: opts];
+              [sessionLock unlock];
+            }
           [self disconnect];
           return YES;   // Failed ... not active.
         }
@@ -1505,6 +1774,17 @@ static NSMutableDictionary      *credentialsCache = nil;
       active = YES;     // The TLS session is now active.
       handshake = NO;   // Handshake is over.
 
+      [sessionLock lock];
+      if (YES == [self resumed])
+        {
+          if (YES == outgoing) clientResumed++; else serverResumed++;
+        }
+      else
+        {
+          if (YES == outgoing) clientFull++; else serverFull++;
+        }
+      [sessionLock unlock];
+
       if (YES == outgoing)
         {
           shouldVerify = verifyServer;  // Verify remote server certificate?
@@ -1535,9 +1815,14 @@ static NSMutableDictionary      *credentialsCache = nil;
                     gnutls_strerror(ret));
                   NSLog(@"%@", [self sessionInfo]);
                 }
+              /* Make sure the session can't be resumed.
+               */
+              cacheable = NO;
+              gnutls_db_remove_session(session);
               [self disconnect];
             }
         }
+      [self _storeSession];
       return YES;       // Handshake complete
     }
 }
@@ -1552,6 +1837,15 @@ static NSMutableDictionary      *credentialsCache = nil;
   return gnutls_record_recv(session, buf, len);
 }
 
+- (BOOL) resumed
+{
+  if (YES == active && gnutls_session_is_resumed(session) != 0)
+    {
+      return YES;
+    }
+  return NO;
+}
+
 - (NSInteger) write: (const void*)buf length: (NSUInteger)len
 {
   return gnutls_record_send(session, buf, len);
@@ -1573,6 +1867,11 @@ static NSMutableDictionary      *credentialsCache = nil;
   dhe = ecdh = 0;
   str = [NSMutableString stringWithCapacity: 2000];
 
+  if (YES == [self resumed])
+    {
+      [str appendString: _(@"- Session resumed\n")];
+    }
+
   /* get the key exchange's algorithm name
    */
   kx = gnutls_kx_get(session);
@@ -0,0 +1,401 @@
+/* GSWorkerPool.m
+   Copyright (C) 2026 Free Software Foundation, Inc.
+
+   This file is part of the GNUstep Base Library.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free
+   Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+   MA 02111 USA.
+*/
+
+#import "common.h"
+#import "Foundation/NSAutoreleasePool.h"
+#import "Foundation/NSException.h"
+#import "Foundation/NSProcessInfo.h"
+#import "Foundation/NSThread.h"
+#import "GSPrivate.h"
+
+#include <pthread.h>
+
+#if	(GS_USE_LIBDISPATCH == 1) \
+  && (defined(HAVE_DISPATCH_H) || defined(HAVE_DISPATCH_DISPATCH_H))
+#  if	defined(HAVE_DISPATCH_H)
+#    include <dispatch.h>
+#  else
+#    include <dispatch/dispatch.h>
+#  endif
+#  define	USE_DISPATCH	1
+#endif
+
+/* A piece of work passed to GSPrivateParallelApply().
+ * The job is on the stack of the thread which submitted it, and is in
+ * the queue of jobs until all its indexes have been claimed.  The 'users'
+ * count (protected by poolLock) is the number of worker threads which
+ * may still refer to it, so the submitting thread must wait for that
+ * to drop to zero before returning.
+ */
+typedef struct GSWorkJob {
+  struct GSWorkJob	*next;
+  void			(*function)(void *context, NSUInteger index);
+  void			*context;
+  NSUInteger		count;
+  NSUInteger		claimed;	/* Next index to run.		*/
+  NSUInteger		finished;	/* Number of indexes run.	*/
+  NSUInteger		users;		/* Workers using the job.	*/
+  NSException		*exception;	/* First exception raised.	*/
+} GSWorkJob;
+
+static pthread_mutex_t	poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	workCond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	doneCond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t	poolOnce = PTHREAD_ONCE_INIT;
+static GSWorkJob	*jobs = 0;
+static NSUInteger	parallelism = 1;
+#if	defined(USE_DISPATCH)
+static BOOL		useDispatch = NO;
+#endif
+
+/* Run one index of a job, recording (rather than propagating) any
+ * exception so that the worker thread survives it.
+ */
+static void
+runIndex(GSWorkJob *job, NSUInteger index)
+{
+  void	*pool = GSAutoreleasePoolPush();
+
+  NS_DURING
+    {
+      (*job->function)(job->context, index);
+    }
+  NS_HANDLER
+    {
+      RETAIN(localException);
+      if (NO == __sync_bool_compare_and_swap(&job->exception,
+	(NSException*)nil, localException))
+	{
+	  RELEASE(localException);
+	}
+    }
+  NS_ENDHANDLER
+  GSAutoreleasePoolPop(pool);
+  __sync_add_and_fetch(&job->finished, 1);
+}
+
+/* Claim and run indexes of the job until there are none left.
+ */
+static void
+runJob(GSWorkJob *job)
+{
+  NSUInteger	index;
+
+  while ((index = __sync_fetch_and_add(&job->claimed, 1)) < job->count)
+    {
+      runIndex(job, index);
+    }
+}
+
+@interface	GSWorkerPool : NSObject
++ (void) _work: (id)ignored;
+@end
+
+@implementation	GSWorkerPool
++ (void) _work: (id)ignored
+{
+  pthread_mutex_lock(&poolLock);
+  for (;;)
+    {
+      GSWorkJob	*job;
+
+      while (0 == (job = jobs))
+	{
+	  pthread_cond_wait(&workCond, &poolLock);
+	}
+      if (__sync_add_and_fetch(&job->claimed, 0) >= job->count)
+	{
+	  /* Every index has been claimed, so take the job off the queue.
+	   */
+	  jobs = job->next;
+	  job->next = 0;
+	  continue;
+	}
+      job->users++;
+      pthread_mutex_unlock(&poolLock);
+      runJob(job);
+      pthread_mutex_lock(&poolLock);
+      if (0 == --job->users)
+	{
+	  pthread_cond_broadcast(&doneCond);
+	}
+    }
+}
+@end
+
+#if	defined(USE_DISPATCH)
+static void
+dispatchIndex(void *context, size_t index)
+{
+  runIndex((GSWorkJob*)context, (NSUInteger)index);
+}
+#endif
+
+/* Work out how many threads to use and start the workers.
+ * The GNUSTEP_WORKER_THREADS environment variable may be used to set the
+ * number of threads (including the calling thread) used for parallel work,
+ * in which case the built-in pool is used even if libdispatch is available.
+ */
+static void
+poolStart(void)
+{
+  const char	*env = getenv("GNUSTEP_WORKER_THREADS");
+  NSUInteger	i;
+
+  if (env != 0 && atoi(env) > 0)
+    {
+      parallelism = atoi(env);
+    }
+  else
+    {
+      parallelism = [[NSProcessInfo processInfo] activeProcessorCount];
+      if (parallelism < 1)
+	{
+	  parallelism = 1;
+	}
+#if	defined(USE_DISPATCH)
+      useDispatch = YES;
+      return;
+#endif
+    }
+  for (i = 1; i < parallelism; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(_work:)
+			       toTarget: [GSWorkerPool class]
+			     withObject: nil];
+    }
+}
+
+NSUInteger
+GSPrivateParallelism(void)
+{
+  pthread_once(&poolOnce, poolStart);
+  return parallelism;
+}
+
+void
+GSPrivateParallelApply(NSUInteger count, void *context,
+  void (*function)(void *context, NSUInteger index))
+{
+  GSWorkJob	job;
+
+  if (0 == count)
+    {
+      return;
+    }
+  memset(&job, '\0', sizeof(job));
+  job.function = function;
+  job.context = context;
+  job.count = count;
+
+  if (1 == count || 1 == GSPrivateParallelism())
+    {
+      runJob(&job);
+    }
+#if	defined(USE_DISPATCH)
+  else if (YES == useDispatch)
+    {
+      dispatch_apply_f(count,
+	dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+	&job, dispatchIndex);
+    }
+#endif
+  else
+    {
+      GSWorkJob	**p;
+
+      /* The newest job goes at the head of the queue, so that the work
+       * of a job submitted from a worker thread (nested inside another
+       * job) is done first.
+       */
+      pthread_mutex_lock(&poolLock);
+      job.next = jobs;
+      jobs = &job;
+      pthread_cond_broadcast(&workCond);
+      pthread_mutex_unlock(&poolLock);
+
+      /* The calling thread works on the job too, so it completes even
+       * when all the workers are busy.
+       */
+      runJob(&job);
+
+      pthread_mutex_lock(&poolLock);
+      for (p = &jobs; *p != 0; p = &(*p)->next)
+	{
+	  if (*p == &job)
+	    {
+	      *p = job.next;
+	      break;
+	    }
+	}
+      while (job.users > 0
+	|| __sync_add_and_fetch(&job.finished, 0) < job.count)
+	{
+	  pthread_cond_wait(&doneCond, &poolLock);
+	}
+      pthread_mutex_unlock(&poolLock);
+    }
+
+  if (job.exception != nil)
+    {
+      [AUTORELEASE(job.exception) raise];
+    }
+}
+
+/* Chunks of fewer positions than this are not worth handing to another
+ * thread.
+ */
+#define	MIN_CHUNK	64
+
+typedef struct {
+  NSUInteger	*hits;
+  NSUInteger	count;
+  NSUInteger	capacity;
+} GSFilterChunk;
+
+typedef struct {
+  void		*context;
+  BOOL		(*test)(void *context, NSUInteger position, BOOL *stop);
+  BOOL		*stop;
+  NSUInteger	count;
+  NSUInteger	chunks;
+  GSFilterChunk	*results;
+} GSFilter;
+
+static void
+filterChunk(void *context, NSUInteger index)
+{
+  GSFilter	*f = (GSFilter*)context;
+  GSFilterChunk	*c = f->results + index;
+  NSUInteger	end = f->count * (index + 1) / f->chunks;
+  NSUInteger	i;
+
+  for (i = f->count * index / f->chunks; i < end; i++)
+    {
+      if (YES == *(volatile BOOL*)f->stop)
+	{
+	  break;
+	}
+      if ((*f->test)(f->context, i, f->stop))
+	{
+	  if (c->count == c->capacity)
+	    {
+	      NSUInteger	*h;
+
+	      c->capacity = (0 == c->capacity) ? 16 : c->capacity * 2;
+	      h = realloc(c->hits, c->capacity * sizeof(NSUInteger));
+	      if (0 == h)
+		{
+		  [NSException raise: NSMallocException
+			      format: @"Unable to grow filter results"];
+		}
+	      c->hits = h;
+	    }
+	  c->hits[c->count++] = i;
+	}
+    }
+}
+
+NSUInteger *
+GSPrivateParallelFilter(NSUInteger count, void *context,
+  BOOL (*test)(void *context, NSUInteger position, BOOL *stop),
+  BOOL *stop, NSUInteger *found)
+{
+  GSFilter	f;
+  NSUInteger	*result = 0;
+  NSUInteger	total = 0;
+  NSUInteger	i;
+
+  *found = 0;
+  if (0 == count)
+    {
+      return 0;
+    }
+  f.context = context;
+  f.test = test;
+  f.stop = stop;
+  f.count = count;
+  f.chunks = MIN(4 * GSPrivateParallelism(),
+    (count + MIN_CHUNK - 1) / MIN_CHUNK);
+  f.results = calloc(f.chunks, sizeof(GSFilterChunk));
+  if (0 == f.results)
+    {
+      [NSException raise: NSMallocException
+		  format: @"Unable to allocate filter results"];
+    }
+  NS_DURING
+    {
+      GSPrivateParallelApply(f.chunks, &f, filterChunk);
+    }
+  NS_HANDLER
+    {
+      for (i = 0; i < f.chunks; i++)
+	{
+	  free(f.results[i].hits);
+	}
+      free(f.results);
+      [localException raise];
+    }
+  NS_ENDHANDLER
+
+  /* Join the chunks in order, reusing the buffer of the first chunk
+   * with results (often the only one) for the joined results.
+   */
+  for (i = 0; i < f.chunks; i++)
+    {
+      if (f.results[i].count > 0)
+	{
+	  if (0 == total)
+	    {
+	      result = f.results[i].hits;
+	      f.results[i].hits = 0;
+	    }
+	  else
+	    {
+	      NSUInteger	*r;
+
+	      r = realloc(result,
+		(total + f.results[i].count) * sizeof(NSUInteger));
+	      if (0 == r)
+		{
+		  NSUInteger	j;
+
+		  for (j = i; j < f.chunks; j++)
+		    {
+		      free(f.results[j].hits);
+		    }
+		  free(f.results);
+		  free(result);
+		  [NSException raise: NSMallocException
+			      format: @"Unable to join filter results"];
+		}
+	      result = r;
+	      memcpy(result + total, f.results[i].hits,
+		f.results[i].count * sizeof(NSUInteger));
+	    }
+	  total += f.results[i].count;
+	}
+      free(f.results[i].hits);
+    }
+  free(f.results);
+  *found = total;
+  return result;
+}
@@ -64,6 +64,45 @@ static BOOL GSMacOSXCompatiblePropertyLists(void)
 
 extern void     GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 
+/* State for concurrent enumeration of the objects in an array using
+ * GSPrivateParallelFilter(), where each position is an array index.
+ */
+typedef struct {
+  id			*objects;
+  GSEnumeratorBlock	enumerator;
+  GSPredicateBlock	predicate;
+} GSArrayConcurrency;
+
+static BOOL
+concurrentEnumerate(void *context, NSUInteger index, BOOL *stop)
+{
+  GSArrayConcurrency	*c = (GSArrayConcurrency*)context;
+
+  CALL_BLOCK(c->enumerator, c->objects[index], index, stop);
+  return NO;
+}
+
+static BOOL
+concurrentTest(void *context, NSUInteger index, BOOL *stop)
+{
+  GSArrayConcurrency	*c = (GSArrayConcurrency*)context;
+
+  return CALL_BLOCK(c->predicate, c->objects[index], index, stop);
+}
+
+static BOOL
+concurrentFind(void *context, NSUInteger index, BOOL *stop)
+{
+  GSArrayConcurrency	*c = (GSArrayConcurrency*)context;
+
+  if (CALL_BLOCK(c->predicate, c->objects[index], index, stop))
+    {
+      *stop = YES;	/* No need to test any more objects.	*/
+      return YES;
+    }
+  return NO;
+}
+
 @interface NSArrayEnumerator : NSEnumerator
 {
   NSArray	*array;
@@ -1744,6 +1783,26 @@ compare(id elem1, id elem2, void* context)
   BOOL isReverse = (opts & NSEnumerationReverse);
   id<NSFastEnumeration> enumerator = self;
 
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSArrayConcurrency	c;
+      NSUInteger		found;
+
+      /* The order is undefined, so each thread works forward through
+       * a contiguous chunk of the array even if NSEnumerationReverse
+       * is set.
+       */
+      count = [self count];
+      GS_BEGINIDBUF(objects, count);
+      [self getObjects: objects];
+      c.objects = objects;
+      c.enumerator = aBlock;
+      GSPrivateParallelFilter(count, &c, concurrentEnumerate,
+	&shouldStop, &found);
+      GS_ENDIDBUF();
+      return;
+    }
+
   /* If we are enumerating in reverse, use the reverse enumerator for fast
    * enumeration. */
   if (isReverse)
@@ -1785,14 +1844,43 @@ compare(id elem1, id elem2, void* context)
 - (NSIndexSet *) indexesOfObjectsWithOptions: (NSEnumerationOptions)opts
 				 passingTest: (GSPredicateBlock)predicate
 {
-  /* TODO: Concurrency. */
   NSMutableIndexSet *set = [NSMutableIndexSet indexSet];
   BLOCK_SCOPE BOOL shouldStop = NO;
   id<NSFastEnumeration> enumerator = self;
   NSUInteger count = 0;
-  BLOCK_SCOPE NSLock *setLock = nil;
 
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSArrayConcurrency	c;
+      NSUInteger		*hits;
+      NSUInteger		found;
+      NSUInteger		i;
+
+      count = [self count];
+      GS_BEGINIDBUF(objects, count);
+      [self getObjects: objects];
+      c.objects = objects;
+      c.predicate = predicate;
+      hits = GSPrivateParallelFilter(count, &c, concurrentTest,
+	&shouldStop, &found);
+      GS_ENDIDBUF();
+
+      /* The indexes are in order, so add each run of consecutive
+       * indexes to the set as a range.
+       */
+      for (i = 0; i < found; )
+	{
+	  NSUInteger	start = i++;
 
+	  while (i < found && hits[i] == hits[i - 1] + 1)
+	    {
+	      i++;
+	    }
+	  [set addIndexesInRange: NSMakeRange(hits[start], i - start)];
+	}
+      free(hits);
+      return set;
+    }
 
   /* If we are enumerating in reverse, use the reverse enumerator for fast
    * enumeration. */
@@ -1800,44 +1888,19 @@ compare(id elem1, id elem2, void* context)
     {
       enumerator = [self reverseObjectEnumerator];
     }
-  if (opts & NSEnumerationConcurrent)
-  {
-    setLock = [NSLock new];
-  }
-  {
-    GS_DISPATCH_CREATE_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
-    FOR_IN (id, obj, enumerator)
-#     if __has_feature(blocks) && (GS_USE_LIBDISPATCH == 1)
-
-      dispatch_group_async(enumQueueGroup, enumQueue, ^(void){
-        if (shouldStop)
-        {
-	  return;
-        }
-        if (predicate(obj, count, &shouldStop))
-        {
-	  [setLock lock];
-	  [set addIndex: count];
-	  [setLock unlock];
-        }
-      });
-#     else
-      if (CALL_BLOCK(predicate, obj, count, &shouldStop))
-        {
-	  /* TODO: It would be more efficient to collect an NSRange and only
-	   * pass it to the index set when CALL_BLOCK returned NO. */
-	  [set addIndex: count];
-        }
-#     endif
-      if (shouldStop)
-        {
-	  break;
-        }
-      count++;
-    END_FOR_IN(enumerator)
-    GS_DISPATCH_TEARDOWN_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts);
-  }
-  [setLock release];
+  FOR_IN (id, obj, enumerator)
+    if (CALL_BLOCK(predicate, obj, count, &shouldStop))
+      {
+	/* TODO: It would be more efficient to collect an NSRange and only
+	 * pass it to the index set when CALL_BLOCK returned NO. */
+	[set addIndex: count];
+      }
+    if (shouldStop)
+      {
+	break;
+      }
+    count++;
+  END_FOR_IN(enumerator)
   return set;
 }
 
@@ -1858,60 +1921,55 @@ compare(id elem1, id elem2, void* context)
 - (NSUInteger)indexOfObjectWithOptions: (NSEnumerationOptions)opts
 			   passingTest: (GSPredicateBlock)predicate
 {
-  /* TODO: Concurrency. */
   id<NSFastEnumeration> enumerator = self;
   BLOCK_SCOPE BOOL shouldStop = NO;
   NSUInteger count = 0;
-  BLOCK_SCOPE NSUInteger index = NSNotFound;
-  BLOCK_SCOPE NSLock *indexLock = nil;
+  NSUInteger index = NSNotFound;
+
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSArrayConcurrency	c;
+      NSUInteger		*hits;
+      NSUInteger		found;
+
+      count = [self count];
+      GS_BEGINIDBUF(objects, count);
+      [self getObjects: objects];
+      c.objects = objects;
+      c.predicate = predicate;
+      hits = GSPrivateParallelFilter(count, &c, concurrentFind,
+	&shouldStop, &found);
+      GS_ENDIDBUF();
+
+      /* Other threads may have found a match before they saw the stop
+       * flag, so prefer the first (or last, when enumerating in reverse).
+       */
+      if (found > 0)
+	{
+	  index = (opts & NSEnumerationReverse) ? hits[found - 1] : hits[0];
+	}
+      free(hits);
+      return index;
+    }
+
   /* If we are enumerating in reverse, use the reverse enumerator for fast
    * enumeration. */
   if (opts & NSEnumerationReverse)
     {
       enumerator = [self reverseObjectEnumerator];
     }
-
-  if (opts & NSEnumerationConcurrent)
-  {
-    indexLock = [NSLock new];
-  }
-  {
-    GS_DISPATCH_CREATE_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
-    FOR_IN (id, obj, enumerator)
-#     if __has_feature(blocks) && (GS_USE_LIBDISPATCH == 1)
-      dispatch_group_async(enumQueueGroup, enumQueue, ^(void){
-        if (shouldStop)
-        {
-	  return;
-        }
-        if (predicate(obj, count, &shouldStop))
-        {
-	  // FIXME: atomic operation on the shouldStop variable would be nicer,
-	  // but we don't expose the GSAtomic* primitives anywhere.
-	  [indexLock lock];
-	  index =  count;
-	  // Cancel all other predicate evaluations:
-	  shouldStop = YES;
-	  [indexLock unlock];
-        }
-      });
-#     else
-      if (CALL_BLOCK(predicate, obj, count, &shouldStop))
-        {
-
-	  index = count;
-	  shouldStop = YES;
-        }
-#     endif
-      if (shouldStop)
-        {
-	  break;
-        }
-      count++;
-    END_FOR_IN(enumerator)
-    GS_DISPATCH_TEARDOWN_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts);
-  }
-  [indexLock release];
+  FOR_IN (id, obj, enumerator)
+    if (CALL_BLOCK(predicate, obj, count, &shouldStop))
+      {
+	index = count;
+	shouldStop = YES;
+      }
+    if (shouldStop)
+      {
+	break;
+      }
+    count++;
+  END_FOR_IN(enumerator)
   return index;
 }
 
@@ -214,6 +214,20 @@ static Class PoolClass;
 
 @end
 
+#if GS_WITH_GC
+void *
+GSAutoreleasePoolPush(void)
+{
+  return [NSAutoreleasePool new];
+}
+
+void
+GSAutoreleasePoolPop(void *pool)
+{
+  [(NSAutoreleasePool*)pool drain];
+}
+#endif
+
 #endif
 
 
@@ -233,8 +247,8 @@ static unsigned pool_count_warning_threshhold = UINT_MAX;
    an exception.  This can be adjusted with +setPoolNumberThreshhold */
 static unsigned pool_number_warning_threshhold = 10000;
 
-/* The size of the first _released array. */
-#define BEGINNING_POOL_SIZE 32
+/* The maximum number of pages kept in the cache of a thread. */
+#define MAX_CACHED_PAGES 64
 
 /* Easy access to the thread variables belonging to NSAutoreleasePool. */
 #define ARP_THREAD_VARS (&((GSCurrentThread())->_autorelease_vars))
@@ -247,11 +261,38 @@ static unsigned pool_number_warning_threshhold = 10000;
 
 
 /* Functions for managing a per-thread cache of NSAutoreleasedPool's
-   already alloc'ed.  The cache is kept in the autorelease_thread_var
-   structure, which is an ivar of NSThread. */
+   already alloc'ed, and of the pages holding their objects.  The cache is
+   a pool_cache_struct, found through the pool_cache field (which points
+   to its pools array) of the autorelease_thread_var structure, which is
+   an ivar of NSThread. */
+
+typedef struct {
+  /* Pages not in use by any pool, linked through their next fields. */
+  struct autorelease_array_list *pages;
+  unsigned page_count;
+  __unsafe_unretained id pools[0];
+} pool_cache_struct;
+
+#define POOL_CACHE(tv) ((pool_cache_struct*)(void*)\
+  ((char*)(tv)->pool_cache - offsetof(pool_cache_struct, pools)))
+
+/* The number of objects which fit in a page. */
+static unsigned page_capacity = 0;
 
 static id pop_pool_from_cache (struct autorelease_thread_vars *tv);
 
+static inline void
+free_pages (struct autorelease_array_list *page)
+{
+  while (page != 0)
+    {
+      struct autorelease_array_list *next = page->next;
+
+      NSDeallocateMemoryPages(page, NSPageSize());
+      page = next;
+    }
+}
+
 static inline void
 free_pool_cache (struct autorelease_thread_vars *tv)
 {
@@ -264,7 +305,10 @@ free_pool_cache (struct autorelease_thread_vars *tv)
 
   if (tv->pool_cache)
     {
-      NSZoneFree(NSDefaultMallocZone(), tv->pool_cache);
+      pool_cache_struct *cache = POOL_CACHE(tv);
+
+      free_pages(cache->pages);
+      NSZoneFree(NSDefaultMallocZone(), cache);
       tv->pool_cache = 0;
       tv->pool_cache_size = 0;
     }
@@ -273,10 +317,15 @@ free_pool_cache (struct autorelease_thread_vars *tv)
 static inline void
 init_pool_cache (struct autorelease_thread_vars *tv)
 {
+  pool_cache_struct *cache;
+
   tv->pool_cache_size = 32;
   tv->pool_cache_count = 0;
-  tv->pool_cache = (id*)NSZoneMalloc(NSDefaultMallocZone(),
-    sizeof(id) * tv->pool_cache_size);
+  cache = (pool_cache_struct*)NSZoneMalloc(NSDefaultMallocZone(),
+    sizeof(pool_cache_struct) + sizeof(id) * tv->pool_cache_size);
+  cache->pages = 0;
+  cache->page_count = 0;
+  tv->pool_cache = cache->pools;
 }
 
 static void
@@ -288,9 +337,12 @@ push_pool_to_cache (struct autorelease_thread_vars *tv, id p)
     }
   else if (tv->pool_cache_count == tv->pool_cache_size)
     {
+      pool_cache_struct *cache = POOL_CACHE(tv);
+
       tv->pool_cache_size *= 2;
-      tv->pool_cache = (id*)NSZoneRealloc(NSDefaultMallocZone(),
-	tv->pool_cache, sizeof(id) * tv->pool_cache_size);
+      cache = (pool_cache_struct*)NSZoneRealloc(NSDefaultMallocZone(),
+	cache, sizeof(pool_cache_struct) + sizeof(id) * tv->pool_cache_size);
+      tv->pool_cache = cache->pools;
     }
   tv->pool_cache[tv->pool_cache_count++] = p;
 }
@@ -301,7 +353,72 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
   return tv->pool_cache[--(tv->pool_cache_count)];
 }
 
-
+#ifndef ARC_RUNTIME
+/* Returns an empty page from the cache of the thread, or a new one.
+   Pages are all one page of memory in size (and page aligned), so
+   they may be used by any pool. */
+static struct autorelease_array_list *
+pop_page_from_cache (struct autorelease_thread_vars *tv)
+{
+  struct autorelease_array_list *page = 0;
+
+  if (tv->pool_cache)
+    {
+      pool_cache_struct *cache = POOL_CACHE(tv);
+
+      if ((page = cache->pages) != 0)
+	{
+	  cache->pages = page->next;
+	  cache->page_count--;
+	}
+    }
+  if (0 == page)
+    {
+      if (0 == page_capacity)
+	{
+	  page_capacity = (NSPageSize() - sizeof(struct autorelease_array_list))
+	    / sizeof(id);
+	}
+      page = NSAllocateMemoryPages(NSPageSize());
+      if (0 == page)
+	{
+	  [NSException raise: NSMallocException
+		      format: @"Unable to allocate autorelease pool page"];
+	}
+      page->size = page_capacity;
+    }
+  page->next = 0;
+  page->count = 0;
+  return page;
+}
+
+/* Puts a list of empty pages in the cache of the thread, freeing those
+   which don't fit. */
+static void
+push_pages_to_cache (struct autorelease_thread_vars *tv,
+  struct autorelease_array_list *page)
+{
+  pool_cache_struct *cache;
+
+  if (!tv->pool_cache)
+    {
+      init_pool_cache (tv);
+    }
+  cache = POOL_CACHE(tv);
+  while (page != 0 && cache->page_count < MAX_CACHED_PAGES)
+    {
+      struct autorelease_array_list *next = page->next;
+
+      page->next = cache->pages;
+      cache->pages = page;
+      cache->page_count++;
+      page = next;
+    }
+  free_pages(page);
+}
+#endif
+
+
 #if __OBJC_GC__
 @implementation GSAutoreleasePool
 #else
@@ -416,60 +533,120 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
  * pools.
  */
 - (void)_ARCCompatibleAutoreleasePool {}
+
+void *
+GSAutoreleasePoolPush(void)
+{
+  return objc_autoreleasePoolPush();
+}
+
+void
+GSAutoreleasePoolPop(void *pool)
+{
+  objc_autoreleasePoolPop(pool);
+}
+
 #else
-- (id) init
+
+/* Makes p (a new or cached pool) the current pool of the thread.
+ */
+static NSAutoreleasePool *
+init_pool (NSAutoreleasePool *p, struct autorelease_thread_vars *tv)
 {
-  if (!_released_head)
-    {
-      _addImp = (void (*)(id, SEL, id))
-	[self methodForSelector: @selector(addObject:)];
-      /* Allocate the array that will be the new head of the list of arrays. */
-      _released = (struct autorelease_array_list*)
-	NSZoneMalloc(NSDefaultMallocZone(),
-	sizeof(struct autorelease_array_list)
-	+ (BEGINNING_POOL_SIZE * sizeof(id)));
-      /* Currently no NEXT array in the list, so NEXT == NULL. */
-      _released->next = NULL;
-      _released->size = BEGINNING_POOL_SIZE;
-      _released->count = 0;
-      _released_head = _released;
-      _released_count = 0;
+  unsigned	level = 0;
+
+  if (0 == p->_addImp)
+    {
+      p->_addImp = (void (*)(id, SEL, id))
+	[p methodForSelector: @selector(addObject:)];
     }
-  else
-    /* Already initialized; (it came from autorelease_pool_cache);
-       we don't have to allocate new array list memory. */
+  p->_released = p->_released_head = pop_page_from_cache(tv);
+  p->_released_count = 0;
+
+  /* Install the pool as the current pool.
+   * The only other place where the parent/child linked list is modified
+   * should be in dealloc_pool()
+   */
+  p->_parent = tv->current_pool;
+  if (p->_parent)
+    {
+      NSAutoreleasePool	*pool = p->_parent;
+
+      while (nil != pool)
+	{
+	  level++;
+	  pool = pool->_parent;
+	}
+      p->_parent->_child = p;
+    }
+  tv->current_pool = p;
+  if (level > pool_number_warning_threshhold)
     {
-      _released = _released_head;
+      [NSException raise: NSGenericException
+	format: @"Too many (%u) autorelease pools ... leaking them?", level];
     }
+  return p;
+}
 
-  /* Install ourselves as the current pool.
+/* Empties p, removes it from the pools of the thread and caches it (and
+ * its pages) for reuse.
+ */
+static void
+dealloc_pool (NSAutoreleasePool *p, struct autorelease_thread_vars *tv)
+{
+  [p emptyPool];
+
+  /* Remove the pool from the linked list of pools in use.
+   * We already know that we have deallocated any child (in -emptyPool),
+   * but we may have a parent which needs to know we have gone.
    * The only other place where the parent/child linked list is modified
-   * should be in -dealloc
+   * should be in init_pool()
    */
-  {
-    struct autorelease_thread_vars *tv = ARP_THREAD_VARS;
-    unsigned	level = 0;
-    _parent = tv->current_pool;
-    if (_parent)
-      {
-	NSAutoreleasePool	*pool = _parent;
+  if (tv->current_pool == p)
+    {
+      tv->current_pool = p->_parent;
+    }
+  if (p->_parent != nil)
+    {
+      p->_parent->_child = nil;
+      p->_parent = nil;
+    }
 
-	while (nil != pool)
-	  {
-	    level++;
-	    pool = pool->_parent;
-	  }
-        _parent->_child = self;
-      }
-    tv->current_pool = self;
-    if (level > pool_number_warning_threshhold)
-      {
-	[NSException raise: NSGenericException
-	  format: @"Too many (%u) autorelease pools ... leaking them?", level];
-      }
-  }
+  /* Don't deallocate the pool, just save it (and its pages, which go to
+   * whichever pool is created next) for later use.
+   */
+  push_pages_to_cache (tv, p->_released_head);
+  p->_released = p->_released_head = 0;
+  push_pool_to_cache (tv, p);
+}
 
-  return self;
+void *
+GSAutoreleasePoolPush(void)
+{
+  struct autorelease_thread_vars	*tv = ARP_THREAD_VARS;
+  NSAutoreleasePool			*p;
+
+  if (tv->pool_cache_count)
+    {
+      p = pop_pool_from_cache(tv);
+    }
+  else
+    {
+      p = NSAllocateObject([NSAutoreleasePool class], 0,
+	NSDefaultMallocZone());
+    }
+  return init_pool(p, tv);
+}
+
+void
+GSAutoreleasePoolPop(void *pool)
+{
+  dealloc_pool((NSAutoreleasePool*)pool, ARP_THREAD_VARS);
+}
+
+- (id) init
+{
+  return init_pool(self, ARP_THREAD_VARS);
 }
 
 - (unsigned) autoreleaseCount
@@ -558,29 +735,11 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
     [NSException raise: NSGenericException
 		 format: @"AutoreleasePool count threshhold exceeded."];
 
-  /* Get a new array for the list, if the current one is full. */
-  while (_released->count == _released->size)
+  /* Get a new page for the list, if the current one is full. */
+  if (_released->count == _released->size)
     {
-      if (_released->next)
-	{
-	  /* There is an already-allocated one in the chain; use it. */
-	  _released = _released->next;
-	}
-      else
-	{
-	  /* We are at the end of the chain, and need to allocate a new one. */
-	  struct autorelease_array_list *new_released;
-	  unsigned new_size = _released->size * 2;
-	
-	  new_released = (struct autorelease_array_list*)
-	    NSZoneMalloc(NSDefaultMallocZone(),
-	    sizeof(struct autorelease_array_list) + (new_size * sizeof(id)));
-	  new_released->next = NULL;
-	  new_released->size = new_size;
-	  new_released->count = 0;
-	  _released->next = new_released;
-	  _released = new_released;
-	}
+      _released->next = pop_page_from_cache(ARP_THREAD_VARS);
+      _released = _released->next;
     }
 
   /* Put the object at the end of the list. */
@@ -594,6 +753,7 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
 - (void) emptyPool
 {
   unsigned	i;
+  unsigned	run;
   Class		classes[16];
   IMP	 	imps[16];
 
@@ -651,14 +811,27 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
 	{
 	  id	*objects = (id*)(released->objects);
 
-	  for (i = 0; i < released->count; i++)
+	  for (i = 0; i < released->count; i += run)
 	    {
 	      id	anObject;
 	      Class	c;
 	      unsigned	hash;
+	      unsigned	j;
 
+	      /* Consecutive entries for the same object (as when something
+	       * is autoreleased repeatedly) are released as a batch, using
+	       * a single lookup of the release method.
+	       */
 	      anObject = objects[i];
-	      objects[i] = nil;
+	      run = 1;
+	      while (i + run < released->count && objects[i + run] == anObject)
+		{
+		  run++;
+		}
+	      for (j = 0; j < run; j++)
+		{
+		  objects[i + j] = nil;
+		}
               if (anObject == nil)
                 {
                   fprintf(stderr,
@@ -686,13 +859,25 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
 		    = class_getMethodImplementation(c, @selector(release));
 		  classes[hash] = c;
 		}
-	      (imps[hash])(anObject, @selector(release));
+	      for (j = 0; j < run; j++)
+		{
+		  (imps[hash])(anObject, @selector(release));
+		}
 	    }
 	  _released_count -= released->count;
 	  released->count = 0;
 	  released = released->next;
 	}
     }
+
+  /* Keep only the first page, so the pool starts again at the beginning.
+   */
+  if (_released_head != 0 && _released_head->next != 0)
+    {
+      push_pages_to_cache (ARP_THREAD_VARS, _released_head->next);
+      _released_head->next = 0;
+    }
+  _released = _released_head;
 }
 
 #endif // ARC_RUNTIME
@@ -724,6 +909,7 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
 
 - (void) dealloc
 {
+#ifdef ARC_RUNTIME
   struct autorelease_thread_vars *tv = ARP_THREAD_VARS;
 
   [self emptyPool];
@@ -746,18 +932,18 @@ pop_pool_from_cache (struct autorelease_thread_vars *tv)
 
   /* Don't deallocate ourself, just save us for later use. */
   push_pool_to_cache (tv, self);
+#else
+  dealloc_pool(self, ARP_THREAD_VARS);
+#endif
   GSNOSUPERDEALLOC;
 }
 
 - (void) _reallyDealloc
 {
-  struct autorelease_array_list *a;
-  for (a = _released_head; a;)
-    {
-      void *n = a->next;
-      NSZoneFree(NSDefaultMallocZone(), a);
-      a = n;
-    }
+  /* This may be called on behalf of an exiting thread, so the pages
+   * are freed rather than being put in the cache of the current thread.
+   */
+  free_pages(_released_head);
   _released = _released_head = 0;
   [super dealloc];
 }
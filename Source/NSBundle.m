@@ -2023,6 +2023,10 @@ IF_NO_GC(
 	  return NO;
 	}
 
+      /* Categories in the bundle may have added key-value coding
+	 accessors to existing classes. */
+      GSPrivateKVCFlush();
+
       /* We now construct the list of bundles from frameworks linked with
 	 this one */
       classEnumerator = [_loadingFrameworks objectEnumerator];
@@ -23,35 +23,265 @@
    */ 
 
 #import "common.h"
+#include <pthread.h>
 
-#define	EXPOSE_NSCache_IVARS	1
+/* An entry in a cache.  Entries which may be evicted are kept in a list
+ * for their stripe, from the most recently used to the least.
+ */
+typedef struct GSCacheEntry {
+  struct GSCacheEntry	*prev;	/* More recently used.	*/
+  struct GSCacheEntry	*next;	/* Less recently used.	*/
+  id			key;
+  id			object;
+  NSUInteger		cost;
+  NSUInteger		stamp;	/* When last used (larger is more recent). */
+  BOOL			discardable;
+  BOOL			linked;	/* In the LRU list (may be evicted).	*/
+} GSCacheEntry;
+
+/*
+ *	Setup for inline operation of the index of a stripe, mapping keys
+ *	(retained) to entries.
+ */
+#define	GSI_MAP_KTYPES	GSUNION_OBJ
+#define	GSI_MAP_VTYPES	GSUNION_PTR
+#define	GSI_MAP_RETAIN_VAL(M, X)
+#define	GSI_MAP_RELEASE_VAL(M, X)
+
+#include "GNUstepBase/GSIMap.h"
+
+/* The objects in a cache are spread over several stripes by the hash of
+ * their keys, each with its own lock, index and LRU list, so that threads
+ * using different keys rarely wait for each other.
+ */
+#define	STRIPE_BITS	4
+#define	STRIPES		(1 << STRIPE_BITS)
+
+typedef struct {
+  pthread_mutex_t	lock;
+  GSIMapTable_t		map;
+  GSCacheEntry		lru;	/* Next is most, prev least recently used. */
+  NSUInteger		hits;
+  NSUInteger		misses;
+  NSUInteger		evictions;
+} GSCacheStripe;
+
+#define	GS_NSCache_IVARS \
+  NSUInteger		_costLimit; \
+  NSUInteger		_totalCost; \
+  NSUInteger		_countLimit; \
+  NSUInteger		_count; \
+  NSUInteger		_clock; \
+  id			_delegate; \
+  BOOL			_evictsObjectsWithDiscardedContent; \
+  NSString		*_name; \
+  GSCacheStripe		*_stripes
 
-#import "Foundation/NSArray.h"
 #import "Foundation/NSCache.h"
-#import "Foundation/NSDictionary.h"
-#import "Foundation/NSEnumerator.h"
-
-/**
- * _GSCachedObject is effectively used as a structure containing the various
- * things that need to be associated with objects stored in an NSCache.  It is
- * an NSObject subclass so that it can be used with OpenStep collection
- * classes.
+
+#define	GSInternal	NSCacheInternal
+#include	"GSInternal.h"
+GS_PRIVATE_INTERNAL(NSCache)
+
+
+static inline GSCacheStripe *
+stripeForKey(NSCache *self, id key)
+{
+  unsigned	h = (unsigned)[key hash] * 2654435761U;
+
+  return &internal->_stripes[h >> (32 - STRIPE_BITS)];
+}
+
+/* Makes e the most recently used entry of its stripe.
  */
-@interface _GSCachedObject : NSObject
+static inline void
+entryUsed(NSCache *self, GSCacheStripe *s, GSCacheEntry *e)
 {
-  @public
-  id object;
-  NSString *key;
-  int accessCount;
-  NSUInteger cost;
-  BOOL isEvictable;
+  if (YES == e->linked)
+    {
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+    }
+  e->next = s->lru.next;
+  e->prev = &s->lru;
+  s->lru.next->prev = e;
+  s->lru.next = e;
+  e->linked = YES;
+  e->stamp = __sync_add_and_fetch(&internal->_clock, 1);
 }
-@end
 
-@interface NSCache (EvictionPolicy)
-/** The method controlling eviction policy in an NSCache. */
-- (void) _evictObjectsToMakeSpaceForObjectWithCost: (NSUInteger)cost;
-@end
+static inline void
+entryUnlink(GSCacheEntry *e)
+{
+  if (YES == e->linked)
+    {
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+      e->prev = e->next = 0;
+      e->linked = NO;
+    }
+}
+
+/* Takes e out of its stripe and adds it to the list of removed entries.
+ * The caller tells the delegate and frees the entry once the stripe is
+ * unlocked.
+ */
+static inline void
+entryRemove(NSCache *self, GSCacheStripe *s, GSCacheEntry *e,
+  GSCacheEntry **removed)
+{
+  entryUnlink(e);
+  __sync_fetch_and_sub(&internal->_count, 1);
+  __sync_fetch_and_sub(&internal->_totalCost, e->cost);
+  GSIMapRemoveKey(&s->map, (GSIMapKey)e->key);
+  e->key = nil;
+  e->next = *removed;
+  *removed = e;
+}
+
+/* Tells the delegate about, and releases, the removed entries.
+ */
+static void
+entriesRelease(NSCache *self, GSCacheEntry *removed, BOOL notify)
+{
+  id	delegate = internal->_delegate;
+
+  while (removed != 0)
+    {
+      GSCacheEntry	*e = removed;
+
+      removed = e->next;
+      if (YES == notify)
+	{
+	  [delegate cache: self willEvictObject: e->object];
+	}
+      [e->object release];
+      NSZoneFree(NSDefaultMallocZone(), e);
+    }
+}
+
+static inline BOOL
+overLimit(NSCache *self)
+{
+  if (internal->_countLimit > 0 && internal->_count > internal->_countLimit)
+    {
+      return YES;
+    }
+  if (internal->_costLimit > 0 && internal->_totalCost > internal->_costLimit)
+    {
+      return YES;
+    }
+  return NO;
+}
+
+/* Removes objects, least recently used first, until the cache is within
+ * its limits.  Objects implementing NSDiscardableContent have their
+ * content discarded first, and are only removed if the cache evicts
+ * objects with discarded content (otherwise they stay, at no cost, but
+ * are no longer candidates for eviction).  An object whose content can
+ * not be discarded (because it is in use) counts as used again.
+ */
+static void
+shrink(NSCache *self)
+{
+  GSCacheEntry	*removed = 0;
+  NSUInteger	budget = internal->_count;
+
+  while (budget-- > 0 && YES == overLimit(self))
+    {
+      GSCacheStripe	*victim = 0;
+      NSUInteger	oldest = 0;
+      GSCacheEntry	*e;
+      unsigned		i;
+
+      for (i = 0; i < STRIPES; i++)
+	{
+	  GSCacheStripe	*s = &internal->_stripes[i];
+
+	  pthread_mutex_lock(&s->lock);
+	  e = s->lru.prev;
+	  if (e != &s->lru && (0 == victim || e->stamp < oldest))
+	    {
+	      victim = s;
+	      oldest = e->stamp;
+	    }
+	  pthread_mutex_unlock(&s->lock);
+	}
+      if (0 == victim)
+	{
+	  break;	// Nothing may be evicted.
+	}
+
+      pthread_mutex_lock(&victim->lock);
+      e = victim->lru.prev;
+      if (e != &victim->lru)
+	{
+	  if (YES == e->discardable)
+	    {
+	      [e->object discardContentIfPossible];
+	      if (YES == [e->object isContentDiscarded])
+		{
+		  victim->evictions++;
+		  if (YES == internal->_evictsObjectsWithDiscardedContent)
+		    {
+		      entryRemove(self, victim, e, &removed);
+		    }
+		  else
+		    {
+		      __sync_fetch_and_sub(&internal->_totalCost, e->cost);
+		      e->cost = 0;
+		      entryUnlink(e);
+		    }
+		}
+	      else
+		{
+		  entryUsed(self, victim, e);
+		}
+	    }
+	  else
+	    {
+	      victim->evictions++;
+	      entryRemove(self, victim, e, &removed);
+	    }
+	}
+      pthread_mutex_unlock(&victim->lock);
+    }
+  entriesRelease(self, removed, YES);
+}
+
+/* Removes all objects from all stripes.
+ */
+static void
+empty(NSCache *self, BOOL notify)
+{
+  unsigned	i;
+
+  for (i = 0; i < STRIPES; i++)
+    {
+      GSCacheStripe	*s = &internal->_stripes[i];
+      GSCacheEntry	*removed = 0;
+      GSIMapEnumerator_t	enumerator;
+      GSIMapNode	node;
+
+      pthread_mutex_lock(&s->lock);
+      enumerator = GSIMapEnumeratorForMap(&s->map);
+      while ((node = GSIMapEnumeratorNextNode(&enumerator)) != 0)
+	{
+	  GSCacheEntry	*e = (GSCacheEntry*)node->value.ptr;
+
+	  __sync_fetch_and_sub(&internal->_count, 1);
+	  __sync_fetch_and_sub(&internal->_totalCost, e->cost);
+	  e->key = nil;
+	  e->next = removed;
+	  removed = e;
+	}
+      GSIMapEndEnumerator(&enumerator);
+      GSIMapCleanMap(&s->map);
+      s->lru.next = s->lru.prev = &s->lru;
+      pthread_mutex_unlock(&s->lock);
+      entriesRelease(self, removed, notify);
+    }
+}
 
 @implementation NSCache
 - (id) init
@@ -60,120 +290,207 @@
     {
       return nil;
     }
-  _objects = [NSMutableDictionary new];
-  _accesses = [NSMutableArray new];
+  GS_CREATE_INTERNAL(NSCache);
+  internal->_stripes = NSZoneCalloc(NSDefaultMallocZone(),
+    STRIPES, sizeof(GSCacheStripe));
+  {
+    unsigned	i;
+
+    for (i = 0; i < STRIPES; i++)
+      {
+	GSCacheStripe	*s = &internal->_stripes[i];
+
+	pthread_mutex_init(&s->lock, NULL);
+	GSIMapInitWithZoneAndCapacity(&s->map, NSDefaultMallocZone(), 8);
+	s->lru.next = s->lru.prev = &s->lru;
+      }
+  }
   return self;
 }
 
 - (NSUInteger) countLimit
 {
-  return _countLimit;
+  return internal->_countLimit;
 }
 
 - (id) delegate
 {
-  return _delegate;
+  return internal->_delegate;
+}
+
+- (NSUInteger) evictionCount
+{
+  NSUInteger	count = 0;
+  unsigned	i;
+
+  for (i = 0; i < STRIPES; i++)
+    {
+      count += internal->_stripes[i].evictions;
+    }
+  return count;
 }
 
 - (BOOL) evictsObjectsWithDiscardedContent
 {
-  return _evictsObjectsWithDiscardedContent;
+  return internal->_evictsObjectsWithDiscardedContent;
+}
+
+- (NSUInteger) hitCount
+{
+  NSUInteger	count = 0;
+  unsigned	i;
+
+  for (i = 0; i < STRIPES; i++)
+    {
+      count += internal->_stripes[i].hits;
+    }
+  return count;
+}
+
+- (NSUInteger) missCount
+{
+  NSUInteger	count = 0;
+  unsigned	i;
+
+  for (i = 0; i < STRIPES; i++)
+    {
+      count += internal->_stripes[i].misses;
+    }
+  return count;
 }
 
 - (NSString*) name
 {
-  return _name;
+  return internal->_name;
 }
 
 - (id) objectForKey: (id)key
 {
-  _GSCachedObject *obj = [_objects objectForKey: key];
+  GSCacheStripe	*s;
+  GSIMapNode	node;
+  id		obj = nil;
 
-  if (nil == obj)
+  if (nil == key)
     {
       return nil;
     }
-  if (obj->isEvictable)
+  s = stripeForKey(self, key);
+  pthread_mutex_lock(&s->lock);
+  node = GSIMapNodeForKey(&s->map, (GSIMapKey)key);
+  if (node == 0)
+    {
+      s->misses++;
+    }
+  else
     {
-      // Move the object to the end of the access list.
-      [_accesses removeObjectIdenticalTo: obj];
-      [_accesses addObject: obj];
+      GSCacheEntry	*e = (GSCacheEntry*)node->value.ptr;
+
+      if (YES == e->linked)
+	{
+	  entryUsed(self, s, e);
+	}
+      obj = [e->object retain];
+      s->hits++;
     }
-  obj->accessCount++;
-  _totalAccesses++;
-  return obj->object;
+  pthread_mutex_unlock(&s->lock);
+  return [obj autorelease];
 }
 
 - (void) removeAllObjects
 {
-  NSEnumerator *e = [_objects objectEnumerator];
-  _GSCachedObject *obj;
-
-  while (nil != (obj = [e nextObject]))
-    {
-      [_delegate cache: self willEvictObject: obj->object];
-    }
-  [_objects removeAllObjects];
-  [_accesses removeAllObjects];
-  _totalAccesses = 0;
+  empty(self, YES);
 }
 
 - (void) removeObjectForKey: (id)key
 {
-  _GSCachedObject *obj = [_objects objectForKey: key];
+  GSCacheStripe	*s;
+  GSIMapNode	node;
+  GSCacheEntry	*removed = 0;
 
-  if (nil != obj)
+  if (nil == key)
+    {
+      return;
+    }
+  s = stripeForKey(self, key);
+  pthread_mutex_lock(&s->lock);
+  node = GSIMapNodeForKey(&s->map, (GSIMapKey)key);
+  if (node != 0)
     {
-      [_delegate cache: self willEvictObject: obj->object];
-      _totalAccesses -= obj->accessCount;
-      [_objects removeObjectForKey: key];
-      [_accesses removeObjectIdenticalTo: obj];
+      entryRemove(self, s, (GSCacheEntry*)node->value.ptr, &removed);
     }
+  pthread_mutex_unlock(&s->lock);
+  entriesRelease(self, removed, YES);
 }
 
 - (void) setCountLimit: (NSUInteger)lim
 {
-  _countLimit = lim;
+  internal->_countLimit = lim;
+  shrink(self);
 }
 
 - (void) setDelegate:(id)del
 {
-  _delegate = del;
+  internal->_delegate = del;
 }
 
 - (void) setEvictsObjectsWithDiscardedContent:(BOOL)b
 {
-  _evictsObjectsWithDiscardedContent = b;
+  internal->_evictsObjectsWithDiscardedContent = b;
 }
 
 - (void) setName: (NSString*)cacheName
 {
-  ASSIGN(_name, cacheName);
+  ASSIGN(internal->_name, cacheName);
 }
 
 - (void) setObject: (id)obj forKey: (id)key cost: (NSUInteger)num
 {
-  _GSCachedObject *oldObject = [_objects objectForKey: key];
-  _GSCachedObject *newObject;
+  GSCacheStripe	*s;
+  GSIMapNode	node;
+  GSCacheEntry	*e;
+  id		old = nil;
+  BOOL		discardable;
 
-  if (nil != oldObject)
+  if (nil == obj)
+    {
+      [self removeObjectForKey: key];
+      return;
+    }
+  if (nil == key)
+    {
+      return;
+    }
+  discardable = [obj conformsToProtocol: @protocol(NSDiscardableContent)];
+  [obj retain];
+  s = stripeForKey(self, key);
+  pthread_mutex_lock(&s->lock);
+  node = GSIMapNodeForKey(&s->map, (GSIMapKey)key);
+  if (node == 0)
     {
-      [self removeObjectForKey: oldObject->key];
+      e = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(GSCacheEntry));
+      node = GSIMapAddPair(&s->map, (GSIMapKey)key, (GSIMapVal)(void*)e);
+      e->key = node->key.obj;
+      __sync_fetch_and_add(&internal->_count, 1);
     }
-  [self _evictObjectsToMakeSpaceForObjectWithCost: num];
-  newObject = [_GSCachedObject new];
-  // Retained here, released when obj is dealloc'd
-  newObject->object = RETAIN(obj);
-  newObject->key = RETAIN(key);
-  newObject->cost = num;
-  if ([obj conformsToProtocol: @protocol(NSDiscardableContent)])
+  else
     {
-      newObject->isEvictable = YES;
-      [_accesses addObject: newObject];
+      e = (GSCacheEntry*)node->value.ptr;
+      old = e->object;
+      __sync_fetch_and_sub(&internal->_totalCost, e->cost);
     }
-  [_objects setObject: newObject forKey: key];
-  RELEASE(newObject);
-  _totalCost += num;
+  e->object = obj;
+  e->cost = num;
+  e->discardable = discardable;
+  __sync_fetch_and_add(&internal->_totalCost, num);
+  entryUsed(self, s, e);
+  pthread_mutex_unlock(&s->lock);
+
+  if (nil != old)
+    {
+      [internal->_delegate cache: self willEvictObject: old];
+      [old release];
+    }
+  shrink(self);
 }
 
 - (void) setObject: (id)obj forKey: (id)key
@@ -183,102 +500,33 @@
 
 - (void) setTotalCostLimit: (NSUInteger)lim
 {
-  _costLimit = lim;
+  internal->_costLimit = lim;
+  shrink(self);
 }
 
 - (NSUInteger)totalCostLimit
 {
-  return _costLimit;
+  return internal->_costLimit;
 }
 
-/**
- * This method is the one that handles the eviction policy.  This
- * implementation uses a relatively simple LRU/LFU hybrid.  The NSCache
- * documentation from Apple makes it clear that the policy may change, so we
- * could in future have a class cluster with pluggable policies for different
- * caches or some other mechanism.
- */
-- (void)_evictObjectsToMakeSpaceForObjectWithCost: (NSUInteger)cost
+- (void) dealloc
 {
-  NSUInteger spaceNeeded = 0;
-  NSUInteger count = [_objects count];
-
-  if (_costLimit > 0 && _totalCost + cost > _costLimit)
+  if (GS_EXISTS_INTERNAL)
     {
-      spaceNeeded = _totalCost + cost - _costLimit;
-    }
+      unsigned	i;
 
-  // Only evict if we need the space.
-  if (count > 0 && (spaceNeeded > 0 || count >= _countLimit))
-    {
-      NSMutableArray *evictedKeys = nil;
-      // Round up slightly.
-      NSUInteger averageAccesses = (_totalAccesses / count * 0.2) + 1;
-      NSEnumerator *e = [_accesses objectEnumerator];
-      _GSCachedObject *obj;
-
-      if (_evictsObjectsWithDiscardedContent)
-	{
-	  evictedKeys = [[NSMutableArray alloc] init];
-	}
-      while (nil != (obj = [e nextObject]))
-	{
-	  // Don't evict frequently accessed objects.
-	  if (obj->accessCount < averageAccesses && obj->isEvictable)
-	    {
-	      [obj->object discardContentIfPossible];
-	      if ([obj->object isContentDiscarded])
-		{
-		  NSUInteger cost = obj->cost;
-
-		  // Evicted objects have no cost.
-		  obj->cost = 0;
-		  // Don't try evicting this again in future; it's gone already.
-		  obj->isEvictable = NO;
-		  // Remove this object as well as its contents if required
-		  if (_evictsObjectsWithDiscardedContent)
-		    {
-		      [evictedKeys addObject: obj->key];
-		    }
-		  _totalCost -= cost;
-		  // If we've freed enough space, give up
-		  if (cost > spaceNeeded)
-		    {
-		      break;
-		    }
-		  spaceNeeded -= cost;
-		}
-	    }
-	}
-      // Evict all of the objects whose content we have discarded if required
-      if (_evictsObjectsWithDiscardedContent)
+      empty(self, NO);
+      for (i = 0; i < STRIPES; i++)
 	{
-	  NSString *key;
+	  GSCacheStripe	*s = &internal->_stripes[i];
 
-	  e = [evictedKeys objectEnumerator];
-	  while (nil != (key = [e nextObject]))
-	    {
-	      [self removeObjectForKey: key];
-	    }
+	  GSIMapEmptyMap(&s->map);
+	  pthread_mutex_destroy(&s->lock);
 	}
-    [evictedKeys release];
+      NSZoneFree(NSDefaultMallocZone(), internal->_stripes);
+      [internal->_name release];
+      GS_DESTROY_INTERNAL(NSCache);
     }
-}
-
-- (void) dealloc
-{
-  [_name release];
-  [_objects release];
-  [_accesses release];
-  [super dealloc];
-}
-@end
-
-@implementation _GSCachedObject
-- (void)dealloc
-{
-  [object release];
-  [key release];
   [super dealloc];
 }
 @end
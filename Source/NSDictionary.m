@@ -62,6 +62,34 @@ static BOOL GSMacOSXCompatiblePropertyLists(void)
 
 extern void	GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 
+/* State for concurrent enumeration of the contents of a dictionary using
+ * GSPrivateParallelFilter(), where each position is an index into the
+ * keys and objects.
+ */
+typedef struct {
+  id				*keys;
+  id				*objects;
+  GSKeysAndObjectsEnumeratorBlock	enumerator;
+  GSKeysAndObjectsPredicateBlock	predicate;
+} GSDictionaryConcurrency;
+
+static BOOL
+concurrentEnumerate(void *context, NSUInteger index, BOOL *stop)
+{
+  GSDictionaryConcurrency	*c = (GSDictionaryConcurrency*)context;
+
+  CALL_BLOCK(c->enumerator, c->keys[index], c->objects[index], stop);
+  return NO;
+}
+
+static BOOL
+concurrentTest(void *context, NSUInteger index, BOOL *stop)
+{
+  GSDictionaryConcurrency	*c = (GSDictionaryConcurrency*)context;
+
+  return CALL_BLOCK(c->predicate, c->keys[index], c->objects[index], stop);
+}
+
 
 static Class NSArray_class;
 static Class NSDictionaryClass;
@@ -165,8 +193,8 @@ static SEL	appSel;
 {
   /*
    * NOTE: According to the Cocoa documentation, NSEnumerationReverse is
-   * undefined for NSDictionary. NSEnumerationConcurrent will be handled through
-   * the GS_DISPATCH_* macros if libdispatch is available.
+   * undefined for NSDictionary. NSEnumerationConcurrent is handled by
+   * splitting the contents into chunks for the threads of the worker pool.
    */
    id<NSFastEnumeration> enumerator = [self keyEnumerator];
    SEL objectForKeySelector = @selector(objectForKey:);
@@ -174,6 +202,23 @@ static SEL	appSel;
    BLOCK_SCOPE BOOL shouldStop = NO;
    id obj;
 
+   if (opts & NSEnumerationConcurrent)
+     {
+       GSDictionaryConcurrency	c;
+       NSUInteger		count = [self count];
+       NSUInteger		found;
+
+       GS_BEGINIDBUF(keys, count * 2);
+       c.keys = keys;
+       c.objects = keys + count;
+       c.enumerator = aBlock;
+       [self getObjects: c.objects andKeys: c.keys];
+       GSPrivateParallelFilter(count, &c, concurrentEnumerate,
+	 &shouldStop, &found);
+       GS_ENDIDBUF();
+       return;
+     }
+
    GS_DISPATCH_CREATE_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
    FOR_IN(id, key, enumerator)
      obj = (*objectForKey)(self, objectForKeySelector, key);
@@ -1019,42 +1064,43 @@ compareIt(id o1, id o2, void* context)
   IMP addObject = [buildSet methodForSelector: addObjectSelector];
   NSSet *resultSet = nil;
   id obj = nil;
-  BLOCK_SCOPE NSLock *setLock = nil;
 
   if (opts & NSEnumerationConcurrent)
     {
-      setLock = [NSLock new];
+      GSDictionaryConcurrency	c;
+      NSUInteger		count = [self count];
+      NSUInteger		*hits;
+      NSUInteger		found;
+      NSUInteger		i;
+
+      GS_BEGINIDBUF(keys, count * 2);
+      c.keys = keys;
+      c.objects = keys + count;
+      c.predicate = aPredicate;
+      [self getObjects: c.objects andKeys: c.keys];
+      hits = GSPrivateParallelFilter(count, &c, concurrentTest,
+	&shouldStop, &found);
+      for (i = 0; i < found; i++)
+	{
+	  addObject(buildSet, addObjectSelector, keys[hits[i]]);
+	}
+      free(hits);
+      GS_ENDIDBUF();
     }
-  GS_DISPATCH_CREATE_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
-  FOR_IN(id, key, enumerator)
-    obj = (*objectForKey)(self, objectForKeySelector, key);
-#if (__has_feature(blocks) && (GS_USE_LIBDISPATCH == 1))
-      dispatch_group_async(enumQueueGroup, enumQueue, ^(void){
-        if (shouldStop)
-          {
-	    return;
-          }
-        if (aPredicate(key, obj, &shouldStop))
-          {
-	    [setLock lock];
+  else
+    {
+      FOR_IN(id, key, enumerator)
+	obj = (*objectForKey)(self, objectForKeySelector, key);
+	if (CALL_BLOCK(aPredicate, key, obj, &shouldStop))
+	  {
 	    addObject(buildSet, addObjectSelector, key);
-	    [setLock unlock];
-          }
-    });
-#else
-    if (CALL_BLOCK(aPredicate, key, obj, &shouldStop))
-      {
-        addObject(buildSet, addObjectSelector, key);
-      }
-#endif
-
-    if (YES == shouldStop)
-      {
-	break;
-      }
-  END_FOR_IN(enumerator)
-  GS_DISPATCH_TEARDOWN_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
-  [setLock release];
+	  }
+	if (YES == shouldStop)
+	  {
+	    break;
+	  }
+      END_FOR_IN(enumerator)
+    }
   resultSet = [NSSet setWithSet: buildSet];
   [buildSet release];
   return resultSet;
@@ -1015,6 +1015,21 @@ GSTLSHandlePush(gnutls_transport_ptr_t handle, const void *buffer, size_t len)
               [d release];
             }
         }
+
+      /* Identify the server we are connecting to so that an earlier
+       * session with it may be resumed.
+       */
+      if (YES == isOutgoing && nil == [opts objectForKey: GSTLSServerAddress]
+        && nil != [self socketAddress] && nil != [self socketService])
+        {
+          NSMutableDictionary   *d = [opts mutableCopy];
+
+          [d setObject: [NSString stringWithFormat: @"%@:%@",
+            [self socketAddress], [self socketService]]
+                forKey: GSTLSServerAddress];
+          ASSIGNCOPY(opts, d);
+          [d release];
+        }
       [self setNonBlocking: YES];
       session = [[GSTLSSession alloc] initWithOptions: opts
                                             direction: isOutgoing
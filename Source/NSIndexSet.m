@@ -30,6 +30,7 @@
 #import	"Foundation/NSIndexSet.h"
 #import	"Foundation/NSException.h"
 #import "GSDispatch.h"
+#import "GSPrivate.h"
 
 #define	GSI_ARRAY_TYPE	NSRange
 
@@ -41,6 +42,44 @@
 #define	_array	((GSIArray)(self->_data))
 #define	_other	((GSIArray)(aSet->_data))
 
+/* State for concurrent enumeration of the indexes in a set using
+ * GSPrivateParallelFilter(), where each position is the number of the
+ * index within the ranges being enumerated.
+ */
+typedef struct {
+  NSRange			*ranges;
+  NSUInteger			*starts;	/* Position of each range */
+  NSUInteger			count;
+  GSIndexSetEnumerationBlock	enumerator;
+} GSIndexSetConcurrency;
+
+static BOOL
+concurrentEnumerate(void *context, NSUInteger position, BOOL *stop)
+{
+  GSIndexSetConcurrency	*c = (GSIndexSetConcurrency*)context;
+  NSUInteger		lower = 0;
+  NSUInteger		upper = c->count;
+
+  /* Find the last range starting at or before the position.
+   */
+  while (upper - lower > 1)
+    {
+      NSUInteger	pos = (upper + lower) / 2;
+
+      if (c->starts[pos] > position)
+	{
+	  upper = pos;
+	}
+      else
+	{
+	  lower = pos;
+	}
+    }
+  CALL_BLOCK(c->enumerator,
+    c->ranges[lower].location + position - c->starts[lower], stop);
+  return NO;
+}
+
 #ifdef	SANITY_CHECKS
 static void sanity(GSIArray array)
 {
@@ -896,6 +935,58 @@ static NSUInteger posForIndex(GSIArray array, NSUInteger index)
       endArrayIndex = GSIArrayCount(_array) - 1;
     }
 
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSIndexSetConcurrency	state;
+      NSUInteger		total = 0;
+      NSUInteger		found;
+      NSUInteger		n;
+
+      if (endArrayIndex < startArrayIndex)
+	{
+	  return;
+	}
+
+      /* Make a list of the parts of our ranges which lie within the range
+       * to be enumerated, so that positions may be mapped to indexes.
+       */
+      state.count = 0;
+      state.enumerator = aBlock;
+      n = endArrayIndex - startArrayIndex + 1;
+      state.ranges = malloc(n * (sizeof(NSRange) + sizeof(NSUInteger)));
+      if (0 == state.ranges)
+	{
+	  [NSException raise: NSMallocException
+		      format: @"Unable to allocate enumeration ranges"];
+	}
+      state.starts = (NSUInteger*)(state.ranges + n);
+      for (i = startArrayIndex; i <= endArrayIndex; i++)
+	{
+	  NSRange	r;
+
+	  r = NSIntersectionRange(GSIArrayItemAtIndex(_array, i).ext, range);
+	  if (r.length > 0)
+	    {
+	      state.ranges[state.count] = r;
+	      state.starts[state.count++] = total;
+	      total += r.length;
+	    }
+	}
+      NS_DURING
+	{
+	  GSPrivateParallelFilter(total, &state, concurrentEnumerate,
+	    &shouldStop, &found);
+	}
+      NS_HANDLER
+	{
+	  free(state.ranges);
+	  [localException raise];
+	}
+      NS_ENDHANDLER
+      free(state.ranges);
+      return;
+    }
+
   if (isReverse)
     {
       i = endArrayIndex;
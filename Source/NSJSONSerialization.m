@@ -73,6 +73,19 @@ typedef struct ParserStateStruct
    * Error value, if this parser is currently in an error state, nil otherwise.
    */
   NSError *error;
+  /**
+   * The UTF-8 input, when parsing directly from bytes rather than through
+   * the character buffer.
+   */
+  const uint8_t *bytes;
+  /**
+   * The number of bytes of UTF-8 input.
+   */
+  NSUInteger bytesLength;
+  /**
+   * The index of the parser within the UTF-8 input.
+   */
+  NSUInteger bytesIndex;
 } ParserState;
 
 /**
@@ -640,407 +653,2226 @@ parseValue(ParserState *state)
   return nil;
 }
 
+/*
+ * UTF-8 parser.
+ *
+ * When the input is UTF-8 data (by far the most common case) the functions
+ * below parse it directly from the bytes of the NSData, rather than first
+ * converting the whole document to an NSString and then fetching it back
+ * BUFFER_SIZE characters at a time.  Runs of plain characters inside strings
+ * are located several bytes at a time and each string is created directly
+ * from the bytes of its run when it contains no escapes.
+ * The grammar accepted is the same as that of the character based parser
+ * above.
+ */
+
+#if	defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /**
- * We have to autodetect the string encoding.  We know that it is some
- * unicode encoding, which may or may not contain a BOM.  If it contains a
- * BOM, then we need to skip that.  If it doesn't, then we need to work out
- * the encoding from the position of the NULLs.  The first two characters are
- * guaranteed to be ASCII in a JSON stream, so we can work out the encoding
- * from the pattern of NULLs.
+ * Returns the current byte, or 0 at the end of the input.
  */
-static void
-getEncoding(const uint8_t BOM[4], ParserState *state)
+static inline uint8_t
+currentByte(ParserState *state)
 {
-  NSStringEncoding enc = NSUTF8StringEncoding;
-  int BOMLength = 0;
+  return (state->bytesIndex < state->bytesLength)
+    ? state->bytes[state->bytesIndex] : 0;
+}
 
-  if ((BOM[0] == 0xEF) && (BOM[1] == 0xBB) && (BOM[2] == 0xBF))
-    {
-      BOMLength = 3;
-    }
-  else if ((BOM[0] == 0xFE) && (BOM[1] == 0xFF))
-    {
-      BOMLength = 2;
-      enc = NSUTF16BigEndianStringEncoding;
-    }
-  else if ((BOM[0] == 0xFF) && (BOM[1] == 0xFE))
+/**
+ * Consumes a byte and returns the next one.
+ */
+static inline uint8_t
+consumeByte(ParserState *state)
+{
+  state->bytesIndex++;
+  return currentByte(state);
+}
+
+/**
+ * Consumes whitespace and returns the first byte which is not a space.
+ */
+static inline uint8_t
+consumeByteSpace(ParserState *state)
+{
+  const uint8_t	*b = state->bytes;
+  NSUInteger	i = state->bytesIndex;
+  NSUInteger	l = state->bytesLength;
+
+  while (i < l && (b[i] == ' ' || (b[i] >= '\t' && b[i] <= '\r')))
     {
-      if ((BOM[2] == 0) && (BOM[3] == 0))
-        {
-          BOMLength = 4;
-          enc = NSUTF32LittleEndianStringEncoding;
-        }
-      else
-        {
-          BOMLength = 2;
-          enc = NSUTF16LittleEndianStringEncoding;
-        }
+      i++;
     }
-  else if ((BOM[0] == 0)
-    && (BOM[1] == 0)
-    && (BOM[2] == 0xFE)
-    && (BOM[3] == 0xFF))
+  state->bytesIndex = i;
+  return (i < l) ? b[i] : 0;
+}
+
+/**
+ * Sets an error state for the byte at the current position.
+ */
+static void
+parseByteError(ParserState *state)
+{
+  NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:
+    _(@"JSON Parse error"), NSLocalizedDescriptionKey,
+    _(([NSString stringWithFormat: @"Unexpected character %c at index %"PRIdPTR,
+        (char)currentByte(state), (NSInteger)state->bytesIndex])), 
+      NSLocalizedFailureReasonErrorKey,
+    nil];
+  state->error = [NSError errorWithDomain: NSCocoaErrorDomain
+                                     code: 0
+                                 userInfo: userInfo];
+  [userInfo release];
+}
+
+/**
+ * Returns the number of bytes from ptr (but before end) which precede the
+ * first quote, backslash or control character.  Sets *high to YES if any
+ * of those bytes is not ASCII.
+ */
+static inline NSUInteger
+plainSpan(const uint8_t *ptr, const uint8_t *end, BOOL *high)
+{
+  const uint8_t	*start = ptr;
+
+#if	defined(__SSE2__)
+  const __m128i	quote = _mm_set1_epi8('"');
+  const __m128i	slash = _mm_set1_epi8('\\');
+  const __m128i	ctrl = _mm_set1_epi8(0x1f);
+
+  while (end - ptr >= 16)
     {
-      BOMLength = 4;
-      enc = NSUTF32BigEndianStringEncoding;
+      __m128i	v = _mm_loadu_si128((const __m128i*)(const void*)ptr);
+      __m128i	m;
+      int	stop;
+      int	top;
+
+      m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash));
+      /* A byte is a control character if it is unchanged by taking the
+       * (unsigned) maximum of it and 0x1f.
+       */
+      m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+      stop = _mm_movemask_epi8(m);
+      top = _mm_movemask_epi8(v);
+      if (stop != 0)
+	{
+	  int	n = __builtin_ctz(stop);
+
+	  if ((top & ((1 << n) - 1)) != 0)
+	    {
+	      *high = YES;
+	    }
+	  return (ptr - start) + n;
+	}
+      if (top != 0)
+	{
+	  *high = YES;
+	}
+      ptr += 16;
     }
-  else if (BOM[0] == 0)
+#else
+  /* Examine eight bytes at a time, stopping at the first word containing
+   * a byte which needs attention.
+   */
+  const uint64_t	ones = 0x0101010101010101ULL;
+  const uint64_t	tops = 0x8080808080808080ULL;
+
+  while (end - ptr >= 8)
     {
-      // TODO: Throw an error if this doesn't match one of the patterns
-      // described in section 3 of RFC4627
-      if (BOM[1] == 0)
-        {
-          enc = NSUTF32BigEndianStringEncoding;
-        }
-      else
-        {
-          enc = NSUTF16BigEndianStringEncoding;
-        }
+      uint64_t	w;
+      uint64_t	q;
+      uint64_t	s;
+
+      memcpy(&w, ptr, 8);
+      q = w ^ (ones * '"');
+      s = w ^ (ones * '\\');
+      if ((((q - ones) & ~q) | ((s - ones) & ~s) | ((w - ones * 0x20) & ~w))
+	& tops)
+	{
+	  break;
+	}
+      if (w & tops)
+	{
+	  *high = YES;
+	}
+      ptr += 8;
     }
-  else if (BOM[1] == 0)
+#endif
+  while (ptr < end && *ptr != '"' && *ptr != '\\' && *ptr >= 0x20)
     {
-      if (BOM[2] == 0)
-        {
-          enc = NSUTF32LittleEndianStringEncoding;
-        }
-      else
-        {
-          enc = NSUTF16LittleEndianStringEncoding;
-        }
+      if (*ptr & 0x80)
+	{
+	  *high = YES;
+	}
+      ptr++;
     }
-  state->enc = enc;
-  state->BOMLength = BOMLength;
+  return ptr - start;
 }
 
 /**
- * Classes that are permitted to be written.  
+ * Creates a string from bytes which are UTF-8 except that they may contain
+ * three byte encodings of unpaired surrogates (which \u escapes can
+ * produce but UTF-8 does not permit).
  */
-static Class NSArrayClass;
-static Class NSDictionaryClass;
-static Class NSNullClass;
-static Class NSNumberClass;
-static Class NSStringClass;
+static NSString*
+newStringFromSurrogateBytes(const uint8_t *b, NSUInteger length, BOOL mutable)
+{
+  unichar	*chars;
+  NSUInteger	count = 0;
+  NSUInteger	i = 0;
+  NSString	*str;
 
-static NSMutableCharacterSet *escapeSet;
+  chars = NSZoneMalloc(NSDefaultMallocZone(), sizeof(unichar) * length);
+  while (i < length)
+    {
+      uint8_t	c = b[i];
 
-static inline void
-writeTabs(NSMutableString *output, NSInteger tabs)
-{
-  NSInteger i;
+      if (c < 0x80)
+	{
+	  chars[count++] = c;
+	  i += 1;
+	}
+      else if ((c & 0xe0) == 0xc0 && i + 1 < length)
+	{
+	  chars[count++] = ((c & 0x1f) << 6) | (b[i+1] & 0x3f);
+	  i += 2;
+	}
+      else if ((c & 0xf0) == 0xe0 && i + 2 < length)
+	{
+	  chars[count++] = ((c & 0x0f) << 12) | ((b[i+1] & 0x3f) << 6)
+	    | (b[i+2] & 0x3f);
+	  i += 3;
+	}
+      else if ((c & 0xf8) == 0xf0 && i + 3 < length)
+	{
+	  uint32_t	u;
 
-  for (i = 0 ; i < tabs ; i++)
+	  u = ((c & 0x07) << 18) | ((b[i+1] & 0x3f) << 12)
+	    | ((b[i+2] & 0x3f) << 6) | (b[i+3] & 0x3f);
+	  u -= 0x10000;
+	  chars[count++] = 0xd800 + (u >> 10);
+	  chars[count++] = 0xdc00 + (u & 0x3ff);
+	  i += 4;
+	}
+      else
+	{
+	  NSZoneFree(NSDefaultMallocZone(), chars);
+	  return nil;
+	}
+    }
+  if (mutable)
     {
-      [output appendString: @"\t"];
+      str = [[NSMutableString alloc] initWithCharacters: chars length: count];
     }
-}
-
-static inline void
-writeNewline(NSMutableString *output, NSInteger tabs)
-{
-  if (tabs >= 0)
+  else
     {
-      [output appendString: @"\n"];
+      str = [[NSString alloc] initWithCharacters: chars length: count];
     }
+  NSZoneFree(NSDefaultMallocZone(), chars);
+  return str;
 }
 
-static BOOL
-writeObject(id obj, NSMutableString *output, NSInteger tabs)
+/**
+ * Parse a string, as defined by RFC4627, section 2.5
+ */
+NS_RETURNS_RETAINED static NSString*
+parseByteString(ParserState *state)
 {
-  if ([obj isKindOfClass: NSArrayClass])
+  const uint8_t		*b = state->bytes;
+  const uint8_t		*end = b + state->bytesLength;
+  const uint8_t		*ptr;
+  uint8_t		buffer[BUFFER_SIZE * 4];
+  uint8_t		*out = buffer;
+  NSUInteger		capacity = sizeof(buffer);
+  NSUInteger		used = 0;
+  BOOL			high = NO;
+  BOOL			surrogates = NO;
+  BOOL			escaped = NO;
+  NSString		*str;
+  NSUInteger		n;
+
+  if (state->error)
     {
-      BOOL writeComma = NO;
-      [output appendString: @"["];
-      FOR_IN(id, o, obj)
-        if (writeComma)
-          {
-            [output appendString: @","];
-          }
-        writeComma = YES;
-        writeNewline(output, tabs);
-        writeTabs(output, tabs);
-        writeObject(o, output, tabs + 1);
-      END_FOR_IN(obj)
-      writeNewline(output, tabs);
-      writeTabs(output, tabs);
-      [output appendString: @"]"];
+      return nil;
     }
-  else if ([obj isKindOfClass: NSDictionaryClass])
+  if (currentByte(state) != '"')
     {
-      BOOL writeComma = NO;
-      [output appendString: @"{"];
-      FOR_IN(id, o, obj)
-        // Keys in dictionaries must be strings
-        if (![o isKindOfClass: NSStringClass]) { return NO; }
-        if (writeComma)
-          {
-            [output appendString: @","];
-          }
-        writeComma = YES;
-        writeNewline(output, tabs);
-        writeTabs(output, tabs);
-        writeObject(o, output, tabs + 1);
-        [output appendString: @": "];
-        writeObject([obj objectForKey: o], output, tabs + 1);
-      END_FOR_IN(obj)
-      writeNewline(output, tabs);
-      writeTabs(output, tabs);
-      [output appendString: @"}"];
+      parseByteError(state);
+      return nil;
     }
-  else if ([obj isKindOfClass: NSStringClass])
-    {
-      NSString  *str = (NSString*)obj;
-      unsigned	length = [str length];
-
-      if (length == 0)
-        {
-          [output appendString: @"\"\""];
-        }
-      else
-        {
-          unsigned	size = 2;
-          unichar	*from;
-          unsigned	i = 0;
-          unichar	*to;
-          unsigned	j = 0;
+  ptr = b + state->bytesIndex + 1;
 
-          from = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * length);
-          [str getCharacters: from];
+  /* Make room for at least x more bytes in the output buffer.
+   */
+#define	RESERVE(x) do {\
+  if (used + (x) > capacity)\
+    {\
+      while (used + (x) > capacity) capacity *= 2;\
+      if (out == buffer)\
+	{\
+	  out = NSZoneMalloc(NSDefaultMallocZone(), capacity);\
+	  memcpy(out, buffer, used);\
+	}\
+      else\
+	{\
+	  out = NSZoneRealloc(NSDefaultMallocZone(), out, capacity);\
+	}\
+    }} while (0)
 
-          for (i = 0; i < length; i++)
-            {
-              unichar	c = from[i];
+  for (;;)
+    {
+      n = plainSpan(ptr, end, &high);
+      if (ptr + n < end && '"' == ptr[n] && NO == escaped)
+	{
+	  /* The common case ... no escapes in the string, so it can be made
+	   * directly from the bytes in the input.
+	   */
+	  used = n;
+	  break;
+	}
+      RESERVE(n);
+      memcpy(out + used, ptr, n);
+      used += n;
+      ptr += n;
+      if (ptr >= end || *ptr < 0x20)
+	{
+	  /* Unterminated string; the character based parser would have
+	   * accepted a control character, so we do too.
+	   */
+	  if (ptr < end && *ptr != 0)
+	    {
+	      RESERVE(1);
+	      out[used++] = *ptr++;
+	      escaped = YES;
+	      continue;
+	    }
+	  state->bytesIndex = ptr - b;
+	  if (out != buffer)
+	    {
+	      NSZoneFree(NSDefaultMallocZone(), out);
+	    }
+	  parseByteError(state);
+	  return nil;
+	}
+      if ('"' == *ptr)
+	{
+	  n = 0;
+	  break;
+	}
+      /* A backslash escape.
+       */
+      escaped = YES;
+      ptr++;
+      RESERVE(4);
+      switch (ptr < end ? *ptr : 0)
+	{
+	  case '"':
+	  case '\\':
+	  case '/':
+	    out[used++] = *ptr++;
+	    break;
+	  case 'b': out[used++] = 0x08; ptr++; break;
+	  case 'f': out[used++] = 0x0c; ptr++; break;
+	  case 'n': out[used++] = 0x0a; ptr++; break;
+	  case 'r': out[used++] = 0x0d; ptr++; break;
+	  case 't': out[used++] = 0x09; ptr++; break;
+	  case 'u':
+	    {
+	      uint32_t	u = 0;
+	      unsigned	i;
 
-              if (c == '"' || c == '\\' || c == '\b'
-                || c == '\f' || c == '\n' || c == '\r' || c == '\t')
-                {
-                  size += 2;
-                }
-              else if (c < 0x20)
-                {
-                  size += 6;
-                }
-              else
-                {
-                  size++;
-                }
-            }
+	      ptr++;
+	      for (i = 0; i < 4; i++)
+		{
+		  uint8_t	c = (ptr < end) ? *ptr : 0;
 
-          to = NSZoneMalloc (NSDefaultMallocZone(), sizeof(unichar) * size);
-          to[j++] = '"';
-          for (i = 0; i < length; i++)
-            {
-              unichar	c = from[i];
+		  if (!isxdigit(c))
+		    {
+		      state->bytesIndex = ptr - b;
+		      if (out != buffer)
+			{
+			  NSZoneFree(NSDefaultMallocZone(), out);
+			}
+		      parseByteError(state);
+		      return nil;
+		    }
+		  u = (u << 4) | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+		  ptr++;
+		}
+	      /* Combine a surrogate pair into a single character.
+	       */
+	      if (u >= 0xd800 && u < 0xdc00 && end - ptr >= 6
+		&& '\\' == ptr[0] && 'u' == ptr[1]
+		&& isxdigit(ptr[2]) && isxdigit(ptr[3])
+		&& isxdigit(ptr[4]) && isxdigit(ptr[5]))
+		{
+		  char		hex[5];
+		  uint32_t	l;
 
-              if (c == '"' || c == '\\' || c == '\b'
-                || c == '\f' || c == '\n' || c == '\r' || c == '\t')
-                {
-                  to[j++] = '\\';
-                  switch (c)
-                    {
-                      case '\\': to[j++] = '\\'; break;
-                      case '\b': to[j++] = 'b'; break;
-                      case '\f': to[j++] = 'f'; break;
-                      case '\n': to[j++] = 'n'; break;
-                      case '\r': to[j++] = 'r'; break;
-                      case '\t': to[j++] = 't'; break;
-                      default: to[j++] = '"'; break;
-                    }
-                }
-              else if (c < 0x20)
-                {
-                  char	buf[5];
-
-                  to[j++] = '\\';
-                  to[j++] = 'u';
-                  sprintf(buf, "%04x", c);
-                  to[j++] = buf[0];
-                  to[j++] = buf[1];
-                  to[j++] = buf[2];
-                  to[j++] = buf[3];
-                }
-              else
-                {
-                  to[j++] = c;
-                }
-            }
-          to[j] = '"';
-          str = [[NSStringClass alloc] initWithCharacters: to length: size];
-          NSZoneFree (NSDefaultMallocZone (), to);
-          NSZoneFree (NSDefaultMallocZone (), from);
-          [output appendString: str];
-          [str release];
-        }
+		  memcpy(hex, ptr + 2, 4);
+		  hex[4] = '\0';
+		  l = (uint32_t)strtol(hex, 0, 16);
+		  if (l >= 0xdc00 && l < 0xe000)
+		    {
+		      u = 0x10000 + ((u - 0xd800) << 10) + (l - 0xdc00);
+		      ptr += 6;
+		    }
+		}
+	      if (u < 0x80)
+		{
+		  out[used++] = u;
+		}
+	      else if (u < 0x800)
+		{
+		  out[used++] = 0xc0 | (u >> 6);
+		  out[used++] = 0x80 | (u & 0x3f);
+		}
+	      else if (u < 0x10000)
+		{
+		  if (u >= 0xd800 && u < 0xe000)
+		    {
+		      surrogates = YES;
+		    }
+		  out[used++] = 0xe0 | (u >> 12);
+		  out[used++] = 0x80 | ((u >> 6) & 0x3f);
+		  out[used++] = 0x80 | (u & 0x3f);
+		}
+	      else
+		{
+		  out[used++] = 0xf0 | (u >> 18);
+		  out[used++] = 0x80 | ((u >> 12) & 0x3f);
+		  out[used++] = 0x80 | ((u >> 6) & 0x3f);
+		  out[used++] = 0x80 | (u & 0x3f);
+		}
+	      high = high || (u >= 0x80);
+	    }
+	    break;
+	  default:
+	    /* Unknown escapes are taken literally (as by the character
+	     * based parser).
+	     */
+	    if (ptr < end)
+	      {
+		out[used++] = *ptr++;
+		high = high || (ptr[-1] >= 0x80);
+	      }
+	    break;
+	}
     }
-  else if (obj == boolN)
+#undef	RESERVE
+
+  if (NO == escaped)
     {
-      [output appendString: @"false"];
+      /* Create the string from the input with no intermediate copy.
+       */
+      str = [(state->mutableStrings ? (id)[NSMutableString alloc]
+	: (id)[NSString alloc])
+	initWithBytes: ptr
+	       length: used
+	     encoding: high ? NSUTF8StringEncoding : NSASCIIStringEncoding];
+      ptr += used;
     }
-  else if (obj == boolY)
+  else if (YES == surrogates)
     {
-      [output appendString: @"true"];
+      str = newStringFromSurrogateBytes(out, used, state->mutableStrings);
     }
-  else if ([obj isKindOfClass: NSNumberClass])
+  else
     {
-      [output appendFormat: @"%g", [obj doubleValue]];
+      str = [(state->mutableStrings ? (id)[NSMutableString alloc]
+	: (id)[NSString alloc])
+	initWithBytes: out
+	       length: used
+	     encoding: high ? NSUTF8StringEncoding : NSASCIIStringEncoding];
     }
-  else if ([obj isKindOfClass: NSNullClass])
+  if (out != buffer)
     {
-      [output appendString: @"null"];
+      NSZoneFree(NSDefaultMallocZone(), out);
     }
-  else
+  if (nil == str)
     {
-      return NO;
+      // Not valid UTF-8
+      parseByteError(state);
+      return nil;
     }
-  return YES;
+  // Consume the trailing "
+  state->bytesIndex = (ptr - b) + 1;
+  return str;
 }
 
-@implementation NSJSONSerialization
-+ (void) initialize
+/**
+ * Parses a number, as defined by section 2.4 of the JSON specification.
+ */
+NS_RETURNS_RETAINED static NSNumber*
+parseByteNumber(ParserState *state)
 {
-  NSNullClass = [NSNull class];
-  NSArrayClass = [NSArray class];
-  NSStringClass = [NSString class];
-  NSDictionaryClass = [NSDictionary class];
+  const uint8_t	*b = state->bytes;
+  NSUInteger	l = state->bytesLength;
+  NSUInteger	start = state->bytesIndex;
+  NSUInteger	i = start;
+  BOOL		simple = YES;
+  BOOL		negative = NO;
+  uint64_t	value = 0;
+  unsigned	digits = 0;
+  double	num;
+
+  // JSON numbers must start with a - or a digit
+  if (i >= l || !(b[i] == '-' || isdigit(b[i])))
+    {
+      parseByteError(state);
+      return nil;
+    }
+  if ('-' == b[i])
+    {
+      negative = YES;
+      i++;
+    }
+  // Read as many digits as we see
+  while (i < l && isdigit(b[i]))
+    {
+      value = value * 10 + (b[i++] - '0');
+      digits++;
+    }
+  // Parse the fractional component, if there is one
+  if (i < l && '.' == b[i])
+    {
+      simple = NO;
+      i++;
+      while (i < l && isdigit(b[i]))
+	{
+	  i++;
+	}
+    }
+  // parse the exponent if there is one
+  if (i < l && 'e' == tolower(b[i]))
+    {
+      simple = NO;
+      i++;
+      if (i < l && (b[i] == '-' || b[i] == '+' || isdigit(b[i])))
+	{
+	  i++;
+	}
+      while (i < l && isdigit(b[i]))
+	{
+	  i++;
+	}
+    }
+  if (YES == simple && digits > 0 && digits <= 18)
+    {
+      /* An integer small enough to be converted without rounding.
+       */
+      num = (double)value;
+      if (negative)
+	{
+	  num = -num;
+	}
+    }
+  else
+    {
+      char		numberBuffer[128];
+      char		*number = numberBuffer;
+      NSUInteger	size = i - start;
+
+      /* The input is not nul terminated, so strtod() must be given a copy.
+       */
+      if (size >= sizeof(numberBuffer))
+	{
+	  number = malloc(size + 1);
+	}
+      memcpy(number, b + start, size);
+      number[size] = '\0';
+      num = strtod(number, 0);
+      if (number != numberBuffer)
+	{
+	  free(number);
+	}
+    }
+  state->bytesIndex = i;
+  return [[NSNumber alloc] initWithDouble: num];
+}
+
+NS_RETURNS_RETAINED static id parseByteValue(ParserState *state);
+
+/**
+ * Parse an array, as described by section 2.3 of RFC 4627.
+ */
+NS_RETURNS_RETAINED static NSArray*
+parseByteArray(ParserState *state)
+{
+  uint8_t		c = consumeByteSpace(state);
+  NSMutableArray	*array;
+
+  if (c != '[')
+    {
+      parseByteError(state);
+      return nil;
+    }
+  // Eat the [
+  consumeByte(state);
+  array = [NSMutableArray new];
+  c = consumeByteSpace(state);
+  while (c != ']')
+    {
+      // If this fails, it will already set the error, so we don't have to.
+      id obj = parseByteValue(state);
+      if (nil == obj)
+        {
+          [array release];
+          return nil;
+        }
+      [array addObject: obj];
+      [obj release];
+      c = consumeByteSpace(state);
+      if (c == ',')
+        {
+          consumeByte(state);
+          c = consumeByteSpace(state);
+        }
+    }
+  // Eat the trailing ]
+  consumeByte(state);
+  if (!state->mutableContainers)
+    {
+      array = [array makeImmutableCopyOnFail: YES];
+    }
+  return array;
+}
+
+NS_RETURNS_RETAINED static NSDictionary*
+parseByteObject(ParserState *state)
+{
+  uint8_t		c = consumeByteSpace(state);
+  NSMutableDictionary	*dict;
+
+  if (c != '{')
+    {
+      parseByteError(state);
+      return nil;
+    }
+  // Eat the {
+  consumeByte(state);
+  dict = [NSMutableDictionary new];
+  c = consumeByteSpace(state);
+  while (c != '}')
+    {
+      id key = parseByteString(state);
+      id obj;
+
+      if (nil == key)
+        {
+          [dict release];
+          return nil;
+        }
+      c = consumeByteSpace(state);
+      if (':' != c)
+        {
+          [key release];
+          [dict release];
+          parseByteError(state);
+          return nil;
+        }
+      // Eat the :
+      consumeByte(state);
+      obj = parseByteValue(state);
+      if (nil == obj)
+        {
+          [key release];
+          [dict release];
+          return nil;
+        }
+      [dict setObject: obj forKey: key];
+      [key release];
+      [obj release];
+      c = consumeByteSpace(state);
+      if (c == ',')
+        {
+          consumeByte(state);
+        }
+      c = consumeByteSpace(state);
+    }
+  // Eat the trailing }
+  consumeByte(state);
+  if (!state->mutableContainers)
+    {
+      dict = [dict makeImmutableCopyOnFail: YES];
+    }
+  return dict;
+}
+
+/**
+ * Checks for a literal name at the current position and consumes it.
+ */
+static inline BOOL
+consumeByteLiteral(ParserState *state, const char *name, NSUInteger length)
+{
+  NSUInteger	available = state->bytesLength - state->bytesIndex;
+
+  if (available >= length
+    && memcmp(state->bytes + state->bytesIndex, name, length) == 0)
+    {
+      state->bytesIndex += length;
+      return YES;
+    }
+  if (available < length
+    && memcmp(state->bytes + state->bytesIndex, name, available) == 0)
+    {
+      /* The input ends part way through the name, so report the error
+       * at the end of the input.
+       */
+      state->bytesIndex = state->bytesLength;
+    }
+  return NO;
+}
+
+/**
+ * Parses a JSON value, as defined by RFC4627, section 2.1.
+ */
+NS_RETURNS_RETAINED static id
+parseByteValue(ParserState *state)
+{
+  uint8_t c;
+
+  if (state->error) { return nil; };
+  c = consumeByteSpace(state);
+  switch (c)
+    {
+      case '"':
+        return parseByteString(state);
+      case '[':
+        return parseByteArray(state);
+      case '{':
+        return parseByteObject(state);
+      case '-':
+      case '0' ... '9':
+        return parseByteNumber(state);
+      case 'n':
+	if (consumeByteLiteral(state, "null", 4))
+	  {
+	    return [[NSNull null] retain];
+	  }
+	break;
+      case 't':
+	if (consumeByteLiteral(state, "true", 4))
+	  {
+	    return [boolY retain];
+	  }
+	break;
+      case 'f':
+	if (consumeByteLiteral(state, "false", 5))
+	  {
+	    return [boolN retain];
+	  }
+	break;
+    }
+  parseByteError(state);
+  return nil;
+}
+
+/**
+ * We have to autodetect the string encoding.  We know that it is some
+ * unicode encoding, which may or may not contain a BOM.  If it contains a
+ * BOM, then we need to skip that.  If it doesn't, then we need to work out
+ * the encoding from the position of the NULLs.  The first two characters are
+ * guaranteed to be ASCII in a JSON stream, so we can work out the encoding
+ * from the pattern of NULLs.
+ */
+static void
+getEncoding(const uint8_t BOM[4], ParserState *state)
+{
+  NSStringEncoding enc = NSUTF8StringEncoding;
+  int BOMLength = 0;
+
+  if ((BOM[0] == 0xEF) && (BOM[1] == 0xBB) && (BOM[2] == 0xBF))
+    {
+      BOMLength = 3;
+    }
+  else if ((BOM[0] == 0xFE) && (BOM[1] == 0xFF))
+    {
+      BOMLength = 2;
+      enc = NSUTF16BigEndianStringEncoding;
+    }
+  else if ((BOM[0] == 0xFF) && (BOM[1] == 0xFE))
+    {
+      if ((BOM[2] == 0) && (BOM[3] == 0))
+        {
+          BOMLength = 4;
+          enc = NSUTF32LittleEndianStringEncoding;
+        }
+      else
+        {
+          BOMLength = 2;
+          enc = NSUTF16LittleEndianStringEncoding;
+        }
+    }
+  else if ((BOM[0] == 0)
+    && (BOM[1] == 0)
+    && (BOM[2] == 0xFE)
+    && (BOM[3] == 0xFF))
+    {
+      BOMLength = 4;
+      enc = NSUTF32BigEndianStringEncoding;
+    }
+  else if (BOM[0] == 0)
+    {
+      // TODO: Throw an error if this doesn't match one of the patterns
+      // described in section 3 of RFC4627
+      if (BOM[1] == 0)
+        {
+          enc = NSUTF32BigEndianStringEncoding;
+        }
+      else
+        {
+          enc = NSUTF16BigEndianStringEncoding;
+        }
+    }
+  else if (BOM[1] == 0)
+    {
+      if (BOM[2] == 0)
+        {
+          enc = NSUTF32LittleEndianStringEncoding;
+        }
+      else
+        {
+          enc = NSUTF16LittleEndianStringEncoding;
+        }
+    }
+  state->enc = enc;
+  state->BOMLength = BOMLength;
+}
+
+/**
+ * Classes that are permitted to be written.  
+ */
+static Class NSArrayClass;
+static Class NSDictionaryClass;
+static Class NSNullClass;
+static Class NSNumberClass;
+static Class NSStringClass;
+
+/**
+ * The number of bytes of output buffered before it is written to the
+ * destination.
+ */
+#define WRITER_SIZE 8192
+
+/**
+ * Structure for storing the state of the writer.  Output is encoded as UTF-8
+ * into a fixed size buffer, which is appended to data or written to stream
+ * whenever it fills, so writing to a stream needs a bounded amount of memory
+ * however large the object being written.
+ */
+typedef struct
+{
+  /**
+   * Buffer used to collect output.
+   */
+  uint8_t buffer[WRITER_SIZE];
+  /**
+   * The number of bytes stored within the buffer.
+   */
+  NSUInteger used;
+  /**
+   * Data to which output is appended, if writing to memory.
+   */
+  NSMutableData *data;
+  /**
+   * Stream to which output is written, if writing to a stream.
+   */
+  NSOutputStream *stream;
+  /**
+   * The total number of bytes written to the stream.
+   */
+  NSInteger written;
+  /**
+   * Set if the stream could not be written to.
+   */
+  BOOL failed;
+} WriterState;
+
+/**
+ * Writes length bytes to the stream, waiting for space to become available
+ * if the stream is non-blocking and is full.
+ */
+static void
+writeToStream(WriterState *w, const uint8_t *bytes, NSUInteger length)
+{
+  while (length > 0 && NO == w->failed)
+    {
+      NSInteger	wrote = [w->stream write: bytes maxLength: length];
+
+      if (wrote > 0)
+	{
+	  bytes += wrote;
+	  length -= wrote;
+	  w->written += wrote;
+	}
+      else
+	{
+	  NSStreamStatus	s = [w->stream streamStatus];
+
+	  if (s == NSStreamStatusError || s == NSStreamStatusClosed
+	    || s == NSStreamStatusAtEnd || s == NSStreamStatusNotOpen)
+	    {
+	      w->failed = YES;
+	    }
+	  else
+	    {
+	      NSDate	*limit;
+
+	      /* The stream is full ... let the run loop handle its events
+	       * until it has space again.  If the stream is not scheduled
+	       * the run loop may have nothing to do, so sleep briefly too.
+	       */
+	      limit = [[NSDate alloc] initWithTimeIntervalSinceNow: 0.01];
+	      if (NO == [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+						 beforeDate: limit])
+		{
+		  [NSThread sleepUntilDate: limit];
+		}
+	      [limit release];
+	    }
+	}
+    }
+}
+
+/**
+ * Sends the buffered output to its destination.
+ */
+static void
+flushWriter(WriterState *w)
+{
+  if (w->used > 0)
+    {
+      if (nil != w->stream)
+	{
+	  writeToStream(w, w->buffer, w->used);
+	}
+      else
+	{
+	  [w->data appendBytes: w->buffer length: w->used];
+	}
+      w->used = 0;
+    }
+}
+
+static inline void
+writeBytes(WriterState *w, const void *bytes, NSUInteger length)
+{
+  if (NULL == w)
+    {
+      return;
+    }
+  if (w->used + length > WRITER_SIZE)
+    {
+      flushWriter(w);
+      if (length > WRITER_SIZE)
+	{
+	  if (nil != w->stream)
+	    {
+	      writeToStream(w, bytes, length);
+	    }
+	  else
+	    {
+	      [w->data appendBytes: bytes length: length];
+	    }
+	  return;
+	}
+    }
+  memcpy(w->buffer + w->used, bytes, length);
+  w->used += length;
+}
+
+static inline void
+writeByte(WriterState *w, uint8_t c)
+{
+  if (NULL == w)
+    {
+      return;
+    }
+  if (w->used == WRITER_SIZE)
+    {
+      flushWriter(w);
+    }
+  w->buffer[w->used++] = c;
+}
+
+static inline void
+writeTabs(WriterState *w, NSInteger tabs)
+{
+  NSInteger i;
+
+  for (i = 0 ; i < tabs ; i++)
+    {
+      writeByte(w, '\t');
+    }
+}
+
+static inline void
+writeNewline(WriterState *w, NSInteger tabs)
+{
+  if (tabs >= 0)
+    {
+      writeByte(w, '\n');
+    }
+}
+
+/**
+ * Writes the escape sequence for a character which may not appear in a
+ * JSON string as itself.
+ */
+static inline void
+writeEscape(WriterState *w, unichar c)
+{
+  char	buf[8];
+
+  switch (c)
+    {
+      case '"': writeBytes(w, "\\\"", 2); break;
+      case '\\': writeBytes(w, "\\\\", 2); break;
+      case '\b': writeBytes(w, "\\b", 2); break;
+      case '\f': writeBytes(w, "\\f", 2); break;
+      case '\n': writeBytes(w, "\\n", 2); break;
+      case '\r': writeBytes(w, "\\r", 2); break;
+      case '\t': writeBytes(w, "\\t", 2); break;
+      default:
+	snprintf(buf, sizeof(buf), "\\u%04x", c);
+	writeBytes(w, buf, 6);
+	break;
+    }
+}
+
+/**
+ * Writes UTF-8 string contents, escaping as required.  Runs of characters
+ * which need no escaping are located several bytes at a time and copied
+ * to the output as they are.
+ */
+static void
+writeUTF8(WriterState *w, const uint8_t *ptr, NSUInteger length)
+{
+  const uint8_t	*end = ptr + length;
+  BOOL		high = NO;
+
+  while (ptr < end)
+    {
+      NSUInteger	n = plainSpan(ptr, end, &high);
+
+      writeBytes(w, ptr, n);
+      ptr += n;
+      if (ptr < end)
+	{
+	  writeEscape(w, *ptr++);
+	}
+    }
+}
+
+/**
+ * Writes string contents a chunk of characters at a time, converting them
+ * to UTF-8 and escaping as required.
+ */
+static void
+writeCharacters(WriterState *w, NSString *str, NSUInteger length)
+{
+  unichar	chars[BUFFER_SIZE * 4];
+  uint8_t	bytes[BUFFER_SIZE * 12 + 4];
+  unichar	pending = 0;	// A high surrogate from the previous chunk
+  NSUInteger	index = 0;
+
+  while (index < length)
+    {
+      NSUInteger	count = length - index;
+      NSUInteger	used = 0;
+      NSUInteger	i;
+
+      if (count > BUFFER_SIZE * 4)
+	{
+	  count = BUFFER_SIZE * 4;
+	}
+      [str getCharacters: chars range: NSMakeRange(index, count)];
+      index += count;
+      for (i = 0; i < count; i++)
+	{
+	  uint32_t	u = chars[i];
+
+	  if (pending != 0)
+	    {
+	      if (u >= 0xdc00 && u < 0xe000)
+		{
+		  u = 0x10000 + ((pending - 0xd800) << 10) + (u - 0xdc00);
+		  pending = 0;
+		}
+	      else
+		{
+		  /* An unpaired surrogate can't be represented in UTF-8,
+		   * so it is written as an escape.
+		   */
+		  writeBytes(w, bytes, used);
+		  used = 0;
+		  writeEscape(w, pending);
+		  pending = 0;
+		}
+	    }
+	  if (u < 0x80)
+	    {
+	      if (u == '"' || u == '\\' || u < 0x20)
+		{
+		  writeBytes(w, bytes, used);
+		  used = 0;
+		  writeEscape(w, u);
+		}
+	      else
+		{
+		  bytes[used++] = u;
+		}
+	    }
+	  else if (u < 0x800)
+	    {
+	      bytes[used++] = 0xc0 | (u >> 6);
+	      bytes[used++] = 0x80 | (u & 0x3f);
+	    }
+	  else if (u >= 0xd800 && u < 0xdc00)
+	    {
+	      pending = u;
+	    }
+	  else if (u >= 0xdc00 && u < 0xe000)
+	    {
+	      writeBytes(w, bytes, used);
+	      used = 0;
+	      writeEscape(w, u);
+	    }
+	  else if (u < 0x10000)
+	    {
+	      bytes[used++] = 0xe0 | (u >> 12);
+	      bytes[used++] = 0x80 | ((u >> 6) & 0x3f);
+	      bytes[used++] = 0x80 | (u & 0x3f);
+	    }
+	  else
+	    {
+	      bytes[used++] = 0xf0 | (u >> 18);
+	      bytes[used++] = 0x80 | ((u >> 12) & 0x3f);
+	      bytes[used++] = 0x80 | ((u >> 6) & 0x3f);
+	      bytes[used++] = 0x80 | (u & 0x3f);
+	    }
+	}
+      writeBytes(w, bytes, used);
+    }
+  if (pending != 0)
+    {
+      writeEscape(w, pending);
+    }
+}
+
+static void
+writeString(WriterState *w, NSString *str)
+{
+  NSUInteger	length = [str length];
+
+  writeByte(w, '"');
+  if (length > 0)
+    {
+      if ([str fastestEncoding] != NSUnicodeStringEncoding
+	&& length <= WRITER_SIZE)
+	{
+	  char		buffer[WRITER_SIZE * 2 + 1];
+
+	  /* The string holds 8-bit characters (ASCII or Latin-1), which can
+	   * be copied out as UTF-8 without going through unichars, and then
+	   * scanned for characters needing to be escaped.
+	   */
+	  if ([str getCString: buffer
+		    maxLength: sizeof(buffer)
+		     encoding: NSUTF8StringEncoding])
+	    {
+	      NSUInteger	n = strlen(buffer);
+
+	      /* UTF-8 is never shorter than the 8-bit characters, so a
+	       * short result means the string contains a nul character.
+	       */
+	      if (n >= length)
+		{
+		  writeUTF8(w, (const uint8_t*)buffer, n);
+		  writeByte(w, '"');
+		  return;
+		}
+	    }
+	}
+      writeCharacters(w, str, length);
+    }
+  writeByte(w, '"');
+}
+
+/**
+ * Writes obj to w (or just checks that it can be written if w is NULL).
+ */
+static BOOL
+writeObject(id obj, WriterState *w, NSInteger tabs)
+{
+  if (NULL != w && YES == w->failed)
+    {
+      return NO;
+    }
+  if ([obj isKindOfClass: NSArrayClass])
+    {
+      BOOL writeComma = NO;
+      writeByte(w, '[');
+      FOR_IN(id, o, obj)
+        if (writeComma)
+          {
+            writeByte(w, ',');
+          }
+        writeComma = YES;
+        writeNewline(w, tabs);
+        writeTabs(w, tabs);
+        if (NO == writeObject(o, w, tabs + 1))
+          {
+            return NO;
+          }
+      END_FOR_IN(obj)
+      writeNewline(w, tabs);
+      writeTabs(w, tabs);
+      writeByte(w, ']');
+    }
+  else if ([obj isKindOfClass: NSDictionaryClass])
+    {
+      BOOL writeComma = NO;
+      writeByte(w, '{');
+      FOR_IN(id, o, obj)
+        // Keys in dictionaries must be strings
+        if (![o isKindOfClass: NSStringClass]) { return NO; }
+        if (writeComma)
+          {
+            writeByte(w, ',');
+          }
+        writeComma = YES;
+        writeNewline(w, tabs);
+        writeTabs(w, tabs);
+        writeObject(o, w, tabs + 1);
+        writeBytes(w, ": ", 2);
+        if (NO == writeObject([obj objectForKey: o], w, tabs + 1))
+          {
+            return NO;
+          }
+      END_FOR_IN(obj)
+      writeNewline(w, tabs);
+      writeTabs(w, tabs);
+      writeByte(w, '}');
+    }
+  else if ([obj isKindOfClass: NSStringClass])
+    {
+      if (NULL != w)
+        {
+          writeString(w, obj);
+        }
+    }
+  else if (obj == boolN)
+    {
+      writeBytes(w, "false", 5);
+    }
+  else if (obj == boolY)
+    {
+      writeBytes(w, "true", 4);
+    }
+  else if ([obj isKindOfClass: NSNumberClass])
+    {
+      if (NULL != w)
+        {
+          char	buf[32];
+          int	len;
+
+          len = snprintf(buf, sizeof(buf), "%g", [obj doubleValue]);
+          writeBytes(w, buf, len);
+        }
+    }
+  else if ([obj isKindOfClass: NSNullClass])
+    {
+      writeBytes(w, "null", 4);
+    }
+  else
+    {
+      return NO;
+    }
+  return (NULL == w || NO == w->failed) ? YES : NO;
+}
+
+@implementation NSJSONSerialization
++ (void) initialize
+{
+  NSNullClass = [NSNull class];
+  NSArrayClass = [NSArray class];
+  NSStringClass = [NSString class];
+  NSDictionaryClass = [NSDictionary class];
   NSNumberClass = [NSNumber class];
-  escapeSet = [NSMutableCharacterSet new];
-  [escapeSet addCharactersInString: @"\"\\"];
   boolN = [[NSNumber alloc] initWithBool: NO];
   boolY = [[NSNumber alloc] initWithBool: YES];
 }
 
-+ (NSData*) dataWithJSONObject: (id)obj
-                       options: (NSJSONWritingOptions)opt
-                         error: (NSError **)error
++ (NSData*) dataWithJSONObject: (id)obj
+                       options: (NSJSONWritingOptions)opt
+                         error: (NSError **)error
+{
+  WriterState *w;
+  NSData *data = nil;
+  NSInteger tabs;
+
+  tabs = ((opt & NSJSONWritingPrettyPrinted) == NSJSONWritingPrettyPrinted) ?
+    0 : NSIntegerMin;
+  w = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(WriterState));
+  /* Allocate more space than we are likely to use so we just quickly claim
+   * a page and then give it back later
+   */
+  w->data = [[NSMutableData alloc] initWithCapacity: 4096];
+  if (writeObject(obj, w, tabs))
+    {
+      flushWriter(w);
+      data = [w->data autorelease];
+      w->data = nil;
+      if (NULL != error)
+        {
+          *error = nil;
+        }
+    }
+  else
+    {
+      [w->data release];
+      if (NULL != error)
+	{
+	  NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:
+	    _(@"JSON writing error"), NSLocalizedDescriptionKey,
+	    nil];
+	  *error = [NSError errorWithDomain: NSCocoaErrorDomain
+				       code: 0
+				   userInfo: userInfo];
+	  [userInfo release];
+	}
+    }
+  NSZoneFree(NSDefaultMallocZone(), w);
+  return data;
+}
+
++ (BOOL) isValidJSONObject: (id)obj
+{
+  return writeObject(obj, NULL, NSIntegerMin);
+}
+
++ (id) JSONObjectWithData: (NSData *)data
+                  options: (NSJSONReadingOptions)opt
+                    error: (NSError **)error
+{
+  uint8_t BOM[4];
+  ParserState p = { 0 };
+  id obj;
+
+  [data getBytes: BOM length: 4];
+  getEncoding(BOM, &p);
+  p.mutableContainers
+    = (opt & NSJSONReadingMutableContainers) == NSJSONReadingMutableContainers;
+  p.mutableStrings
+    = (opt & NSJSONReadingMutableLeaves) == NSJSONReadingMutableLeaves;
+  if (NSUTF8StringEncoding == p.enc)
+    {
+      p.bytes = (const uint8_t*)[data bytes] + p.BOMLength;
+      p.bytesLength = [data length] - p.BOMLength;
+      obj = parseByteValue(&p);
+    }
+  else
+    {
+      p.source = [[NSString alloc] initWithData: data encoding: p.enc];
+      p.updateBuffer = updateStringBuffer;
+      obj = parseValue(&p);
+      [p.source release];
+    }
+  if (NULL != error)
+    {
+      *error = p.error;
+    }
+  return [obj autorelease];
+}
+
++ (id) JSONObjectWithStream: (NSInputStream *)stream
+                    options: (NSJSONReadingOptions)opt
+                      error: (NSError **)error
+{
+  uint8_t BOM[4];
+  ParserState p = { 0 };
+  id obj;
+
+  // TODO: Handle failure here!
+  [stream read: (uint8_t*)BOM maxLength: 4];
+  getEncoding(BOM, &p);
+  p.mutableContainers
+    = (opt & NSJSONReadingMutableContainers) == NSJSONReadingMutableContainers;
+  p.mutableStrings
+    = (opt & NSJSONReadingMutableLeaves) == NSJSONReadingMutableLeaves;
+  if (p.BOMLength < 4)
+    {
+      p.source = [[NSString alloc] initWithBytesNoCopy: &BOM[p.BOMLength]
+                                                length: 4 - p.BOMLength
+                                              encoding: p.enc
+                                          freeWhenDone: NO];
+      updateStringBuffer(&p);
+      /* Negative source index because we are before the
+       * current point in the buffer
+       */
+      p.sourceIndex = p.BOMLength - 4;
+    }
+  p.source = stream;
+  p.updateBuffer = updateStreamBuffer;
+  obj = parseValue(&p);
+  // Consume any data in the stream that we've failed to read
+  updateStreamBuffer(&p);
+  if (NULL != error)
+    {
+      *error = p.error;
+    }
+  return [obj autorelease];
+}
+
++ (NSInteger) writeJSONObject: (id)obj
+                     toStream: (NSOutputStream *)stream
+                      options: (NSJSONWritingOptions)opt
+                        error: (NSError **)error
+{
+  WriterState *w;
+  NSInteger tabs;
+  NSInteger written;
+
+  tabs = ((opt & NSJSONWritingPrettyPrinted) == NSJSONWritingPrettyPrinted) ?
+    0 : NSIntegerMin;
+  /* Check the whole object first, so that nothing is written to the stream
+   * for an object which can't be represented as JSON.
+   */
+  if (NO == writeObject(obj, NULL, tabs))
+    {
+      if (NULL != error)
+	{
+	  NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:
+	    _(@"JSON writing error"), NSLocalizedDescriptionKey,
+	    nil];
+	  *error = [NSError errorWithDomain: NSCocoaErrorDomain
+				       code: 0
+				   userInfo: userInfo];
+	  [userInfo release];
+	}
+      return 0;
+    }
+
+  /* Output is written to the stream as it is produced, a buffer at a time,
+   * rather than producing the whole document in memory first.
+   */
+  w = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(WriterState));
+  w->stream = stream;
+  writeObject(obj, w, tabs);
+  flushWriter(w);
+  if (YES == w->failed)
+    {
+      if (NULL != error)
+        {
+          *error = [stream streamError];
+        }
+      written = 0;
+    }
+  else
+    {
+      if (NULL != error)
+        {
+          *error = nil;
+        }
+      written = w->written;
+    }
+  NSZoneFree(NSDefaultMallocZone(), w);
+  return written;
+}
+@end
+
+
+/* GSJSONReader is a pull parser built from the same byte level functions
+ * as +JSONObjectWithData:options:error:, but instead of parsing a whole
+ * document it stops after each token.  Only the bytes after the current
+ * position need to be kept, so input from a stream is held in a window
+ * which is refilled (discarding what has been consumed) whenever a token
+ * runs past its end; the token is then parsed again from its start.
+ * Input in any encoding other than UTF-8 is converted to UTF-8 first.
+ */
+
+/**
+ * The least number of bytes to read from a stream at once.
+ */
+#define READER_SIZE 65536
+
+/* How the key path of a value relates to the key paths which a reader has
+ * been restricted to.
+ */
+enum {
+  MatchNone = 0,	// Neither at nor above a wanted key path
+  MatchAbove,		// A prefix of a wanted key path
+  MatchWithin		// At or inside a wanted key path
+};
+
+/**
+ * An array or object enclosing the current position of a reader.
+ */
+typedef struct
+{
+  BOOL		object;		// An object rather than an array
+  BOOL		wantKey;	// Expecting a key or the end of the object
+  uint8_t	match;		// How the container itself matched
+  uint8_t	memberMatch;	// How the current member of an object matched
+  NSString	*key;		// The key of the current member of an object
+} ReaderLevel;
+
+typedef struct
+{
+  ParserState	p;
+  NSInputStream	*stream;	// Source of more input, or nil
+  NSMutableData	*window;	// The unconsumed input read from the stream
+  NSData	*data;		// The input when not reading from a stream
+  BOOL		eof;		// No more input can be read
+  GSJSONToken	token;		// The current token
+  id		value;		// The value of the current token
+  NSError	*error;
+  BOOL		pending;	// Positioned at the { or [ of the token
+  uint8_t	pendingMatch;	// How the pending container matched
+  uint8_t	rootMatch;	// How top level values match
+  NSUInteger	depth;		// The number of enclosing containers
+  NSUInteger	capacity;	// The space for enclosing containers
+  ReaderLevel	*levels;	// The enclosing containers
+  NSArray	*filters;	// Arrays of components of wanted key paths
+} ReaderState;
+
+/**
+ * Discards the consumed input and reads more from the stream.  Returns NO
+ * if there is no more input.
+ */
+static BOOL
+readerMore(ReaderState *r)
+{
+  NSUInteger	keep;
+  NSUInteger	size;
+  NSInteger	got;
+  uint8_t	*b;
+
+  if (nil == r->stream || YES == r->eof)
+    {
+      return NO;
+    }
+  keep = r->p.bytesLength - r->p.bytesIndex;
+  b = [r->window mutableBytes];
+  if (r->p.bytesIndex > 0)
+    {
+      memmove(b, b + r->p.bytesIndex, keep);
+      r->p.bytesIndex = 0;
+    }
+  /* The window only grows beyond twice READER_SIZE if a single token (or
+   * a value passed to -readValue) is larger than that.  It then at least
+   * doubles, so that a large value is parsed again only a logarithmic
+   * number of times.
+   */
+  size = (keep > READER_SIZE) ? keep : READER_SIZE;
+  if (keep + size > [r->window length])
+    {
+      [r->window setLength: keep + size];
+      b = [r->window mutableBytes];
+    }
+  got = [r->stream read: b + keep maxLength: size];
+  if (got <= 0)
+    {
+      if (got < 0 && nil == r->p.error)
+	{
+	  r->p.error = [r->stream streamError];
+	}
+      r->eof = YES;
+      got = 0;
+    }
+  r->p.bytes = b;
+  r->p.bytesLength = keep + got;
+  return (got > 0) ? YES : NO;
+}
+
+/**
+ * Makes sure that at least n bytes follow the current position, unless
+ * the end of the input is reached first.
+ */
+static inline void
+readerNeed(ReaderState *r, NSUInteger n)
+{
+  while (r->p.bytesLength - r->p.bytesIndex < n && YES == readerMore(r))
+    {
+      continue;
+    }
+}
+
+/**
+ * Consumes whitespace (reading more input as needed) and returns the
+ * first byte which is not a space, or 0 at the end of the input.
+ */
+static uint8_t
+readerSpace(ReaderState *r)
+{
+  for (;;)
+    {
+      consumeByteSpace(&r->p);
+      if (r->p.bytesIndex < r->p.bytesLength || NO == readerMore(r))
+	{
+	  break;
+	}
+    }
+  /* Make sure that a literal name is complete.
+   */
+  readerNeed(r, 8);
+  return currentByte(&r->p);
+}
+
+/**
+ * Calls parse to create the value at the current position.  If the value
+ * runs to the end of the input read so far it may be incomplete, so at
+ * least as much input again is read and it is parsed again.  The input
+ * held doubles each time, so the total work is linear in the size of the
+ * value.
+ */
+static id
+readerParse(ReaderState *r, id (*parse)(ParserState*))
+{
+  for (;;)
+    {
+      NSUInteger	start = r->p.bytesIndex;
+      id		obj = (*parse)(&r->p);
+
+      if (r->p.bytesIndex < r->p.bytesLength
+	|| nil == r->stream || YES == r->eof)
+	{
+	  return obj;
+	}
+      [obj release];
+      r->p.error = nil;
+      r->p.bytesIndex = start;
+      readerNeed(r, 2 * (r->p.bytesLength - start) + 1);
+    }
+}
+
+static inline BOOL
+isScalarByte(uint8_t c)
+{
+  return (isalnum(c) || '-' == c || '+' == c || '.' == c) ? YES : NO;
+}
+
+/**
+ * Skips the value at the current position without creating anything.
+ * Unlike readerParse() this never needs to go back, so consumed input is
+ * discarded as it goes and the value may be any size.
+ */
+static BOOL
+readerSkip(ReaderState *r)
+{
+  ParserState	*p = &r->p;
+  NSUInteger	depth = 0;
+
+  for (;;)
+    {
+      uint8_t	c = readerSpace(r);
+
+      switch (c)
+	{
+	  case '"':
+	    consumeByte(p);
+	    for (;;)
+	      {
+		BOOL	high = NO;
+
+		p->bytesIndex += plainSpan(p->bytes + p->bytesIndex,
+		  p->bytes + p->bytesLength, &high);
+		if (p->bytesIndex >= p->bytesLength)
+		  {
+		    if (NO == readerMore(r))
+		      {
+			parseByteError(p);
+			return NO;
+		      }
+		    continue;
+		  }
+		c = p->bytes[p->bytesIndex++];
+		if ('"' == c)
+		  {
+		    break;
+		  }
+		if ('\\' == c)
+		  {
+		    if (p->bytesIndex >= p->bytesLength && NO == readerMore(r))
+		      {
+			parseByteError(p);
+			return NO;
+		      }
+		    p->bytesIndex++;
+		  }
+		else if (0 == c)
+		  {
+		    p->bytesIndex--;
+		    parseByteError(p);
+		    return NO;
+		  }
+	      }
+	    break;
+	  case '{':
+	  case '[':
+	    depth++;
+	    consumeByte(p);
+	    continue;
+	  case '}':
+	  case ']':
+	    if (0 == depth)
+	      {
+		parseByteError(p);
+		return NO;
+	      }
+	    depth--;
+	    consumeByte(p);
+	    break;
+	  case ',':
+	  case ':':
+	    if (0 == depth)
+	      {
+		parseByteError(p);
+		return NO;
+	      }
+	    consumeByte(p);
+	    continue;
+	  default:
+	    if (NO == isScalarByte(c))
+	      {
+		parseByteError(p);
+		return NO;
+	      }
+	    for (;;)
+	      {
+		while (p->bytesIndex < p->bytesLength
+		  && YES == isScalarByte(p->bytes[p->bytesIndex]))
+		  {
+		    p->bytesIndex++;
+		  }
+		if (p->bytesIndex < p->bytesLength || NO == readerMore(r))
+		  {
+		    break;
+		  }
+	      }
+	    break;
+	}
+      if (0 == depth)
+	{
+	  return YES;
+	}
+    }
+}
+
+static void
+readerPush(ReaderState *r, BOOL object, uint8_t match)
+{
+  ReaderLevel	*l;
+
+  if (r->depth == r->capacity)
+    {
+      if (0 == r->capacity)
+	{
+	  r->capacity = 8;
+	  r->levels = NSZoneMalloc(NSDefaultMallocZone(),
+	    r->capacity * sizeof(ReaderLevel));
+	}
+      else
+	{
+	  r->capacity *= 2;
+	  r->levels = NSZoneRealloc(NSDefaultMallocZone(), r->levels,
+	    r->capacity * sizeof(ReaderLevel));
+	}
+    }
+  l = &r->levels[r->depth++];
+  l->object = object;
+  l->wantKey = object;
+  l->match = match;
+  l->memberMatch = match;
+  l->key = nil;
+}
+
+/**
+ * Records that a member of the innermost container has been completed.
+ */
+static inline void
+readerDone(ReaderState *r)
 {
-  /* Temporary string: allocate more space than we are likely to use so we just
-   * quickly claim a page and then give it back later
-   */
-  NSMutableString *str = [[NSMutableString alloc] initWithCapacity: 4096];
-  NSData *data = nil;
-  NSUInteger tabs;
+  if (r->depth > 0 && YES == r->levels[r->depth - 1].object)
+    {
+      r->levels[r->depth - 1].wantKey = YES;
+    }
+}
 
-  tabs = ((opt & NSJSONWritingPrettyPrinted) == NSJSONWritingPrettyPrinted) ?
-    0 : NSIntegerMin;
-  if (writeObject(obj, str, tabs))
+/**
+ * Removes the innermost container and returns how it matched.
+ */
+static uint8_t
+readerPop(ReaderState *r)
+{
+  ReaderLevel	*l = &r->levels[--r->depth];
+
+  DESTROY(l->key);
+  readerDone(r);
+  return l->match;
+}
+
+/**
+ * Returns how the key path ending at the key of the innermost container
+ * matches the wanted key paths.
+ */
+static uint8_t
+readerKeyMatch(ReaderState *r)
+{
+  uint8_t	best = MatchNone;
+  NSUInteger	count = [r->filters count];
+  NSUInteger	i;
+
+  for (i = 0; i < count; i++)
     {
-      data = [str dataUsingEncoding: NSUTF8StringEncoding];
-      if (NULL != error)
-        {
-          *error = nil;
-        }
+      NSArray		*f = [r->filters objectAtIndex: i];
+      NSUInteger	fc = [f count];
+      NSUInteger	j = 0;
+      NSUInteger	d;
+
+      for (d = 0; d < r->depth && j < fc; d++)
+	{
+	  ReaderLevel	*l = &r->levels[d];
+
+	  if (YES == l->object && nil != l->key)
+	    {
+	      if (NO == [l->key isEqualToString: [f objectAtIndex: j]])
+		{
+		  break;
+		}
+	      j++;
+	    }
+	}
+      if (j == fc)
+	{
+	  return MatchWithin;
+	}
+      if (d == r->depth)
+	{
+	  best = MatchAbove;
+	}
     }
-  else
+  return best;
+}
+
+static void
+readerFailed(ReaderState *r)
+{
+  r->token = GSJSONTokenNone;
+  r->pending = NO;
+  DESTROY(r->value);
+  if (nil == r->error)
     {
-      if (NULL != error)
+      ASSIGN(r->error, r->p.error);
+    }
+}
+
+@implementation GSJSONReader
++ (void) initialize
+{
+  if (self == [GSJSONReader class])
+    {
+      [NSJSONSerialization class];
+    }
+}
+
+- (void) dealloc
+{
+  ReaderState	*r = (ReaderState*)_state;
+
+  if (r != 0)
+    {
+      while (r->depth > 0)
 	{
-	  NSDictionary *userInfo = [[NSDictionary alloc] initWithObjectsAndKeys:
-	    _(@"JSON writing error"), NSLocalizedDescriptionKey,
-	    nil];
-	  *error = [NSError errorWithDomain: NSCocoaErrorDomain
-				       code: 0
-				   userInfo: userInfo];
+	  readerPop(r);
+	}
+      if (r->levels != 0)
+	{
+	  NSZoneFree(NSDefaultMallocZone(), r->levels);
 	}
+      DESTROY(r->stream);
+      DESTROY(r->window);
+      DESTROY(r->data);
+      DESTROY(r->value);
+      DESTROY(r->error);
+      DESTROY(r->filters);
+      NSZoneFree(NSDefaultMallocZone(), r);
     }
-  [str release];
-  return data;
+  [super dealloc];
 }
 
-+ (BOOL) isValidJSONObject: (id)obj
+- (NSUInteger) depth
 {
-  return writeObject(obj, nil, NSIntegerMin);
+  return ((ReaderState*)_state)->depth;
 }
 
-+ (id) JSONObjectWithData: (NSData *)data
-                  options: (NSJSONReadingOptions)opt
-                    error: (NSError **)error
+- (NSError*) error
 {
-  uint8_t BOM[4];
-  ParserState p = { 0 };
-  id obj;
+  return ((ReaderState*)_state)->error;
+}
 
-  [data getBytes: BOM length: 4];
-  getEncoding(BOM, &p);
-  p.source = [[NSString alloc] initWithData: data encoding: p.enc];
-  p.updateBuffer = updateStringBuffer;
-  p.mutableContainers
-    = (opt & NSJSONReadingMutableContainers) == NSJSONReadingMutableContainers;
-  p.mutableStrings
-    = (opt & NSJSONReadingMutableLeaves) == NSJSONReadingMutableLeaves;
-  obj = parseValue(&p);
-  [p.source release];
-  if (NULL != error)
+- (id) init
+{
+  return [self initWithData: nil options: 0];
+}
+
+- (id) initWithData: (NSData*)data
+	    options: (NSJSONReadingOptions)opt
+{
+  if (nil != (self = [super init]))
     {
-      *error = p.error;
+      ReaderState	*r;
+      uint8_t		BOM[4] = { 0 };
+      NSUInteger	length = [data length];
+      NSUInteger	skip;
+
+      r = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(ReaderState));
+      _state = r;
+      [data getBytes: BOM length: (length < 4) ? length : 4];
+      getEncoding(BOM, &r->p);
+      skip = r->p.BOMLength;
+      if (length > 0 && r->p.enc != NSUTF8StringEncoding)
+	{
+	  NSString	*s;
+
+	  s = [[NSString alloc] initWithData: data encoding: r->p.enc];
+	  data = [s dataUsingEncoding: NSUTF8StringEncoding];
+	  [s release];
+	  length = [data length];
+	  skip = (length >= 3
+	    && memcmp([data bytes], "\xef\xbb\xbf", 3) == 0) ? 3 : 0;
+	}
+      r->data = [data copy];
+      r->p.bytes = (const uint8_t*)[r->data bytes] + skip;
+      r->p.bytesLength = (length > skip) ? length - skip : 0;
+      r->p.mutableContainers = (opt & NSJSONReadingMutableContainers)
+	== NSJSONReadingMutableContainers;
+      r->p.mutableStrings = (opt & NSJSONReadingMutableLeaves)
+	== NSJSONReadingMutableLeaves;
+      r->eof = YES;
+      r->rootMatch = MatchWithin;
     }
-  return [obj autorelease];
+  return self;
 }
 
-+ (id) JSONObjectWithStream: (NSInputStream *)stream
-                    options: (NSJSONReadingOptions)opt
-                      error: (NSError **)error
+- (id) initWithStream: (NSInputStream*)stream
+	      options: (NSJSONReadingOptions)opt
 {
-  uint8_t BOM[4];
-  ParserState p = { 0 };
-  id obj;
+  if (nil != (self = [super init]))
+    {
+      ReaderState	*r;
+      uint8_t		BOM[4] = { 0 };
 
-  // TODO: Handle failure here!
-  [stream read: (uint8_t*)BOM maxLength: 4];
-  getEncoding(BOM, &p);
-  p.mutableContainers
-    = (opt & NSJSONReadingMutableContainers) == NSJSONReadingMutableContainers;
-  p.mutableStrings
-    = (opt & NSJSONReadingMutableLeaves) == NSJSONReadingMutableLeaves;
-  if (p.BOMLength < 4)
+      r = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(ReaderState));
+      _state = r;
+      r->stream = [stream retain];
+      r->window = [[NSMutableData alloc] initWithLength: READER_SIZE];
+      r->p.bytes = [r->window mutableBytes];
+      r->p.mutableContainers = (opt & NSJSONReadingMutableContainers)
+	== NSJSONReadingMutableContainers;
+      r->p.mutableStrings = (opt & NSJSONReadingMutableLeaves)
+	== NSJSONReadingMutableLeaves;
+      r->rootMatch = MatchWithin;
+      readerNeed(r, 4);
+      memcpy(BOM, r->p.bytes, (r->p.bytesLength < 4) ? r->p.bytesLength : 4);
+      getEncoding(BOM, &r->p);
+      if (r->p.bytesLength > 0 && r->p.enc != NSUTF8StringEncoding)
+	{
+	  NSString	*s;
+	  NSData	*d;
+
+	  /* Read everything and convert it to UTF-8 in one go.
+	   */
+	  while (YES == readerMore(r))
+	    {
+	      continue;
+	    }
+	  s = [[NSString alloc] initWithBytes: r->p.bytes
+				       length: r->p.bytesLength
+				     encoding: r->p.enc];
+	  d = [s dataUsingEncoding: NSUTF8StringEncoding];
+	  [s release];
+	  [r->window setLength: 0];
+	  [r->window appendData: d];
+	  r->p.bytes = [r->window mutableBytes];
+	  r->p.bytesLength = [d length];
+	  r->p.BOMLength = (r->p.bytesLength >= 3
+	    && memcmp(r->p.bytes, "\xef\xbb\xbf", 3) == 0) ? 3 : 0;
+	}
+      r->p.bytesIndex = r->p.BOMLength;
+    }
+  return self;
+}
+
+- (NSString*) key
+{
+  ReaderState	*r = (ReaderState*)_state;
+
+  if (r->depth > 0 && YES == r->levels[r->depth - 1].object)
     {
-      p.source = [[NSString alloc] initWithBytesNoCopy: &BOM[p.BOMLength]
-                                                length: 4 - p.BOMLength
-                                              encoding: p.enc
-                                          freeWhenDone: NO];
-      updateStringBuffer(&p);
-      /* Negative source index because we are before the
-       * current point in the buffer
+      return r->levels[r->depth - 1].key;
+    }
+  return nil;
+}
+
+- (NSString*) keyPath
+{
+  ReaderState		*r = (ReaderState*)_state;
+  NSMutableString	*path = [NSMutableString string];
+  NSUInteger		d;
+
+  for (d = 0; d < r->depth; d++)
+    {
+      ReaderLevel	*l = &r->levels[d];
+
+      if (YES == l->object && nil != l->key)
+	{
+	  if ([path length] > 0)
+	    {
+	      [path appendString: @"."];
+	    }
+	  [path appendString: l->key];
+	}
+    }
+  return path;
+}
+
+- (GSJSONToken) nextToken
+{
+  ReaderState	*r = (ReaderState*)_state;
+
+  DESTROY(r->value);
+  r->token = GSJSONTokenNone;
+  if (YES == r->pending)
+    {
+      BOOL	object = ('{' == currentByte(&r->p)) ? YES : NO;
+
+      consumeByte(&r->p);
+      r->pending = NO;
+      readerPush(r, object, r->pendingMatch);
+    }
+
+  while (nil == r->p.error)
+    {
+      ReaderLevel	*l = (r->depth > 0) ? &r->levels[r->depth - 1] : 0;
+      uint8_t		c = readerSpace(r);
+      uint8_t		m;
+
+      if (0 == l)
+	{
+	  if (r->p.bytesIndex >= r->p.bytesLength)
+	    {
+	      /* The end of the input, after any number of top level values.
+	       */
+	      if (nil != r->p.error)
+		{
+		  break;
+		}
+	      return GSJSONTokenNone;
+	    }
+	  m = r->rootMatch;
+	}
+      else if (YES == l->object && YES == l->wantKey)
+	{
+	  NSString	*key;
+
+	  if ('}' == c)
+	    {
+	      consumeByte(&r->p);
+	      if (MatchWithin == readerPop(r))
+		{
+		  return r->token = GSJSONTokenEndObject;
+		}
+	      continue;
+	    }
+	  if (',' == c)
+	    {
+	      consumeByte(&r->p);
+	      continue;
+	    }
+	  key = readerParse(r, (id (*)(ParserState*))parseByteString);
+	  if (nil == key)
+	    {
+	      break;
+	    }
+	  if (readerSpace(r) != ':')
+	    {
+	      [key release];
+	      parseByteError(&r->p);
+	      break;
+	    }
+	  consumeByte(&r->p);
+	  [l->key release];
+	  l->key = key;
+	  l->wantKey = NO;
+	  if (MatchWithin == l->match)
+	    {
+	      l->memberMatch = MatchWithin;
+	    }
+	  else
+	    {
+	      l->memberMatch = readerKeyMatch(r);
+	    }
+	  if (MatchWithin == l->memberMatch)
+	    {
+	      r->value = [key retain];
+	      return r->token = GSJSONTokenKey;
+	    }
+	  continue;
+	}
+      else if (YES == l->object)
+	{
+	  m = l->memberMatch;
+	}
+      else
+	{
+	  if (']' == c)
+	    {
+	      consumeByte(&r->p);
+	      if (MatchWithin == readerPop(r))
+		{
+		  return r->token = GSJSONTokenEndArray;
+		}
+	      continue;
+	    }
+	  if (',' == c)
+	    {
+	      consumeByte(&r->p);
+	      continue;
+	    }
+	  m = l->match;
+	}
+
+      /* At the start of a value.
        */
-      p.sourceIndex = p.BOMLength - 4;
+      if (MatchNone == m)
+	{
+	  if (NO == readerSkip(r))
+	    {
+	      break;
+	    }
+	  readerDone(r);
+	  continue;
+	}
+      if ('{' == c || '[' == c)
+	{
+	  if (MatchWithin == m)
+	    {
+	      /* Leave the container unopened until the next call, so that
+	       * it can be read or skipped as a whole instead.
+	       */
+	      r->pending = YES;
+	      r->pendingMatch = m;
+	      return r->token = ('{' == c)
+		? GSJSONTokenStartObject : GSJSONTokenStartArray;
+	    }
+	  consumeByte(&r->p);
+	  readerPush(r, ('{' == c) ? YES : NO, m);
+	  continue;
+	}
+      if (MatchAbove == m)
+	{
+	  /* A scalar can't contain the wanted key path.
+	   */
+	  if (NO == readerSkip(r))
+	    {
+	      break;
+	    }
+	  readerDone(r);
+	  continue;
+	}
+      r->value = readerParse(r, parseByteValue);
+      if (nil == r->value)
+	{
+	  break;
+	}
+      readerDone(r);
+      switch (c)
+	{
+	  case '"': r->token = GSJSONTokenString; break;
+	  case 't':
+	  case 'f': r->token = GSJSONTokenBoolean; break;
+	  case 'n': r->token = GSJSONTokenNull; break;
+	  default: r->token = GSJSONTokenNumber; break;
+	}
+      return r->token;
     }
-  p.source = stream;
-  p.updateBuffer = updateStreamBuffer;
-  obj = parseValue(&p);
-  // Consume any data in the stream that we've failed to read
-  updateStreamBuffer(&p);
-  if (NULL != error)
+  readerFailed(r);
+  return GSJSONTokenNone;
+}
+
+- (id) readValue
+{
+  ReaderState	*r = (ReaderState*)_state;
+
+  if (YES == r->pending)
     {
-      *error = p.error;
+      r->pending = NO;
+      r->value = readerParse(r, parseByteValue);
+      if (nil == r->value)
+	{
+	  readerFailed(r);
+	  return nil;
+	}
+      readerDone(r);
     }
-  return [obj autorelease];
+  return r->value;
 }
 
-+ (NSInteger) writeJSONObject: (id)obj
-                     toStream: (NSOutputStream *)stream
-                      options: (NSJSONWritingOptions)opt
-                        error: (NSError **)error
+- (void) setKeyPaths: (NSArray*)paths
 {
-  NSData *data = [self dataWithJSONObject: obj options: opt error: error];
+  ReaderState		*r = (ReaderState*)_state;
+  NSMutableArray	*filters = nil;
+  NSUInteger		count = [paths count];
+  NSUInteger		i;
 
-  if (nil != data)
+  r->rootMatch = MatchWithin;
+  if (count > 0)
     {
-      const char *bytes = [data bytes];
-      NSUInteger toWrite = [data length];
+      filters = [NSMutableArray arrayWithCapacity: count];
+      for (i = 0; i < count; i++)
+	{
+	  NSString	*path = [paths objectAtIndex: i];
 
-      while (toWrite > 0)
-        {
-          NSInteger wrote = [stream write: (uint8_t*)bytes maxLength: toWrite];
-          bytes += wrote;
-          toWrite -= wrote;
-          if (0 == wrote)
-            {
-              if (NULL != error)
-                {
-                  *error = [stream streamError];
-                }
-              return 0;
-            }
-        }
+	  if ([path length] == 0)
+	    {
+	      /* Everything is within the empty key path.
+	       */
+	      filters = nil;
+	      break;
+	    }
+	  [filters addObject: [path componentsSeparatedByString: @"."]];
+	}
+      if (nil != filters)
+	{
+	  r->rootMatch = MatchAbove;
+	}
+    }
+  ASSIGN(r->filters, filters);
+}
+
+- (void) skipValue
+{
+  ReaderState	*r = (ReaderState*)_state;
+
+  if (YES == r->pending)
+    {
+      r->pending = NO;
+      if (YES == readerSkip(r))
+	{
+	  readerDone(r);
+	}
+      else
+	{
+	  readerFailed(r);
+	}
     }
-  return [data length];
+}
+
+- (id) value
+{
+  return ((ReaderState*)_state)->value;
 }
 @end
@@ -35,6 +35,9 @@
 #import "Foundation/NSNull.h"
 #import "Foundation/NSSet.h"
 #import "Foundation/NSValue.h"
+#import "GSPrivate.h"
+
+#include <pthread.h>
 
 /* For the NSKeyValueMutableArray and NSKeyValueMutableSet classes
  */
@@ -77,13 +80,236 @@ static inline void setupCompat()
 
 #endif
 
+/*
+ * The accessors found for a key are remembered in a per-thread cache keyed
+ * by the class of the receiver and the key, so that repeated access to the
+ * same key of objects of the same class costs a hash probe rather than
+ * building selector names, asking whether the object responds to them and
+ * searching its instance variables.  The real class of the receiver is
+ * used (rather than -class) so that classes replaced for key-value
+ * observing get entries of their own.
+ * Methods may be added to or replaced in a class at any time, by GNUstep
+ * or directly through the runtime, which may give a key a different
+ * accessor.  So each entry records the selectors which were looked for
+ * before the accessor was found (and which the class did not implement)
+ * and the implementation of the accessor method, and an entry is only
+ * used while the class still implements none of those selectors and has
+ * the same implementation for the accessor.  In addition, all entries are
+ * discarded when GNUstep adds methods to a class (see GSPrivateKVCFlush()).
+ * Only accessors which are real methods or instance variables are cached;
+ * undefined keys and methods which are forwarded are looked up every time.
+ */
+#define	KVC_CACHE_SIZE	128	/* Entries for getting and setting.	*/
+#define	KVC_KEY_MAX	39	/* Length of the longest key cached.	*/
+#define	KVC_CHECK_MAX	5	/* Most selectors looked for in a search.	*/
+
+typedef struct {
+  Class		cls;
+  unsigned	generation;	/* Valid if equal to kvcGeneration.	*/
+  uint32_t	hash;
+  unsigned	length;
+  GSKVCAccessor	accessor;
+  unsigned	checks;		/* Number of selectors in 'absent'.	*/
+  SEL		absent[KVC_CHECK_MAX];
+  char		key[KVC_KEY_MAX + 1];
+} KVCEntry;
+
+typedef struct {
+  KVCEntry	get[KVC_CACHE_SIZE];
+  KVCEntry	set[KVC_CACHE_SIZE];
+} KVCCache;
+
+/* The selectors looked for while searching for an accessor.
+ */
+typedef struct {
+  unsigned	count;
+  SEL		sels[KVC_CHECK_MAX];
+  BOOL		record;		/* Register and record the selectors.	*/
+} KVCSearch;
+
+static pthread_key_t		kvcKey;
+static pthread_once_t		kvcOnce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t		kvcLock = PTHREAD_MUTEX_INITIALIZER;
+static volatile unsigned	kvcGeneration = 1;
+
 static void
-SetValueForKey(NSObject *self, id anObject, const char *key, unsigned size)
+kvcSetup(void)
 {
-  SEL		sel = 0;
-  const char	*type = 0;
-  int		off = 0;
+  pthread_key_create(&kvcKey, free);
+}
 
+void
+GSPrivateKVCFlush(void)
+{
+  pthread_mutex_lock(&kvcLock);
+  if (++kvcGeneration == 0)
+    {
+      kvcGeneration = 1;	// Zero is used by empty entries
+    }
+  pthread_mutex_unlock(&kvcLock);
+}
+
+/* Returns YES if the class still has the methods it had when the entry
+ * was stored (see the comment above).
+ */
+static inline BOOL
+kvcCurrent(KVCEntry *e, Class cls)
+{
+  unsigned	i;
+
+  for (i = 0; i < e->checks; i++)
+    {
+      if (YES == class_respondsToSelector(cls, e->absent[i]))
+	{
+	  return NO;
+	}
+    }
+  if (e->accessor.sel != 0
+    && class_getMethodImplementation(cls, e->accessor.sel) != e->accessor.imp)
+    {
+      return NO;
+    }
+  return YES;
+}
+
+/* Finds the slot for key in the getter or setter cache of the current
+ * thread.  Returns YES if the slot holds a valid entry for the key, NO if
+ * the accessor must be looked up (and may then be stored in the slot).
+ * Sets *slot to 0 if the key can't be cached.
+ */
+static inline BOOL
+kvcFind(BOOL set, Class cls, const char *key, unsigned length,
+  KVCEntry **slot, uint32_t *hash, unsigned *generation)
+{
+  KVCCache	*c;
+  KVCEntry	*e;
+  uint32_t	h;
+
+  *slot = 0;
+  if (length > KVC_KEY_MAX)
+    {
+      return NO;
+    }
+  pthread_once(&kvcOnce, kvcSetup);
+  c = (KVCCache*)pthread_getspecific(kvcKey);
+  if (0 == c)
+    {
+      if (0 == (c = calloc(1, sizeof(KVCCache))))
+	{
+	  return NO;
+	}
+      pthread_setspecific(kvcKey, c);
+    }
+  h = GSPrivateHash((uint32_t)(((uintptr_t)cls) >> 3), key, length);
+  e = &(set ? c->set : c->get)[h & (KVC_CACHE_SIZE - 1)];
+  *slot = e;
+  *hash = h;
+  *generation = kvcGeneration;
+  return (e->generation == *generation && e->cls == cls && e->hash == h
+    && e->length == length && memcmp(e->key, key, length) == 0
+    && YES == kvcCurrent(e, cls)) ? YES : NO;
+}
+
+/* Stores the accessor found for key in slot.  Must be passed the hash and
+ * generation from kvcFind() as methods may have been added since then.
+ * The slot is filled completely, as it may have been used for a different
+ * key while the accessor was being found.
+ * Fills in the implementation and value type of an accessor method.
+ */
+static void
+kvcStore(KVCEntry *slot, BOOL set, Class cls, const char *key,
+  unsigned length, uint32_t hash, unsigned generation, GSKVCAccessor *a,
+  KVCSearch *search)
+{
+  if (a->sel != 0)
+    {
+      Method		m = class_getInstanceMethod(cls, a->sel);
+      NSMethodSignature	*sig;
+      const char	*t;
+
+      if (0 == m)
+	{
+	  return;	// Forwarded ... look it up each time
+	}
+      sig = [NSMethodSignature signatureWithObjCTypes:
+	method_getTypeEncoding(m)];
+      if (YES == set)
+	{
+	  t = ([sig numberOfArguments] == 3)
+	    ? [sig getArgumentTypeAtIndex: 2] : "";
+	}
+      else
+	{
+	  t = ([sig numberOfArguments] == 2) ? [sig methodReturnType] : "";
+	}
+      a->imp = method_getImplementation(m);
+      a->kind = *t;
+      a->type = 0;
+      a->size = 0;
+      a->offset = 0;
+    }
+  else if (0 == a->type)
+    {
+      return;	// Undefined key
+    }
+  else
+    {
+      a->imp = 0;
+      a->kind = *a->type;
+    }
+  if (0 == slot || NO == search->record)
+    {
+      return;
+    }
+  slot->generation = 0;
+  slot->cls = cls;
+  slot->hash = hash;
+  slot->length = length;
+  memcpy(slot->key, key, length);
+  slot->key[length] = '\0';
+  slot->accessor = *a;
+  /* The last selector looked for is the accessor (if one was found).
+   */
+  slot->checks = search->count - ((a->sel != 0) ? 1 : 0);
+  memcpy(slot->absent, search->sels, slot->checks * sizeof(SEL));
+  slot->generation = generation;
+}
+
+/* Returns the selector for name if the receiver responds to it, or 0.
+ * When the search is being recorded, the selector is registered (so that
+ * a method added later can be noticed) and recorded.
+ */
+static SEL
+kvcResponds(id self, const char *name, KVCSearch *search)
+{
+  SEL	sel = sel_getUid(name);
+
+  if (YES == search->record)
+    {
+      if (0 == sel)
+	{
+	  sel = sel_registerName(name);
+	}
+      search->sels[search->count++] = sel;
+    }
+  if (sel == 0 || [self respondsToSelector: sel] == NO)
+    {
+      return 0;
+    }
+  return sel;
+}
+
+/* Finds the accessor used to set the value for key in instances of the
+ * class of self.
+ */
+static void
+kvcSearchSetter(id self, const char *key, unsigned size, GSKVCAccessor *a,
+  KVCSearch *search)
+{
+  a->sel = 0;
+  a->type = 0;
+  a->size = 0;
+  a->offset = 0;
   if (size > 0)
     {
       const char	*name;
@@ -99,43 +325,40 @@ SetValueForKey(NSObject *self, id anObject, const char *key, unsigned size)
       buf[size + 4] = ':';
       buf[size + 5] = '\0';
 
-      name = &buf[1];	// setKey:
-      type = NULL;
-      sel = sel_getUid(name);
-      if (sel == 0 || [self respondsToSelector: sel] == NO)
+      a->sel = kvcResponds(self, &buf[1], search);	// setKey:
+      if (0 == a->sel)
 	{
-	  name = buf;	// _setKey:
-	  sel = sel_getUid(name);
-	  if (sel == 0 || [self respondsToSelector: sel] == NO)
+	  a->sel = kvcResponds(self, buf, search);	// _setKey:
+	  if (0 == a->sel)
 	    {
-	      sel = 0;
 	      if ([[self class] accessInstanceVariablesDirectly] == YES)
 		{
 		  buf[size + 4] = '\0';
 		  buf[3] = '_';
 		  buf[4] = lo;
 		  name = &buf[3];	// _key
-		  if (GSObjCFindVariable(self, name, &type, &size, &off) == NO)
+		  if (GSObjCFindVariable(self, name,
+		    &a->type, &a->size, &a->offset) == NO)
 		    {
 		      buf[4] = hi;
 		      buf[3] = 's';
 		      buf[2] = 'i';
 		      buf[1] = '_';
 		      name = &buf[1];	// _isKey
-		      if (GSObjCFindVariable(self,
-			name, &type, &size, &off) == NO)
+		      if (GSObjCFindVariable(self, name,
+			&a->type, &a->size, &a->offset) == NO)
 			{
 			  buf[4] = lo;
 			  name = &buf[4];	// key
-			  if (GSObjCFindVariable(self,
-			    name, &type, &size, &off) == NO)
+			  if (GSObjCFindVariable(self, name,
+			    &a->type, &a->size, &a->offset) == NO)
 			    {
 			      buf[4] = hi;
 			      buf[3] = 's';
 			      buf[2] = 'i';
 			      name = &buf[2];	// isKey
-			      GSObjCFindVariable(self,
-				name, &type, &size, &off);
+			      GSObjCFindVariable(self, name,
+				&a->type, &a->size, &a->offset);
 			    }
 			}
 		    }
@@ -147,15 +370,19 @@ SetValueForKey(NSObject *self, id anObject, const char *key, unsigned size)
 	    }
 	}
     }
-  GSObjCSetVal(self, key, anObject, sel, type, size, off);
 }
 
-static id ValueForKey(NSObject *self, const char *key, unsigned size)
+/* Finds the accessor used to get the value for key from instances of the
+ * class of self.
+ */
+static void
+kvcSearchGetter(id self, const char *key, unsigned size, GSKVCAccessor *a,
+  KVCSearch *search)
 {
-  SEL		sel = 0;
-  int		off = 0;
-  const char	*type = NULL;
-
+  a->sel = 0;
+  a->type = 0;
+  a->size = 0;
+  a->offset = 0;
   if (size > 0)
     {
       const char	*name;
@@ -170,70 +397,148 @@ static id ValueForKey(NSObject *self, const char *key, unsigned size)
       hi = islower(lo) ? toupper(lo) : lo;
       buf[4] = hi;
 
-      name = &buf[1];	// getKey
-      sel = sel_getUid(name);
-      if (sel == 0 || [self respondsToSelector: sel] == NO)
+      a->sel = kvcResponds(self, &buf[1], search);	// getKey
+      if (0 == a->sel)
 	{
 	  buf[4] = lo;
-	  name = &buf[4];	// key
-	  sel = sel_getUid(name);
-	  if (sel == 0 || [self respondsToSelector: sel] == NO)
+	  a->sel = kvcResponds(self, &buf[4], search);	// key
+	  if (0 == a->sel)
 	    {
               buf[4] = hi;
               buf[3] = 's';
               buf[2] = 'i';
-              name = &buf[2];	// isKey
-              sel = sel_getUid(name);
-              if (sel == 0 || [self respondsToSelector: sel] == NO)
-                {
-                  sel = 0;
-                }
+	      a->sel = kvcResponds(self, &buf[2], search);	// isKey
 	    }
 	}
 
-      if (sel == 0 && [[self class] accessInstanceVariablesDirectly] == YES)
+      if (0 == a->sel
+	&& [[self class] accessInstanceVariablesDirectly] == YES)
 	{
 	  buf[4] = hi;
-	  name = buf;	// _getKey
-	  sel = sel_getUid(name);
-	  if (sel == 0 || [self respondsToSelector: sel] == NO)
+	  buf[3] = 't';
+	  buf[2] = 'e';
+	  buf[1] = 'g';
+	  a->sel = kvcResponds(self, buf, search);	// _getKey
+	  if (0 == a->sel)
 	    {
 	      buf[4] = lo;
 	      buf[3] = '_';
 	      name = &buf[3];	// _key
-	      sel = sel_getUid(name);
-	      if (sel == 0 || [self respondsToSelector: sel] == NO)
-		{
-		  sel = 0;
-		}
-	    }
-	  if (sel == 0)
-	    {
-	      if (GSObjCFindVariable(self, name, &type, &size, &off) == NO)
+	      a->sel = kvcResponds(self, name, search);
+	      if (0 == a->sel && GSObjCFindVariable(self, name,
+		&a->type, &a->size, &a->offset) == NO)
 		{
                   buf[4] = hi;
                   buf[3] = 's';
                   buf[2] = 'i';
                   buf[1] = '_';
                   name = &buf[1];	// _isKey
-		  if (!GSObjCFindVariable(self, name, &type, &size, &off))
+		  if (!GSObjCFindVariable(self, name,
+		    &a->type, &a->size, &a->offset))
                     {
                        buf[4] = lo;
                        name = &buf[4];		// key
-		       if (!GSObjCFindVariable(self, name, &type, &size, &off))
+		       if (!GSObjCFindVariable(self, name,
+			 &a->type, &a->size, &a->offset))
                          {
                             buf[4] = hi;
                             buf[3] = 's';
                             buf[2] = 'i';
                             name = &buf[2];	// isKey
-                            GSObjCFindVariable(self, name, &type, &size, &off);
+                            GSObjCFindVariable(self, name,
+			      &a->type, &a->size, &a->offset);
                          }
                     }
 		}
 	    }
 	}
     }
-  return GSObjCGetVal(self, key, sel, type, size, off);
+}
+
+/* Finds the accessor key-value coding uses to get (or set) the value for
+ * key in self, using the cache where possible.  Returns YES if it's a real
+ * method or an instance variable, in which case the implementation (for a
+ * method) and the first character of the value type are filled in.
+ * Otherwise a->sel is the selector of a method which is forwarded, or 0
+ * for an undefined key.
+ */
+static BOOL
+kvcAccessor(BOOL set, id self, const char *key, unsigned length,
+  GSKVCAccessor *a)
+{
+  Class		cls = object_getClass(self);
+  KVCEntry	*slot;
+  uint32_t	hash;
+  unsigned	generation;
+  KVCSearch	search;
+
+  if (YES == kvcFind(set, cls, key, length, &slot, &hash, &generation))
+    {
+      *a = slot->accessor;
+      return YES;
+    }
+  search.count = 0;
+  search.record = (0 == slot) ? NO : YES;
+  if (YES == set)
+    {
+      kvcSearchSetter(self, key, length, a, &search);
+    }
+  else
+    {
+      kvcSearchGetter(self, key, length, a, &search);
+    }
+  a->imp = 0;
+  a->kind = 0;
+  kvcStore(slot, set, cls, key, length, hash, generation, a, &search);
+  return (0 == a->kind) ? NO : YES;
+}
+
+BOOL
+GSPrivateKVCGetter(id obj, const char *key, unsigned length,
+  GSKVCAccessor *a)
+{
+  return kvcAccessor(NO, obj, key, length, a);
+}
+
+static void
+SetValueForKey(NSObject *self, id anObject, const char *key, unsigned size)
+{
+  GSKVCAccessor	a;
+
+  if (YES == kvcAccessor(YES, self, key, size, &a))
+    {
+      if (a.sel != 0 && (_C_ID == a.kind || _C_CLASS == a.kind))
+	{
+	  (*(void (*)(id, SEL, id))a.imp)(self, a.sel, anObject);
+	  return;
+	}
+      if (0 == a.sel && (_C_ID == a.kind || _C_CLASS == a.kind))
+	{
+	  id	*ptr = (id *)((char *)self + a.offset);
+
+	  ASSIGN(*ptr, anObject);
+	  return;
+	}
+    }
+  GSObjCSetVal(self, key, anObject, a.sel, a.type, a.size, a.offset);
+}
+
+static id ValueForKey(NSObject *self, const char *key, unsigned size)
+{
+  GSKVCAccessor	a;
+
+  if (YES == kvcAccessor(NO, self, key, size, &a))
+    {
+      if (a.sel != 0 && (_C_ID == a.kind || _C_CLASS == a.kind))
+	{
+	  return (*(id (*)(id, SEL))a.imp)(self, a.sel);
+	}
+      if (0 == a.sel && (_C_ID == a.kind || _C_CLASS == a.kind))
+	{
+	  return *(id *)((char *)self + a.offset);
+	}
+    }
+  return GSObjCGetVal(self, key, a.sel, a.type, a.size, a.offset);
 }
 
 
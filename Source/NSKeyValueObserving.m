@@ -43,6 +43,7 @@
 #import "GNUstepBase/GSLock.h"
 #import "GNUstepBase/NSObject+GNUstepBase.h"
 #import "GSInvocation.h"
+#import "GSPrivate.h"
 
 #if defined(USE_LIBFFI)
 #import "cifframe.h"
@@ -634,6 +635,7 @@ cifframe_callback(ffi_cif *cif, void *retp, void **args, void *user)
         }
       if (found == YES)
         {
+          GSPrivateKVCFlush();
           [keys addObject: aKey];
         }
       else
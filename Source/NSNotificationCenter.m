@@ -39,6 +39,17 @@
 #import "GNUstepBase/GSLock.h"
 #import "GNUstepBase/NSObject+GNUstepBase.h"
 
+/* Posting uses lock-free snapshots of the observer lists if we have
+ * atomic builtins (and are not using garbage collection).
+ */
+#if	!GS_WITH_GC && !defined(__OBJC_GC__) \
+  && (defined(__llvm__) || (defined(USE_ATOMIC_BUILTINS) \
+  && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1))))
+#define	GS_NC_SNAPSHOTS	1
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 static NSZone	*_zone = 0;
 
 /**
@@ -289,6 +300,14 @@ static GC_descr	nodeDesc;	// Type descriptor for map node.
  */
 #define	CHUNKSIZE	128
 #define	CACHESIZE	16
+#if	defined(GS_NC_SNAPSHOTS)
+#define	NC_SHARD_BITS	4
+#define	NC_SHARDS	(1 << NC_SHARD_BITS)
+typedef struct {
+  volatile int	count;		/* Number of active readers.	*/
+  char		pad[60];	/* Keep shards in separate cache lines. */
+} NCReaders;
+#endif
 typedef struct NCTbl {
   Observation		*wildcard;	/* Get ALL messages.		*/
   GSIMapTable		nameless;	/* Get messages for any name.	*/
@@ -301,6 +320,14 @@ typedef struct NCTbl {
   GSIMapTable		cache[CACHESIZE];
   unsigned short	chunkIndex;
   unsigned short	cacheIndex;
+#if	defined(GS_NC_SNAPSHOTS)
+  struct NCIndex	*index;		/* Snapshots by name/object.	*/
+  struct NCGarbage	*garbage;	/* Retired snapshots etc.	*/
+  unsigned		garbageCount;
+  unsigned		garbageSize;
+  volatile unsigned	epoch;		/* Selects reader counters.	*/
+  NCReaders		readers[2][NC_SHARDS];
+#endif
 } NCTable;
 
 #define	TABLE		((NCTable*)_table)
@@ -408,6 +435,13 @@ static void	mapFree(NCTable *t, GSIMapTable m)
     }
 }
 
+#if	defined(GS_NC_SNAPSHOTS)
+struct NCIndex;
+static struct NCIndex *ncIndexNew(unsigned size);
+static void endNCIndex(NCTable *t);
+static void ncSync(NCTable *t);
+#endif
+
 static void endNCTable(NCTable *t)
 {
   unsigned		i;
@@ -415,6 +449,9 @@ static void endNCTable(NCTable *t)
   GSIMapNode		n0;
   Observation		*l;
 
+#if	defined(GS_NC_SNAPSHOTS)
+  endNCIndex(t);
+#endif
   TEST_RELEASE(t->_lock);
 
   /*
@@ -489,6 +526,9 @@ static NCTable *newNCTable(void)
   t->named->extra = YES;        // This table retains keys
 
   t->_lock = [NSRecursiveLock new];
+#if	defined(GS_NC_SNAPSHOTS)
+  t->index = ncIndexNew(64);
+#endif
   return t;
 }
 
@@ -500,6 +540,12 @@ static inline void lockNCTable(NCTable* t)
 
 static inline void unlockNCTable(NCTable* t)
 {
+#if	defined(GS_NC_SNAPSHOTS)
+  if (t->lockCount == 1 && t->garbageCount > 0)
+    {
+      ncSync(t);
+    }
+#endif
   t->lockCount--;
   [t->_lock unlock];
 }
@@ -538,6 +584,402 @@ static void listFree(Observation *list)
     }
 }
 
+#if	defined(GS_NC_SNAPSHOTS)
+/*
+ * Lock-free posting.
+ *
+ * As well as the linked lists of observations (which are only used while
+ * the table is locked), each list is published for posting as an
+ * immutable snapshot (an array of observations).  Snapshots are found
+ * through an index keyed by name/object (a nil name for the nameless
+ * lists, and nil name and object for the wildcard list), which is an
+ * open addressed hash table in which an entry is never moved or removed
+ * while readers might be using it.
+ *
+ * Adding or removing an observer builds a new snapshot for each list it
+ * changes and replaces the old one in the index.  Posting looks up the
+ * snapshots it needs without taking the lock, counting itself as an
+ * active reader (in a shard of the reader counters chosen by thread, to
+ * avoid contention on a single counter) while doing so, and retains the
+ * snapshots so that it can use them after it stops being a reader.
+ *
+ * Replaced snapshots and index structures are retired rather than freed
+ * and are reclaimed by the thread which retired them once all readers
+ * which could have seen them have finished (a grace period), before it
+ * unlocks the table.
+ */
+
+/*
+ * An immutable list of observations ready for posting.  Each observation
+ * is retained by the snapshot, so it is not reused while in a snapshot,
+ * and an observation removed from the notification center can be seen
+ * by the fact that its 'next' field has been cleared.
+ */
+typedef struct NCSnap {
+  int		refs;		/* Retain count (index and posters).	*/
+  unsigned	count;		/* Number of observations.		*/
+  Observation	*obs[1];	/* Observations in list order.		*/
+} NCSnap;
+
+/* An index entry.  The name and object are fixed once the entry has been
+ * published, but the snapshot may be replaced (or removed) at any time.
+ */
+typedef struct NCEntry {
+  NSString		*name;
+  id			object;
+  NSUInteger		hash;
+  NCSnap * volatile	snap;
+} NCEntry;
+
+typedef struct NCIndex {
+  unsigned		size;	/* Number of slots (a power of two).	*/
+  unsigned		used;	/* Number of entries in slots.		*/
+  NCEntry * volatile	slots[1];
+} NCIndex;
+
+typedef struct NCGarbage {
+  int		type;
+  void		*ptr;
+} NCGarbage;
+
+#define	NC_SNAP		0
+#define	NC_ENTRY	1
+#define	NC_INDEX	2
+
+static inline NSUInteger
+ncHash(NSString *name, id object)
+{
+  NSUInteger	h = doHash(YES, name);
+
+  return (h * 31) ^ (((NSUInteger)(uintptr_t)object >> 3) * 2654435761U);
+}
+
+static NCIndex *
+ncIndexNew(unsigned size)
+{
+  NCIndex	*ix;
+
+  ix = (NCIndex*)NSZoneCalloc(NSDefaultMallocZone(), 1,
+    sizeof(NCIndex) + (size - 1) * sizeof(NCEntry*));
+  ix->size = size;
+  return ix;
+}
+
+/* Find the entry for name/object in the index, or 0 if there is none.
+ * This is safe to call without the table being locked, so long as the
+ * caller is a reader.
+ */
+static inline NCEntry *
+ncIndexFind(NCIndex *ix, NSString *name, id object, NSUInteger hash)
+{
+  unsigned	mask = ix->size - 1;
+  unsigned	i = (unsigned)hash & mask;
+  NCEntry	*e;
+
+  while ((e = ix->slots[i]) != 0)
+    {
+      if (e->hash == hash && e->object == object
+	&& doEqual(YES, e->name, name))
+	{
+	  return e;
+	}
+      i = (i + 1) & mask;
+    }
+  return 0;
+}
+
+static inline void
+ncIndexPut(NCIndex *ix, NCEntry *e)
+{
+  unsigned	mask = ix->size - 1;
+  unsigned	i = (unsigned)e->hash & mask;
+
+  while (ix->slots[i] != 0)
+    {
+      i = (i + 1) & mask;
+    }
+  /* Make sure the entry is complete before readers can see it.
+   */
+  __sync_synchronize();
+  ix->slots[i] = e;
+  ix->used++;
+}
+
+static void
+ncRetire(NCTable *t, int type, void *ptr)
+{
+  if (t->garbageCount == t->garbageSize)
+    {
+      t->garbageSize = (t->garbageSize == 0) ? 16 : t->garbageSize * 2;
+      t->garbage = NSZoneRealloc(NSDefaultMallocZone(), t->garbage,
+	t->garbageSize * sizeof(NCGarbage));
+    }
+  t->garbage[t->garbageCount].type = type;
+  t->garbage[t->garbageCount].ptr = ptr;
+  t->garbageCount++;
+}
+
+/* Free a snapshot whose retain count has reached zero.
+ * The table must be locked.
+ */
+static void
+snapFree(NCSnap *s)
+{
+  unsigned	i;
+
+  for (i = 0; i < s->count; i++)
+    {
+      obsFree(s->obs[i]);
+    }
+  NSZoneFree(NSDefaultMallocZone(), s);
+}
+
+/* Release a snapshot retained by a poster.
+ */
+static inline void
+snapRelease(NCTable *t, NCSnap *s)
+{
+  if (__sync_sub_and_fetch(&s->refs, 1) == 0)
+    {
+      lockNCTable(t);
+      snapFree(s);
+      unlockNCTable(t);
+    }
+}
+
+/* Publish a new snapshot of the list of observations for name/object.
+ * The table must be locked.
+ */
+static void
+snapSet(NCTable *t, NSString *name, id object, Observation *list)
+{
+  NSUInteger	hash = ncHash(name, object);
+  NCSnap	*s = 0;
+  NCEntry	*e;
+  Observation	*o;
+  unsigned	count = 0;
+
+  for (o = list; o != ENDOBS; o = o->next)
+    {
+      count++;
+    }
+  if (count > 0)
+    {
+      s = (NCSnap*)NSZoneMalloc(NSDefaultMallocZone(),
+	sizeof(NCSnap) + (count - 1) * sizeof(Observation*));
+      s->refs = 1;
+      s->count = count;
+      count = 0;
+      for (o = list; o != ENDOBS; o = o->next)
+	{
+	  obsRetain(o);
+	  s->obs[count++] = o;
+	}
+      __sync_synchronize();
+    }
+
+  e = ncIndexFind(t->index, name, object, hash);
+  if (e != 0)
+    {
+      NCSnap	*old = e->snap;
+
+      e->snap = s;
+      if (old != 0)
+	{
+	  ncRetire(t, NC_SNAP, old);
+	}
+      return;
+    }
+  if (s == 0)
+    {
+      return;
+    }
+
+  e = (NCEntry*)NSZoneMalloc(NSDefaultMallocZone(), sizeof(NCEntry));
+  e->name = RETAIN(name);
+  e->object = object;
+  e->hash = hash;
+  e->snap = s;
+  if ((t->index->used + 1) * 2 > t->index->size)
+    {
+      NCIndex	*old = t->index;
+      NCIndex	*ix;
+      unsigned	live = 1;
+      unsigned	size = old->size;
+      unsigned	i;
+
+      /* Build a new index without the entries which have no snapshot
+       * (growing it if necessary), then publish it and retire the old
+       * one along with the unused entries.
+       */
+      for (i = 0; i < old->size; i++)
+	{
+	  if (old->slots[i] != 0 && old->slots[i]->snap != 0)
+	    {
+	      live++;
+	    }
+	}
+      while (live * 4 > size)
+	{
+	  size *= 2;
+	}
+      ix = ncIndexNew(size);
+      for (i = 0; i < old->size; i++)
+	{
+	  NCEntry	*tmp = old->slots[i];
+
+	  if (tmp != 0)
+	    {
+	      if (tmp->snap != 0)
+		{
+		  ncIndexPut(ix, tmp);
+		}
+	      else
+		{
+		  ncRetire(t, NC_ENTRY, tmp);
+		}
+	    }
+	}
+      ncIndexPut(ix, e);
+      __sync_synchronize();
+      t->index = ix;
+      ncRetire(t, NC_INDEX, old);
+    }
+  else
+    {
+      ncIndexPut(t->index, e);
+    }
+}
+
+/* Called before the table is finally unlocked, to wait until there are
+ * no readers which could be using retired structures, then free them.
+ */
+static void
+ncSync(NCTable *t)
+{
+  unsigned	old = t->epoch;
+  unsigned	i;
+
+  /* Readers which start from now on use the new epoch, so we only need
+   * to wait for those counted in the old one to finish.
+   */
+  t->epoch = old ^ 1;
+  __sync_synchronize();
+  for (i = 0; i < NC_SHARDS; i++)
+    {
+      while (t->readers[old][i].count != 0)
+	{
+	  sched_yield();
+	}
+    }
+  __sync_synchronize();
+
+  for (i = 0; i < t->garbageCount; i++)
+    {
+      void	*ptr = t->garbage[i].ptr;
+
+      switch (t->garbage[i].type)
+	{
+	  case NC_SNAP:
+	    if (__sync_sub_and_fetch(&((NCSnap*)ptr)->refs, 1) == 0)
+	      {
+		snapFree((NCSnap*)ptr);
+	      }
+	    break;
+	  case NC_ENTRY:
+	    RELEASE(((NCEntry*)ptr)->name);
+	    NSZoneFree(NSDefaultMallocZone(), ptr);
+	    break;
+	  case NC_INDEX:
+	    NSZoneFree(NSDefaultMallocZone(), ptr);
+	    break;
+	}
+    }
+  t->garbageCount = 0;
+}
+
+/* Start reading the index without locking the table.
+ * Returns the reader counter to be passed to ncReadEnd().
+ */
+static inline volatile int *
+ncReadBegin(NCTable *t)
+{
+  unsigned	shard;
+
+  shard = ((unsigned)((uintptr_t)pthread_self() >> 4) * 2654435761U)
+    >> (32 - NC_SHARD_BITS);
+  for (;;)
+    {
+      unsigned		epoch = t->epoch;
+      volatile int	*counter = &t->readers[epoch][shard].count;
+
+      __sync_fetch_and_add(counter, 1);
+      /* If the epoch changed before we were counted, a writer may not
+       * wait for us, so we must try again in the new epoch.
+       */
+      if (t->epoch == epoch)
+	{
+	  return counter;
+	}
+      __sync_fetch_and_sub(counter, 1);
+    }
+}
+
+static inline void
+ncReadEnd(volatile int *counter)
+{
+  __sync_fetch_and_sub(counter, 1);
+}
+
+/* Retain the snapshot for name/object (if any) in the current index.
+ * Must be called by a reader.
+ */
+static inline NCSnap *
+ncSnapFor(NCTable *t, NSString *name, id object)
+{
+  NCEntry	*e = ncIndexFind(t->index, name, object, ncHash(name, object));
+  NCSnap	*s;
+
+  if (e != 0 && (s = e->snap) != 0)
+    {
+      __sync_fetch_and_add(&s->refs, 1);
+      return s;
+    }
+  return 0;
+}
+
+static void
+endNCIndex(NCTable *t)
+{
+  NCIndex	*ix = t->index;
+  unsigned	i;
+
+  ncSync(t);
+  for (i = 0; i < ix->size; i++)
+    {
+      NCEntry	*e = ix->slots[i];
+
+      if (e != 0)
+	{
+	  if (e->snap != 0 && __sync_sub_and_fetch(&e->snap->refs, 1) == 0)
+	    {
+	      snapFree(e->snap);
+	    }
+	  RELEASE(e->name);
+	  NSZoneFree(NSDefaultMallocZone(), e);
+	}
+    }
+  NSZoneFree(NSDefaultMallocZone(), ix);
+  if (t->garbage != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), t->garbage);
+    }
+}
+
+#else
+#define	snapSet(T, N, O, L)
+#endif	/* GS_NC_SNAPSHOTS */
+
 /*
  *	NB. We need to explicitly set the 'next' field of any observation
  *	we remove to be zero so that, if it currently exists in an array
@@ -587,12 +1029,14 @@ static Observation *listPurge(Observation *list, id observer)
  * removed from the map.
  */
 static inline void
-purgeMapNode(GSIMapTable map, GSIMapNode node, id observer)
+purgeMapNode(NCTable *t, NSString *name, GSIMapTable map, GSIMapNode node,
+  id observer)
 {
   Observation	*list = node->value.ext;
 
   if (observer == 0)
     {
+      snapSet(t, name, node->key.obj, ENDOBS);
       listFree(list);
       GSIMapRemoveKey(map, node->key);
     }
@@ -601,6 +1045,7 @@ purgeMapNode(GSIMapTable map, GSIMapNode node, id observer)
       Observation	*start = list;
 
       list = listPurge(list, observer);
+      snapSet(t, name, node->key.obj, list);
       if (list == ENDOBS)
 	{
 	  /*
@@ -832,6 +1277,7 @@ static NSNotificationCenter *default_center = nil;
 	}
       else
 	{
+	  name = (NSString*)n->key.obj;	// Use the immutable copy
 	  m = (GSIMapTable)n->value.ptr;
 	}
 
@@ -843,6 +1289,7 @@ static NSNotificationCenter *default_center = nil;
 	{
 	  o->next = ENDOBS;
 	  GSIMapAddPair(m, (GSIMapKey)object, (GSIMapVal)o);
+	  list = o;
 	}
       else
 	{
@@ -850,6 +1297,7 @@ static NSNotificationCenter *default_center = nil;
 	  o->next = list->next;
 	  list->next = o;
 	}
+      snapSet(TABLE, name, object, list);
     }
   else if (object)
     {
@@ -858,6 +1306,7 @@ static NSNotificationCenter *default_center = nil;
 	{
 	  o->next = ENDOBS;
 	  GSIMapAddPair(NAMELESS, (GSIMapKey)object, (GSIMapVal)o);
+	  list = o;
 	}
       else
 	{
@@ -865,11 +1314,13 @@ static NSNotificationCenter *default_center = nil;
 	  o->next = list->next;
 	  list->next = o;
 	}
+      snapSet(TABLE, nil, object, list);
     }
   else
     {
       o->next = WILDCARD;
       WILDCARD = o;
+      snapSet(TABLE, nil, nil, WILDCARD);
     }
 
   unlockNCTable(TABLE);
@@ -901,6 +1352,7 @@ static NSNotificationCenter *default_center = nil;
   if (name == nil && object == nil)
     {
       WILDCARD = listPurge(WILDCARD, observer);
+      snapSet(TABLE, nil, nil, WILDCARD);
     }
 
   if (name == nil)
@@ -933,7 +1385,7 @@ static NSNotificationCenter *default_center = nil;
 		{
 		  GSIMapNode	next = GSIMapEnumeratorNextNode(&e1);
 
-		  purgeMapNode(m, n1, observer);
+		  purgeMapNode(TABLE, thisName, m, n1, observer);
 		  n1 = next;
 		}
 	    }
@@ -949,7 +1401,7 @@ static NSNotificationCenter *default_center = nil;
 	      n1 = GSIMapNodeForSimpleKey(m, (GSIMapKey)object);
 	      if (n1 != 0)
 		{
-		  purgeMapNode(m, n1, observer);
+		  purgeMapNode(TABLE, thisName, m, n1, observer);
 		}
 	    }
 	  /*
@@ -974,7 +1426,7 @@ static NSNotificationCenter *default_center = nil;
 	    {
 	      GSIMapNode	next = GSIMapEnumeratorNextNode(&e0);
 
-	      purgeMapNode(NAMELESS, n0, observer);
+	      purgeMapNode(TABLE, nil, NAMELESS, n0, observer);
 	      n0 = next;
 	    }
 	}
@@ -983,7 +1435,7 @@ static NSNotificationCenter *default_center = nil;
 	  n0 = GSIMapNodeForSimpleKey(NAMELESS, (GSIMapKey)object);
 	  if (n0 != 0)
 	    {
-	      purgeMapNode(NAMELESS, n0, observer);
+	      purgeMapNode(TABLE, nil, NAMELESS, n0, observer);
 	    }
 	}
     }
@@ -1013,7 +1465,7 @@ static NSNotificationCenter *default_center = nil;
 	    {
 	      GSIMapNode	next = GSIMapEnumeratorNextNode(&e0);
 
-	      purgeMapNode(m, n0, observer);
+	      purgeMapNode(TABLE, name, m, n0, observer);
 	      n0 = next;
 	    }
 	}
@@ -1022,7 +1474,7 @@ static NSNotificationCenter *default_center = nil;
 	  n0 = GSIMapNodeForSimpleKey(m, (GSIMapKey)object);
 	  if (n0 != 0)
 	    {
-	      purgeMapNode(m, n0, observer);
+	      purgeMapNode(TABLE, name, m, n0, observer);
 	    }
 	}
       if (m->nodeCount == 0)
@@ -1054,6 +1506,79 @@ static NSNotificationCenter *default_center = nil;
  */
 - (void) _postAndRelease: (NSNotification*)notification
 {
+#if	defined(GS_NC_SNAPSHOTS)
+  NSString	*name = [notification name];
+  id		object;
+  NCSnap	*snaps[4];
+  unsigned	count = 0;
+  volatile int	*reader;
+
+  if (name == nil)
+    {
+      RELEASE(notification);
+      [NSException raise: NSInvalidArgumentException
+		  format: @"Tried to post a notification with no name."];
+    }
+  object = [notification object];
+
+  /*
+   * Retain the snapshots of the observers that specified neither NAME nor
+   * OBJECT, those that specified OBJECT but not NAME, those that specified
+   * NAME and OBJECT, and those that specified NAME with a nil OBJECT.
+   * We don't need to lock the table, just to be counted as a reader while
+   * we look at it.
+   */
+  reader = ncReadBegin(TABLE);
+  if ((snaps[count] = ncSnapFor(TABLE, nil, nil)) != 0)
+    {
+      count++;
+    }
+  if (object != nil && (snaps[count] = ncSnapFor(TABLE, nil, object)) != 0)
+    {
+      count++;
+    }
+  if ((snaps[count] = ncSnapFor(TABLE, name, object)) != 0)
+    {
+      count++;
+    }
+  if (object != nil && (snaps[count] = ncSnapFor(TABLE, name, nil)) != 0)
+    {
+      count++;
+    }
+  ncReadEnd(reader);
+
+  /*
+   * Now send all the notifications, skipping any observations which have
+   * been removed since the snapshots were made.
+   */
+  while (count-- > 0)
+    {
+      NCSnap	*snap = snaps[count];
+      unsigned	i = snap->count;
+
+      while (i-- > 0)
+	{
+	  Observation	*o = snap->obs[i];
+
+	  if (o->next != 0)
+	    {
+	      NS_DURING
+		{
+		  [o->observer performSelector: o->selector
+				    withObject: notification];
+		}
+	      NS_HANDLER
+		{
+		  NSLog(@"Problem posting notification: %@", localException);
+		}
+	      NS_ENDHANDLER
+	    }
+	}
+      snapRelease(TABLE, snap);
+    }
+
+  RELEASE(notification);
+#else
   Observation	*o;
   unsigned	count;
   NSString	*name = [notification name];
@@ -1203,6 +1728,7 @@ static NSNotificationCenter *default_center = nil;
   unlockNCTable(TABLE);
 
   RELEASE(notification);
+#endif
 }
 
 
@@ -51,6 +51,7 @@
 #ifdef HAVE_LOCALE_H
 #include <locale.h>
 #endif
+#include <pthread.h>
 
 #if	defined(HAVE_SYS_SIGNAL_H)
 #  include	<sys/signal.h>
@@ -188,214 +189,169 @@ static void GSLogZombie(id o, SEL sel)
  *	allocated is stored with the object.
  */
 
-/* Now, if we are on a platform where we know how to do atomic
- * read, increment, and decrement, then we define the GSATOMICREAD
- * macro and macros or functions to increment/decrement.
- * The presence of the GSATOMICREAD macro is used later to determine
- * whether to attempt atomic operations or to use locking for the
- * retain/release mechanism.
- * The GSAtomicIncrement() and GSAtomicDecrement() functions take a
- * pointer to a 32bit integer as an argument, increment/decrement the
- * value pointed to, and return the result.
- */
-#ifdef	GSATOMICREAD
-#undef	GSATOMICREAD
-#endif
-
-
-#if	defined(__MINGW__)
-#ifndef _WIN64
-#undef InterlockedIncrement
-#undef InterlockedDecrement
-LONG WINAPI InterlockedIncrement(LONG volatile *);
-LONG WINAPI InterlockedDecrement(LONG volatile *);
-#endif
-
-/* Set up atomic read, increment and decrement for mswindows
- */
-
-typedef int32_t volatile *gsatomic_t;
-
-#define	GSATOMICREAD(X)	(*(X))
-
-#define	GSAtomicIncrement(X)	InterlockedIncrement((LONG volatile*)X)
-#define	GSAtomicDecrement(X)	InterlockedDecrement((LONG volatile*)X)
-
-
-#elif defined(__llvm__) || (defined(USE_ATOMIC_BUILTINS) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)))
-/* Use the GCC atomic operations with recent GCC versions */
-
-typedef int32_t volatile *gsatomic_t;
-#define GSATOMICREAD(X) (*(X))
-#define GSAtomicIncrement(X)    __sync_add_and_fetch(X, 1)
-#define GSAtomicDecrement(X)    __sync_sub_and_fetch(X, 1)
-
-
-#elif	defined(__linux__) && (defined(__i386__) || defined(__x86_64__))
-/* Set up atomic read, increment and decrement for intel style linux
- */
-
-typedef int32_t volatile *gsatomic_t;
-
-#define	GSATOMICREAD(X)	(*(X))
-
-static __inline__ int
-GSAtomicIncrement(gsatomic_t X)
-{
-  register int tmp;
-  __asm__ __volatile__ (
-    "movl $1, %0\n"
-    "lock xaddl %0, %1"
-    :"=r" (tmp), "=m" (*X)
-    :"r" (tmp), "m" (*X)
-    :"memory" );
-  return tmp + 1;
-}
-
-static __inline__ int
-GSAtomicDecrement(gsatomic_t X)
-{
-  register int tmp;
-  __asm__ __volatile__ (
-    "movl $1, %0\n"
-    "negl %0\n"
-    "lock xaddl %0, %1"
-    :"=r" (tmp), "=m" (*X)
-    :"r" (tmp), "m" (*X)
-    :"memory" );
- return tmp - 1;
+/* The reference count is a 32bit word before the object, updated using
+ * atomic operations so that retain/release never needs a lock.
+ * We use the atomic builtins (which are what C11 atomics are built on)
+ * with explicit memory ordering where the compiler has them, otherwise
+ * the older full barrier builtins, and only as a last resort (where the
+ * compiler has no atomic operations at all) a lock.
+ * GSRefCompareAndSwap() stores n in *x if it contains *o and returns YES,
+ * otherwise it sets *o to the value of *x and returns NO.  The ordering
+ * argument is either GSRefRelaxed (for retains) or GSRefRelease (for
+ * releases, so that the thread which deallocates the object sees all
+ * the changes made by other threads before they released it).
+ */
+#if	defined(__ATOMIC_RELAXED) \
+  && (defined(__llvm__) || defined(USE_ATOMIC_BUILTINS))
+
+#define	GSRefRelaxed	__ATOMIC_RELAXED
+#define	GSRefRelease	__ATOMIC_RELEASE
+#define	GSRefLoad(X)	__atomic_load_n((X), __ATOMIC_RELAXED)
+#define	GSRefIncrement(X)	__atomic_add_fetch((X), 1, __ATOMIC_RELAXED)
+#define	GSRefDecrement(X)	__atomic_sub_fetch((X), 1, __ATOMIC_RELAXED)
+#define	GSRefCompareAndSwap(X, O, N, M) \
+  __atomic_compare_exchange_n((X), (O), (N), 1, (M), __ATOMIC_RELAXED)
+#define	GSRefAcquire()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#elif	defined(__llvm__) || (defined(USE_ATOMIC_BUILTINS) \
+  && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)))
+
+#define	GSRefRelaxed	0
+#define	GSRefRelease	0
+#define	GSRefLoad(X)	(*(volatile uint32_t*)(X))
+#define	GSRefIncrement(X)	__sync_add_and_fetch((X), 1)
+#define	GSRefDecrement(X)	__sync_sub_and_fetch((X), 1)
+#define	GSRefAcquire()	__sync_synchronize()
+
+static inline BOOL
+GSRefCompareAndSwap(uint32_t *x, uint32_t *o, uint32_t n, int m)
+{
+  uint32_t	v = __sync_val_compare_and_swap(x, *o, n);
+
+  if (v == *o)
+    {
+      return YES;
+    }
+  *o = v;
+  return NO;
 }
 
-#elif defined(__PPC__) || defined(__POWERPC__)
+#else
 
-typedef int32_t volatile *gsatomic_t;
+static pthread_mutex_t	refLock = PTHREAD_MUTEX_INITIALIZER;
 
-#define	GSATOMICREAD(X)	(*(X))
+#define	GSRefRelaxed	0
+#define	GSRefRelease	0
+#define	GSRefLoad(X)	(*(volatile uint32_t*)(X))
+#define	GSRefAcquire()
 
-static __inline__ int
-GSAtomicIncrement(gsatomic_t X)
+static inline uint32_t
+GSRefIncrement(uint32_t *x)
 {
-  int tmp;
-  __asm__ __volatile__ (
-    "0:"
-    "lwarx %0,0,%1 \n"
-    "addic %0,%0,1 \n"
-    "stwcx. %0,0,%1 \n"
-    "bne- 0b \n"
-    :"=&r" (tmp)
-    :"r" (X)
-    :"cc", "memory");
-  return tmp;
-}
+  uint32_t	v;
 
-static __inline__ int
-GSAtomicDecrement(gsatomic_t X)
-{
-  int tmp;
-  __asm__ __volatile__ (
-    "0:"
-    "lwarx %0,0,%1 \n"
-    "addic %0,%0,-1 \n"
-    "stwcx. %0,0,%1 \n"
-    "bne- 0b \n"
-    :"=&r" (tmp)
-    :"r" (X)
-    :"cc", "memory");
-  return tmp;
+  pthread_mutex_lock(&refLock);
+  v = ++*x;
+  pthread_mutex_unlock(&refLock);
+  return v;
 }
 
-#elif defined(__m68k__)
-
-typedef int32_t volatile *gsatomic_t;
-
-#define	GSATOMICREAD(X)	(*(X))
-
-static __inline__ int
-GSAtomicIncrement(gsatomic_t X)
+static inline uint32_t
+GSRefDecrement(uint32_t *x)
 {
-  __asm__ __volatile__ (
-    "addq%.l %#1, %0"
-    :"=m" (*X));
-    return *X;
-}
+  uint32_t	v;
 
-static __inline__ int
-GSAtomicDecrement(gsatomic_t X)
-{
-  __asm__ __volatile__ (
-    "subq%.l %#1, %0"
-    :"=m" (*X));
-    return *X;
+  pthread_mutex_lock(&refLock);
+  v = --*x;
+  pthread_mutex_unlock(&refLock);
+  return v;
 }
 
-#elif defined(__mips__)
-
-typedef int32_t volatile *gsatomic_t;
-
-#define	GSATOMICREAD(X)	(*(X))
-
-static __inline__ int
-GSAtomicIncrement(gsatomic_t X)
+static inline BOOL
+GSRefCompareAndSwap(uint32_t *x, uint32_t *o, uint32_t n, int m)
 {
-  int tmp;
+  BOOL	swapped;
 
-  __asm__ __volatile__ (
-#if !defined(__mips64__)
-    "   .set  mips2  \n"
-#endif
-    "0: ll    %0, %1 \n"
-    "   addiu %0, 1  \n"
-    "   sc    %0, %1 \n"
-    "   beqz  %0, 0b  \n"
-    :"=&r" (tmp), "=m" (*X));
-    return tmp;
+  pthread_mutex_lock(&refLock);
+  if (*x == *o)
+    {
+      *x = n;
+      swapped = YES;
+    }
+  else
+    {
+      *o = *x;
+      swapped = NO;
+    }
+  pthread_mutex_unlock(&refLock);
+  return swapped;
 }
 
-static __inline__ int
-GSAtomicDecrement(gsatomic_t X)
-{
-  int tmp;
-
-  __asm__ __volatile__ (
-#if !defined(__mips64__)
-    "   .set  mips2  \n"
-#endif
-    "0: ll    %0, %1 \n"
-    "   addiu %0, -1 \n"
-    "   sc    %0, %1 \n"
-    "   beqz  %0, 0b  \n"
-    :"=&r" (tmp), "=m" (*X));
-    return tmp;
-}
 #endif
 
-#if	!defined(GSATOMICREAD)
-
 /*
- * Having just one allocationLock for all leads to lock contention
- * if there are lots of threads doing lots of retain/release calls.
- * To alleviate this, instead of a single
- * allocationLock for all objects, we divide the object space into
- * chunks, each with its own lock. The chunk is selected by shifting
- * off the low-order ALIGNBITS of the object's pointer (these bits
- * are presumably always zero) and take
- * the low-order LOCKBITS of the result to index into a table of locks.
- */
-
-#define LOCKBITS 5
-#define LOCKCOUNT (1<<LOCKBITS)
-#define LOCKMASK (LOCKCOUNT-1)
-#define ALIGNBITS 3
-
-static NSLock *allocationLocks[LOCKCOUNT] = { 0 };
+ * The low 31 bits of the word hold the extra reference count, unless
+ * the top bit (REF_SPILLED) is set, in which case part of the count is
+ * held in the spill table below.  When retains take the count in the
+ * word up to REF_LIMIT, REF_BATCH is moved into the spill table, and
+ * when releases take it down to zero, up to REF_BATCH is moved back,
+ * so the table is used once per REF_BATCH operations at most.
+ * An object whose count has never got that large (almost all of them)
+ * has no spill table entry, so when its count is zero we know it must
+ * be deallocated without any locking.
+ */
+#define	REF_SPILLED	0x80000000
+#define	REF_MASK	0x7fffffff
+#define	REF_LIMIT	0x40000000
+#define	REF_BATCH	0x20000000
+
+typedef struct gs_ref_spill {
+  struct gs_ref_spill	*next;
+  id			object;
+  NSUInteger		count;
+} gs_ref_spill;
+
+static pthread_mutex_t	refSpillLock = PTHREAD_MUTEX_INITIALIZER;
+static gs_ref_spill	*refSpills = 0;
+
+/* Returns the spill table entry for anObject, creating it if necessary.
+ * Must be called with refSpillLock held.
+ */
+static gs_ref_spill *
+refSpillForObject(id anObject, BOOL create)
+{
+  gs_ref_spill	*s;
+
+  for (s = refSpills; s != 0; s = s->next)
+    {
+      if (s->object == anObject)
+	{
+	  return s;
+	}
+    }
+  if (YES == create)
+    {
+      s = (gs_ref_spill*)malloc(sizeof(gs_ref_spill));
+      s->object = anObject;
+      s->count = 0;
+      s->next = refSpills;
+      refSpills = s;
+    }
+  return s;
+}
 
-static inline NSLock *GSAllocationLockForObject(id p)
+static void
+refSpillRemove(gs_ref_spill *spill)
 {
-  NSUInteger i = ((((NSUInteger)(uintptr_t)p) >> ALIGNBITS) & LOCKMASK);
-  return allocationLocks[i];
-}
+  gs_ref_spill	**p = &refSpills;
 
-#endif
+  while (*p != spill)
+    {
+      p = &(*p)->next;
+    }
+  *p = spill->next;
+  free(spill);
+}
 
 #ifdef ALIGN
 #undef ALIGN
@@ -411,7 +367,7 @@ static inline NSLock *GSAllocationLockForObject(id p)
  *	(before the start) in each object.
  */
 typedef struct obj_layout_unpadded {
-    NSUInteger	retained;
+    uint32_t	retained;
 } unp;
 #define	UNP sizeof(unp)
 
@@ -422,7 +378,7 @@ typedef struct obj_layout_unpadded {
  */
 struct obj_layout {
     char	padding[ALIGN - ((UNP % ALIGN) ? (UNP % ALIGN) : ALIGN)];
-    NSUInteger	retained;
+    uint32_t	retained;
 };
 typedef	struct obj_layout *obj;
 
@@ -468,58 +424,57 @@ NSDecrementExtraRefCountWasZero(id anObject)
         [NSException raise: NSGenericException
 		    format: @"Release would release object too many times."];
     }
-  if (allocationLock != 0)
-    {
-#if	defined(GSATOMICREAD)
-      int	result;
-
-      result = GSAtomicDecrement((gsatomic_t)&(((obj)anObject)[-1].retained));
-      if (result < 0)
-	{
-	  if (result != -1)
-	    {
-	      [NSException raise: NSInternalInconsistencyException
-		format: @"NSDecrementExtraRefCount() decremented too far"];
-	    }
-	  /* The counter has become negative so it must have been zero.
-	   * We reset it and return YES ... in a correctly operating
-	   * process we know we can safely reset back to zero without
-	   * worrying about atomicity, since there can be no other
-	   * thread accessing the object (or its reference count would
-	   * have been greater than zero)
-	   */
-	  (((obj)anObject)[-1].retained) = 0;
-	  return YES;
-	}
-#else	/* GSATOMICREAD */
-      NSLock *theLock = GSAllocationLockForObject(anObject);
+  {
+    uint32_t	*word = &(((obj)anObject)[-1].retained);
+    uint32_t	old = GSRefLoad(word);
 
-      [theLock lock];
-      if (((obj)anObject)[-1].retained == 0)
-	{
-	  [theLock unlock];
-	  return YES;
-	}
-      else
-	{
-	  ((obj)anObject)[-1].retained--;
-	  [theLock unlock];
-	  return NO;
-	}
-#endif	/* GSATOMICREAD */
-    }
-  else
-    {
-      if (((obj)anObject)[-1].retained == 0)
-	{
-	  return YES;
-	}
-      else
-	{
-	  ((obj)anObject)[-1].retained--;
-	  return NO;
-	}
-    }
+    for (;;)
+      {
+	if (old & REF_MASK)
+	  {
+	    if (GSRefCompareAndSwap(word, &old, old - 1, GSRefRelease))
+	      {
+		return NO;
+	      }
+	  }
+	else if (0 == old)
+	  {
+	    /* The count was zero, so this is the last reference and no
+	     * other thread can be using the object.
+	     */
+	    GSRefAcquire();
+	    return YES;
+	  }
+	else
+	  {
+	    gs_ref_spill	*spill;
+	    NSUInteger		batch;
+	    BOOL		done;
+
+	    /* Nothing left in the word, so we get a batch back from
+	     * the spill table (which must hold at least one).
+	     */
+	    pthread_mutex_lock(&refSpillLock);
+	    spill = refSpillForObject(anObject, NO);
+	    batch = (spill->count > REF_BATCH) ? REF_BATCH : spill->count;
+	    done = GSRefCompareAndSwap(word, &old, (batch - 1)
+	      | ((spill->count > batch) ? REF_SPILLED : 0), GSRefRelease);
+	    if (YES == done)
+	      {
+		spill->count -= batch;
+		if (0 == spill->count)
+		  {
+		    refSpillRemove(spill);
+		  }
+	      }
+	    pthread_mutex_unlock(&refSpillLock);
+	    if (YES == done)
+	      {
+		return NO;
+	      }
+	  }
+      }
+  }
 #endif /* !GS_WITH_GC */
   return NO;
 }
@@ -541,7 +496,22 @@ NSExtraRefCount(id anObject)
 #if	GS_WITH_GC
   return UINT_MAX - 1;
 #else	/* GS_WITH_GC */
-  return ((obj)anObject)[-1].retained;
+  uint32_t	word = GSRefLoad(&(((obj)anObject)[-1].retained));
+  NSUInteger	count = word & REF_MASK;
+
+  if (word & REF_SPILLED)
+    {
+      gs_ref_spill	*spill;
+
+      pthread_mutex_lock(&refSpillLock);
+      spill = refSpillForObject(anObject, NO);
+      if (spill != 0)
+	{
+	  count += spill->count;
+	}
+      pthread_mutex_unlock(&refSpillLock);
+    }
+  return count;
 #endif /* GS_WITH_GC */
 }
 
@@ -577,41 +547,40 @@ NSIncrementExtraRefCount(id anObject)
 #if	GS_WITH_GC || __OBJC_GC__
   return;
 #else	/* GS_WITH_GC */
-  if (allocationLock != 0)
+  uint32_t	*word = &(((obj)anObject)[-1].retained);
+
+  if ((GSRefIncrement(word) & REF_MASK) >= REF_LIMIT)
     {
-#if	defined(GSATOMICREAD)
-      /* I've seen comments saying that some platforms only support up to
-       * 24 bits in atomic locking, so raise an exception if we try to
-       * go beyond 0xfffffe.
+      gs_ref_spill	*spill;
+      uint32_t		old;
+
+      /* Move a batch out of the word into the spill table (unless
+       * another thread got here first and has already done so).
        */
-      if (GSAtomicIncrement((gsatomic_t)&(((obj)anObject)[-1].retained))
-        > 0xfffffe)
+      pthread_mutex_lock(&refSpillLock);
+      spill = refSpillForObject(anObject, YES);
+      if (spill->count > NSUIntegerMax - REF_LIMIT - REF_BATCH)
 	{
+	  pthread_mutex_unlock(&refSpillLock);
+	  GSRefDecrement(word);
 	  [NSException raise: NSInternalInconsistencyException
 	    format: @"NSIncrementExtraRefCount() asked to increment too far"];
 	}
-#else	/* GSATOMICREAD */
-      NSLock *theLock = GSAllocationLockForObject(anObject);
-
-      [theLock lock];
-      if (((obj)anObject)[-1].retained == UINT_MAX - 1)
+      old = GSRefLoad(word);
+      while ((old & REF_MASK) >= REF_LIMIT)
 	{
-	  [theLock unlock];
-	  [NSException raise: NSInternalInconsistencyException
-	    format: @"NSIncrementExtraRefCount() asked to increment too far"];
+	  if (GSRefCompareAndSwap(word, &old,
+	    (old - REF_BATCH) | REF_SPILLED, GSRefRelaxed))
+	    {
+	      spill->count += REF_BATCH;
+	      break;
+	    }
 	}
-      ((obj)anObject)[-1].retained++;
-      [theLock unlock];
-#endif	/* GSATOMICREAD */
-    }
-  else
-    {
-      if (((obj)anObject)[-1].retained == UINT_MAX - 1)
+      if (0 == spill->count)
 	{
-	  [NSException raise: NSInternalInconsistencyException
-	    format: @"NSIncrementExtraRefCount() asked to increment too far"];
+	  refSpillRemove(spill);
 	}
-      ((obj)anObject)[-1].retained++;
+      pthread_mutex_unlock(&refSpillLock);
     }
 #endif	/* GS_WITH_GC */
 }
@@ -943,14 +912,6 @@ NSShouldRetainWithZone (NSObject *anObject, NSZone *requestedZone)
 {
   if (allocationLock == 0)
     {
-#if !defined(GSATOMICREAD)
-      NSUInteger	i;
-
-      for (i = 0; i < LOCKCOUNT; i++)
-        {
-	  allocationLocks[i] = [NSLock new];
-	}
-#endif
       allocationLock = [NSLock new];
     }
 }
@@ -28,8 +28,28 @@
 
 #import "common.h"
 
+#import "Foundation/NSHashTable.h"
 #import "Foundation/NSLock.h"
 
+/* Entry in the binary heap of operations waiting to be started by a queue.
+ * The priority is sampled when the operation becomes ready (and updated
+ * if it is changed while the operation waits), and the sequence number
+ * keeps operations of equal priority in the order in which they became
+ * ready.
+ */
+typedef struct {
+  id		op;
+  NSInteger	pri;
+  NSUInteger	seq;
+} GSOperationHeapNode;
+
+typedef struct {
+  GSOperationHeapNode	*nodes;
+  NSUInteger		count;
+  NSUInteger		size;
+  NSUInteger		serial;
+} GSOperationHeap;
+
 #define	GS_NSOperation_IVARS \
   NSRecursiveLock *lock; \
   NSConditionLock *cond; \
@@ -42,19 +62,30 @@
   BOOL blocked; \
   BOOL ready; \
   NSMutableArray *dependencies; \
-  GSOperationCompletionBlock completionBlock;
+  GSOperationCompletionBlock completionBlock; \
+  id queue; \
+  NSHashTable *dependents; \
+  NSUInteger pending; \
+  NSUInteger queueState; \
+  NSUInteger heapIndex; \
+  BOOL notified; \
+  BOOL customReady;
 
 #define	GS_NSOperationQueue_IVARS \
   NSRecursiveLock	*lock; \
   NSConditionLock	*cond; \
   NSMutableArray	*operations; \
-  NSMutableArray	*waiting; \
+  NSLock		*doneLock; \
+  NSMutableArray	*done; \
+  GSOperationHeap	waiting; \
   NSMutableArray	*starting; \
   NSString		*name; \
   BOOL			suspended; \
   NSInteger		executing; \
   NSInteger		threadCount; \
-  NSInteger		count;
+  NSInteger		count; \
+  NSUInteger		scheduler; \
+  struct GSOperationWorkers	*workers;
 
 #import "Foundation/NSOperation.h"
 #import "Foundation/NSArray.h"
@@ -63,21 +94,84 @@
 #import "Foundation/NSEnumerator.h"
 #import "Foundation/NSException.h"
 #import "Foundation/NSKeyValueObserving.h"
+#import "Foundation/NSProcessInfo.h"
 #import "Foundation/NSThread.h"
+#import "Foundation/NSValue.h"
 #import "GSPrivate.h"
+#import "GSPThread.h"
+
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>
+#endif
+
+/* The work stealing scheduler needs atomic compare and swap.
+ */
+#if	defined(__llvm__) || (defined(USE_ATOMIC_BUILTINS) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 1)))
+#define	GS_WORK_STEALING	1
+#endif
 
 #define	GSInternal	NSOperationInternal
 #include	"GSInternal.h"
 GS_PRIVATE_INTERNAL(NSOperation)
 
-/* The pool of threads for 'non-concurrent' operations in a queue.
+/* The maximum size of the pool of threads for 'non-concurrent' operations
+ * in a queue (set from the number of processors).
  */
-#define	POOL	8
+static NSUInteger	poolSize = 0;
 
 static NSArray	*empty = nil;
+static IMP	readyIMP = 0;
+
+/* Return YES if o is currently being key-value-observed (the KVO
+ * mechanism replaces the class of observed instances).
+ * When nobody is observing we can skip the (relatively expensive)
+ * change notification methods altogether.
+ */
+static inline BOOL
+isObserved(id o)
+{
+  return (object_getClass(o) != [o class]) ? YES : NO;
+}
+
+#define	WILL_CHANGE(o, k) \
+  do { if (YES == isObserved(o)) [o willChangeValueForKey: k]; } while (0)
+#define	DID_CHANGE(o, k) \
+  do { if (YES == isObserved(o)) [o didChangeValueForKey: k]; } while (0)
+
+/* The states of an operation with respect to the queue containing it.
+ * These are only changed while the queue is locked.
+ */
+#define	GSOpQueueNone		0	// Not in a queue (yet)
+#define	GSOpQueueAdded		1	// In the operations array of the queue
+#define	GSOpQueueWaiting	2	// In the heap of ready operations
+#define	GSOpQueueDispatched	3	// Started by the queue
+
+@interface	NSOperationQueue (Private)
++ (void) _mainQueue;
+- (void) _execute;
+- (void) _flush;
+- (void) _operationFinished: (NSOperation*)op;
+- (void) _operationPriority: (NSOperation*)op;
+- (void) _operationReady: (NSOperation*)op;
+- (void) _thread;
+#if	defined(GS_WORK_STEALING)
+- (void) _schedule: (NSOperation*)op;
+- (void) _workStealingThread: (NSValue*)slot;
+#endif
+@end
 
 @interface	NSOperation (Private)
+- (void) _addDependent: (NSOperation*)op;
+- (BOOL) _dependencyAdded;
+- (NSOperationQueue*) _dependencyFinished;
 - (void) _finish;
+- (NSUInteger) _heapIndex;
+- (void) _notifyFinished;
+- (NSUInteger) _queueState;
+- (void) _removeDependent: (NSOperation*)op;
+- (void) _setHeapIndex: (NSUInteger)i;
+- (BOOL) _setQueue: (NSOperationQueue*)q;
+- (void) _setQueueState: (NSUInteger)s;
 @end
 
 @implementation NSOperation
@@ -91,11 +185,17 @@ static NSArray	*empty = nil;
 
 + (void) initialize
 {
-  empty = [NSArray new];
+  if (nil == empty)
+    {
+      empty = [NSArray new];
+      readyIMP = [NSOperation instanceMethodForSelector: @selector(isReady)];
+    }
 }
 
 - (void) addDependency: (NSOperation *)op
 {
+  BOOL	added = NO;
+
   if (NO == [op isKindOfClass: [NSOperation class]])
     {
       [NSException raise: NSInvalidArgumentException
@@ -117,35 +217,10 @@ static NSArray	*empty = nil;
     {
       if (NSNotFound == [internal->dependencies indexOfObjectIdenticalTo: op])
 	{
-	  [self willChangeValueForKey: @"dependencies"];
+	  WILL_CHANGE(self, @"dependencies");
           [internal->dependencies addObject: op];
-	  /* We only need to watch for changes if it's possible for them to
-	   * happen and make a difference.
-	   */
-	  if (NO == [op isFinished]
-	    && NO == [self isCancelled]
-	    && NO == [self isExecuting]
-	    && NO == [self isFinished])
-	    {
-	      /* Can change readiness if we are neither cancelled nor
-	       * executing nor finished.  So we need to observe for the
-	       * finish of the dependency.
-	       */
-	      [op addObserver: self
-		   forKeyPath: @"isFinished"
-		      options: NSKeyValueObservingOptionNew
-		      context: NULL];
-	      if (internal->ready == YES)
-		{
-		  /* The new dependency stops us being ready ...
-		   * change state.
-		   */
-		  [self willChangeValueForKey: @"isReady"];
-		  internal->ready = NO;
-		  [self didChangeValueForKey: @"isReady"];
-		}
-	    }
-	  [self didChangeValueForKey: @"dependencies"];
+	  DID_CHANGE(self, @"dependencies");
+	  added = YES;
 	}
     }
   NS_HANDLER
@@ -156,26 +231,38 @@ static NSArray	*empty = nil;
     }
   NS_ENDHANDLER
   [internal->lock unlock];
+
+  /* Register with the dependency (outside our own lock, since a
+   * dependency locks itself before locking its dependents) so that it
+   * tells us directly when it finishes.
+   */
+  if (YES == added)
+    {
+      [op _addDependent: self];
+    }
 }
 
 - (void) cancel
 {
   if (NO == internal->cancelled && NO == [self isFinished])
     {
+      NSOperationQueue	*q = nil;
+
       [internal->lock lock];
       if (NO == internal->cancelled && NO == [self isFinished])
 	{
 	  NS_DURING
 	    {
-	      [self willChangeValueForKey: @"isCancelled"];
+	      WILL_CHANGE(self, @"isCancelled");
 	      internal->cancelled = YES;
 	      if (NO == internal->ready)
 		{
-	          [self willChangeValueForKey: @"isReady"];
+	          WILL_CHANGE(self, @"isReady");
 		  internal->ready = YES;
-	          [self didChangeValueForKey: @"isReady"];
+	          DID_CHANGE(self, @"isReady");
+		  q = internal->queue;
 		}
-	      [self didChangeValueForKey: @"isCancelled"];
+	      DID_CHANGE(self, @"isCancelled");
 	    }
 	  NS_HANDLER
 	    {
@@ -186,6 +273,11 @@ static NSArray	*empty = nil;
 	  NS_ENDHANDLER
 	}
       [internal->lock unlock];
+      if (nil != q)
+	{
+	  [q _operationReady: self];
+	  [q _execute];
+	}
     }
 }
 
@@ -204,6 +296,10 @@ static NSArray	*empty = nil;
 	{
 	  [self removeDependency: op];
 	}
+      if (0 != internal->dependents)
+	{
+	  NSFreeHashTable(internal->dependents);
+	}
       RELEASE(internal->dependencies);
       RELEASE(internal->cond);
       RELEASE(internal->lock);
@@ -229,6 +325,39 @@ static NSArray	*empty = nil;
   return a;
 }
 
+/* Operations which manage their own state (concurrent operations
+ * overriding -isFinished etc) must send change notifications for it,
+ * so we intercept those to update dependents and queues directly.
+ * Changes made by the NSOperation implementation itself are propagated
+ * without going through this method.
+ */
+- (void) didChangeValueForKey: (NSString*)aKey
+{
+  [super didChangeValueForKey: aKey];
+  if (YES == [aKey isEqualToString: @"isFinished"])
+    {
+      if (NO == internal->finished && YES == [self isFinished])
+	{
+	  [self _notifyFinished];
+	}
+    }
+  else if (YES == internal->customReady
+    && YES == [aKey isEqualToString: @"isReady"])
+    {
+      if (YES == [self isReady])
+	{
+	  NSOperationQueue	*q;
+
+	  [internal->lock lock];
+	  q = [internal->queue retain];
+	  [internal->lock unlock];
+	  [q _operationReady: self];
+	  [q _execute];
+	  [q release];
+	}
+    }
+}
+
 - (id) init
 {
   if ((self = [super init]) != nil)
@@ -238,6 +367,10 @@ static NSArray	*empty = nil;
       internal->threadPriority = 0.5;
       internal->ready = YES;
       internal->lock = [NSRecursiveLock new];
+      if ([self methodForSelector: @selector(isReady)] != readyIMP)
+	{
+	  internal->customReady = YES;
+	}
     }
   return self;
 }
@@ -272,54 +405,6 @@ static NSArray	*empty = nil;
   return;	// OSX default implementation does nothing
 }
 
-- (void) observeValueForKeyPath: (NSString *)keyPath
-		       ofObject: (id)object
-                         change: (NSDictionary *)change
-                        context: (void *)context
-{
-  [internal->lock lock];
-
-  /* We only observe isFinished changes, and we can remove self as an
-   * observer once we know the operation has finished since it can never
-   * become unfinished.
-   */
-  [object removeObserver: self
-	      forKeyPath: @"isFinished"];
-
-  if (object == self)
-    {
-      /* We have finished and need to unlock the condition lock so that
-       * any waiting thread can continue.
-       */
-      [internal->cond lock];
-      [internal->cond unlockWithCondition: 1];
-    }
-  else if (NO == internal->ready)
-    {
-      NSEnumerator	*en;
-      NSOperation	*op;
-
-      /* Some dependency has finished (or been removed) ...
-       * so we need to check to see if we are now ready unless we know we are.
-       * This is protected by locks so that an update due to an observed
-       * change in one thread won't interrupt anything in another thread.
-       */
-      en = [internal->dependencies objectEnumerator];
-      while ((op = [en nextObject]) != nil)
-        {
-          if (NO == [op isFinished])
-	    break;
-        }
-      if (op == nil)
-	{
-          [self willChangeValueForKey: @"isReady"];
-	  internal->ready = YES;
-          [self didChangeValueForKey: @"isReady"];
-	}
-    }
-  [internal->lock unlock];
-}
-
 - (NSOperationQueuePriority) queuePriority
 {
   return internal->priority;
@@ -327,26 +412,18 @@ static NSArray	*empty = nil;
 
 - (void) removeDependency: (NSOperation *)op
 {
+  BOOL	removed = NO;
+
   [internal->lock lock];
   NS_DURING
     {
       if (NSNotFound != [internal->dependencies indexOfObjectIdenticalTo: op])
 	{
-	  [op removeObserver: self
-	          forKeyPath: @"isFinished"];
-	  [self willChangeValueForKey: @"dependencies"];
-	  [internal->dependencies removeObject: op];
-	  if (NO == internal->ready)
-	    {
-	      /* The dependency may cause us to become ready ...
-	       * fake an observation so we can deal with that.
-	       */
-	      [self observeValueForKeyPath: @"isFinished"
-				  ofObject: op
-				    change: nil
-				   context: nil];
-	    }
-	  [self didChangeValueForKey: @"dependencies"];
+	  WILL_CHANGE(self, @"dependencies");
+	  [op retain];
+	  [internal->dependencies removeObjectIdenticalTo: op];
+	  DID_CHANGE(self, @"dependencies");
+	  removed = YES;
 	}
     }
   NS_HANDLER
@@ -357,6 +434,14 @@ static NSArray	*empty = nil;
     }
   NS_ENDHANDLER
   [internal->lock unlock];
+
+  if (YES == removed)
+    {
+      /* The dependency may cause us to become ready.
+       */
+      [op _removeDependent: self];
+      [op release];
+    }
 }
 
 - (void) setCompletionBlock: (GSOperationCompletionBlock)aBlock
@@ -379,14 +464,16 @@ static NSArray	*empty = nil;
 
   if (pri != internal->priority)
     {
+      NSOperationQueue	*q = nil;
+
       [internal->lock lock];
       if (pri != internal->priority)
 	{
 	  NS_DURING
 	    {
-	      [self willChangeValueForKey: @"queuePriority"];
+	      WILL_CHANGE(self, @"queuePriority");
 	      internal->priority = pri;
-	      [self didChangeValueForKey: @"queuePriority"];
+	      DID_CHANGE(self, @"queuePriority");
 	    }
 	  NS_HANDLER
 	    {
@@ -395,8 +482,16 @@ static NSArray	*empty = nil;
 	      return;
 	    }
 	  NS_ENDHANDLER
+	  q = [internal->queue retain];
 	}
       [internal->lock unlock];
+      if (nil != q)
+	{
+	  /* We may be waiting in the queue's heap under the old priority.
+	   */
+	  [q _operationPriority: self];
+	  [q release];
+	}
     }
 }
 
@@ -441,9 +536,9 @@ static NSArray	*empty = nil;
 	}
       if (NO == internal->executing)
 	{
-	  [self willChangeValueForKey: @"isExecuting"];
+	  WILL_CHANGE(self, @"isExecuting");
 	  internal->executing = YES;
-	  [self didChangeValueForKey: @"isExecuting"];
+	  DID_CHANGE(self, @"isExecuting");
 	}
     }
   NS_HANDLER
@@ -485,23 +580,12 @@ static NSArray	*empty = nil;
       [internal->lock lock];
       if (nil == internal->cond)
 	{
-	  /* Set up condition to wait on and observer to unblock.
-	   */
-	  internal->cond = [[NSConditionLock alloc] initWithCondition: 0];
-	  [self addObserver: self
-		 forKeyPath: @"isFinished"
-		    options: NSKeyValueObservingOptionNew
-		    context: NULL];
-	  /* Some other thread could have marked us as finished while we
-	   * were setting up ... so we can fake the observation if needed.
+	  /* Set up condition to wait on ... it is unlocked with a
+	   * condition of 1 when the finish is propagated, which may
+	   * already have happened in another thread.
 	   */
-          if (YES == [self isFinished])
-	    {
-	      [self observeValueForKeyPath: @"isFinished"
-				  ofObject: self
-				    change: nil
-				   context: nil];
-	    }
+	  internal->cond = [[NSConditionLock alloc]
+	    initWithCondition: (YES == internal->notified) ? 1 : 0];
 	}
       [internal->lock unlock];
       [internal->cond lockWhenCondition: 1];	// Wait for finish
@@ -511,6 +595,77 @@ static NSArray	*empty = nil;
 @end
 
 @implementation	NSOperation (Private)
+
+/* Called on a dependency of op (with op's lock not held) to register
+ * op for direct notification when the receiver finishes.
+ */
+- (void) _addDependent: (NSOperation*)op
+{
+  [internal->lock lock];
+  if (NO == internal->notified && NO == [self isFinished])
+    {
+      if (YES == [op _dependencyAdded])
+	{
+	  if (0 == internal->dependents)
+	    {
+	      internal->dependents
+		= NSCreateHashTable(NSNonOwnedPointerHashCallBacks, 4);
+	    }
+	  NSHashInsert(internal->dependents, op);
+	}
+    }
+  [internal->lock unlock];
+}
+
+/* Called (with the lock of the new dependency held) to count an
+ * unfinished dependency.  Returns NO if the dependency can make no
+ * difference because we are already cancelled, executing or finished.
+ */
+- (BOOL) _dependencyAdded
+{
+  BOOL	counted = NO;
+
+  [internal->lock lock];
+  if (NO == [self isCancelled]
+    && NO == [self isExecuting]
+    && NO == [self isFinished])
+    {
+      internal->pending++;
+      counted = YES;
+      if (YES == internal->ready)
+	{
+	  /* The new dependency stops us being ready ... change state.
+	   */
+	  WILL_CHANGE(self, @"isReady");
+	  internal->ready = NO;
+	  DID_CHANGE(self, @"isReady");
+	}
+    }
+  [internal->lock unlock];
+  return counted;
+}
+
+/* Called (with the lock of the dependency held) when a counted
+ * dependency finishes or is removed.  If that makes us ready, this
+ * returns the queue which must be told about it (if any).
+ */
+- (NSOperationQueue*) _dependencyFinished
+{
+  NSOperationQueue	*q = nil;
+
+  [internal->lock lock];
+  if (internal->pending > 0 && 0 == --internal->pending
+    && NO == internal->ready)
+    {
+      WILL_CHANGE(self, @"isReady");
+      internal->ready = YES;
+      DID_CHANGE(self, @"isReady");
+      q = internal->queue;
+    }
+  [internal->lock unlock];
+  return q;
+}
+
 - (void) _finish
 {
   /* retain while finishing so that we don't get deallocated when our
@@ -522,18 +677,18 @@ static NSArray	*empty = nil;
     {
       if (NO == internal->executing)
         {
-	  [self willChangeValueForKey: @"isExecuting"];
-	  [self willChangeValueForKey: @"isFinished"];
+	  WILL_CHANGE(self, @"isExecuting");
+	  WILL_CHANGE(self, @"isFinished");
 	  internal->executing = NO;
 	  internal->finished = YES;
-	  [self didChangeValueForKey: @"isFinished"];
-	  [self didChangeValueForKey: @"isExecuting"];
+	  DID_CHANGE(self, @"isFinished");
+	  DID_CHANGE(self, @"isExecuting");
 	}
       else
 	{
-	  [self willChangeValueForKey: @"isFinished"];
+	  WILL_CHANGE(self, @"isFinished");
 	  internal->finished = YES;
-	  [self didChangeValueForKey: @"isFinished"];
+	  DID_CHANGE(self, @"isFinished");
 	}
       if (NULL != internal->completionBlock)
 	{
@@ -541,9 +696,144 @@ static NSArray	*empty = nil;
 	}
     }
   [internal->lock unlock];
+  [self _notifyFinished];
   [self release];
 }
 
+/* Propagate the fact that we have finished to any thread waiting for us,
+ * to the operations which depend on us, and to our queue.
+ * This happens exactly once.
+ */
+- (void) _notifyFinished
+{
+  NSMutableArray	*queues = nil;
+  NSOperationQueue	*q;
+
+  [internal->lock lock];
+  if (YES == internal->notified)
+    {
+      [internal->lock unlock];
+      return;
+    }
+  internal->notified = YES;
+  if (nil != internal->cond)
+    {
+      [internal->cond lock];
+      [internal->cond unlockWithCondition: 1];
+    }
+  if (0 != internal->dependents)
+    {
+      NSHashEnumerator	e = NSEnumerateHashTable(internal->dependents);
+      NSOperation	*op;
+
+      /* Our dependents can't be deallocated while we hold our lock
+       * (they remove themselves from the table first), so this is
+       * the only place where it's safe to tell them we are done.
+       */
+      while ((op = NSNextHashEnumeratorItem(&e)) != nil)
+	{
+	  if ((q = [op _dependencyFinished]) != nil)
+	    {
+	      [q _operationReady: op];
+	      if (nil == queues)
+		{
+		  queues = [NSMutableArray new];
+		}
+	      if (NSNotFound == [queues indexOfObjectIdenticalTo: q])
+		{
+		  [queues addObject: q];
+		}
+	    }
+	}
+      NSEndHashTableEnumeration(&e);
+      NSResetHashTable(internal->dependents);
+    }
+  q = [internal->queue retain];
+  [internal->lock unlock];
+
+  [q _operationFinished: self];
+  [q release];
+  if (nil != queues)
+    {
+      [queues makeObjectsPerformSelector: @selector(_execute)];
+      [queues release];
+    }
+}
+
+/* Called on a dependency of op (with op's lock not held) when op no
+ * longer depends upon the receiver.
+ */
+- (void) _removeDependent: (NSOperation*)op
+{
+  NSOperationQueue	*q = nil;
+
+  [internal->lock lock];
+  if (0 != internal->dependents && 0 != NSHashGet(internal->dependents, op))
+    {
+      NSHashRemove(internal->dependents, op);
+      q = [[op _dependencyFinished] retain];
+    }
+  [internal->lock unlock];
+  if (nil != q)
+    {
+      [q _operationReady: op];
+      [q _execute];
+      [q release];
+    }
+}
+
+/* Only called by our queue while it is locked.
+ */
+- (NSUInteger) _heapIndex
+{
+  return internal->heapIndex;
+}
+
+- (NSUInteger) _queueState
+{
+  return internal->queueState;
+}
+
+/* Record the queue we are being added to.  Returns NO if we are
+ * already in a different queue.
+ */
+- (BOOL) _setQueue: (NSOperationQueue*)q
+{
+  BOOL	ok = YES;
+
+  [internal->lock lock];
+  if (nil == internal->queue || nil == q)
+    {
+      internal->queue = q;
+    }
+  else if (q != internal->queue)
+    {
+      ok = NO;
+    }
+  [internal->lock unlock];
+  return ok;
+}
+
+/* Only called by our queue while it is locked, as our position in its
+ * heap of waiting operations changes.
+ */
+- (void) _setHeapIndex: (NSUInteger)i
+{
+  internal->heapIndex = i;
+}
+
+/* Only called by our queue while it is locked.  We forget the queue
+ * once it has removed us, as it may be deallocated.
+ */
+- (void) _setQueueState: (NSUInteger)s
+{
+  internal->queueState = s;
+  if (GSOpQueueNone == s)
+    {
+      internal->queue = nil;
+    }
+}
+
 @end
 
 #undef	GSInternal
@@ -552,29 +842,414 @@ static NSArray	*empty = nil;
 GS_PRIVATE_INTERNAL(NSOperationQueue)
 
 
-@interface	NSOperationQueue (Private)
-+ (void) _mainQueue;
-- (void) _execute;
-- (void) _thread;
-- (void) observeValueForKeyPath: (NSString *)keyPath
-		       ofObject: (id)object
-                         change: (NSDictionary *)change
-                        context: (void *)context;
-@end
-
 static NSInteger	maxConcurrent = 200;	// Thread pool size
 
-static NSComparisonResult
-sortFunc(id o1, id o2, void *ctxt)
+/* Return YES if the heap node a should be started before the node b.
+ */
+static inline BOOL
+heapBefore(GSOperationHeapNode *a, GSOperationHeapNode *b)
+{
+  if (a->pri != b->pri)
+    {
+      return (a->pri > b->pri) ? YES : NO;
+    }
+  return (a->seq < b->seq) ? YES : NO;
+}
+
+/* Put a node at index i of the heap, telling its operation where it is
+ * so that its priority can be changed while it waits.
+ */
+static inline void
+heapPlace(GSOperationHeap *h, NSUInteger i, GSOperationHeapNode node)
+{
+  h->nodes[i] = node;
+  [node.op _setHeapIndex: i];
+}
+
+/* Move the node at index i towards the root until it is in order.
+ */
+static void
+heapUp(GSOperationHeap *h, NSUInteger i)
+{
+  GSOperationHeapNode	node = h->nodes[i];
+
+  while (i > 0)
+    {
+      NSUInteger	parent = (i - 1) / 2;
+
+      if (NO == heapBefore(&node, &h->nodes[parent]))
+	{
+	  break;
+	}
+      heapPlace(h, i, h->nodes[parent]);
+      i = parent;
+    }
+  heapPlace(h, i, node);
+}
+
+/* Move the node at index i away from the root until it is in order.
+ */
+static void
+heapDown(GSOperationHeap *h, NSUInteger i)
+{
+  GSOperationHeapNode	node = h->nodes[i];
+
+  for (;;)
+    {
+      NSUInteger	child = i * 2 + 1;
+
+      if (child >= h->count)
+	{
+	  break;
+	}
+      if (child + 1 < h->count
+	&& YES == heapBefore(&h->nodes[child + 1], &h->nodes[child]))
+	{
+	  child++;
+	}
+      if (NO == heapBefore(&h->nodes[child], &node))
+	{
+	  break;
+	}
+      heapPlace(h, i, h->nodes[child]);
+      i = child;
+    }
+  heapPlace(h, i, node);
+}
+
+/* Add a ready operation to the heap of those waiting to start.
+ * The heap retains the operation.
+ */
+static void
+heapPush(GSOperationHeap *h, NSOperation *op)
+{
+  GSOperationHeapNode	*node;
+
+  if (h->count == h->size)
+    {
+      h->size = (h->size == 0) ? 16 : h->size * 2;
+      h->nodes = NSZoneRealloc(NSDefaultMallocZone(), h->nodes,
+	h->size * sizeof(GSOperationHeapNode));
+    }
+  node = &h->nodes[h->count];
+  node->op = [op retain];
+  node->pri = [op queuePriority];
+  node->seq = h->serial++;
+  heapUp(h, h->count++);
+}
+
+/* Remove the highest priority operation from the heap and return it.
+ * The caller is responsible for releasing the returned operation.
+ */
+static NSOperation *
+heapPop(GSOperationHeap *h)
+{
+  NSOperation		*op;
+
+  if (h->count == 0)
+    {
+      return nil;
+    }
+  op = h->nodes[0].op;
+  if (--h->count > 0)
+    {
+      h->nodes[0] = h->nodes[h->count];
+      heapDown(h, 0);
+    }
+  return op;
+}
+
+/* Change the priority of the operation at index i of the heap.
+ */
+static void
+heapUpdate(GSOperationHeap *h, NSUInteger i, NSInteger pri)
+{
+  if (pri > h->nodes[i].pri)
+    {
+      h->nodes[i].pri = pri;
+      heapUp(h, i);
+    }
+  else if (pri < h->nodes[i].pri)
+    {
+      h->nodes[i].pri = pri;
+      heapDown(h, i);
+    }
+}
+
+static void
+heapDestroy(GSOperationHeap *h)
+{
+  while (h->count > 0)
+    {
+      [h->nodes[--h->count].op release];
+    }
+  if (h->nodes != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), h->nodes);
+      h->nodes = 0;
+    }
+  h->size = 0;
+}
+
+/* Run a non-concurrent operation in a worker thread.
+ */
+static void
+runOperation(NSOperation *op)
+{
+  NS_DURING
+    {
+      NSAutoreleasePool	*opPool = [NSAutoreleasePool new];
+
+      if (NO == [op isCancelled])
+	{
+	  [NSThread setThreadPriority: [op threadPriority]];
+	  [op main];
+	}
+      [opPool release];
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem running operation %@ ... %@",
+	op, localException);
+    }
+  NS_ENDHANDLER
+  [op _finish];
+}
+
+#if	defined(GS_WORK_STEALING)
+
+/* The work stealing scheduler.
+ * Each worker thread owns a fixed size deque of operations (the
+ * Chase-Lev algorithm).  The owner pushes and pops at the bottom of its
+ * deque without locking, while idle workers steal from the top using an
+ * atomic compare and swap.
+ * Operations submitted by threads which are not workers of the queue go
+ * into a shared injection ring which is protected by a mutex, since the
+ * deques may only be pushed to by their owners.
+ * A worker pushing to its own deque only takes the mutex if another
+ * worker needs to be woken or started.  The generation count and the
+ * count of idle workers are each changed before the other is checked
+ * (by the pusher and by a worker about to wait respectively), so that
+ * one of them always sees the other and no wakeup is lost.
+ * NB. Operations still become ready, and are started in priority order,
+ * through the heap of waiting operations under the queue lock (which
+ * also enforces -maxConcurrentOperationCount), so the deques only take
+ * the handoff to and between worker threads off that lock.
+ */
+#define	GSOP_DEQUE_SIZE	256	/* Must be a power of two */
+#define	GSOP_DEQUE_MASK	(GSOP_DEQUE_SIZE - 1)
+
+typedef struct {
+  volatile intptr_t	top;
+  volatile intptr_t	bottom;
+  id			items[GSOP_DEQUE_SIZE];
+} GSOperationDeque;
+
+typedef struct {
+  GSOperationDeque		deque;
+  struct GSOperationWorkers	*workers;
+  BOOL				active;
+} GSOperationWorker;
+
+typedef struct GSOperationWorkers {
+  pthread_mutex_t	lock;		// Protects all but the deques
+  pthread_cond_t	wake;		// Signalled when work is submitted
+  id			*inject;	// Ring of operations from other threads
+  NSUInteger		injectHead;
+  NSUInteger		injectCount;
+  NSUInteger		injectSize;
+  volatile NSUInteger	generation;	// Incremented on each submission
+  volatile NSUInteger	idle;		// Workers waiting for work
+  volatile NSUInteger	active;		// Running worker threads
+  NSUInteger		size;		// Number of worker slots
+  GSOperationWorker	*slots;
+} GSOperationWorkers;
+
+static pthread_key_t	workerKey;	// The worker for the current thread
+
+static BOOL
+dequePush(GSOperationDeque *d, id op)
+{
+  intptr_t	b = d->bottom;
+  intptr_t	t = d->top;
+
+  if (b - t >= GSOP_DEQUE_SIZE)
+    {
+      return NO;	// Full
+    }
+  d->items[b & GSOP_DEQUE_MASK] = op;
+  __sync_synchronize();
+  d->bottom = b + 1;
+  return YES;
+}
+
+static id
+dequePop(GSOperationDeque *d)
+{
+  intptr_t	b = d->bottom - 1;
+  intptr_t	t;
+  id		op;
+
+  d->bottom = b;
+  __sync_synchronize();
+  t = d->top;
+  if (t > b)
+    {
+      d->bottom = b + 1;	// Empty
+      return nil;
+    }
+  op = d->items[b & GSOP_DEQUE_MASK];
+  if (t == b)
+    {
+      /* This is the last item, so we must race any thief for it.
+       */
+      if (NO == __sync_bool_compare_and_swap(&d->top, t, t + 1))
+	{
+	  op = nil;
+	}
+      d->bottom = b + 1;
+    }
+  return op;
+}
+
+static id
+dequeSteal(GSOperationDeque *d)
+{
+  intptr_t	t = d->top;
+  intptr_t	b;
+  id		op;
+
+  __sync_synchronize();
+  b = d->bottom;
+  if (t >= b)
+    {
+      return nil;	// Empty
+    }
+  op = d->items[t & GSOP_DEQUE_MASK];
+  if (NO == __sync_bool_compare_and_swap(&d->top, t, t + 1))
+    {
+      return nil;	// Lost a race with the owner or another thief
+    }
+  return op;
+}
+
+/* Take the oldest item from the injection ring.
+ * Must be called with the lock held.
+ */
+static id
+injectTake(GSOperationWorkers *w)
+{
+  id	op;
+
+  if (w->injectCount == 0)
+    {
+      return nil;
+    }
+  op = w->inject[w->injectHead];
+  w->injectHead = (w->injectHead + 1) % w->injectSize;
+  w->injectCount--;
+  return op;
+}
+
+/* Add an item to the injection ring, growing it as required.
+ * Must be called with the lock held.
+ */
+static void
+injectPut(GSOperationWorkers *w, id op)
+{
+  if (w->injectCount == w->injectSize)
+    {
+      NSUInteger	size = (w->injectSize == 0) ? 64 : w->injectSize * 2;
+      id		*ring;
+      NSUInteger	i;
+
+      ring = NSZoneMalloc(NSDefaultMallocZone(), size * sizeof(id));
+      for (i = 0; i < w->injectCount; i++)
+	{
+	  ring[i] = w->inject[(w->injectHead + i) % w->injectSize];
+	}
+      if (w->inject != 0)
+	{
+	  NSZoneFree(NSDefaultMallocZone(), w->inject);
+	}
+      w->inject = ring;
+      w->injectHead = 0;
+      w->injectSize = size;
+    }
+  w->inject[(w->injectHead + w->injectCount) % w->injectSize] = op;
+  w->injectCount++;
+}
+
+static GSOperationWorkers *
+workersCreate()
 {
-  NSOperationQueuePriority p1 = [o1 queuePriority];
-  NSOperationQueuePriority p2 = [o2 queuePriority];
+  GSOperationWorkers	*w;
+
+  w = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(GSOperationWorkers));
+  pthread_mutex_init(&w->lock, 0);
+  pthread_cond_init(&w->wake, 0);
+  w->size = poolSize;
+  w->slots = NSZoneCalloc(NSDefaultMallocZone(),
+    w->size, sizeof(GSOperationWorker));
+  return w;
+}
+
+static void
+workersDestroy(GSOperationWorkers *w)
+{
+  id	op;
+
+  /* There can be no worker threads (they retain the queue), so anything
+   * left is in the injection ring.
+   */
+  while ((op = injectTake(w)) != nil)
+    {
+      [op release];
+    }
+  if (w->inject != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), w->inject);
+    }
+  NSZoneFree(NSDefaultMallocZone(), w->slots);
+  pthread_cond_destroy(&w->wake);
+  pthread_mutex_destroy(&w->lock);
+  NSZoneFree(NSDefaultMallocZone(), w);
+}
+
+/* Find work for the worker me ... first from its own deque, then from
+ * the injection ring and finally by stealing from the other workers.
+ */
+static id
+workersFind(GSOperationWorkers *w, GSOperationWorker *me)
+{
+  id	op = dequePop(&me->deque);
+
+  if (nil == op)
+    {
+      pthread_mutex_lock(&w->lock);
+      op = injectTake(w);
+      pthread_mutex_unlock(&w->lock);
+    }
+  if (nil == op)
+    {
+      NSUInteger	start = (NSUInteger)(me - w->slots) + 1;
+      NSUInteger	i;
+
+      for (i = 0; nil == op && i < w->size; i++)
+	{
+	  GSOperationWorker	*victim = &w->slots[(start + i) % w->size];
 
-  if (p1 < p2) return NSOrderedDescending;
-  if (p1 > p2) return NSOrderedAscending;
-  return NSOrderedSame;
+	  if (victim != me)
+	    {
+	      op = dequeSteal(&victim->deque);
+	    }
+	}
+    }
+  return op;
 }
 
+#endif	/* GS_WORK_STEALING */
+
 static NSString	*threadKey = @"NSOperationQueue";
 static NSOperationQueue *mainQueue = nil;
 
@@ -587,6 +1262,17 @@ static NSOperationQueue *mainQueue = nil;
 
 + (void) initialize
 {
+  if (0 == poolSize)
+    {
+      poolSize = [[NSProcessInfo processInfo] activeProcessorCount];
+      if (poolSize < 2)
+	{
+	  poolSize = 2;
+	}
+#if	defined(GS_WORK_STEALING)
+      pthread_key_create(&workerKey, 0);
+#endif
+    }
   if (mainQueue == nil)
     {
       [self performSelectorOnMainThread: @selector(_mainQueue)
@@ -608,28 +1294,35 @@ static NSOperationQueue *mainQueue = nil;
 		  format: @"[%@-%@] object is not an NSOperation",
 	NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
     }
+  if (YES == [op isFinished])
+    {
+      return;
+    }
+  /* Tell the operation which queue it is in before we lock ourself,
+   * since operations lock themselves before locking their queue.
+   */
+  if (NO == [op _setQueue: self])
+    {
+      [NSException raise: NSInvalidArgumentException
+		  format: @"[%@-%@] operation is already in another queue",
+	NSStringFromClass([self class]), NSStringFromSelector(_cmd)];
+    }
   [internal->lock lock];
-  if (NSNotFound == [internal->operations indexOfObjectIdenticalTo: op]
-    && NO == [op isFinished])
-    {
-      [op addObserver: self
-	   forKeyPath: @"isReady"
-	      options: NSKeyValueObservingOptionNew
-	      context: NULL];
-      [self willChangeValueForKey: @"operations"];
-      [self willChangeValueForKey: @"operationCount"];
+  if (GSOpQueueNone == [op _queueState] && NO == [op isFinished])
+    {
+      WILL_CHANGE(self, @"operations");
+      WILL_CHANGE(self, @"operationCount");
       [internal->operations addObject: op];
-      [self didChangeValueForKey: @"operationCount"];
-      [self didChangeValueForKey: @"operations"];
+      [op _setQueueState: GSOpQueueAdded];
+      DID_CHANGE(self, @"operationCount");
+      DID_CHANGE(self, @"operations");
       if (YES == [op isReady])
 	{
-	  [self observeValueForKeyPath: @"isReady"
-			      ofObject: op
-				change: nil
-			       context: nil];
+	  [self _operationReady: op];
 	}
     }
   [internal->lock unlock];
+  [self _execute];
 }
 
 - (void) addOperations: (NSArray *)ops
@@ -648,6 +1341,7 @@ static NSOperationQueue *mainQueue = nil;
   if (total > 0)
     {
       BOOL		invalidArg = NO;
+      BOOL		otherQueue = NO;
       NSUInteger	toAdd = total;
       GS_BEGINITEMBUF(buf, total, id)
 
@@ -668,11 +1362,38 @@ static NSOperationQueue *mainQueue = nil;
 	      toAdd--;
 	    }
 	}
+      if (toAdd > 0)
+	{
+	  for (index = 0; index < total; index++)
+	    {
+	      if (buf[index] != nil && NO == [buf[index] _setQueue: self])
+		{
+		  NSUInteger	i;
+
+		  /* In another queue ... forget this queue in those we
+		   * have not yet added, and add none of them.
+		   */
+		  [internal->lock lock];
+		  for (i = 0; i < index; i++)
+		    {
+		      if (buf[i] != nil
+			&& GSOpQueueNone == [buf[i] _queueState])
+			{
+			  [buf[i] _setQueue: nil];
+			}
+		    }
+		  [internal->lock unlock];
+		  otherQueue = YES;
+		  toAdd = 0;
+		  break;
+		}
+	    }
+	}
       if (toAdd > 0)
 	{
           [internal->lock lock];
-	  [self willChangeValueForKey: @"operationCount"];
-	  [self willChangeValueForKey: @"operations"];
+	  WILL_CHANGE(self, @"operationCount");
+	  WILL_CHANGE(self, @"operations");
 	  for (index = 0; index < total; index++)
 	    {
 	      NSOperation	*op = buf[index];
@@ -681,38 +1402,28 @@ static NSOperationQueue *mainQueue = nil;
 		{
 		  continue;		// Not added
 		}
-	      if (NSNotFound
-		!= [internal->operations indexOfObjectIdenticalTo: op])
+	      if (GSOpQueueNone != [op _queueState])
 		{
 		  buf[index] = nil;	// Not added
 		  toAdd--;
 		  continue;
 		}
-	      [op addObserver: self
-		   forKeyPath: @"isReady"
-		      options: NSKeyValueObservingOptionNew
-		      context: NULL];
 	      [internal->operations addObject: op];
-	      if (NO == [op isReady])
-		{
-		  buf[index] = nil;	// Not yet ready
-		}
+	      [op _setQueueState: GSOpQueueAdded];
 	    }
-	  [self didChangeValueForKey: @"operationCount"];
-	  [self didChangeValueForKey: @"operations"];
+	  DID_CHANGE(self, @"operationCount");
+	  DID_CHANGE(self, @"operations");
 	  for (index = 0; index < total; index++)
 	    {
 	      NSOperation	*op = buf[index];
 
-	      if (op != nil)
+	      if (op != nil && YES == [op isReady])
 		{
-		  [self observeValueForKeyPath: @"isReady"
-				      ofObject: op
-					change: nil
-				       context: nil];
+		  [self _operationReady: op];
 		}
 	    }
           [internal->lock unlock];
+	  [self _execute];
 	}
       GS_ENDITEMBUF()
       if (YES == invalidArg)
@@ -722,6 +1433,14 @@ static NSOperationQueue *mainQueue = nil;
 	    NSStringFromClass([self class]), NSStringFromSelector(_cmd),
 	    index];
 	}
+      if (YES == otherQueue)
+	{
+	  [NSException raise: NSInvalidArgumentException
+	    format: @"[%@-%@] operation at index %"PRIuPTR
+	    " is already in another queue",
+	    NSStringFromClass([self class]), NSStringFromSelector(_cmd),
+	    index];
+	}
     }
   if (YES == shouldWait)
     {
@@ -736,9 +1455,25 @@ static NSOperationQueue *mainQueue = nil;
 
 - (void) dealloc
 {
+  [self _flush];
+  [internal->lock lock];
+  while ([internal->operations count] > 0)
+    {
+      [[internal->operations lastObject] _setQueueState: GSOpQueueNone];
+      [internal->operations removeLastObject];
+    }
+  [internal->lock unlock];
   [internal->operations release];
+  [internal->done release];
+  [internal->doneLock release];
   [internal->starting release];
-  [internal->waiting release];
+  heapDestroy(&internal->waiting);
+#if	defined(GS_WORK_STEALING)
+  if (internal->workers != 0)
+    {
+      workersDestroy(internal->workers);
+    }
+#endif
   [internal->name release];
   [internal->cond release];
   [internal->lock release];
@@ -754,8 +1489,9 @@ static NSOperationQueue *mainQueue = nil;
       internal->suspended = NO;
       internal->count = NSOperationQueueDefaultMaxConcurrentOperationCount;
       internal->operations = [NSMutableArray new];
+      internal->done = [NSMutableArray new];
+      internal->doneLock = [NSLock new];
       internal->starting = [NSMutableArray new];
-      internal->waiting = [NSMutableArray new];
       internal->lock = [NSRecursiveLock new];
       internal->cond = [[NSConditionLock alloc] initWithCondition: 0];
     }
@@ -772,6 +1508,11 @@ static NSOperationQueue *mainQueue = nil;
   return internal->count;
 }
 
+- (GSOperationQueueScheduler) scheduler
+{
+  return internal->scheduler;
+}
+
 - (NSString*) name
 {
   NSString	*s;
@@ -792,6 +1533,7 @@ static NSOperationQueue *mainQueue = nil;
   NSUInteger	c;
 
   [internal->lock lock];
+  [self _flush];
   c = [internal->operations count];
   [internal->lock unlock];
   return c;
@@ -802,6 +1544,7 @@ static NSOperationQueue *mainQueue = nil;
   NSArray	*a;
 
   [internal->lock lock];
+  [self _flush];
   a = [NSArray arrayWithArray: internal->operations];
   [internal->lock unlock];
   return a;
@@ -827,6 +1570,28 @@ static NSOperationQueue *mainQueue = nil;
   [self _execute];
 }
 
+- (void) setScheduler: (GSOperationQueueScheduler)s
+{
+  [internal->lock lock];
+  if (GSOperationQueueSchedulerWorkStealing == s)
+    {
+#if	defined(GS_WORK_STEALING)
+      if (0 == internal->workers)
+	{
+	  internal->workers = workersCreate();
+	}
+#else
+      s = GSOperationQueueSchedulerPool;
+#endif
+    }
+  else
+    {
+      s = GSOperationQueueSchedulerPool;
+    }
+  internal->scheduler = s;
+  [internal->lock unlock];
+}
+
 - (void) setName: (NSString*)s
 {
   if (s == nil) s = @"";
@@ -859,6 +1624,7 @@ static NSOperationQueue *mainQueue = nil;
   NSOperation	*op;
 
   [internal->lock lock];
+  [self _flush];
   while ((op = [internal->operations lastObject]) != nil)
     {
       [op retain];
@@ -866,6 +1632,7 @@ static NSOperationQueue *mainQueue = nil;
       [op waitUntilFinished];
       [op release];
       [internal->lock lock];
+      [self _flush];
     }
   [internal->lock unlock];
 }
@@ -883,31 +1650,99 @@ static NSOperationQueue *mainQueue = nil;
     }
 }
 
-- (void) observeValueForKeyPath: (NSString *)keyPath
-		       ofObject: (id)object
-                         change: (NSDictionary *)change
-                        context: (void *)context
+/* Remove finished operations from the queue.  Operations are added to
+ * the done list as they finish (without waiting for the queue lock) and
+ * whichever thread next locks the queue removes them all at once, with
+ * a single pair of change notifications for the batch.
+ * Must be called with the queue locked.
+ */
+- (void) _flush
+{
+  NSArray	*batch;
+  NSUInteger	count;
+  NSUInteger	index;
+
+  [internal->doneLock lock];
+  count = [internal->done count];
+  if (0 == count)
+    {
+      [internal->doneLock unlock];
+      return;
+    }
+  batch = [internal->done copy];
+  [internal->done removeAllObjects];
+  [internal->doneLock unlock];
+
+  WILL_CHANGE(self, @"operations");
+  WILL_CHANGE(self, @"operationCount");
+  for (index = 0; index < count; index++)
+    {
+      NSOperation	*op = [batch objectAtIndex: index];
+      NSUInteger	state = [op _queueState];
+
+      if (GSOpQueueDispatched == state)
+	{
+	  internal->executing--;
+	}
+      if (GSOpQueueNone != state)
+	{
+          [op _setQueueState: GSOpQueueNone];
+	  [internal->operations removeObjectIdenticalTo: op];
+	}
+    }
+  DID_CHANGE(self, @"operationCount");
+  DID_CHANGE(self, @"operations");
+  [batch release];
+}
+
+/* Called directly by an operation in the queue when it has finished.
+ */
+- (void) _operationFinished: (NSOperation*)op
+{
+  [internal->doneLock lock];
+  [internal->done addObject: op];
+  [internal->doneLock unlock];
+  [self _execute];
+}
+
+/* Called by an operation whose priority has been changed, to move it
+ * within the heap if it is waiting to start.
+ */
+- (void) _operationPriority: (NSOperation*)op
 {
   [internal->lock lock];
-  if (YES == [object isFinished])
+  if (GSOpQueueWaiting == [op _queueState])
     {
-      internal->executing--;
-      [object removeObserver: self
-		  forKeyPath: @"isFinished"];
-      [self willChangeValueForKey: @"operations"];
-      [self willChangeValueForKey: @"operationCount"];
-      [internal->operations removeObjectIdenticalTo: object];
-      [self didChangeValueForKey: @"operationCount"];
-      [self didChangeValueForKey: @"operations"];
+      NSUInteger	i = [op _heapIndex];
+
+      if (i < internal->waiting.count && internal->waiting.nodes[i].op == op)
+	{
+	  heapUpdate(&internal->waiting, i, [op queuePriority]);
+	}
     }
-  else if (YES == [object isReady])
+  [internal->lock unlock];
+}
+
+/* Called directly by an operation in the queue when it may have become
+ * ready, to add it to the heap of operations waiting to start.  This may
+ * be called more than once for an operation, and may be called before
+ * the operation has been added, in which case it is ignored (the
+ * queue checks readiness after adding).
+ * A subclass may override -isReady to wait for more than its
+ * dependencies, so we ask the operation rather than assuming it is
+ * ready; if it is not, it will send a change notification for isReady
+ * when it is, and we will be called again.
+ * The caller must call -_execute after this.
+ */
+- (void) _operationReady: (NSOperation*)op
+{
+  [internal->lock lock];
+  if (GSOpQueueAdded == [op _queueState] && YES == [op isReady])
     {
-      [object removeObserver: self
-		  forKeyPath: @"isReady"];
-      [internal->waiting addObject: object];
+      [op _setQueueState: GSOpQueueWaiting];
+      heapPush(&internal->waiting, op);
     }
   [internal->lock unlock];
-  [self _execute];
 }
 
 - (void) _thread
@@ -951,24 +1786,7 @@ static NSOperationQueue *mainQueue = nil;
 
       if (nil != op)
 	{
-          NS_DURING
-	    {
-	      NSAutoreleasePool	*opPool = [NSAutoreleasePool new];
-
-	      if (NO == [op isCancelled])
-		{
-		  [NSThread setThreadPriority: [op threadPriority]];
-		  [op main];
-		}
-	      [opPool release];
-	    }
-          NS_HANDLER
-	    {
-	      NSLog(@"Problem running operation %@ ... %@",
-		op, localException);
-	    }
-          NS_ENDHANDLER
-	  [op _finish];
+	  runOperation(op);
 	}
     }
 
@@ -979,6 +1797,121 @@ static NSOperationQueue *mainQueue = nil;
   [NSThread exit];
 }
 
+#if	defined(GS_WORK_STEALING)
+- (void) _workStealingThread: (NSValue*)slot
+{
+  NSAutoreleasePool	*pool = [NSAutoreleasePool new];
+  GSOperationWorker	*me = [slot pointerValue];
+  GSOperationWorkers	*w = me->workers;
+
+  pthread_setspecific(workerKey, me);
+  for (;;)
+    {
+      NSUInteger	gen = w->generation;
+      id		op = workersFind(w, me);
+
+      if (nil == op)
+	{
+	  struct timespec	when;
+	  struct timeval	now;
+	  int			rc;
+
+	  gettimeofday(&now, 0);
+	  when.tv_sec = now.tv_sec + 5;
+	  when.tv_nsec = now.tv_usec * 1000;
+
+	  pthread_mutex_lock(&w->lock);
+	  __sync_fetch_and_add(&w->idle, 1);
+	  op = injectTake(w);
+	  if (nil == op && gen == w->generation)
+	    {
+	      /* Nothing has been submitted since we started looking,
+	       * so we wait for something to be submitted.
+	       */
+	      rc = pthread_cond_timedwait(&w->wake, &w->lock, &when);
+	      if (ETIMEDOUT == rc && gen == w->generation)
+		{
+		  /* Idle for 5 seconds ... exit thread.  Our own deque
+		   * must be empty since only we can push to it.
+		   */
+		  __sync_fetch_and_sub(&w->idle, 1);
+		  me->active = NO;
+		  w->active--;
+		  pthread_mutex_unlock(&w->lock);
+		  break;
+		}
+	    }
+	  __sync_fetch_and_sub(&w->idle, 1);
+	  pthread_mutex_unlock(&w->lock);
+	}
+      if (nil != op)
+	{
+	  runOperation(op);
+	  [op release];
+	}
+    }
+  pthread_setspecific(workerKey, 0);
+  [pool release];
+  [NSThread exit];
+}
+
+/* Hand a non-concurrent operation to the work stealing scheduler.
+ * When called from one of our own workers (eg an operation adding
+ * more operations to its queue) the operation goes on to that worker's
+ * deque without locking, otherwise it goes in the injection ring.
+ */
+- (void) _schedule: (NSOperation*)op
+{
+  GSOperationWorkers	*w = internal->workers;
+  GSOperationWorker	*me = pthread_getspecific(workerKey);
+
+  [op retain];
+  if (me != 0 && me->workers == w && YES == dequePush(&me->deque, op))
+    {
+      /* Nobody else needs telling unless some workers are idle (and
+       * may be able to steal the operation) or have not been started.
+       */
+      __sync_fetch_and_add(&w->generation, 1);
+      if (0 == w->idle && w->active >= w->size)
+	{
+	  return;
+	}
+      pthread_mutex_lock(&w->lock);
+    }
+  else
+    {
+      pthread_mutex_lock(&w->lock);
+      injectPut(w, op);
+      __sync_fetch_and_add(&w->generation, 1);
+    }
+  if (w->idle > 0)
+    {
+      pthread_cond_signal(&w->wake);
+    }
+  else if (w->active < w->size)
+    {
+      NSUInteger	i;
+
+      for (i = 0; i < w->size; i++)
+	{
+	  if (NO == w->slots[i].active)
+	    {
+	      GSOperationWorker	*slot = &w->slots[i];
+
+	      slot->active = YES;
+	      slot->workers = w;
+	      w->active++;
+	      [NSThread detachNewThreadSelector: @selector(_workStealingThread:)
+				       toTarget: self
+				     withObject: [NSValue valueWithPointer: slot]];
+	      break;
+	    }
+	}
+    }
+  pthread_mutex_unlock(&w->lock);
+}
+#endif
+
 /* Check for operations which can be executed and start them.
  */
 - (void) _execute
@@ -986,6 +1919,7 @@ static NSOperationQueue *mainQueue = nil;
   NSInteger	max;
 
   [internal->lock lock];
+  [self _flush];
 
   max = [self maxConcurrentOperationCount];
   if (NSOperationQueueDefaultMaxConcurrentOperationCount == max)
@@ -995,30 +1929,34 @@ static NSOperationQueue *mainQueue = nil;
 
   while (NO == [self isSuspended]
     && max > internal->executing
-    && [internal->waiting count] > 0)
+    && internal->waiting.count > 0)
     {
       NSOperation	*op;
 
-      /* Make sure we have a sorted queue of operations waiting to execute.
+      /* Take the highest priority operation from the heap and start it
+       * executing.
+       * We keep track of the count of operations we have started (the
+       * operation tells us directly when it finishes), but the actual
+       * startup is left to the NSOperation -start method.
        */
-      [internal->waiting sortUsingFunction: sortFunc context: 0];
-
-      /* Take the first operation from the queue and start it executing.
-       * We set ourselves up as an observer for the operating finishing
-       * and we keep track of the count of operations we have started,
-       * but the actual startup is left to the NSOperation -start method.
-       */
-      op = [internal->waiting objectAtIndex: 0];
-      [internal->waiting removeObjectAtIndex: 0];
-      [op addObserver: self
-	   forKeyPath: @"isFinished"
-	      options: NSKeyValueObservingOptionNew
-	      context: NULL];
+      op = heapPop(&internal->waiting);
+      if (GSOpQueueWaiting != [op _queueState] || YES == [op isFinished])
+	{
+	  [op release];		// Finished before it could be started.
+	  continue;
+	}
+      [op _setQueueState: GSOpQueueDispatched];
       internal->executing++;
       if (YES == [op isConcurrent])
 	{
           [op start];
 	}
+#if	defined(GS_WORK_STEALING)
+      else if (GSOperationQueueSchedulerWorkStealing == internal->scheduler)
+	{
+	  [self _schedule: op];
+	}
+#endif
       else
 	{
 	  NSUInteger	pending;
@@ -1031,7 +1969,7 @@ static NSOperationQueue *mainQueue = nil;
 	   * we haven't reached the pool limit.
 	   */
 	  if (0 == internal->threadCount
-	    || (pending > 0 && internal->threadCount < POOL))
+	    || (pending > 0 && internal->threadCount < poolSize))
 	    {
 	      internal->threadCount++;
 	      [NSThread detachNewThreadSelector: @selector(_thread)
@@ -1042,6 +1980,7 @@ static NSOperationQueue *mainQueue = nil;
 	   */
 	  [internal->cond unlockWithCondition: 1];
 	}
+      [op release];
     }
   [internal->lock unlock];
 }
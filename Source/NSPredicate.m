@@ -28,6 +28,21 @@
 
 #import "common.h"
 
+/* Matchers kept for reuse by a comparison predicate with a constant
+ * regular expression (at most one per concurrently evaluating thread).
+ */
+#define	GS_REGEX_POOL	8
+
+/* The compiled regular expression and pooled matchers are stored as
+ * untyped pointers so that the ivar layout does not depend on ICU.
+ */
+#define	GS_NSComparisonPredicate_IVARS \
+  NSLock	*_regexLock; \
+  void		*_regex; \
+  void		*_matchers[GS_REGEX_POOL]; \
+  unsigned	_matcherCount; \
+  BOOL		_regexFailed;
+
 #define	EXPOSE_NSComparisonPredicate_IVARS	1
 #define	EXPOSE_NSCompoundPredicate_IVARS	1
 #define	EXPOSE_NSExpression_IVARS	1
@@ -38,17 +53,26 @@
 #import "Foundation/NSPredicate.h"
 
 #import "Foundation/NSArray.h"
+#import "Foundation/NSDecimalNumber.h"
 #import "Foundation/NSDictionary.h"
 #import "Foundation/NSEnumerator.h"
 #import "Foundation/NSException.h"
 #import "Foundation/NSKeyValueCoding.h"
 #import "Foundation/NSNull.h"
+#import "Foundation/NSLock.h"
+#import "Foundation/NSMethodSignature.h"
 #import "Foundation/NSScanner.h"
 #import "Foundation/NSValue.h"
 
 #import "GSPrivate.h"
 #import "GNUstepBase/NSObject+GNUstepBase.h"
 
+#define	GSInternal	NSComparisonPredicateInternal
+#include	"GSInternal.h"
+GS_PRIVATE_INTERNAL(NSComparisonPredicate)
+
+#include <ctype.h>
+#include <limits.h>
 // For pow()
 #include <math.h>
 
@@ -56,6 +80,16 @@
 #include <unicode/uregex.h>
 #endif
 
+#if	GS_USE_ICU == 1
+#include <unicode/uversion.h>
+/* See NSRegularExpression.m for why this is not an autoconf check.
+ */
+#if (U_ICU_VERSION_MAJOR_NUM > 4 || (U_ICU_VERSION_MAJOR_NUM == 4 && U_ICU_VERSION_MINOR_NUM >= 4))
+#define HAVE_UREGEX_OPENUTEXT 1
+#endif
+#import "GSICUString.h"
+#endif
+
 /* Object to represent the expression beign evaluated.
  */
 static NSExpression	*evaluatedObjectExpression = nil;
@@ -647,6 +681,7 @@ extern void     GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 {
   if ((self = [super init]) != nil)
     {
+      GS_CREATE_INTERNAL(NSComparisonPredicate)
       ASSIGN(_left, left);
       ASSIGN(_right, right);
       _selector = sel;
@@ -663,6 +698,8 @@ extern void     GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 {
   if ((self = [super init]) != nil)
     {
+      GS_CREATE_INTERNAL(NSComparisonPredicate)
+      internal->_regexLock = [NSLock new];
       ASSIGN(_left, left);
       ASSIGN(_right, right);
       _modifier = modifier;
@@ -676,6 +713,21 @@ extern void     GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 {
   RELEASE(_left);
   RELEASE(_right);
+  if (GS_EXISTS_INTERNAL)
+    {
+#if	GS_USE_ICU == 1
+      while (internal->_matcherCount > 0)
+	{
+	  uregex_close(internal->_matchers[--internal->_matcherCount]);
+	}
+      if (internal->_regex != 0)
+	{
+	  uregex_close(internal->_regex);
+	}
+#endif
+      DESTROY(internal->_regexLock);
+      GS_DESTROY_INTERNAL(NSComparisonPredicate)
+    }
   [super dealloc];
 }
 
@@ -818,40 +870,190 @@ extern void     GSPropertyListMake(id,NSDictionary*,BOOL,BOOL,unsigned,id*);
 }
 
 #if	GS_USE_ICU == 1
+static URegularExpression *
+GSICUCompileRegex(NSString *regex, NSStringCompareOptions opts)
+{
+  UErrorCode		error = 0;
+  uint32_t		flags = 0;
+  URegularExpression	*icuregex;
+
+  flags |= UREGEX_DOTALL; // . is supposed to recognize newlines
+  if ((opts & NSCaseInsensitiveSearch) != 0) { flags |= UREGEX_CASE_INSENSITIVE; }
+
+#if	HAVE_UREGEX_OPENUTEXT
+  {
+    UText	p = UTEXT_INITIALIZER;
+
+    UTextInitWithNSString(&p, regex);
+    icuregex = uregex_openUText(&p, flags, NULL, &error);
+    utext_close(&p);
+  }
+#else
+  {
+    NSUInteger	regexLength = [regex length];
+    unichar	*regexBuffer;
+
+    regexBuffer = malloc(regexLength * sizeof(unichar));
+    if (NULL == regexBuffer) { return NULL; }
+    [regex getCharacters: regexBuffer range: NSMakeRange(0, regexLength)];
+    icuregex = uregex_open(regexBuffer, regexLength, flags, NULL, &error);
+    free(regexBuffer);
+  }
+#endif
+  if (U_FAILURE(error))
+    {
+      uregex_close(icuregex);
+      return NULL;
+    }
+  return icuregex;
+}
+
+/* Matches the whole of string against an already compiled regex.
+ * With UText support the matcher reads the string in place rather than
+ * from a copy, and is detached from it again afterwards so that it does
+ * not keep the string alive.
+ */
 static BOOL
-GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOptions opts)
+GSICUStringMatchesCompiledRegex(NSString *string, URegularExpression *icuregex)
 {
-  BOOL result = NO;
-  UErrorCode error = 0;
-  uint32_t flags = 0;
-  NSUInteger stringLength = [string length];
-  NSUInteger regexLength = [regex length];
-  unichar *stringBuffer;
-  unichar *regexBuffer;
-  URegularExpression *icuregex = NULL;  
+  static const UChar	empty = 0;
+  UErrorCode		error = 0;
+  BOOL			result = NO;
+
+#if	HAVE_UREGEX_OPENUTEXT
+  UText			txt = UTEXT_INITIALIZER;
+
+  UTextInitWithNSString(&txt, string);
+  uregex_setUText(icuregex, &txt, &error);
+  if (U_SUCCESS(error))
+    {
+      result = uregex_matches(icuregex, 0, &error);
+    }
+  uregex_setText(icuregex, &empty, 0, &error);
+  utext_close(&txt);
+#else
+  NSUInteger		stringLength = [string length];
+  unichar		*stringBuffer;
 
   stringBuffer = malloc(stringLength * sizeof(unichar));
   if (NULL == stringBuffer) { return NO; }
-  regexBuffer = malloc(regexLength * sizeof(unichar));
-  if (NULL == regexBuffer) { free(stringBuffer); return NO; }
-
   [string getCharacters: stringBuffer range: NSMakeRange(0, stringLength)];
-  [regex getCharacters: regexBuffer range: NSMakeRange(0, regexLength)];
+  uregex_setText(icuregex, stringBuffer, stringLength, &error);
+  if (U_SUCCESS(error))
+    {
+      result = uregex_matches(icuregex, 0, &error);
+    }
+  uregex_setText(icuregex, &empty, 0, &error);
+  free(stringBuffer);
+#endif
+  return result;
+}
 
-  flags |= UREGEX_DOTALL; // . is supposed to recognize newlines
-  if ((opts & NSCaseInsensitiveSearch) != 0) { flags |= UREGEX_CASE_INSENSITIVE; }
+static BOOL
+GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOptions opts)
+{
+  URegularExpression	*icuregex;
+  BOOL			result;
 
-  icuregex = uregex_open(regexBuffer, regexLength, flags, NULL, &error);
-  if (icuregex != NULL && U_SUCCESS(error))
+  icuregex = GSICUCompileRegex(regex, opts);
+  if (NULL == icuregex)
     {
-      uregex_setText(icuregex, stringBuffer, stringLength, &error);
-      result = uregex_matches(icuregex, 0, &error);
+      return NO;
     }
+  result = GSICUStringMatchesCompiledRegex(string, icuregex);
   uregex_close(icuregex);
+  return result;
+}
 
-  free(stringBuffer);
-  free(regexBuffer);
+/* Translates the pattern of a LIKE comparison into a regex.
+ */
+static NSString *
+GSICURegexForLike(NSString *pattern)
+{
+  NSString	*regex;
+
+  /* The right hand is a pattern with '?' meaning match one character,
+   * and '*' meaning match zero or more characters, so translate that
+   * into a regex.
+   */
+  regex = [pattern stringByReplacingOccurrencesOfString: @"*"
+					     withString: @".*"];
+  regex = [regex stringByReplacingOccurrencesOfString: @"?"
+					   withString: @".?"];
+  return [NSString stringWithFormat: @"^%@$", regex];
+}
+
+/* Matches string against the pattern of a MATCHES or LIKE comparison.
+ * When the pattern is the constant right hand expression of the
+ * receiver, it is compiled only once (on first use) and each evaluation
+ * borrows a clone of it from a small pool, since an ICU matcher holds
+ * the state of a match and must not be used by two threads at once.
+ * Any other pattern is compiled afresh for each evaluation.
+ */
+- (BOOL) _matchString: (NSString*)string
+	      pattern: (id)pattern
+	      options: (NSStringCompareOptions)opts
+{
+  URegularExpression	*matcher = NULL;
+  BOOL			result;
+
+  if (NO == GS_EXISTS_INTERNAL
+    || [_right expressionType] != NSConstantValueExpressionType
+    || [_right constantValue] != pattern)
+    {
+      if (NSLikePredicateOperatorType == _type)
+	{
+	  pattern = GSICURegexForLike(pattern);
+	}
+      return GSICUStringMatchesRegex(string, pattern, opts);
+    }
+
+  [internal->_regexLock lock];
+  if (NULL == internal->_regex && NO == internal->_regexFailed)
+    {
+      NSString	*regex = pattern;
+
+      if (NSLikePredicateOperatorType == _type)
+	{
+	  regex = GSICURegexForLike(pattern);
+	}
+      internal->_regex = GSICUCompileRegex(regex, opts);
+      internal->_regexFailed = (NULL == internal->_regex) ? YES : NO;
+    }
+  if (internal->_matcherCount > 0)
+    {
+      matcher = internal->_matchers[--internal->_matcherCount];
+    }
+  else if (internal->_regex != NULL)
+    {
+      UErrorCode	error = 0;
+
+      matcher = uregex_clone(internal->_regex, &error);
+      if (U_FAILURE(error))
+	{
+	  uregex_close(matcher);
+	  matcher = NULL;
+	}
+    }
+  [internal->_regexLock unlock];
 
+  if (NULL == matcher)
+    {
+      return NO;
+    }
+  result = GSICUStringMatchesCompiledRegex(string, matcher);
+
+  [internal->_regexLock lock];
+  if (internal->_matcherCount < GS_REGEX_POOL)
+    {
+      internal->_matchers[internal->_matcherCount++] = matcher;
+      matcher = NULL;
+    }
+  [internal->_regexLock unlock];
+  if (matcher != NULL)
+    {
+      uregex_close(matcher);
+    }
   return result;
 }
 #endif
@@ -915,27 +1117,18 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
 	return ![leftResult isEqual: rightResult];
       case NSMatchesPredicateOperatorType:
 #if	GS_USE_ICU == 1
-	return GSICUStringMatchesRegex(leftResult, rightResult, compareOptions);
+	return [self _matchString: leftResult
+			  pattern: rightResult
+			  options: compareOptions];
 #else
 	return [leftResult compare: rightResult options: compareOptions]
 	  == NSOrderedSame;  
 #endif
       case NSLikePredicateOperatorType:
 #if	GS_USE_ICU == 1
-	{
-	  NSString *regex;
-
-	  /* The right hand is a pattern with '?' meaning match one character,
-	   * and '*' meaning match zero or more characters, so translate that
-	   * into a regex.
-	   */
-	  regex = [rightResult stringByReplacingOccurrencesOfString: @"*"
-							 withString: @".*"];
-	  regex = [regex stringByReplacingOccurrencesOfString: @"?"
-						   withString: @".?"];
-	  regex = [NSString stringWithFormat: @"^%@$", regex];
-	  return GSICUStringMatchesRegex(leftResult, regex, compareOptions);
-	}
+	return [self _matchString: leftResult
+			  pattern: rightResult
+			  options: compareOptions];
 #else
 	return [leftResult compare: rightResult options: compareOptions]
 	  == NSOrderedSame;
@@ -1042,6 +1235,16 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
   NSComparisonPredicate *copy;
 
   copy = (NSComparisonPredicate *)NSCopyObject(self, 0, z);
+  if (GS_EXISTS_INTERNAL)
+    {
+      /* The copy compiles its own regex (if any) when first evaluated.
+       */
+      GS_COPY_INTERNAL(copy, z)
+      GSIVar(copy, _regexLock) = [NSLock new];
+      GSIVar(copy, _regex) = NULL;
+      GSIVar(copy, _matcherCount) = 0;
+      GSIVar(copy, _regexFailed) = NO;
+    }
   copy->_left = [_left copyWithZone: z];
   copy->_right = [_right copyWithZone: z];
   return copy;
@@ -1651,6 +1854,847 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
 
 
 
+/* The compiled form of a predicate, used when the same predicate is
+ * evaluated against each object of a collection.
+ * The predicate tree is flattened into a tree of C structures in which
+ * constant sub-expressions have been evaluated, the operands of AND/OR
+ * are ordered so that the cheapest are evaluated first, and key paths
+ * are split into keys whose accessor methods or instance variables are
+ * found through the key-value coding cache (GSPrivateKVCGetter()) and
+ * used directly.  A comparison of a scalar valued key with a constant
+ * number is performed directly on the scalar value, without creating
+ * an NSNumber.
+ * Anything which cannot be compiled is evaluated by the original
+ * predicate or expression.
+ */
+typedef enum {
+  GSPAccessKVC,		// Use -valueForKey:
+  GSPAccessKeyPath,	// Use -valueForKeyPath: for the rest of the path
+  GSPAccessDirect	// Use the accessor found by GSPrivateKVCGetter()
+} GSPAccess;
+
+typedef struct {
+  NSString	*name;		// The key
+  NSString	*path;		// The key path from this key onwards
+  char		*key;		// UTF-8 copy of the key
+  unsigned	length;		// Length of the UTF-8 key
+  Class		cls;		// The class the access was decided for
+  GSPAccess	access;
+} GSPKey;
+
+typedef enum {
+  GSPOperandConstant,
+  GSPOperandSelf,
+  GSPOperandKeyPath,
+  GSPOperandGeneric	// Evaluate the expression
+} GSPOperandKind;
+
+typedef struct {
+  GSPOperandKind	kind;
+  id			value;	// Constant value or expression
+  unsigned		count;	// Number of keys
+  GSPKey		*keys;
+} GSPOperand;
+
+typedef struct {
+  BOOL		real;
+  long long	i;
+  double	d;
+} GSPNumber;
+
+typedef enum {
+  GSPNodeTrue,
+  GSPNodeFalse,
+  GSPNodeAnd,
+  GSPNodeOr,
+  GSPNodeNot,
+  GSPNodeCompare,
+  GSPNodeGeneric	// Evaluate the predicate
+} GSPNodeKind;
+
+typedef struct GSPNode {
+  GSPNodeKind		kind;
+  unsigned		cost;
+  unsigned		count;		// Number of children
+  struct GSPNode	*children;
+  NSPredicate		*predicate;
+  GSPOperand		left;
+  GSPOperand		right;
+  BOOL			numeric;	// Left scalar key vs right number
+  BOOL			swapped;	// Operands swapped for numeric
+  NSPredicateOperatorType	type;
+  GSPNumber		number;
+} GSPNode;
+
+@interface GSCompiledPredicate : NSPredicate
+{
+  NSPredicate	*_predicate;
+  GSPNode	_root;
+}
++ (NSPredicate*) compiledPredicate: (NSPredicate*)predicate;
+@end
+
+static IMP	objectValueForKey = 0;
+static IMP	objectValueForKeyPath = 0;
+static BOOL	(*evaluateValues)(id, SEL, id, id, id) = 0;
+static SEL	evaluateValuesSel = 0;
+
+static BOOL
+GSPNumberFromObject(id o, GSPNumber *n)
+{
+  const char	*t;
+
+  if (NO == [o isKindOfClass: [NSNumber class]]
+    || YES == [o isKindOfClass: [NSDecimalNumber class]])
+    {
+      return NO;
+    }
+  t = [o objCType];
+  if (*t == _C_FLT || *t == _C_DBL)
+    {
+      n->real = YES;
+      n->d = [o doubleValue];
+      return isnan(n->d) ? NO : YES;
+    }
+  if ((*t == _C_ULNG
+#ifdef	_C_ULNG_LNG
+    || *t == _C_ULNG_LNG
+#endif
+    ) && [o unsignedLongLongValue] > (unsigned long long)LLONG_MAX)
+    {
+      n->real = YES;
+      n->d = [o doubleValue];
+      return YES;
+    }
+  n->real = NO;
+  n->i = [o longLongValue];
+  return YES;
+}
+
+static int
+GSPNumberCompare(GSPNumber *a, GSPNumber *b)
+{
+  if (a->real || b->real)
+    {
+      double	x = a->real ? a->d : (double)a->i;
+      double	y = b->real ? b->d : (double)b->i;
+
+      return (x < y) ? -1 : ((x > y) ? 1 : 0);
+    }
+  return (a->i < b->i) ? -1 : ((a->i > b->i) ? 1 : 0);
+}
+
+/* Works out whether the value of the key can be got from instances of
+ * the class of o using the accessor -valueForKey: of NSObject would use.
+ * Where the class supplies its own key-value coding the key is simply
+ * passed to -valueForKey: (or -valueForKeyPath:).
+ */
+static void
+GSPKeyResolve(GSPKey *k, id o, Class c)
+{
+  k->cls = c;
+  k->access = GSPAccessKVC;
+  if (NO == GSObjCIsKindOf(c, [NSObject class]) || 0 == k->length)
+    {
+      return;
+    }
+  if ([c instanceMethodForSelector: @selector(valueForKeyPath:)]
+    != objectValueForKeyPath)
+    {
+      k->access = GSPAccessKeyPath;
+      return;
+    }
+  if ([c instanceMethodForSelector: @selector(valueForKey:)]
+    != objectValueForKey)
+    {
+      return;
+    }
+  k->access = GSPAccessDirect;
+}
+
+/* Gets the value of a key as an object.  Sets *done if the value is that
+ * of the whole remaining key path.
+ */
+static inline id
+GSPKeyValue(GSPKey *k, id o, BOOL *done)
+{
+  Class	c = object_getClass(o);
+
+  if (c != k->cls)
+    {
+      GSPKeyResolve(k, o, c);
+    }
+  if (GSPAccessDirect == k->access)
+    {
+      GSKVCAccessor	a;
+
+      if (YES == GSPrivateKVCGetter(o, k->key, k->length, &a)
+	&& (_C_ID == a.kind || _C_CLASS == a.kind))
+	{
+	  if (0 == a.sel)
+	    {
+	      return *(id *)((char *)o + a.offset);
+	    }
+	  return (*(id (*)(id, SEL))a.imp)(o, a.sel);
+	}
+    }
+  else if (GSPAccessKeyPath == k->access)
+    {
+      *done = YES;
+      return [o valueForKeyPath: k->path];
+    }
+  return [o valueForKey: k->name];
+}
+
+/* Gets the scalar value of a key if it has one.
+ */
+static inline BOOL
+GSPKeyNumber(GSPKey *k, id o, GSPNumber *n)
+{
+  Class		c = object_getClass(o);
+  GSKVCAccessor	a;
+  BOOL		ivar;
+
+  if (c != k->cls)
+    {
+      GSPKeyResolve(k, o, c);
+    }
+  if (GSPAccessDirect != k->access
+    || NO == GSPrivateKVCGetter(o, k->key, k->length, &a))
+    {
+      return NO;
+    }
+  ivar = (0 == a.sel) ? YES : NO;
+
+#define	GSP_READ(T, F, V) \
+  { \
+    T	v; \
+    if (ivar) \
+      { \
+	v = *(T *)((char *)o + a.offset); \
+      } \
+    else \
+      { \
+	v = (*(T (*)(id, SEL))a.imp)(o, a.sel); \
+      } \
+    n->real = F; \
+    n->V = v; \
+  }
+  n->real = NO;
+  switch (a.kind)
+    {
+      case _C_CHR:	GSP_READ(signed char, NO, i) break;
+      case _C_UCHR:	GSP_READ(unsigned char, NO, i) break;
+      case _C_SHT:	GSP_READ(short, NO, i) break;
+      case _C_USHT:	GSP_READ(unsigned short, NO, i) break;
+      case _C_INT:	GSP_READ(int, NO, i) break;
+      case _C_UINT:	GSP_READ(unsigned int, NO, i) break;
+      case _C_LNG:	GSP_READ(long, NO, i) break;
+#ifdef	_C_LNG_LNG
+      case _C_LNG_LNG:	GSP_READ(long long, NO, i) break;
+#endif
+#ifdef	_C_BOOL
+      case _C_BOOL:	GSP_READ(_Bool, NO, i) break;
+#endif
+      case _C_FLT:	GSP_READ(float, YES, d) break;
+      case _C_DBL:	GSP_READ(double, YES, d) break;
+      case _C_ULNG:
+	{
+	  unsigned long	u;
+
+	  if (ivar)
+	    {
+	      u = *(unsigned long *)((char *)o + a.offset);
+	    }
+	  else
+	    {
+	      u = (*(unsigned long (*)(id, SEL))a.imp)(o, a.sel);
+	    }
+	  if (u > (unsigned long)LLONG_MAX)
+	    {
+	      n->real = YES;
+	      n->d = u;
+	    }
+	  else
+	    {
+	      n->i = u;
+	    }
+	}
+	break;
+#ifdef	_C_ULNG_LNG
+      case _C_ULNG_LNG:
+	{
+	  unsigned long long	u;
+
+	  if (ivar)
+	    {
+	      u = *(unsigned long long *)((char *)o + a.offset);
+	    }
+	  else
+	    {
+	      u = (*(unsigned long long (*)(id, SEL))a.imp)(o, a.sel);
+	    }
+	  if (u > (unsigned long long)LLONG_MAX)
+	    {
+	      n->real = YES;
+	      n->d = u;
+	    }
+	  else
+	    {
+	      n->i = u;
+	    }
+	}
+	break;
+#endif
+      default:
+	return NO;
+    }
+#undef	GSP_READ
+  if (YES == n->real && isnan(n->d))
+    {
+      return NO;
+    }
+  return YES;
+}
+
+static inline id
+GSPOperandValue(GSPOperand *op, id o)
+{
+  unsigned	i;
+  BOOL		done = NO;
+
+  switch (op->kind)
+    {
+      case GSPOperandConstant:
+	return op->value;
+      case GSPOperandSelf:
+	return o;
+      case GSPOperandKeyPath:
+	for (i = 0; i < op->count && o != nil && NO == done; i++)
+	  {
+	    o = GSPKeyValue(&op->keys[i], o, &done);
+	  }
+	return o;
+      default:
+	return [op->value expressionValueWithObject: o context: nil];
+    }
+}
+
+static BOOL
+GSPNodeEvaluate(GSPNode *n, id o)
+{
+  unsigned	i;
+
+  switch (n->kind)
+    {
+      case GSPNodeTrue:
+	return YES;
+      case GSPNodeFalse:
+	return NO;
+      case GSPNodeAnd:
+	for (i = 0; i < n->count; i++)
+	  {
+	    if (GSPNodeEvaluate(&n->children[i], o) == NO)
+	      {
+		return NO;
+	      }
+	  }
+	return YES;
+      case GSPNodeOr:
+	for (i = 0; i < n->count; i++)
+	  {
+	    if (GSPNodeEvaluate(&n->children[i], o) == YES)
+	      {
+		return YES;
+	      }
+	  }
+	return NO;
+      case GSPNodeNot:
+	return !GSPNodeEvaluate(n->children, o);
+      case GSPNodeCompare:
+	{
+	  id	l;
+	  id	r;
+
+	  if (YES == n->numeric)
+	    {
+	      GSPOperand	*op = &n->left;
+	      BOOL		done = NO;
+	      GSPNumber		v;
+	      int		c;
+
+	      l = o;
+	      for (i = 0; i + 1 < op->count && l != nil && NO == done; i++)
+		{
+		  l = GSPKeyValue(&op->keys[i], l, &done);
+		}
+	      if (NO == done && l != nil)
+		{
+		  if (NO == GSPKeyNumber(&op->keys[i], l, &v))
+		    {
+		      l = GSPKeyValue(&op->keys[i], l, &done);
+		    }
+		  else
+		    {
+		      c = GSPNumberCompare(&v, &n->number);
+		      switch (n->type)
+			{
+			  case NSLessThanPredicateOperatorType:
+			    return (c < 0);
+			  case NSLessThanOrEqualToPredicateOperatorType:
+			    return (c <= 0);
+			  case NSGreaterThanPredicateOperatorType:
+			    return (c > 0);
+			  case NSGreaterThanOrEqualToPredicateOperatorType:
+			    return (c >= 0);
+			  case NSEqualToPredicateOperatorType:
+			    return (c == 0);
+			  default:
+			    return (c != 0);
+			}
+		    }
+		}
+	      r = n->right.value;
+	      if (YES == n->swapped)
+		{
+		  return (*evaluateValues)(n->predicate, evaluateValuesSel,
+		    r, l, o);
+		}
+	      return (*evaluateValues)(n->predicate, evaluateValuesSel, l, r, o);
+	    }
+	  l = GSPOperandValue(&n->left, o);
+	  r = GSPOperandValue(&n->right, o);
+	  return (*evaluateValues)(n->predicate, evaluateValuesSel, l, r, o);
+	}
+      default:
+	return [n->predicate evaluateWithObject: o];
+    }
+}
+
+static void
+GSPOperandCompile(GSPOperand *op, NSExpression *e)
+{
+  memset(op, '\0', sizeof(*op));
+  if (YES == [e isKindOfClass: [GSConstantValueExpression class]])
+    {
+      op->kind = GSPOperandConstant;
+      op->value = RETAIN(((GSConstantValueExpression*)e)->_obj);
+    }
+  else if (YES == [e isKindOfClass: [GSEvaluatedObjectExpression class]])
+    {
+      op->kind = GSPOperandSelf;
+    }
+  else if (YES == [e isKindOfClass: [GSKeyPathExpression class]])
+    {
+      NSString	*path = ((GSKeyPathExpression*)e)->_keyPath;
+      NSArray	*keys = [path componentsSeparatedByString: @"."];
+      unsigned	count = [keys count];
+      unsigned	i;
+
+      for (i = 0; i < count; i++)
+	{
+	  NSString	*k = [keys objectAtIndex: i];
+
+	  if ([k length] == 0 || [k hasPrefix: @"@"])
+	    {
+	      break;
+	    }
+	}
+      if (i < count)
+	{
+	  op->kind = GSPOperandGeneric;
+	  op->value = RETAIN(e);
+	  return;
+	}
+      op->kind = GSPOperandKeyPath;
+      op->count = count;
+      op->keys = NSZoneCalloc(NSDefaultMallocZone(), count, sizeof(GSPKey));
+      for (i = 0; i < count; i++)
+	{
+	  GSPKey	*k = &op->keys[i];
+	  const char	*u;
+
+	  k->name = RETAIN([keys objectAtIndex: i]);
+	  k->path = RETAIN([[keys subarrayWithRange:
+	    NSMakeRange(i, count - i)] componentsJoinedByString: @"."]);
+	  u = [k->name UTF8String];
+	  k->length = strlen(u);
+	  k->key = NSZoneMalloc(NSDefaultMallocZone(), k->length + 1);
+	  memcpy(k->key, u, k->length + 1);
+	}
+    }
+  else if (YES == [e isKindOfClass: [GSFunctionExpression class]])
+    {
+      GSFunctionExpression	*f = (GSFunctionExpression*)e;
+      unsigned			i;
+
+      /* The built in functions have no side effects, so a function of
+       * constants can be evaluated once.
+       */
+      for (i = 0; i < f->_argc; i++)
+	{
+	  GSPOperand	arg;
+	  BOOL		constant;
+
+	  GSPOperandCompile(&arg, [f->_args objectAtIndex: i]);
+	  constant = (GSPOperandConstant == arg.kind) ? YES : NO;
+	  RELEASE(arg.value);
+	  if (NO == constant)
+	    {
+	      break;
+	    }
+	}
+      op->kind = GSPOperandGeneric;
+      op->value = RETAIN(e);
+      if (i == f->_argc)
+	{
+	  NS_DURING
+	    {
+	      id	v = [e expressionValueWithObject: nil context: nil];
+
+	      op->kind = GSPOperandConstant;
+	      ASSIGN(op->value, v);
+	    }
+	  NS_HANDLER
+	    {
+	      // Leave the exception to be raised when evaluated.
+	    }
+	  NS_ENDHANDLER
+	}
+    }
+  else
+    {
+      op->kind = GSPOperandGeneric;
+      op->value = RETAIN(e);
+    }
+}
+
+static void
+GSPOperandFree(GSPOperand *op)
+{
+  unsigned	i;
+
+  for (i = 0; i < op->count; i++)
+    {
+      RELEASE(op->keys[i].name);
+      RELEASE(op->keys[i].path);
+      if (op->keys[i].key != 0)
+	{
+	  NSZoneFree(NSDefaultMallocZone(), op->keys[i].key);
+	}
+    }
+  if (op->keys != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), op->keys);
+    }
+  DESTROY(op->value);
+}
+
+static unsigned
+GSPOperandCost(GSPOperand *op)
+{
+  switch (op->kind)
+    {
+      case GSPOperandConstant:
+      case GSPOperandSelf:
+	return 0;
+      case GSPOperandKeyPath:
+	return 2 * op->count;
+      default:
+	return 8;
+    }
+}
+
+static void
+GSPNodeFree(GSPNode *n)
+{
+  unsigned	i;
+
+  for (i = 0; i < n->count; i++)
+    {
+      GSPNodeFree(&n->children[i]);
+    }
+  if (n->children != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), n->children);
+    }
+  GSPOperandFree(&n->left);
+  GSPOperandFree(&n->right);
+  DESTROY(n->predicate);
+}
+
+static void
+GSPNodeCompile(GSPNode *n, NSPredicate *p)
+{
+  Class	c = object_getClass(p);
+
+  memset(n, '\0', sizeof(*n));
+  n->predicate = RETAIN(p);
+  n->kind = GSPNodeGeneric;
+  n->cost = 32;
+
+  if (c == [GSTruePredicate class] || c == [GSFalsePredicate class])
+    {
+      n->kind = (c == [GSTruePredicate class]) ? GSPNodeTrue : GSPNodeFalse;
+      n->cost = 0;
+    }
+  else if (c == [GSAndCompoundPredicate class]
+    || c == [GSOrCompoundPredicate class])
+    {
+      NSArray		*subs = [(NSCompoundPredicate*)p subpredicates];
+      unsigned		count = [subs count];
+      BOOL		isAnd = (c == [GSAndCompoundPredicate class]);
+      GSPNodeKind	absorb = isAnd ? GSPNodeFalse : GSPNodeTrue;
+      GSPNodeKind	identity = isAnd ? GSPNodeTrue : GSPNodeFalse;
+      unsigned		i;
+
+      n->kind = isAnd ? GSPNodeAnd : GSPNodeOr;
+      n->cost = 0;
+      n->children = NSZoneCalloc(NSDefaultMallocZone(),
+	(count > 0 ? count : 1), sizeof(GSPNode));
+      for (i = 0; i < count; i++)
+	{
+	  GSPNode	*child = &n->children[n->count];
+
+	  GSPNodeCompile(child, [subs objectAtIndex: i]);
+	  if (child->kind == identity)
+	    {
+	      GSPNodeFree(child);
+	    }
+	  else if (child->kind == absorb)
+	    {
+	      GSPNodeFree(child);
+	      GSPNodeFree(n);
+	      memset(n, '\0', sizeof(*n));
+	      n->predicate = RETAIN(p);
+	      n->kind = absorb;
+	      return;
+	    }
+	  else
+	    {
+	      unsigned	j = n->count++;
+
+	      n->cost += child->cost;
+	      /* Keep the operands sorted so that the cheapest are
+	       * evaluated first (stable, so equal costs keep their order).
+	       */
+	      while (j > 0 && n->children[j - 1].cost > n->children[j].cost)
+		{
+		  GSPNode	tmp = n->children[j - 1];
+
+		  n->children[j - 1] = n->children[j];
+		  n->children[j] = tmp;
+		  j--;
+		}
+	    }
+	}
+      if (0 == n->count)
+	{
+	  n->kind = identity;
+	}
+    }
+  else if (c == [GSNotCompoundPredicate class])
+    {
+      NSArray	*subs = [(NSCompoundPredicate*)p subpredicates];
+
+      n->kind = GSPNodeNot;
+      n->children = NSZoneCalloc(NSDefaultMallocZone(), 1, sizeof(GSPNode));
+      GSPNodeCompile(n->children, [subs objectAtIndex: 0]);
+      n->count = 1;
+      n->cost = n->children->cost;
+      if (GSPNodeTrue == n->children->kind
+	|| GSPNodeFalse == n->children->kind)
+	{
+	  GSPNodeKind	k;
+
+	  k = (GSPNodeTrue == n->children->kind) ? GSPNodeFalse : GSPNodeTrue;
+	  GSPNodeFree(n);
+	  memset(n, '\0', sizeof(*n));
+	  n->predicate = RETAIN(p);
+	  n->kind = k;
+	  n->cost = 0;
+	}
+    }
+  else if (c == [NSComparisonPredicate class]
+    && NSDirectPredicateModifier
+      == [(NSComparisonPredicate*)p comparisonPredicateModifier])
+    {
+      NSComparisonPredicate	*cp = (NSComparisonPredicate*)p;
+      NSPredicateOperatorType	t = [cp predicateOperatorType];
+
+      GSPOperandCompile(&n->left, [cp leftExpression]);
+      GSPOperandCompile(&n->right, [cp rightExpression]);
+      n->kind = GSPNodeCompare;
+      n->type = t;
+
+      if (GSPOperandConstant == n->left.kind
+	&& GSPOperandConstant == n->right.kind)
+	{
+	  NS_DURING
+	    {
+	      BOOL	result;
+
+	      result = (*evaluateValues)(p, evaluateValuesSel,
+		n->left.value, n->right.value, nil);
+	      GSPOperandFree(&n->left);
+	      GSPOperandFree(&n->right);
+	      n->kind = result ? GSPNodeTrue : GSPNodeFalse;
+	      n->cost = 0;
+	    }
+	  NS_HANDLER
+	    {
+	      // Leave the exception to be raised when evaluated.
+	    }
+	  NS_ENDHANDLER
+	  if (GSPNodeCompare != n->kind)
+	    {
+	      return;
+	    }
+	}
+
+      switch (t)
+	{
+	  case NSLessThanPredicateOperatorType:
+	  case NSLessThanOrEqualToPredicateOperatorType:
+	  case NSGreaterThanPredicateOperatorType:
+	  case NSGreaterThanOrEqualToPredicateOperatorType:
+	  case NSEqualToPredicateOperatorType:
+	  case NSNotEqualToPredicateOperatorType:
+	    n->cost = 2;
+	    if (GSPOperandConstant == n->left.kind
+	      && GSPOperandKeyPath == n->right.kind)
+	      {
+		GSPOperand	tmp = n->left;
+
+		/* Put the key path on the left, so that the comparison
+		 * can be done as a scalar, and mirror the operator.
+		 */
+		n->left = n->right;
+		n->right = tmp;
+		switch (t)
+		  {
+		    case NSLessThanPredicateOperatorType:
+		      t = NSGreaterThanPredicateOperatorType;
+		      break;
+		    case NSLessThanOrEqualToPredicateOperatorType:
+		      t = NSGreaterThanOrEqualToPredicateOperatorType;
+		      break;
+		    case NSGreaterThanPredicateOperatorType:
+		      t = NSLessThanPredicateOperatorType;
+		      break;
+		    case NSGreaterThanOrEqualToPredicateOperatorType:
+		      t = NSLessThanOrEqualToPredicateOperatorType;
+		      break;
+		    default:
+		      break;
+		  }
+		if (YES == GSPNumberFromObject(n->right.value, &n->number))
+		  {
+		    n->numeric = YES;
+		    n->swapped = YES;
+		    n->type = t;
+		    n->cost = 1;
+		  }
+		else
+		  {
+		    /* Not a scalar comparison after all, so put the
+		     * operands back where they were.
+		     */
+		    n->right = n->left;
+		    n->left = tmp;
+		  }
+	      }
+	    else if (GSPOperandKeyPath == n->left.kind
+	      && GSPOperandConstant == n->right.kind
+	      && YES == GSPNumberFromObject(n->right.value, &n->number))
+	      {
+		n->numeric = YES;
+		n->cost = 1;
+	      }
+	    break;
+	  case NSMatchesPredicateOperatorType:
+	  case NSLikePredicateOperatorType:
+	    n->cost = 16;
+	    break;
+	  case NSCustomSelectorPredicateOperatorType:
+	    n->cost = 8;
+	    break;
+	  default:
+	    n->cost = 4;
+	    break;
+	}
+      n->cost += GSPOperandCost(&n->left) + GSPOperandCost(&n->right);
+    }
+}
+
+@implementation GSCompiledPredicate
+
++ (void) initialize
+{
+  if (self == [GSCompiledPredicate class])
+    {
+      objectValueForKey
+	= [NSObject instanceMethodForSelector: @selector(valueForKey:)];
+      objectValueForKeyPath
+	= [NSObject instanceMethodForSelector: @selector(valueForKeyPath:)];
+      evaluateValuesSel = @selector(_evaluateLeftValue:rightValue:object:);
+      evaluateValues = (BOOL (*)(id, SEL, id, id, id))
+	[NSComparisonPredicate instanceMethodForSelector: evaluateValuesSel];
+    }
+}
+
+/* Returns the compiled form of predicate, or predicate itself if
+ * compiling would not make it any faster to evaluate.
+ */
++ (NSPredicate*) compiledPredicate: (NSPredicate*)predicate
+{
+  GSCompiledPredicate	*c;
+
+  if (nil == predicate || [predicate isKindOfClass: self])
+    {
+      return predicate;
+    }
+  c = [self alloc];
+  GSPNodeCompile(&c->_root, predicate);
+  if (GSPNodeGeneric == c->_root.kind)
+    {
+      RELEASE(c);
+      return predicate;
+    }
+  c->_predicate = RETAIN(predicate);
+  return AUTORELEASE(c);
+}
+
+- (id) copyWithZone: (NSZone *)z
+{
+  return [_predicate copyWithZone: z];
+}
+
+- (void) dealloc
+{
+  GSPNodeFree(&_root);
+  RELEASE(_predicate);
+  [super dealloc];
+}
+
+- (BOOL) evaluateWithObject: (id)object
+{
+  return GSPNodeEvaluate(&_root, object);
+}
+
+- (NSString *) predicateFormat
+{
+  return [_predicate predicateFormat];
+}
+
+- (NSPredicate *) predicateWithSubstitutionVariables: (NSDictionary *)variables
+{
+  return [_predicate predicateWithSubstitutionVariables: variables];
+}
+
+@end
+
+
 @implementation NSArray (NSPredicate)
 
 - (NSArray *) filteredArrayUsingPredicate: (NSPredicate *)predicate
@@ -1660,6 +2704,7 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
   id			object;
 
   result = [NSMutableArray arrayWithCapacity: [self count]];
+  predicate = [GSCompiledPredicate compiledPredicate: predicate];
   while ((object = [e nextObject]) != nil)
     {
       if ([predicate evaluateWithObject: object] == YES)
@@ -1678,6 +2723,7 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
 {	
   unsigned	count = [self count];
 
+  predicate = [GSCompiledPredicate compiledPredicate: predicate];
   while (count-- > 0)
     {
       id	object = [self objectAtIndex: count];
@@ -1700,6 +2746,7 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
   id		object;
 
   result = [NSMutableSet setWithCapacity: [self count]];
+  predicate = [GSCompiledPredicate compiledPredicate: predicate];
   while ((object = [e nextObject]) != nil)
     {
       if ([predicate evaluateWithObject: object] == YES)
@@ -1721,6 +2768,7 @@ GSICUStringMatchesRegex(NSString *string, NSString *regex, NSStringCompareOption
   id		object;
 
   rejected = [NSMutableSet setWithCapacity: [self count]];
+  predicate = [GSCompiledPredicate compiledPredicate: predicate];
   while ((object = [e nextObject]) != nil)
     {
       if ([predicate evaluateWithObject: object] == NO)
@@ -49,6 +49,7 @@
 #import "GSStream.h"
 
 #import "GSPrivate.h"
+#import "GSPThread.h"
 
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
@@ -258,6 +259,323 @@ static inline BOOL timerInvalidated(NSTimer *t)
   return t->_invalidated;
 }
 
+/* Count of timers which have been invalidated.  Run loop contexts
+ * compare this with the value they saw last time they checked, to know
+ * when to tidy their heaps.
+ * It is changed by any thread and read by the thread of each run loop,
+ * so it is only updated and read atomically (the full barrier of the
+ * update also makes the timer's new state visible before the new count).
+ */
+static volatile unsigned	timerInvalidations = 0;
+
+/* Timers whose fire dates have been moved earlier are recorded in a ring
+ * (with a count of the total number moved), and each context looks at
+ * the ones recorded since it last checked, to reposition any of its own.
+ * The ring holds only pointers (it does not retain the timers), so a
+ * context never sends a message to a timer from the ring unless it is in
+ * the context's own heap (and therefore retained by it).
+ * A context which falls more than a ring's worth of moves behind must
+ * rebuild its heap instead.
+ */
+#define	TIMER_MOVES	64	/* Must be a power of two */
+static NSTimer			*timerMoved[TIMER_MOVES];
+static volatile unsigned	timerReschedules = 0;
+static pthread_mutex_t		timerMovedLock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline unsigned
+timerCounter(volatile unsigned *counter)
+{
+  return __sync_fetch_and_add(counter, 0);
+}
+
+void
+GSPrivateTimerChanged(NSTimer *t, BOOL invalidated)
+{
+  if (YES == invalidated)
+    {
+      __sync_fetch_and_add(&timerInvalidations, 1);
+    }
+  else
+    {
+      pthread_mutex_lock(&timerMovedLock);
+      timerMoved[timerReschedules % TIMER_MOVES] = t;
+      __sync_fetch_and_add(&timerReschedules, 1);
+      pthread_mutex_unlock(&timerMovedLock);
+    }
+}
+
+/* Each context keeps its timers in a binary min-heap ordered by the fire
+ * date each timer had when it was positioned in the heap.
+ * A timer may be present in several modes/loops, and may have its date
+ * changed by firing in one of them, so the date recorded in the heap can
+ * become stale.  Since firing only ever moves a date later, a stale entry
+ * is never earlier than it should be, so the entry at the top of the heap
+ * is correct once its recorded date matches the actual date of its timer.
+ * Moving a date earlier (rare) is reported by NSTimer, and a context
+ * holding the timer then adds a new entry for it at the new date, the
+ * old entry being discarded when it reaches the top of the heap.
+ */
+static inline BOOL
+timerBefore(GSTimerHeapEntry *a, GSTimerHeapEntry *b)
+{
+  if (a->when < b->when)
+    {
+      return YES;
+    }
+  if (a->when == b->when && a->seq < b->seq)
+    {
+      return YES;
+    }
+  return NO;
+}
+
+static void
+timerSiftDown(GSRunLoopCtxt *ctxt, unsigned i)
+{
+  GSTimerHeapEntry	*heap = ctxt->timers;
+  unsigned		count = ctxt->timerCount;
+  GSTimerHeapEntry	e = heap[i];
+
+  for (;;)
+    {
+      unsigned	child = i * 2 + 1;
+
+      if (child >= count)
+	{
+	  break;
+	}
+      if (child + 1 < count && timerBefore(&heap[child + 1], &heap[child]))
+	{
+	  child++;
+	}
+      if (NO == timerBefore(&heap[child], &e))
+	{
+	  break;
+	}
+      heap[i] = heap[child];
+      i = child;
+    }
+  heap[i] = e;
+}
+
+static void
+timerSiftUp(GSRunLoopCtxt *ctxt, unsigned i)
+{
+  GSTimerHeapEntry	*heap = ctxt->timers;
+  GSTimerHeapEntry	e = heap[i];
+
+  while (i > 0)
+    {
+      unsigned	parent = (i - 1) / 2;
+
+      if (NO == timerBefore(&e, &heap[parent]))
+	{
+	  break;
+	}
+      heap[i] = heap[parent];
+      i = parent;
+    }
+  heap[i] = e;
+}
+
+/* Add a (retained) timer to the heap, making the new entry the current
+ * one for the timer.
+ */
+static void
+timerHeapAdd(GSRunLoopCtxt *ctxt, NSTimer *t)
+{
+  GSTimerHeapEntry	*e;
+
+  if (ctxt->timerCount == ctxt->timerCapacity)
+    {
+      unsigned	size = ctxt->timerCapacity * 2;
+
+      if (size < 8)
+	{
+	  size = 8;
+	}
+#if	GS_WITH_GC
+      ctxt->timers = NSReallocateCollectable(ctxt->timers,
+	size * sizeof(GSTimerHeapEntry), NSScannedOption);
+#else
+      ctxt->timers = NSZoneRealloc(NSDefaultMallocZone(), ctxt->timers,
+	size * sizeof(GSTimerHeapEntry));
+#endif
+      ctxt->timerCapacity = size;
+    }
+  if (0 == ctxt->timerMap)
+    {
+      ctxt->timerMap = NSCreateMapTable(NSNonOwnedPointerMapKeyCallBacks,
+	NSIntegerMapValueCallBacks, 0);
+    }
+  e = &ctxt->timers[ctxt->timerCount];
+  e->timer = RETAIN(t);
+  e->when = [timerDate(t) timeIntervalSinceReferenceDate];
+  e->seq = ctxt->timerSerial++;
+  NSMapInsert(ctxt->timerMap, t, (void*)(uintptr_t)e->seq);
+  timerSiftUp(ctxt, ctxt->timerCount++);
+}
+
+/* Return YES if the timer is in the heap.
+ */
+static inline BOOL
+timerHeapContains(GSRunLoopCtxt *ctxt, NSTimer *t)
+{
+  if (0 == ctxt->timerMap)
+    {
+      return NO;
+    }
+  return NSMapMember(ctxt->timerMap, t, 0, 0);
+}
+
+/* Return YES if the heap entry is the current one for its timer.
+ */
+static inline BOOL
+timerEntryCurrent(GSRunLoopCtxt *ctxt, GSTimerHeapEntry *e)
+{
+  void	*seq;
+
+  return (NSMapMember(ctxt->timerMap, e->timer, 0, &seq)
+    && (unsigned)(uintptr_t)seq == e->seq) ? YES : NO;
+}
+
+/* Remove the entry at the top of the heap, releasing its timer.
+ */
+static void
+timerHeapRemoveTop(GSRunLoopCtxt *ctxt)
+{
+  NSTimer	*t = ctxt->timers[0].timer;
+
+  if (YES == timerEntryCurrent(ctxt, &ctxt->timers[0]))
+    {
+      NSMapRemove(ctxt->timerMap, t);
+    }
+  if (--ctxt->timerCount > 0)
+    {
+      ctxt->timers[0] = ctxt->timers[ctxt->timerCount];
+      timerSiftDown(ctxt, 0);
+    }
+  RELEASE(t);
+}
+
+/* Remove invalidated timers and stale entries from the heap and, if
+ * 'rekey' is YES, refresh the recorded dates of all the others, then
+ * restore the heap ordering.  This is O(n) and is only done when many
+ * timers have been invalidated or when we have missed some of the
+ * timers moved to an earlier date.
+ */
+static void
+timerHeapRebuild(GSRunLoopCtxt *ctxt, BOOL rekey)
+{
+  GSTimerHeapEntry	*heap = ctxt->timers;
+  unsigned		count = ctxt->timerCount;
+  unsigned		kept = 0;
+  unsigned		i;
+
+  for (i = 0; i < count; i++)
+    {
+      NSTimer	*t = heap[i].timer;
+
+      if (NO == timerEntryCurrent(ctxt, &heap[i]))
+	{
+	  RELEASE(t);
+	}
+      else if (YES == timerInvalidated(t))
+	{
+	  NSMapRemove(ctxt->timerMap, t);
+	  RELEASE(t);
+	}
+      else
+	{
+	  heap[kept] = heap[i];
+	  if (YES == rekey)
+	    {
+	      heap[kept].when = [timerDate(t) timeIntervalSinceReferenceDate];
+	    }
+	  kept++;
+	}
+    }
+  ctxt->timerCount = kept;
+  i = kept / 2;
+  while (i-- > 0)
+    {
+      timerSiftDown(ctxt, i);
+    }
+}
+
+/* Make sure that the top of the heap is a valid timer whose recorded
+ * date is correct (and therefore the earliest timer in the heap).
+ * Returns the timer or nil if the heap is empty.
+ */
+static NSTimer *
+timerHeapTop(GSRunLoopCtxt *ctxt)
+{
+  unsigned	sweeps = timerCounter(&timerInvalidations);
+
+  if (timerCounter(&timerReschedules) != ctxt->timerMoves)
+    {
+      unsigned	moves;
+
+      /* Some timers have been moved earlier ... add a new entry for
+       * each of those which are in our heap.
+       */
+      pthread_mutex_lock(&timerMovedLock);
+      moves = timerReschedules;
+      if (moves - ctxt->timerMoves > TIMER_MOVES)
+	{
+	  ctxt->timerMoves = moves;
+	  pthread_mutex_unlock(&timerMovedLock);
+	  ctxt->timerSweeps = sweeps;
+	  timerHeapRebuild(ctxt, YES);
+	}
+      else
+	{
+	  while (ctxt->timerMoves != moves)
+	    {
+	      NSTimer	*t = timerMoved[ctxt->timerMoves++ % TIMER_MOVES];
+
+	      if (YES == timerHeapContains(ctxt, t))
+		{
+		  timerHeapAdd(ctxt, t);
+		}
+	    }
+	  pthread_mutex_unlock(&timerMovedLock);
+	}
+    }
+  if ((sweeps - ctxt->timerSweeps) > ctxt->timerCount / 2
+    && ctxt->timerCount > 16)
+    {
+      /* Many timers have been invalidated (not necessarily ours) since
+       * we last looked, so remove any of ours which are invalid rather
+       * than waiting for them to reach the top of the heap.
+       */
+      ctxt->timerSweeps = sweeps;
+      timerHeapRebuild(ctxt, NO);
+    }
+
+  while (ctxt->timerCount > 0)
+    {
+      GSTimerHeapEntry	*e = &ctxt->timers[0];
+      NSTimeInterval	ti;
+
+      if (NO == timerEntryCurrent(ctxt, e)
+	|| YES == timerInvalidated(e->timer))
+	{
+	  timerHeapRemoveTop(ctxt);
+	  continue;
+	}
+      ti = [timerDate(e->timer) timeIntervalSinceReferenceDate];
+      if (ti != e->when)
+	{
+	  e->when = ti;
+	  timerSiftDown(ctxt, 0);
+	  continue;
+	}
+      return e->timer;
+    }
+  return nil;
+}
+
 
 
 @implementation NSObject (TimedPerformers)
@@ -420,6 +738,9 @@ static inline BOOL timerInvalidated(NSTimer *t)
     }
   watchers = context->watchers;
   GSIArrayAddItem(watchers, (GSIArrayItem)((id)item));
+#ifdef	HAVE_EPOLL
+  [context addWatcher: item];
+#endif
   i = GSIArrayCount(watchers);
   if (i % 1000 == 0 && i > context->maxWatchers)
     {
@@ -592,6 +913,9 @@ static inline BOOL timerInvalidated(NSTimer *t)
 	  if (info->type == type && info->data == data)
 	    {
 	      info->_invalidated = YES;
+#ifdef	HAVE_EPOLL
+	      [context removeWatcher: info];
+#endif
 	      GSIArrayRemoveItemAtIndex(watchers, i);
 	    }
 	}
@@ -815,8 +1139,6 @@ static inline BOOL timerInvalidated(NSTimer *t)
 	  forMode: (NSString*)mode
 {
   GSRunLoopCtxt	*context;
-  GSIArray	timers;
-  unsigned      i;
 
   if ([timer isKindOfClass: [NSTimer class]] == NO
     || [timer isProxy] == YES)
@@ -842,14 +1164,9 @@ static inline BOOL timerInvalidated(NSTimer *t)
       NSMapInsert(_contextMap, context->mode, context);
       RELEASE(context);
     }
-  timers = context->timers;
-  i = GSIArrayCount(timers);
-  while (i-- > 0)
+  if (YES == timerHeapContains(context, timer))
     {
-      if (timer == GSIArrayItemAtIndex(timers, i).obj)
-        {
-          return;       /* Timer already present */
-        }
+      return;       /* Timer already present */
     }
   /*
    * NB. A previous version of the timer code maintained an ordered
@@ -862,18 +1179,13 @@ static inline BOOL timerInvalidated(NSTimer *t)
    * in one mode/loop adjusts its date ... without changing the
    * ordering of the timers in the other modes/loops which contain
    * the timer.  When the ordering of timers in an array was broken
-   * we could get delays in processing timeouts, so we reverted to
-   * simply having timers in an unordered array and checking them
-   * all each time -limitDateForMode: is called.
+   * we could get delays in processing timeouts.
+   * We now keep a heap in which the recorded date of a timer may be
+   * earlier than its actual date (never later), and correct entries
+   * as they reach the top of the heap (see timerHeapTop()), so we
+   * only need to examine the few timers which are actually due.
    */
-  GSIArrayAddItem(timers, (GSIArrayItem)((id)timer));
-  i = GSIArrayCount(timers);
-  if (i % 1000 == 0 && i > context->maxTimers)
-    {
-      context->maxTimers = i;
-      NSLog(@"WARNING ... there are %u timers scheduled in mode %@ of %@",
-	i, mode, self);
-    }
+  timerHeapAdd(context, timer);
 }
 
 
@@ -955,17 +1267,10 @@ updateTimer(NSTimer *t, NSDate *d, NSTimeInterval now)
       _currentMode = mode;
       NS_DURING
 	{
-	  GSIArray		timers = context->timers;
 	  NSTimeInterval	now;
           NSDate                *earliest;
 	  NSDate		*d;
 	  NSTimer		*t;
-	  NSTimeInterval	ti;
-	  NSTimeInterval	ei;
-          unsigned              c;
-          unsigned              i;
-
-	  ei = 0.0;	// Only needed to avoid compiler warning
 
 	  /*
 	   * Save current time so we don't keep redoing system call to
@@ -995,70 +1300,41 @@ updateTimer(NSTimer *t, NSDate *d, NSTimeInterval now)
                 }
             }
 
-	  /* Fire the oldest/first valid timer whose fire date has passed
-	   * and fire it.
-	   * We fire timers in the order in which they were added to the
-	   * run loop rather than in date order.  This prevents code
-	   * from blocking other timers by adding timers whose fire date
-	   * is some time in the past... we guarantee fair handling.
+	  /* Fire the earliest valid timer whose fire date has passed.
+	   * Timers with the same fire date are fired in the order in
+	   * which they were added to the run loop.  Once fired, a timer
+	   * has its date moved beyond the current time, so code can't
+	   * block other timers by adding timers whose fire date is some
+	   * time in the past... we guarantee fair handling.
 	   */
-	  c = GSIArrayCount(timers);
-	  for (i = 0; i < c; i++)
+	  t = timerHeapTop(context);
+	  if (t != nil
+	    && [(d = timerDate(t)) timeIntervalSinceReferenceDate] < now)
 	    {
-	      t = GSIArrayItemAtIndex(timers, i).obj;
-	      if (timerInvalidated(t) == NO)
+	      /* Take the timer out of the heap while it fires, since the
+	       * timeout handler may add/remove timers in this context.
+	       */
+	      RETAIN(t);
+	      timerHeapRemoveTop(context);
+	      [t fire];
+	      GSPrivateNotifyASAP(_currentMode);
+	      IF_NO_GC([arp emptyPool];)
+	      if (updateTimer(t, d, now) == YES
+		&& NO == timerHeapContains(context, t))
 		{
-		  d = timerDate(t);
-		  ti = [d timeIntervalSinceReferenceDate];
-		  if (ti < now)
-		    {
-		      GSIArrayRemoveItemAtIndexNoRelease(timers, i);
-		      [t fire];
-		      GSPrivateNotifyASAP(_currentMode);
-		      IF_NO_GC([arp emptyPool];)
-		      if (updateTimer(t, d, now) == YES)
-			{
-			  /* Updated ... replace in array.
-			   */
-			  GSIArrayAddItemNoRetain(timers,
-			    (GSIArrayItem)((id)t));
-			}
-		      else
-			{
-			  /* The timer was invalidated, so we can
-			   * release it as we aren't putting it back
-			   * in the array.
-			   */
-			  RELEASE(t);
-			}
-		      break;
-		    }
+		  /* Updated ... put back in heap.
+		   */
+		  timerHeapAdd(context, t);
 		}
+	      RELEASE(t);
 	    }
 
-	  /* Now, find the earliest remaining timer date while removing
-	   * any invalidated timers.  We iterate from the end of the
-	   * array to minimise the amount of array alteration needed.
+	  /* Now, find the earliest remaining timer date.
 	   */
 	  earliest = nil;
-	  i = GSIArrayCount(timers);
-	  while (i-- > 0)
+	  if ((t = timerHeapTop(context)) != nil)
 	    {
-	      t = GSIArrayItemAtIndex(timers, i).obj;
-	      if (timerInvalidated(t) == YES)
-		{
-		  GSIArrayRemoveItemAtIndex(timers, i);
-		}
-	      else
-		{
-		  d = timerDate(t);
-		  ti = [d timeIntervalSinceReferenceDate];
-		  if (earliest == nil || ti < ei)
-		    {
-		      earliest = d;
-		      ei = ti;
-		    }
-		}
+	      earliest = timerDate(t);
 	    }
 
           /* The earliest date of a valid timeout is copied into 'when'
@@ -1155,7 +1431,7 @@ updateTimer(NSTimer *t, NSDate *d, NSTimeInterval now)
 
       if (context == nil
 	|| (GSIArrayCount(context->watchers) == 0
-	  && GSIArrayCount(context->timers) == 0))
+	  && context->timerCount == 0))
 	{
 	  NSDebugMLLog(@"NSRunLoop", @"no inputs or timers in mode %@", mode);
 	  GSPrivateNotifyASAP(_currentMode);
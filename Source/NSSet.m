@@ -48,6 +48,48 @@
 @interface GSMutableSet : NSObject	// Help the compiler
 @end
 
+/* State for concurrent enumeration of the objects in a set using
+ * GSPrivateParallelFilter(), where each position is an index into a
+ * buffer filled by fast enumeration of the set.
+ */
+typedef struct {
+  id			*objects;
+  GSSetEnumeratorBlock	enumerator;
+  GSSetFilterBlock	filter;
+} GSSetConcurrency;
+
+static BOOL
+concurrentEnumerate(void *context, NSUInteger index, BOOL *stop)
+{
+  GSSetConcurrency	*c = (GSSetConcurrency*)context;
+
+  CALL_BLOCK(c->enumerator, c->objects[index], stop);
+  return NO;
+}
+
+static BOOL
+concurrentTest(void *context, NSUInteger index, BOOL *stop)
+{
+  GSSetConcurrency	*c = (GSSetConcurrency*)context;
+
+  return CALL_BLOCK(c->filter, c->objects[index], stop);
+}
+
+/* Fill the buffer with the objects of the set, returning their number.
+ */
+static NSUInteger
+setObjects(NSSet *set, id *objects)
+{
+  NSUInteger	count = 0;
+
+  FOR_IN (id, obj, set)
+    {
+      objects[count++] = obj;
+    }
+  END_FOR_IN(set)
+  return count;
+}
+
 /**
  *  <code>NSSet</code> maintains an unordered collection of unique objects
  *  (according to [NSObject-isEqual:]).  When a duplicate object is added
@@ -870,6 +912,22 @@ static Class NSMutableSet_concrete_class;
   BLOCK_SCOPE BOOL shouldStop = NO;
   id<NSFastEnumeration> enumerator = self;
 
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSSetConcurrency	c;
+      NSUInteger	count = [self count];
+      NSUInteger	found;
+
+      GS_BEGINIDBUF(objects, count);
+      c.objects = objects;
+      c.enumerator = aBlock;
+      count = setObjects(self, objects);
+      GSPrivateParallelFilter(count, &c, concurrentEnumerate,
+	&shouldStop, &found);
+      GS_ENDIDBUF();
+      return;
+    }
+
   GS_DISPATCH_CREATE_QUEUE_AND_GROUP_FOR_ENUMERATION(enumQueue, opts)
   FOR_IN (id, obj, enumerator)
   {
@@ -896,7 +954,30 @@ static Class NSMutableSet_concrete_class;
   NSMutableSet          *resultSet;
 
   resultSet = [NSMutableSet setWithCapacity: [self count]];
-    
+
+  if (opts & NSEnumerationConcurrent)
+    {
+      GSSetConcurrency	c;
+      NSUInteger	count = [self count];
+      NSUInteger	*hits;
+      NSUInteger	found;
+      NSUInteger	i;
+
+      GS_BEGINIDBUF(objects, count);
+      c.objects = objects;
+      c.filter = aBlock;
+      count = setObjects(self, objects);
+      hits = GSPrivateParallelFilter(count, &c, concurrentTest,
+	&shouldStop, &found);
+      for (i = 0; i < found; i++)
+	{
+	  [resultSet addObject: objects[hits[i]]];
+	}
+      free(hits);
+      GS_ENDIDBUF();
+      return [resultSet makeImmutableCopyOnFail: NO];
+    }
+
   FOR_IN (id, obj, enumerator)
     {
       BOOL include = CALL_BLOCK(aBlock, obj, &shouldStop);
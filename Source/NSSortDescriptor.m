@@ -51,6 +51,7 @@ static BOOL     initialized = NO;
 #if     GS_USE_SHELLSORT
 @class  GSShellSortPlaceHolder;
 #endif
+@class  GSParallelSortPlaceHolder;
 
 @implementation NSSortDescriptor
 
@@ -67,6 +68,7 @@ static BOOL     initialized = NO;
 #if     GS_USE_SHELLSORT
       [GSShellSortPlaceHolder class];
 #endif
+      [GSParallelSortPlaceHolder class];
       initialized = YES;
     }
 }
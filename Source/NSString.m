@@ -2550,7 +2550,7 @@ GSICUCollatorOpen(NSStringCompareOptions mask, NSLocale *locale)
 	NSZoneMalloc(NSDefaultMallocZone(), len * sizeof(unichar));
 
       [self getCharacters: ptr range: NSMakeRange(0,len)];
-      ret = GSPrivateHash(0, (const void*)ptr, len * sizeof(unichar));
+      ret = GSPrivateHashCharacters(0, ptr, len);
       if (ptr != buf)
 	{
 	  NSZoneFree(NSDefaultMallocZone(), ptr);
@@ -34,6 +34,7 @@
 #import "Foundation/NSException.h"
 #import "Foundation/NSRunLoop.h"
 #import "Foundation/NSInvocation.h"
+#import "GSPrivate.h"
 
 @class	NSGDate;
 @interface NSGDate : NSObject	// Help the compiler
@@ -285,7 +286,11 @@ static Class	NSDate_class;
 - (void) invalidate
 {
   /* OPENSTEP allows this method to be called multiple times. */
-  _invalidated = YES;
+  if (NO == _invalidated)
+    {
+      _invalidated = YES;
+      GSPrivateTimerChanged(self, YES);
+    }
   if (_target != nil)
     {
       DESTROY(_target);
@@ -328,7 +333,23 @@ static Class	NSDate_class;
  */
 - (void) setFireDate: (NSDate*)fireDate
 {
+  BOOL	earlier = NO;
+
+  if (_date != nil && fireDate != nil
+    && [fireDate timeIntervalSinceReferenceDate]
+    < [_date timeIntervalSinceReferenceDate])
+    {
+      earlier = YES;
+    }
   ASSIGN(_date, fireDate);
+  if (YES == earlier)
+    {
+      /* Run loops keep timers ordered by date and only check for
+       * dates being moved later, so they need to be told about this
+       * (once the new date is set, so that they see it).
+       */
+      GSPrivateTimerChanged(self, NO);
+    }
 }
 
 /**
@@ -26,21 +26,454 @@
 
 #define	EXPOSE_NSURLCache_IVARS	1
 #import "GSURLPrivate.h"
+#import "GSPrivate.h"
 #import "GNUstepBase/NSObject+GNUstepBase.h"
+#import "Foundation/NSByteOrder.h"
+#import "Foundation/NSFileHandle.h"
+#import "Foundation/NSFileManager.h"
+#import "Foundation/NSLock.h"
+#import "Foundation/NSOperation.h"
+#import "Foundation/NSPathUtilities.h"
+#import "Foundation/NSProcessInfo.h"
+#import "Foundation/NSPropertyList.h"
+
+#ifdef	HAVE_MMAP
+#include	<unistd.h>
+#include	<sys/mman.h>
+#endif
+
+#if	!defined(__MINGW__)
+#include	<fcntl.h>
+#include	<unistd.h>
+#include	<sys/file.h>
+#define	USE_FLOCK	1
+#endif
+
+/*
+ * The disk tier of the cache is a single file (cache.db in the disk
+ * directory) to which records are only ever appended.  Each record is a
+ * header followed by the key (the absolute URL of the request), the
+ * metadata of the response (a binary property list) and its data.
+ * A removal record (with no metadata or data) cancels earlier records
+ * for its key.
+ *
+ * The index of the file is not stored; it is rebuilt when the cache is
+ * opened by reading the records in order.  Reading stops at the first
+ * record which is incomplete or fails its checksum (as is left by a crash
+ * while writing) and the file is truncated there, so a crash loses at
+ * most the responses which were being written.
+ *
+ * Each record read from the file is checked against its header, its
+ * checksum and the key it is wanted for, so a file damaged after it was
+ * opened gives cache misses rather than wrong responses.
+ *
+ * When the file grows much larger than the live records in it, it is
+ * compacted by copying the live records (least recently used first) into
+ * a new file which is then renamed over the old one.
+ *
+ * Only one cache (in this or any other process) may use a directory at
+ * a time; it holds a lock on cache.lock in the directory, and any other
+ * cache for the directory keeps responses in memory only.
+ */
+#define	RECORD_MAGIC	0x43555347	/* 'GSUC'	*/
+#define	RECORD_STORE	1
+#define	RECORD_REMOVE	2
+
+typedef struct {
+  uint32_t	magic;
+  uint32_t	kind;
+  uint32_t	keyLength;
+  uint32_t	metaLength;
+  uint32_t	dataLength;
+  uint32_t	checksum;	/* Of key, metadata and data.	*/
+} RecordHeader;
+
+/* An entry in either tier of the cache.  The entries of each tier are
+ * kept in a list from the most recently used to the least.
+ */
+@interface	GSURLCacheEntry : NSObject
+{
+@public
+  GSURLCacheEntry	*prev;		/* More recently used.	*/
+  GSURLCacheEntry	*next;		/* Less recently used.	*/
+  NSString		*key;
+  NSCachedURLResponse	*response;	/* For the memory tier.	*/
+  unsigned long long	offset;		/* For the disk tier.	*/
+  NSUInteger		size;
+}
+@end
+
+@implementation	GSURLCacheEntry
+- (void) dealloc
+{
+  RELEASE(key);
+  RELEASE(response);
+  [super dealloc];
+}
+@end
+
+/* Makes e the most recently used entry of the list at head.
+ */
+static void
+entryUsed(GSURLCacheEntry *head, GSURLCacheEntry *e)
+{
+  if (e->prev != nil)
+    {
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+    }
+  e->next = head->next;
+  e->prev = head;
+  head->next->prev = e;
+  head->next = e;
+}
+
+static void
+entryUnlink(GSURLCacheEntry *e)
+{
+  if (e->prev != nil)
+    {
+      e->prev->next = e->next;
+      e->next->prev = e->prev;
+      e->prev = e->next = nil;
+    }
+}
+
+static GSURLCacheEntry *
+listNew(void)
+{
+  GSURLCacheEntry	*head = [GSURLCacheEntry new];
+
+  head->next = head->prev = head;
+  return head;
+}
 
-// FIXME ... locking and disk storage needed
 typedef struct {
-  unsigned		diskCapacity;
-  unsigned		memoryCapacity;
-  unsigned		diskUsage;
-  unsigned		memoryUsage;
+  NSUInteger		diskCapacity;
+  NSUInteger		memoryCapacity;
+  NSUInteger		diskUsage;
+  NSUInteger		memoryUsage;
   NSString		*path;
-  NSMutableDictionary	*memory;
+  NSLock		*lock;
+  NSMutableDictionary	*memory;	/* Key to entry.		*/
+  GSURLCacheEntry	*memoryList;
+  NSMutableDictionary	*disk;		/* Key to entry.		*/
+  GSURLCacheEntry	*diskList;
+  NSMutableDictionary	*pending;	/* Key to response being written. */
+  NSOperationQueue	*writer;
+  NSFileHandle		*output;	/* Used by the writer only.	*/
+  NSFileHandle		*input;
+  unsigned long long	fileLength;
+  void			*map;
+  unsigned long long	mapLength;
+  int			lockFD;		/* Lock on the directory.	*/
 } Internal;
  
 #define	this	((Internal*)(self->_NSURLCacheInternal))
-#define	inst	((Internal*)(o->_NSURLCacheInternal))
 
+@interface	NSURLCache (Disk)
+- (void) _compact;
+- (void) _flush;
+- (void) _openDisk;
+- (NSData*) _readFrom: (unsigned long long)offset length: (NSUInteger)length;
+- (void) _remove: (NSString*)key;
+- (void) _runJob: (NSArray*)job;
+- (BOOL) _shouldCompact;
+- (void) _trim;
+- (void) _write: (NSCachedURLResponse*)response forKey: (NSString*)key;
+@end
+
+/* An operation on the writer queue of a cache.
+ */
+@interface	GSURLCacheJob : NSOperation
+{
+  NSURLCache	*cache;
+  NSArray	*job;
+}
+- (id) initWithCache: (NSURLCache*)c job: (NSArray*)j;
+@end
+
+@implementation	GSURLCacheJob
+- (void) dealloc
+{
+  RELEASE(cache);
+  RELEASE(job);
+  [super dealloc];
+}
+- (id) initWithCache: (NSURLCache*)c job: (NSArray*)j
+{
+  if ((self = [super init]) != nil)
+    {
+      ASSIGN(cache, c);
+      ASSIGN(job, j);
+    }
+  return self;
+}
+- (void) main
+{
+  [cache _runJob: job];
+  /* Release the cache before the operation is finished, so that once the
+   * writer queue is empty nothing but its owners retains the cache.
+   */
+  DESTROY(cache);
+}
+@end
+
+/* Returns the key used for a request, or nil if responses to the request
+ * are not cached (only those to GET requests are).
+ */
+static NSString *
+keyForRequest(NSURLRequest *request)
+{
+  NSString	*method = [request HTTPMethod];
+
+  if (method != nil && [method isEqualToString: @"GET"] == NO)
+    {
+      return nil;
+    }
+  return [[request URL] absoluteString];
+}
+
+/* Returns YES if the response may be stored at all, which it may not if
+ * its Cache-Control header forbids that.
+ */
+static BOOL
+mayStore(NSCachedURLResponse *cachedResponse)
+{
+  NSURLResponse	*r = [cachedResponse response];
+
+  if ([r isKindOfClass: [NSHTTPURLResponse class]])
+    {
+      NSString	*cc;
+
+      cc = [[(NSHTTPURLResponse*)r allHeaderFields]
+	objectForKey: @"Cache-Control"];
+      if (cc != nil && [[cc lowercaseString] rangeOfString: @"no-store"]
+	.location != NSNotFound)
+	{
+	  return NO;
+	}
+    }
+  return YES;
+}
+
+/* Returns the property list describing a response (everything except
+ * the data), which keeps the headers (ETag, Last-Modified, Cache-Control,
+ * Expires and so on) needed to decide whether the response is still
+ * fresh or to revalidate it.
+ */
+static NSData *
+metaFor(NSCachedURLResponse *cachedResponse)
+{
+  NSURLResponse		*r = [cachedResponse response];
+  NSMutableDictionary	*m = [NSMutableDictionary dictionaryWithCapacity: 8];
+  NSDictionary		*info = [cachedResponse userInfo];
+
+  [m setObject: [[r URL] absoluteString] forKey: @"URL"];
+  if ([r MIMEType] != nil)
+    {
+      [m setObject: [r MIMEType] forKey: @"MIMEType"];
+    }
+  if ([r textEncodingName] != nil)
+    {
+      [m setObject: [r textEncodingName] forKey: @"TextEncodingName"];
+    }
+  [m setObject: [NSNumber numberWithLongLong: [r expectedContentLength]]
+	forKey: @"ExpectedContentLength"];
+  if ([r isKindOfClass: [NSHTTPURLResponse class]])
+    {
+      NSDictionary	*h = [(NSHTTPURLResponse*)r allHeaderFields];
+
+      [m setObject: [NSNumber numberWithInteger:
+	[(NSHTTPURLResponse*)r statusCode]] forKey: @"StatusCode"];
+      [m setObject: (h == nil ? [NSDictionary dictionary] : h)
+	    forKey: @"Headers"];
+    }
+  if (info != nil && [NSPropertyListSerialization propertyList: info
+    isValidForFormat: NSPropertyListBinaryFormat_v1_0])
+    {
+      [m setObject: info forKey: @"UserInfo"];
+    }
+  [m setObject: [NSDate date] forKey: @"Stored"];
+  return [NSPropertyListSerialization
+    dataFromPropertyList: m
+		  format: NSPropertyListBinaryFormat_v1_0
+	errorDescription: 0];
+}
+
+static NSCachedURLResponse *
+responseFor(NSData *meta, NSData *data)
+{
+  NSDictionary		*m;
+  NSURL			*u;
+  NSURLResponse		*r;
+  NSCachedURLResponse	*c;
+
+  m = [NSPropertyListSerialization propertyListFromData: meta
+				       mutabilityOption: NSPropertyListImmutable
+						 format: 0
+				       errorDescription: 0];
+  if ([m isKindOfClass: [NSDictionary class]] == NO
+    || (u = [NSURL URLWithString: [m objectForKey: @"URL"]]) == nil)
+    {
+      return nil;
+    }
+  if ([m objectForKey: @"StatusCode"] != nil)
+    {
+      r = [[NSHTTPURLResponse alloc]
+	initWithURL: u
+	 statusCode: [[m objectForKey: @"StatusCode"] integerValue]
+	HTTPVersion: @"HTTP/1.1"
+       headerFields: [m objectForKey: @"Headers"]];
+    }
+  else
+    {
+      r = [[NSURLResponse alloc]
+	initWithURL: u
+	   MIMEType: [m objectForKey: @"MIMEType"]
+	  expectedContentLength: [[m objectForKey: @"ExpectedContentLength"]
+	    longLongValue]
+	   textEncodingName: [m objectForKey: @"TextEncodingName"]];
+    }
+  c = [[NSCachedURLResponse alloc] initWithResponse: r
+					       data: data
+					   userInfo: [m objectForKey: @"UserInfo"]
+				      storagePolicy: NSURLCacheStorageAllowed];
+  RELEASE(r);
+  return AUTORELEASE(c);
+}
+
+/* Returns the length of the valid records at the start of the data,
+ * calling the function for each (in order) with its kind, key, offset
+ * and length.
+ */
+static unsigned long long
+scanRecords(NSData *d, Internal *o, void (*record)(Internal *o,
+  uint32_t kind, NSString *key, unsigned long long offset, NSUInteger length))
+{
+  const uint8_t		*bytes = [d bytes];
+  unsigned long long	total = [d length];
+  unsigned long long	pos = 0;
+
+  while (total - pos >= sizeof(RecordHeader))
+    {
+      RecordHeader	h;
+      unsigned long long	body;
+      NSString		*key;
+
+      memcpy(&h, bytes + pos, sizeof(h));
+      body = (unsigned long long)NSSwapLittleIntToHost(h.keyLength)
+	+ NSSwapLittleIntToHost(h.metaLength)
+	+ NSSwapLittleIntToHost(h.dataLength);
+      if (NSSwapLittleIntToHost(h.magic) != RECORD_MAGIC
+	|| body > total - pos - sizeof(h)
+	|| GSPrivateHash(0, bytes + pos + sizeof(h), (int)body)
+	  != NSSwapLittleIntToHost(h.checksum))
+	{
+	  break;
+	}
+      key = [[NSString alloc] initWithBytes: bytes + pos + sizeof(h)
+				     length: NSSwapLittleIntToHost(h.keyLength)
+				   encoding: NSUTF8StringEncoding];
+      if (key != nil)
+	{
+	  record(o, NSSwapLittleIntToHost(h.kind), key, pos,
+	    (NSUInteger)(sizeof(h) + body));
+	  RELEASE(key);
+	}
+      pos += sizeof(h) + body;
+    }
+  return pos;
+}
+
+/* Updates the disk index for a record read when opening the cache,
+ * later records for a key replacing earlier ones and so counting as more
+ * recently used.
+ */
+static void
+indexRecord(Internal *o, uint32_t kind, NSString *key,
+  unsigned long long offset, NSUInteger length)
+{
+  GSURLCacheEntry	*e = [o->disk objectForKey: key];
+
+  if (e != nil)
+    {
+      o->diskUsage -= e->size;
+      entryUnlink(e);
+      [o->disk removeObjectForKey: key];
+    }
+  if (RECORD_STORE == kind)
+    {
+      e = [GSURLCacheEntry new];
+      e->key = [key copy];
+      e->offset = offset;
+      e->size = length;
+      entryUsed(o->diskList, e);
+      [o->disk setObject: e forKey: key];
+      RELEASE(e);
+      o->diskUsage += length;
+    }
+}
+
+/* Returns YES if the data is a complete, undamaged store record of the
+ * expected size for the key.
+ */
+static BOOL
+recordValid(NSData *d, NSString *key, NSUInteger size)
+{
+  const uint8_t		*bytes = [d bytes];
+  RecordHeader		h;
+  unsigned long long	body;
+  NSString		*k;
+  BOOL			ok;
+
+  if (nil == d || [d length] != size || size < sizeof(h))
+    {
+      return NO;
+    }
+  memcpy(&h, bytes, sizeof(h));
+  body = (unsigned long long)NSSwapLittleIntToHost(h.keyLength)
+    + NSSwapLittleIntToHost(h.metaLength)
+    + NSSwapLittleIntToHost(h.dataLength);
+  if (NSSwapLittleIntToHost(h.magic) != RECORD_MAGIC
+    || NSSwapLittleIntToHost(h.kind) != RECORD_STORE
+    || body != size - sizeof(h)
+    || GSPrivateHash(0, bytes + sizeof(h), (int)body)
+      != NSSwapLittleIntToHost(h.checksum))
+    {
+      return NO;
+    }
+  k = [[NSString alloc] initWithBytes: bytes + sizeof(h)
+			       length: NSSwapLittleIntToHost(h.keyLength)
+			     encoding: NSUTF8StringEncoding];
+  ok = [k isEqualToString: key];
+  RELEASE(k);
+  return ok;
+}
+
+static NSData *
+recordFor(uint32_t kind, NSString *key, NSData *meta, NSData *data)
+{
+  NSData	*k = [key dataUsingEncoding: NSUTF8StringEncoding];
+  NSMutableData	*r;
+  RecordHeader	h;
+
+  r = [NSMutableData dataWithCapacity:
+    sizeof(h) + [k length] + [meta length] + [data length]];
+  [r setLength: sizeof(h)];
+  [r appendData: k];
+  [r appendData: meta];
+  [r appendData: data];
+  h.magic = NSSwapHostIntToLittle(RECORD_MAGIC);
+  h.kind = NSSwapHostIntToLittle(kind);
+  h.keyLength = NSSwapHostIntToLittle((uint32_t)[k length]);
+  h.metaLength = NSSwapHostIntToLittle((uint32_t)[meta length]);
+  h.dataLength = NSSwapHostIntToLittle((uint32_t)[data length]);
+  h.checksum = NSSwapHostIntToLittle(GSPrivateHash(0,
+    (const uint8_t*)[r bytes] + sizeof(h), (int)([r length] - sizeof(h))));
+  memcpy([r mutableBytes], &h, sizeof(h));
+  return r;
+}
 
 static NSURLCache	*shared = nil;
 
@@ -68,7 +501,27 @@ static NSURLCache	*shared = nil;
 {
   if (this != 0)
     {
+#ifdef	HAVE_MMAP
+      if (this->map != 0)
+	{
+	  munmap(this->map, (size_t)this->mapLength);
+	}
+#endif
+#if	defined(USE_FLOCK)
+      if (this->lock != nil && this->lockFD >= 0)
+	{
+	  close(this->lockFD);	/* Releases the lock.	*/
+	}
+#endif
+      RELEASE(this->input);
+      RELEASE(this->output);
+      RELEASE(this->writer);
+      RELEASE(this->pending);
+      RELEASE(this->disk);
+      RELEASE(this->diskList);
       RELEASE(this->memory);
+      RELEASE(this->memoryList);
+      RELEASE(this->lock);
       RELEASE(this->path);
       NSZoneFree([self zone], this);
     }
@@ -82,9 +535,7 @@ static NSURLCache	*shared = nil;
   [gnustep_global_lock lock];
   if (shared == nil)
     {
-      NSString	*path = nil;
-
-// FIXME user-library-path/Caches/current-app-name
+      NSString	*path = [[NSProcessInfo processInfo] processName];
 
       shared = [[self alloc] initWithMemoryCapacity: 4 * 1024 * 1024
 				       diskCapacity: 20 * 1024 * 1024
@@ -96,10 +547,106 @@ static NSURLCache	*shared = nil;
   return AUTORELEASE(c);
 }
 
+/* Adds a response to the memory tier (the lock must be held).
+ */
+- (void) _cache: (NSCachedURLResponse*)cachedResponse forKey: (NSString*)key
+{
+  NSUInteger		size = [[cachedResponse data] length];
+  GSURLCacheEntry	*e;
+
+  e = [this->memory objectForKey: key];
+  if (e != nil)
+    {
+      this->memoryUsage -= e->size;
+      entryUnlink(e);
+      [this->memory removeObjectForKey: key];
+    }
+  if (size >= this->memoryCapacity)
+    {
+      return;
+    }
+  while (this->memoryUsage + size > this->memoryCapacity)
+    {
+      e = this->memoryList->prev;
+      this->memoryUsage -= e->size;
+      entryUnlink(e);
+      [this->memory removeObjectForKey: e->key];
+    }
+  e = [GSURLCacheEntry new];
+  e->key = [key copy];
+  e->response = RETAIN(cachedResponse);
+  e->size = size;
+  entryUsed(this->memoryList, e);
+  [this->memory setObject: e forKey: key];
+  RELEASE(e);
+  this->memoryUsage += size;
+}
+
 - (NSCachedURLResponse *) cachedResponseForRequest: (NSURLRequest *)request
 {
-  // FIXME ... handle disk cache
-  return [this->memory objectForKey: request];
+  NSString		*key = keyForRequest(request);
+  NSCachedURLResponse	*r = nil;
+  GSURLCacheEntry	*e;
+
+  if (key == nil)
+    {
+      return nil;
+    }
+  [this->lock lock];
+  NS_DURING
+    {
+      if ((e = [this->memory objectForKey: key]) != nil)
+	{
+	  entryUsed(this->memoryList, e);
+	  r = RETAIN(e->response);
+	}
+      else if ((r = [this->pending objectForKey: key]) != nil)
+	{
+	  RETAIN(r);
+	}
+      else if ((e = [this->disk objectForKey: key]) != nil)
+	{
+	  NSData	*d = [self _readFrom: e->offset length: e->size];
+
+	  if (recordValid(d, key, e->size) == YES)
+	    {
+	      const uint8_t	*b = [d bytes];
+	      RecordHeader	h;
+	      NSUInteger	k;
+	      NSUInteger	m;
+
+	      memcpy(&h, b, sizeof(h));
+	      k = NSSwapLittleIntToHost(h.keyLength);
+	      m = NSSwapLittleIntToHost(h.metaLength);
+	      r = responseFor(
+		[d subdataWithRange: NSMakeRange(sizeof(h) + k, m)],
+		[d subdataWithRange: NSMakeRange(sizeof(h) + k + m,
+		  NSSwapLittleIntToHost(h.dataLength))]);
+	    }
+	  if (r != nil)
+	    {
+	      RETAIN(r);
+	      entryUsed(this->diskList, e);
+	      [self _cache: r forKey: key];
+	    }
+	  else
+	    {
+	      /* The record is damaged ... forget it.
+	       */
+	      this->diskUsage -= e->size;
+	      entryUnlink(e);
+	      [this->disk removeObjectForKey: key];
+	    }
+	}
+    }
+  NS_HANDLER
+    {
+      [this->lock unlock];
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  [this->lock unlock];
+  return AUTORELEASE(r);
 }
 
 - (NSUInteger) currentDiskUsage
@@ -127,8 +674,39 @@ static NSURLCache	*shared = nil;
       this->diskCapacity = diskCapacity;
       this->memoryUsage = 0;
       this->memoryCapacity = memoryCapacity;
-      this->path = [path copy];
+      this->lock = [NSLock new];
+      this->lockFD = -1;
       this->memory = [NSMutableDictionary new];
+      this->memoryList = listNew();
+      this->disk = [NSMutableDictionary new];
+      this->diskList = listNew();
+      this->pending = [NSMutableDictionary new];
+      if ([path length] > 0 && diskCapacity > 0)
+	{
+	  /* A relative path is within the user's caches directory.
+	   */
+	  if ([path isAbsolutePath] == NO)
+	    {
+	      NSArray	*a;
+
+	      a = NSSearchPathForDirectoriesInDomains(NSCachesDirectory,
+		NSUserDomainMask, YES);
+	      if ([a count] == 0)
+		{
+		  path = nil;
+		}
+	      else
+		{
+		  path = [[a objectAtIndex: 0]
+		    stringByAppendingPathComponent: path];
+		}
+	    }
+	  if (path != nil)
+	    {
+	      this->path = [path copy];
+	      [self _openDisk];
+	    }
+	}
     }
   return self;
 }
@@ -140,68 +718,130 @@ static NSURLCache	*shared = nil;
 
 - (void) removeAllCachedResponses
 {
-  // FIXME ... disk storage
+  [this->lock lock];
   [this->memory removeAllObjects];
-  this->diskUsage = 0;
+  this->memoryList->next = this->memoryList->prev = this->memoryList;
   this->memoryUsage = 0;
+  [this->pending removeAllObjects];
+  [this->disk removeAllObjects];
+  this->diskList->next = this->diskList->prev = this->diskList;
+  this->diskUsage = 0;
+  [this->lock unlock];
+  if (this->writer != nil)
+    {
+      GSURLCacheJob	*j;
+
+      j = [[GSURLCacheJob alloc] initWithCache: self
+	job: [NSArray arrayWithObject: @"truncate"]];
+      [this->writer addOperation: j];
+      RELEASE(j);
+    }
 }
 
 - (void) removeCachedResponseForRequest: (NSURLRequest *)request
 {
-  NSCachedURLResponse	*item = [self cachedResponseForRequest: request];
+  NSString		*key = keyForRequest(request);
+  GSURLCacheEntry	*e;
+  BOOL			onDisk = NO;
 
-  if (item != nil)
+  if (key == nil)
     {
-      // FIXME ... disk storage
-      this->memoryUsage -= [[item data] length];
-      [this->memory removeObjectForKey: request];
+      return;
+    }
+  [this->lock lock];
+  if ((e = [this->memory objectForKey: key]) != nil)
+    {
+      this->memoryUsage -= e->size;
+      entryUnlink(e);
+      [this->memory removeObjectForKey: key];
+    }
+  if ([this->pending objectForKey: key] != nil)
+    {
+      [this->pending removeObjectForKey: key];
+      onDisk = YES;
+    }
+  if ((e = [this->disk objectForKey: key]) != nil)
+    {
+      this->diskUsage -= e->size;
+      entryUnlink(e);
+      [this->disk removeObjectForKey: key];
+      onDisk = YES;
+    }
+  [this->lock unlock];
+  if (YES == onDisk)
+    {
+      GSURLCacheJob	*j;
+
+      j = [[GSURLCacheJob alloc] initWithCache: self
+	job: [NSArray arrayWithObjects: @"remove", key, nil]];
+      [this->writer addOperation: j];
+      RELEASE(j);
     }
 }
 
 - (void) setDiskCapacity: (NSUInteger)diskCapacity
 {
-  [self notImplemented: _cmd];
-  // FIXME
+  this->diskCapacity = diskCapacity;
+  if (this->writer != nil)
+    {
+      GSURLCacheJob	*j;
+
+      /* Removing records to fit the new capacity is done by the writer.
+       */
+      j = [[GSURLCacheJob alloc] initWithCache: self
+	job: [NSArray arrayWithObject: @"trim"]];
+      [this->writer addOperation: j];
+      RELEASE(j);
+    }
 }
 
 - (void) setMemoryCapacity: (NSUInteger)memoryCapacity
 {
-  [self notImplemented: _cmd];
-  // FIXME
+  [this->lock lock];
+  this->memoryCapacity = memoryCapacity;
+  while (this->memoryUsage > this->memoryCapacity)
+    {
+      GSURLCacheEntry	*e = this->memoryList->prev;
+
+      this->memoryUsage -= e->size;
+      entryUnlink(e);
+      [this->memory removeObjectForKey: e->key];
+    }
+  [this->lock unlock];
 }
 
 - (void) storeCachedResponse: (NSCachedURLResponse *)cachedResponse
 		  forRequest: (NSURLRequest *)request
 {
+  NSString	*key = keyForRequest(request);
+
   switch ([cachedResponse storagePolicy])
     {
       case NSURLCacheStorageAllowed:
-// FIXME ... maybe on disk?
-
       case NSURLCacheStorageAllowedInMemoryOnly:
-        {
-	  unsigned		size = [[cachedResponse data] length];
-
-	  if (size < this->memoryCapacity)
-	    {
-	      NSCachedURLResponse	*old;
+	if (key == nil || mayStore(cachedResponse) == NO)
+	  {
+	    break;
+	  }
+	[this->lock lock];
+	[self _cache: cachedResponse forKey: key];
+	if ([cachedResponse storagePolicy] == NSURLCacheStorageAllowed
+	  && this->writer != nil
+	  && [[cachedResponse data] length] < this->diskCapacity)
+	  {
+	    GSURLCacheJob	*j;
 
-	      old = [this->memory objectForKey: request];
-	      if (old != nil)
-		{
-		  this->memoryUsage -= [[old data] length];
-		  [this->memory removeObjectForKey: request];
-		}
-	      while (this->memoryUsage + size > this->memoryCapacity)
-	        {
-// FIXME ... should delete least recently used.
-		  [self removeCachedResponseForRequest:
-		    [[this->memory allKeys] lastObject]];
-		}
-	      [this->memory setObject: cachedResponse forKey: request];
-	      this->memoryUsage += size;
-	    }
+	    /* The response is written to disk by the writer queue, so
+	     * this never waits for the disk.
+	     */
+	    [this->pending setObject: cachedResponse forKey: key];
+	    j = [[GSURLCacheJob alloc] initWithCache: self
+	      job: [NSArray arrayWithObjects: @"store", key, cachedResponse,
+	      nil]];
+	    [this->writer addOperation: j];
+	    RELEASE(j);
 	  }
+	[this->lock unlock];
         break;
 
       case NSURLCacheStorageNotAllowed:
@@ -216,3 +856,440 @@ static NSURLCache	*shared = nil;
 
 @end
 
+@implementation	NSURLCache (Disk)
+
+/* Replaces the file by one holding only the live records (called by the
+ * writer without the lock held).  Only the writer changes the file, so
+ * the records are copied and the new file synchronised without the
+ * lock, which is taken only to list the records and then to switch to
+ * the new file.
+ */
+- (void) _compact
+{
+  NSString		*file = [this->path stringByAppendingPathComponent:
+    @"cache.db"];
+  NSString		*tmp = [file stringByAppendingPathExtension: @"new"];
+  NSFileManager		*mgr = [NSFileManager defaultManager];
+  NSMutableArray	*entries;
+  NSFileHandle		*from;
+  NSFileHandle		*to;
+  GSURLCacheEntry	*e;
+  unsigned long long	*offsets;
+  unsigned long long	pos = 0;
+  NSUInteger		count;
+  NSUInteger		i;
+  BOOL			ok = YES;
+
+  [mgr removeFileAtPath: tmp handler: nil];
+  if ([mgr createFileAtPath: tmp contents: nil attributes: nil] == NO
+    || (to = [NSFileHandle fileHandleForWritingAtPath: tmp]) == nil)
+    {
+      return;
+    }
+  if ((from = [NSFileHandle fileHandleForReadingAtPath: file]) == nil)
+    {
+      [to closeFile];
+      [mgr removeFileAtPath: tmp handler: nil];
+      return;
+    }
+
+  /* Least recently used first, so that the order survives reopening.
+   * The old offsets are noted while the lock is held, then replaced by
+   * the new offsets (or by ~0 for a record which could not be copied).
+   */
+  entries = [NSMutableArray array];
+  [this->lock lock];
+  for (e = this->diskList->prev; e != this->diskList; e = e->prev)
+    {
+      [entries addObject: e];
+    }
+  count = [entries count];
+  offsets = malloc((count + 1) * sizeof(unsigned long long));
+  for (i = 0; i < count; i++)
+    {
+      e = [entries objectAtIndex: i];
+      offsets[i] = e->offset;
+    }
+  [this->lock unlock];
+
+  NS_DURING
+    {
+      for (i = 0; i < count; i++)
+	{
+	  NSData	*d;
+
+	  e = [entries objectAtIndex: i];
+	  [from seekToFileOffset: offsets[i]];
+	  d = [from readDataOfLength: e->size];
+	  if (recordValid(d, e->key, e->size) == NO)
+	    {
+	      offsets[i] = ~0ULL;	/* Skip a damaged record.	*/
+	      continue;
+	    }
+	  [to writeData: d];
+	  offsets[i] = pos;
+	  pos += e->size;
+	}
+      [to synchronizeFile];
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem compacting URL cache at %@: %@", this->path,
+	localException);
+      ok = NO;
+    }
+  NS_ENDHANDLER
+  [to closeFile];
+  [from closeFile];
+
+  /* The rename replaces the old file atomically, so a crash leaves either
+   * the old file or the new one.  Readers using the old file go on doing
+   * so until they are switched to the new one below.
+   */
+  if (NO == ok || rename([mgr fileSystemRepresentationWithPath: tmp],
+    [mgr fileSystemRepresentationWithPath: file]) != 0)
+    {
+      [mgr removeFileAtPath: tmp handler: nil];
+      free(offsets);
+      return;
+    }
+
+  [this->lock lock];
+  for (i = 0; i < count; i++)
+    {
+      e = [entries objectAtIndex: i];
+      if (~0ULL != offsets[i])
+	{
+	  e->offset = offsets[i];
+	}
+      else if ([this->disk objectForKey: e->key] == e)
+	{
+	  this->diskUsage -= e->size;
+	  entryUnlink(e);
+	  [this->disk removeObjectForKey: e->key];
+	}
+    }
+#ifdef	HAVE_MMAP
+  if (this->map != 0)
+    {
+      munmap(this->map, (size_t)this->mapLength);
+      this->map = 0;
+      this->mapLength = 0;
+    }
+#endif
+  DESTROY(this->input);
+  DESTROY(this->output);
+  this->output = RETAIN([NSFileHandle fileHandleForUpdatingAtPath: file]);
+  this->input = RETAIN([NSFileHandle fileHandleForReadingAtPath: file]);
+  this->fileLength = pos;
+  [this->output seekToFileOffset: pos];
+  [this->lock unlock];
+  free(offsets);
+}
+
+/* Waits until the writer has done all the work queued for it.
+ */
+- (void) _flush
+{
+  [this->writer waitUntilAllOperationsAreFinished];
+}
+
+- (void) _openDisk
+{
+  NSFileManager		*mgr = [NSFileManager defaultManager];
+  NSString		*file;
+  NSData		*d;
+  unsigned long long	valid;
+  BOOL			isDir;
+
+  if ([mgr fileExistsAtPath: this->path isDirectory: &isDir] == NO)
+    {
+      if ([mgr createDirectoryAtPath: this->path
+	 withIntermediateDirectories: YES
+			  attributes: nil
+			       error: 0] == NO)
+	{
+	  return;
+	}
+    }
+  else if (isDir == NO)
+    {
+      return;
+    }
+#if	defined(USE_FLOCK)
+  file = [this->path stringByAppendingPathComponent: @"cache.lock"];
+  this->lockFD = open([mgr fileSystemRepresentationWithPath: file],
+    O_RDWR | O_CREAT, 0600);
+  if (this->lockFD < 0 || flock(this->lockFD, LOCK_EX | LOCK_NB) < 0)
+    {
+      /* Another cache is using the directory.
+       */
+      if (this->lockFD >= 0)
+	{
+	  close(this->lockFD);
+	  this->lockFD = -1;
+	}
+      NSDebugMLLog(@"NSURLCache",
+	@"%@ in use by another cache, keeping responses in memory only",
+	this->path);
+      return;
+    }
+#endif
+  file = [this->path stringByAppendingPathComponent: @"cache.db"];
+  [mgr removeFileAtPath: [file stringByAppendingPathExtension: @"new"]
+		handler: nil];
+  if ([mgr fileExistsAtPath: file] == NO
+    && [mgr createFileAtPath: file contents: nil attributes: nil] == NO)
+    {
+      return;
+    }
+
+  d = [NSData dataWithContentsOfMappedFile: file];
+  valid = scanRecords(d, this, indexRecord);
+  this->output = RETAIN([NSFileHandle fileHandleForUpdatingAtPath: file]);
+  this->input = RETAIN([NSFileHandle fileHandleForReadingAtPath: file]);
+  if (this->output == nil || this->input == nil)
+    {
+      DESTROY(this->output);
+      DESTROY(this->input);
+      [this->disk removeAllObjects];
+      this->diskList->next = this->diskList->prev = this->diskList;
+      this->diskUsage = 0;
+      return;
+    }
+  if (valid < [d length])
+    {
+      /* Discard a partly written record left by a crash.
+       */
+      [this->output truncateFileAtOffset: valid];
+    }
+  this->fileLength = valid;
+  [this->output seekToFileOffset: valid];
+  this->writer = [NSOperationQueue new];
+  [this->writer setMaxConcurrentOperationCount: 1];
+  if (this->diskUsage > this->diskCapacity)
+    {
+      [self setDiskCapacity: this->diskCapacity];
+    }
+}
+
+/* Returns the bytes of a record (called with the lock held).
+ */
+- (NSData*) _readFrom: (unsigned long long)offset length: (NSUInteger)length
+{
+  if (offset + length > this->fileLength)
+    {
+      return nil;
+    }
+#ifdef	HAVE_MMAP
+  if (offset + length > this->mapLength)
+    {
+      void	*m;
+
+      if (this->map != 0)
+	{
+	  munmap(this->map, (size_t)this->mapLength);
+	  this->map = 0;
+	  this->mapLength = 0;
+	}
+      m = mmap(0, (size_t)this->fileLength, PROT_READ, MAP_SHARED,
+	[this->input fileDescriptor], 0);
+      if (m == MAP_FAILED)
+	{
+	  return nil;
+	}
+      this->map = m;
+      this->mapLength = this->fileLength;
+    }
+  return [NSData dataWithBytes: (const uint8_t*)this->map + offset
+			length: length];
+#else
+  [this->input seekToFileOffset: offset];
+  return [this->input readDataOfLength: length];
+#endif
+}
+
+/* Returns YES if most of the file is no longer used, so that it should
+ * be compacted (called with the lock held).
+ */
+- (BOOL) _shouldCompact
+{
+  if (this->output != nil && this->fileLength > 65536
+    && this->fileLength > 2 * this->diskUsage)
+    {
+      return YES;
+    }
+  return NO;
+}
+
+/* Removes least recently used records until the disk tier is within its
+ * capacity (called by the writer with the lock held).
+ */
+- (void) _trim
+{
+  while (this->diskUsage > this->diskCapacity)
+    {
+      GSURLCacheEntry	*e = this->diskList->prev;
+
+      [self _remove: e->key];
+    }
+}
+
+/* Appends a removal record for key and drops it from the index (called
+ * by the writer with the lock held).
+ */
+- (void) _remove: (NSString*)key
+{
+  GSURLCacheEntry	*e = [this->disk objectForKey: key];
+  NSData		*r = recordFor(RECORD_REMOVE, key, nil, nil);
+
+  if (e != nil)
+    {
+      this->diskUsage -= e->size;
+      entryUnlink(e);
+      [this->disk removeObjectForKey: key];
+    }
+  [this->output writeData: r];
+  this->fileLength += [r length];
+}
+
+- (void) _runJob: (NSArray*)job
+{
+  NSString	*kind = [job objectAtIndex: 0];
+  BOOL		compact;
+
+  if ([kind isEqualToString: @"store"])
+    {
+      [self _write: [job objectAtIndex: 2] forKey: [job objectAtIndex: 1]];
+      return;
+    }
+  [this->lock lock];
+  NS_DURING
+    {
+      if ([kind isEqualToString: @"remove"])
+	{
+	  [self _remove: [job objectAtIndex: 1]];
+	}
+      else if ([kind isEqualToString: @"truncate"])
+	{
+#ifdef	HAVE_MMAP
+	  if (this->map != 0)
+	    {
+	      munmap(this->map, (size_t)this->mapLength);
+	      this->map = 0;
+	      this->mapLength = 0;
+	    }
+#endif
+	  [this->output truncateFileAtOffset: 0];
+	  this->fileLength = 0;
+	}
+      [self _trim];
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem writing URL cache at %@: %@", this->path,
+	localException);
+    }
+  NS_ENDHANDLER
+  compact = [self _shouldCompact];
+  [this->lock unlock];
+  if (YES == compact)
+    {
+      [self _compact];
+    }
+}
+
+- (void) _write: (NSCachedURLResponse*)response forKey: (NSString*)key
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSData		*r;
+  unsigned long long	offset;
+  BOOL			compact = NO;
+
+  [this->lock lock];
+  if ([this->pending objectForKey: key] != response)
+    {
+      /* Removed or replaced since this was queued.
+       */
+      [this->lock unlock];
+      [arp release];
+      return;
+    }
+  offset = this->fileLength;
+  [this->lock unlock];
+
+  /* Only the writer appends to the file, so the (slow) part of the work
+   * is done without holding the lock.
+   */
+  r = recordFor(RECORD_STORE, key, metaFor(response), [response data]);
+  NS_DURING
+    {
+      [this->output writeData: r];
+    }
+  NS_HANDLER
+    {
+      NSLog(@"Problem writing URL cache at %@: %@", this->path,
+	localException);
+      r = nil;
+      NS_DURING
+	{
+	  [this->output truncateFileAtOffset: offset];
+	}
+      NS_HANDLER
+	{
+	}
+      NS_ENDHANDLER
+    }
+  NS_ENDHANDLER
+
+  [this->lock lock];
+  if (r != nil)
+    {
+      GSURLCacheEntry	*e = [this->disk objectForKey: key];
+
+      this->fileLength = offset + [r length];
+      if (e != nil)
+	{
+	  this->diskUsage -= e->size;
+	  entryUnlink(e);
+	  [this->disk removeObjectForKey: key];
+	}
+      if ([this->pending objectForKey: key] == response)
+	{
+	  [this->pending removeObjectForKey: key];
+	  e = [GSURLCacheEntry new];
+	  e->key = [key copy];
+	  e->offset = offset;
+	  e->size = [r length];
+	  entryUsed(this->diskList, e);
+	  [this->disk setObject: e forKey: key];
+	  RELEASE(e);
+	  this->diskUsage += [r length];
+	}
+      else if ([this->pending objectForKey: key] == nil)
+	{
+	  /* Removed while being written.
+	   */
+	  [self _remove: key];
+	}
+      NS_DURING
+	{
+	  [self _trim];
+	}
+      NS_HANDLER
+	{
+	  NSLog(@"Problem writing URL cache at %@: %@", this->path,
+	    localException);
+	}
+      NS_ENDHANDLER
+      compact = [self _shouldCompact];
+    }
+  [this->lock unlock];
+  if (YES == compact)
+    {
+      [self _compact];
+    }
+  [arp release];
+}
+
+@end
@@ -30,6 +30,7 @@
 #import "Foundation/NSHost.h"
 #import "Foundation/NSNotification.h"
 #import "Foundation/NSRunLoop.h"
+#import "Foundation/NSThread.h"
 #import "Foundation/NSValue.h"
 
 #import "GSPrivate.h"
@@ -67,37 +68,68 @@ zfree(void *opaque, void *mem)
 #endif
 #endif
 
+/* A connection (input and output stream) to an HTTP server, which is
+ * kept in a pool (keyed on the scheme, host and port, and any TLS options)
+ * to be reused for later requests to the same server.
+ */
 @interface	GSSocketStreamPair : NSObject
 {
   NSInputStream		*ip;
   NSOutputStream	*op;
-  NSHost		*host;
-  uint16_t		port;
-  NSDate		*expires;
-  BOOL			ssl;
-}
+  NSString		*key;
+  NSDate		*expires;	// When an idle pair is closed.
+  NSUInteger		outstanding;	// Requests awaiting a response.
+  NSUInteger		served;		// Responses completed.
+}
++ (void) cancelWaiter: (id)w;
++ (GSSocketStreamPair*) pairForKey: (NSString*)k
+			      host: (NSHost*)h
+			      port: (uint16_t)p
+			    waiter: (id)w
+			      wait: (BOOL*)wait;
 + (void) purge: (NSNotification*)n;
-- (void) cache: (NSDate*)when;
++ (void) stale;
++ (void) _wake: (NSString*)k;
+- (BOOL) acceptsRequest;
+- (void) checkIn: (NSTimeInterval)idle;
 - (void) close;
-- (NSDate*) expires;
-- (id) initWithHost: (NSHost*)h port: (uint16_t)p forSSL: (BOOL)s;
 - (NSInputStream*) inputStream;
 - (NSOutputStream*) outputStream;
+- (NSUInteger) served;
 @end
 
 @implementation	GSSocketStreamPair
 
-static NSMutableArray	*pairCache = nil;
-static NSLock		*pairLock = nil;
+/* All the pairs (in use or idle) for each key, and the requests waiting
+ * for a pair because a server has its maximum number of connections.
+ * NSHost objects all hash to the same value, so the URL host is used in
+ * the key rather than an NSHost.
+ */
+static NSMutableDictionary	*pairPools = nil;
+static NSMutableDictionary	*pairWaiters = nil;
+static NSLock			*pairLock = nil;
+static NSTimeInterval		pairIdleTimeout = 30.0;
+static NSUInteger		pairMaxPerHost = 6;
+
+/* The number of requests which may be outstanding on a pair at once.
+ * Requests could be pipelined by raising this, but each response must
+ * then be read by the protocol which sent the request, in order, so
+ * for now a pair is only handed out when it is idle.
+ */
+static NSUInteger		pairPipelineDepth = 1;
+
+static NSUInteger		pairHits = 0;
+static NSUInteger		pairMisses = 0;
+static NSUInteger		pairWaits = 0;
+static NSUInteger		pairExpired = 0;
+static NSUInteger		pairStale = 0;
 
 + (void) initialize
 {
-  if (pairCache == nil)
+  if (pairPools == nil)
     {
-      /* No use trying to use a dictionary ... NSHost objects all hash
-       * to the same value.
-       */
-      pairCache = [NSMutableArray new];
+      pairPools = [NSMutableDictionary new];
+      pairWaiters = [NSMutableDictionary new];
       pairLock = [NSLock new];
       /*  Purge expired pairs at intervals.
        */
@@ -107,45 +139,227 @@ static NSLock		*pairLock = nil;
     }
 }
 
-+ (void) purge: (NSNotification*)n
++ (void) cancelWaiter: (id)w
 {
-  NSDate	*now = [NSDate date];
-  unsigned	count;
+  NSEnumerator	*e;
+  NSMutableArray	*a;
 
   [pairLock lock];
-  count = [pairCache count];
-  while (count-- > 0)
+  e = [pairWaiters objectEnumerator];
+  while ((a = [e nextObject]) != nil)
     {
-      GSSocketStreamPair	*p = [pairCache objectAtIndex: count];
+      NSUInteger	count = [a count];
 
-      if ([[p expires] timeIntervalSinceDate: now] <= 0.0)
+      while (count-- > 0)
 	{
-	  [pairCache removeObjectAtIndex: count];
+	  if ([[a objectAtIndex: count] objectAtIndex: 0] == w)
+	    {
+	      [a removeObjectAtIndex: count];
+	    }
 	}
     }
   [pairLock unlock];
 }
 
-- (void) cache: (NSDate*)when
+/* Tell the requests waiting for a pair for the key that one may be free.
+ * Each is told on its own thread (where its streams are scheduled) and
+ * queues again if another request took the pair first.
+ * Must be called with pairLock locked.
+ */
++ (void) _wake: (NSString*)k
 {
-  NSTimeInterval	ti = [when timeIntervalSinceNow];
+  NSMutableArray	*a = [pairWaiters objectForKey: k];
+  NSUInteger		count = [a count];
+  NSUInteger		i;
 
-  if (ti <= 0.0)
+  if (count > 0)
     {
-      [self close];
-      return;
+      NSArray	*waiting = [a copy];
+
+      [a removeAllObjects];
+      for (i = 0; i < count; i++)
+	{
+	  NSArray	*w = [waiting objectAtIndex: i];
+
+	  [[w objectAtIndex: 0] performSelector: @selector(_poolAvailable)
+				       onThread: [w objectAtIndex: 1]
+				     withObject: nil
+				  waitUntilDone: NO];
+	}
+      [waiting release];
     }
-  NSAssert(ip != nil, NSGenericException);
-  if (ti > 120.0)
+}
+
+/* Returns an idle pair for the key if there is one, otherwise a new
+ * (unopened) pair if the server does not yet have its maximum number of
+ * connections.  Otherwise the waiter is queued to be sent -_poolAvailable
+ * when a pair is free, and nil is returned with *wait set to YES.
+ */
++ (GSSocketStreamPair*) pairForKey: (NSString*)k
+			      host: (NSHost*)h
+			      port: (uint16_t)p
+			    waiter: (id)w
+			      wait: (BOOL*)wait
+{
+  GSSocketStreamPair	*pair = nil;
+  NSMutableArray	*pool;
+  NSDate		*now = [NSDate date];
+  NSUInteger		count;
+
+  *wait = NO;
+  [pairLock lock];
+  pool = [pairPools objectForKey: k];
+  if (nil == pool)
+    {
+      pool = [NSMutableArray new];
+      [pairPools setObject: pool forKey: k];
+      [pool release];
+    }
+  count = [pool count];
+  while (count-- > 0)
     {
-      ASSIGN(expires, [NSDate dateWithTimeIntervalSinceNow: 120.0]);
+      GSSocketStreamPair	*tmp = [pool objectAtIndex: count];
+
+      if (tmp->expires != nil
+	&& [tmp->expires timeIntervalSinceDate: now] <= 0.0)
+	{
+	  [tmp close];
+	  [pool removeObjectAtIndex: count];
+	  pairExpired++;
+	}
+      else if (nil == pair && [tmp acceptsRequest] == YES)
+	{
+	  pair = tmp;
+	}
+    }
+  if (nil != pair)
+    {
+      DESTROY(pair->expires);
+      pair->outstanding++;
+      pairHits++;
+      [pair retain];
+    }
+  else if ([pool count] < pairMaxPerHost)
+    {
+      NSInputStream	*i = nil;
+      NSOutputStream	*o = nil;
+
+      [NSStream getStreamsToHost: h
+			    port: p
+		     inputStream: &i
+		    outputStream: &o];
+      if (i != nil && o != nil)
+	{
+	  pair = [self new];
+	  pair->ip = [i retain];
+	  pair->op = [o retain];
+	  pair->key = [k copy];
+	  pair->outstanding = 1;
+	  [pool addObject: pair];
+	  pairMisses++;
+	}
     }
   else
-    { 
-      ASSIGN(expires, when);
+    {
+      NSMutableArray	*a = [pairWaiters objectForKey: k];
+
+      if (nil == a)
+	{
+	  a = [NSMutableArray new];
+	  [pairWaiters setObject: a forKey: k];
+	  [a release];
+	}
+      [a addObject: [NSArray arrayWithObjects:
+	w, [NSThread currentThread], nil]];
+      pairWaits++;
+      *wait = YES;
+    }
+  [pairLock unlock];
+  return AUTORELEASE(pair);
+}
+
++ (void) purge: (NSNotification*)n
+{
+  NSDate		*now = [NSDate date];
+  NSEnumerator		*e;
+  NSString		*k;
+
+  [pairLock lock];
+  e = [[pairPools allKeys] objectEnumerator];
+  while ((k = [e nextObject]) != nil)
+    {
+      NSMutableArray	*pool = [pairPools objectForKey: k];
+      NSUInteger	count = [pool count];
+
+      while (count-- > 0)
+	{
+	  GSSocketStreamPair	*p = [pool objectAtIndex: count];
+
+	  if (p->expires != nil && [p->expires timeIntervalSinceDate: now] <= 0.0)
+	    {
+	      [p close];
+	      [pool removeObjectAtIndex: count];
+	      pairExpired++;
+	      [self _wake: k];
+	    }
+	}
+      if ([pool count] == 0 && [[pairWaiters objectForKey: k] count] == 0)
+	{
+	  [pairPools removeObjectForKey: k];
+	  [pairWaiters removeObjectForKey: k];
+	}
     }
+  [pairLock unlock];
+}
+
++ (void) stale
+{
   [pairLock lock];
-  [pairCache addObject: self];
+  pairStale++;
+  [pairLock unlock];
+}
+
+- (BOOL) acceptsRequest
+{
+  return (outstanding < pairPipelineDepth && ip != nil) ? YES : NO;
+}
+
+/* Called when a request has finished with the pair.  If idle is greater
+ * than zero (the response was completely read and the server will keep
+ * the connection open) the pair may be reused for that many seconds,
+ * otherwise it is closed.
+ */
+- (void) checkIn: (NSTimeInterval)idle
+{
+  NSStreamStatus	s = [ip streamStatus];
+
+  [ip setDelegate: nil];
+  [op setDelegate: nil];
+  [pairLock lock];
+  if (outstanding > 0)
+    {
+      outstanding--;
+    }
+  if (idle > pairIdleTimeout)
+    {
+      idle = pairIdleTimeout;
+    }
+  if (idle > 0.0 && ip != nil
+    && s != NSStreamStatusAtEnd && s != NSStreamStatusError
+    && s != NSStreamStatusClosed)
+    {
+      served++;
+      if (0 == outstanding)
+	{
+	  ASSIGN(expires, [NSDate dateWithTimeIntervalSinceNow: idle]);
+	}
+    }
+  else
+    {
+      [self close];
+      [[pairPools objectForKey: key] removeObjectIdenticalTo: self];
+    }
+  [GSSocketStreamPair _wake: key];
   [pairLock unlock];
 }
 
@@ -166,78 +380,11 @@ static NSLock		*pairLock = nil;
 - (void) dealloc
 {
   [self close];
-  DESTROY(host);
+  DESTROY(key);
   DESTROY(expires);
   [super dealloc];
 }
 
-- (NSDate*) expires
-{
-  return expires;
-}
-
-- (id) init
-{
-  DESTROY(self);
-  return nil;
-}
-
-- (id) initWithHost: (NSHost*)h port: (uint16_t)p forSSL: (BOOL)s;
-{
-  unsigned		count;
-  NSDate		*now;
-
-  now = [NSDate date];
-  [pairLock lock];
-  count = [pairCache count];
-  while (count-- > 0)
-    {
-      GSSocketStreamPair	*pair = [pairCache objectAtIndex: count];
-
-      if ([pair->expires timeIntervalSinceDate: now] <= 0.0)
-	{
-	  [pairCache removeObjectAtIndex: count];
-	}
-      else if (pair->port == p && pair->ssl == s && [pair->host isEqual: h])
-	{
-	  /* Found a match ... remove from cache and return as self.
-	   */
-	  DESTROY(self);
-	  self = [pair retain];
-	  [pairCache removeObjectAtIndex: count];
-	  [pairLock unlock];
-	  return self;
-	}
-    }
-  [pairLock unlock];
-
-  if ((self = [super init]) != nil)
-    {
-      [NSStream getStreamsToHost: host
-			    port: port
-		     inputStream: &ip
-		    outputStream: &op];
-      if (ip == nil || op == nil)
-	{
-	  DESTROY(self);
-	  return nil;
-	}
-      ssl = s;
-      port = p;
-      host = [h retain];
-      [ip retain];
-      [op retain];
-      if (ssl == YES)
-        {
-          [ip setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
-		   forKey: NSStreamSocketSecurityLevelKey];
-          [op setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
-		   forKey: NSStreamSocketSecurityLevelKey];
-        }
-    }
-  return self;
-}
-
 - (NSInputStream*) inputStream
 {
   return ip;
@@ -248,6 +395,11 @@ static NSLock		*pairLock = nil;
   return op;
 }
 
+- (NSUInteger) served
+{
+  return served;
+}
+
 @end
 
 @interface _NSAboutURLProtocol : NSURLProtocol
@@ -269,15 +421,22 @@ static NSLock		*pairLock = nil;
   NSInputStream		*_body;		// for sending the body
   unsigned		_writeOffset;	// Request data to write
   NSData		*_writeData;	// Request bytes written so far
+  GSSocketStreamPair	*_pair;		// Pooled connection in use
   BOOL			_complete;
   BOOL			_debug;
   BOOL			_isLoading;
   BOOL			_shouldClose;
+  BOOL			_reused;	// Connection used before.
+  BOOL			_waiting;	// Waiting for a connection.
   NSURLAuthenticationChallenge	*_challenge;
   NSURLCredential		*_credential;
   NSHTTPURLResponse		*_response;
 }
 - (void) setDebug: (BOOL)flag;
+- (void) _connect;
+- (void) _disconnect: (NSTimeInterval)idle;
+- (void) _poolAvailable;
+- (BOOL) _retryStale;
 @end
 
 @interface _NSHTTPSURLProtocol : _NSHTTPURLProtocol
@@ -584,6 +743,78 @@ static NSURLProtocol	*placeholder = nil;
 
 @end
 
+@implementation	NSURLProtocol (GSConnectionPool)
+
++ (NSDictionary*) connectionPoolStatistics
+{
+  NSDictionary	*d;
+  NSEnumerator	*e;
+  NSArray	*pool;
+  NSUInteger	idle = 0;
+  NSUInteger	active = 0;
+
+  [GSSocketStreamPair class];	// Ensure pool is initialised.
+  [pairLock lock];
+  e = [pairPools objectEnumerator];
+  while ((pool = [e nextObject]) != nil)
+    {
+      NSUInteger	count = [pool count];
+
+      while (count-- > 0)
+	{
+	  GSSocketStreamPair	*p = [pool objectAtIndex: count];
+
+	  if (YES == [p acceptsRequest])
+	    {
+	      idle++;
+	    }
+	  else
+	    {
+	      active++;
+	    }
+	}
+    }
+  d = [NSDictionary dictionaryWithObjectsAndKeys:
+    [NSNumber numberWithUnsignedInteger: pairHits], @"hits",
+    [NSNumber numberWithUnsignedInteger: pairMisses], @"misses",
+    [NSNumber numberWithUnsignedInteger: pairWaits], @"waits",
+    [NSNumber numberWithUnsignedInteger: pairExpired], @"expired",
+    [NSNumber numberWithUnsignedInteger: pairStale], @"stale",
+    [NSNumber numberWithUnsignedInteger: idle], @"idle",
+    [NSNumber numberWithUnsignedInteger: active], @"active",
+    nil];
+  [pairLock unlock];
+  return d;
+}
+
++ (void) setConnectionPoolIdleTimeout: (NSTimeInterval)seconds
+{
+  [GSSocketStreamPair class];
+  [pairLock lock];
+  pairIdleTimeout = (seconds > 0.0) ? seconds : 0.0;
+  [pairLock unlock];
+}
+
++ (void) setConnectionPoolMaximumPerHost: (NSUInteger)max
+{
+  [GSSocketStreamPair class];
+  [pairLock lock];
+  if (max > pairMaxPerHost)
+    {
+      NSEnumerator	*e = [[pairWaiters allKeys] objectEnumerator];
+      NSString		*k;
+
+      while ((k = [e nextObject]) != nil)
+	{
+	  [GSSocketStreamPair _wake: k];
+	}
+    }
+  pairMaxPerHost = (max > 0) ? max : 1;
+  [pairLock unlock];
+}
+
+@end
+
 
 
 
@@ -620,6 +851,13 @@ static NSURLProtocol	*placeholder = nil;
 
 - (void) dealloc
 {
+  /* Check any pooled connection back in (and stop waiting for one) so
+   * that it is not left counted against the limit for its host.
+   */
+  if (this != 0)
+    {
+      [self _disconnect: 0.0];
+    }
   [_parser release];			// received headers
   [_body release];			// for sending the body
   [_response release];
@@ -724,7 +962,7 @@ static NSURLProtocol	*placeholder = nil;
         {
 	  return;	// Loading cancelled
 	}
-      if (nil != this->input)
+      if (nil != this->input || YES == _waiting)
 	{
 	  return;	// Following redirection
 	}
@@ -736,107 +974,184 @@ static NSURLProtocol	*placeholder = nil;
     }
   else
     {
-      NSURL	*url = [this->request URL];
-      NSHost	*host = [NSHost hostWithName: [url host]];
-      int	port = [[url port] intValue];
+      [self _connect];
+    }
+}
 
-      _parseOffset = 0;
-      DESTROY(_parser);
+- (void) stopLoading
+{
+  if (_debug == YES)
+    {
+      NSLog(@"%@ stopLoading", self);
+    }
+  _isLoading = NO;
+  DESTROY(_writeData);
+  [self _disconnect: 0.0];
+}
 
-      if (host == nil)
-        {
-	  host = [NSHost hostWithAddress: [url host]];	// try dotted notation
+/* Get a connection to the server (reusing a pooled one if possible)
+ * and start sending the request on it.
+ */
+- (void) _connect
+{
+  static NSArray	*keys = nil;
+  NSURL			*url = [this->request URL];
+  NSHost		*host = [NSHost hostWithName: [url host]];
+  int			port = [[url port] intValue];
+  NSMutableString	*key;
+  NSMutableDictionary	*tls = nil;
+  BOOL			wait;
+
+  _parseOffset = 0;
+  DESTROY(_parser);
+
+  if (host == nil)
+    {
+      host = [NSHost hostWithAddress: [url host]];	// try dotted notation
+    }
+  if (host == nil)
+    {
+      host = [NSHost hostWithAddress: @"127.0.0.1"];	// final default
+    }
+  if (port == 0)
+    {
+      // default if not specified
+      port = [[url scheme] isEqualToString: @"https"] ? 443 : 80;
+    }
+
+  key = [NSMutableString stringWithFormat: @"%@://%@:%d",
+    [url scheme], [url host], port];
+  if ([[url scheme] isEqualToString: @"https"] == YES)
+    {
+      NSUInteger	count;
+
+      if (nil == keys)
+	{
+	  keys = [[NSArray alloc] initWithObjects:
+	    GSTLSCAFile,
+	    GSTLSCertificateFile,
+	    GSTLSCertificateKeyFile,
+	    GSTLSCertificateKeyPassword,
+	    GSTLSDebug,
+	    GSTLSPriority,
+	    GSTLSRemoteHosts,
+	    GSTLSRevokeFile,
+	    GSTLSVerify,
+	    nil];
 	}
-      if (host == nil)
-        {
-	  host = [NSHost hostWithAddress: @"127.0.0.1"];	// final default
+      tls = [NSMutableDictionary dictionaryWithCapacity: [keys count]];
+      count = [keys count];
+      while (count-- > 0)
+	{
+	  NSString      *k = [keys objectAtIndex: count];
+	  NSString      *str = [this->request _propertyForKey: k];
+
+	  if (nil != str)
+	    {
+	      [tls setObject: str forKey: k];
+	    }
 	}
-      if (port == 0)
-        {
-	  // default if not specified
-	  port = [[url scheme] isEqualToString: @"https"] ? 443 : 80;
+      if (_debug) [tls setObject: @"YES" forKey: GSTLSDebug];
+      /* A connection is only shared by requests with the same TLS options.
+       */
+      if ([tls count] > 0)
+	{
+	  [key appendFormat: @" %@", tls];
 	}
+    }
 
-      [NSStream getStreamsToHost: host
-			    port: port
-		     inputStream: &this->input
-		    outputStream: &this->output];
-      if (!this->input || !this->output)
+  _pair = RETAIN([GSSocketStreamPair pairForKey: key
+					   host: host
+					   port: port
+					 waiter: self
+					   wait: &wait]);
+  if (nil == _pair)
+    {
+      if (YES == wait)
 	{
 	  if (_debug == YES)
 	    {
-	      NSLog(@"%@ did not create streams for %@:%@",
-		self, host, [url port]);
+	      NSLog(@"%@ waiting for a connection to %@", self, key);
 	    }
-	  [self stopLoading];
-	  [this->client URLProtocol: self didFailWithError:
-	    [NSError errorWithDomain: @"can't connect" code: 0 userInfo: 
-	      [NSDictionary dictionaryWithObjectsAndKeys: 
-		url, @"NSErrorFailingURLKey",
-		host, @"NSErrorFailingURLStringKey",
-		@"can't find host", @"NSLocalizedDescription",
-		nil]]];
+	  _waiting = YES;
 	  return;
 	}
-#if	!GS_WITH_GC
-      [this->input retain];
-      [this->output retain];
-#endif
-      if ([[url scheme] isEqualToString: @"https"] == YES)
-        {
-          static NSArray        *keys;
-          NSUInteger            count;
-
-          [this->input setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
-                            forKey: NSStreamSocketSecurityLevelKey];
-          [this->output setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
-                             forKey: NSStreamSocketSecurityLevelKey];
-          if (nil == keys)
-            {
-              keys = [[NSArray alloc] initWithObjects:
-                GSTLSCAFile,
-                GSTLSCertificateFile,
-                GSTLSCertificateKeyFile,
-                GSTLSCertificateKeyPassword,
-                GSTLSDebug,
-                GSTLSPriority,
-                GSTLSRemoteHosts,
-                GSTLSRevokeFile,
-                GSTLSVerify,
-                nil];
-            }
-          count = [keys count];
-          while (count-- > 0)
-            {
-              NSString      *key = [keys objectAtIndex: count];
-              NSString      *str = [this->request _propertyForKey: key];
-
-              if (nil != str)
-                {
-                  [this->output setProperty: str forKey: key];
-                }
-            }
-          if (_debug) [this->output setProperty: @"YES" forKey: GSTLSDebug];
-        }
-      [this->input setDelegate: self];
-      [this->output setDelegate: self];
-      [this->input scheduleInRunLoop: [NSRunLoop currentRunLoop]
-			     forMode: NSDefaultRunLoopMode];
-      [this->output scheduleInRunLoop: [NSRunLoop currentRunLoop]
-			      forMode: NSDefaultRunLoopMode];
+      if (_debug == YES)
+	{
+	  NSLog(@"%@ did not create streams for %@:%@",
+	    self, host, [url port]);
+	}
+      [self stopLoading];
+      [this->client URLProtocol: self didFailWithError:
+	[NSError errorWithDomain: @"can't connect" code: 0 userInfo: 
+	  [NSDictionary dictionaryWithObjectsAndKeys: 
+	    url, @"NSErrorFailingURLKey",
+	    host, @"NSErrorFailingURLStringKey",
+	    @"can't find host", @"NSLocalizedDescription",
+	    nil]]];
+      return;
+    }
+  this->input = RETAIN([_pair inputStream]);
+  this->output = RETAIN([_pair outputStream]);
+  _reused = ([_pair served] > 0) ? YES : NO;
+  if (NO == _reused && nil != tls)
+    {
+      NSEnumerator	*e = [tls keyEnumerator];
+      NSString		*k;
+
+      [this->input setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
+			forKey: NSStreamSocketSecurityLevelKey];
+      [this->output setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
+			 forKey: NSStreamSocketSecurityLevelKey];
+      while ((k = [e nextObject]) != nil)
+	{
+	  [this->output setProperty: [tls objectForKey: k] forKey: k];
+	}
+      /* Identify the server by name rather than by address, so that a
+       * TLS session with it may be resumed whichever of its addresses
+       * we connect to.
+       */
+      [this->output setProperty: [NSString stringWithFormat: @"%@:%d",
+	[url host], port] forKey: GSTLSServerAddress];
+    }
+  [this->input setDelegate: self];
+  [this->output setDelegate: self];
+  [this->input scheduleInRunLoop: [NSRunLoop currentRunLoop]
+			 forMode: NSDefaultRunLoopMode];
+  [this->output scheduleInRunLoop: [NSRunLoop currentRunLoop]
+			  forMode: NSDefaultRunLoopMode];
+  if (YES == _reused)
+    {
+      if (_debug == YES)
+	{
+	  NSLog(@"%@ reusing connection to %@", self, key);
+	}
+      /* The streams are already open, so we can send the request now.
+       */
+      [self stream: this->output handleEvent: NSStreamEventOpenCompleted];
+    }
+  else
+    {
       [this->input open];
       [this->output open];
     }
 }
 
-- (void) stopLoading
+- (void) _didLoad: (NSData*)d
 {
-  if (_debug == YES)
+  [this->client URLProtocol: self didLoadData: d];
+}
+
+/* Stop using the connection, leaving it in the pool to be reused for up
+ * to idle seconds, or closing it if idle is not greater than zero.
+ */
+- (void) _disconnect: (NSTimeInterval)idle
+{
+  if (YES == _waiting)
     {
-      NSLog(@"%@ stopLoading", self);
+      _waiting = NO;
+      [GSSocketStreamPair cancelWaiter: self];
     }
-  _isLoading = NO;
-  DESTROY(_writeData);
   if (this->input != nil)
     {
       [this->input setDelegate: nil];
@@ -845,16 +1160,19 @@ static NSURLProtocol	*placeholder = nil;
 			     forMode: NSDefaultRunLoopMode];
       [this->output removeFromRunLoop: [NSRunLoop currentRunLoop]
 			      forMode: NSDefaultRunLoopMode];
-      [this->input close];
-      [this->output close];
+      if (idle <= 0.0)
+	{
+	  [this->input close];
+	  [this->output close];
+	}
       DESTROY(this->input);
       DESTROY(this->output);
     }
-}
-
-- (void) _didLoad: (NSData*)d
-{
-  [this->client URLProtocol: self didLoadData: d];
+  if (_pair != nil)
+    {
+      [_pair checkIn: idle];
+      DESTROY(_pair);
+    }
 }
 
 - (void) _got: (NSStream*)stream
@@ -867,6 +1185,12 @@ static NSURLProtocol	*placeholder = nil;
 
   readCount = [(NSInputStream *)stream read: buffer
 				  maxLength: sizeof(buffer)];
+  if ((0 == readCount
+    || (readCount < 0 && [stream streamStatus] == NSStreamStatusError))
+    && YES == [self _retryStale])
+    {
+      return;
+    }
   if (readCount < 0)
     {
       if ([stream  streamStatus] == NSStreamStatusError)
@@ -1253,18 +1577,34 @@ static NSURLProtocol	*placeholder = nil;
 		}
 	    }
 
-	  [this->input removeFromRunLoop: [NSRunLoop currentRunLoop]
-				 forMode: NSDefaultRunLoopMode];
-	  [this->output removeFromRunLoop: [NSRunLoop currentRunLoop]
-				  forMode: NSDefaultRunLoopMode];
-	  if (_shouldClose == YES)
+	  /* The connection may only be reused if the whole request was
+	   * sent, the whole response read, and the server keeps it open.
+	   */
+	  if (_shouldClose == YES || readCount == 0
+	    || _writeData != nil || _body != nil || [_parser excess] != nil)
 	    {
-	      [this->input setDelegate: nil];
-	      [this->output setDelegate: nil];
-	      [this->input close];
-	      [this->output close];
-	      DESTROY(this->input);
-	      DESTROY(this->output);
+	      [self _disconnect: 0.0];
+	    }
+	  else
+	    {
+	      NSTimeInterval	idle = 3600.0;	// Limited by the pool
+	      NSString		*ka;
+	      NSRange		r;
+
+	      ka = [[document headerNamed: @"keep-alive"] value];
+	      if (nil != ka)
+		{
+		  r = [ka rangeOfString: @"timeout="
+				options: NSCaseInsensitiveSearch];
+		  if (r.length > 0)
+		    {
+		      /* Allow a second for the server closing it early.
+		       */
+		      idle = [[ka substringFromIndex: NSMaxRange(r)] intValue]
+			- 1;
+		    }
+		}
+	      [self _disconnect: idle];
 	    }
 
 	  /*
@@ -1338,6 +1678,44 @@ static NSURLProtocol	*placeholder = nil;
     }
 }
 
+- (void) _poolAvailable
+{
+  if (YES == _waiting)
+    {
+      _waiting = NO;
+      if (YES == _isLoading)
+	{
+	  [self _connect];
+	}
+    }
+}
+
+/* A pooled connection may have been closed by the server while it was
+ * idle, in which case using it fails before any of the response arrives.
+ * If so (and the request body can be sent again) the request is retried
+ * on another connection.  Returns YES if the request was retried.
+ */
+- (BOOL) _retryStale
+{
+  if (NO == _reused || nil != _parser || YES == _complete
+    || NO == _isLoading || [this->request HTTPBodyStream] != nil)
+    {
+      return NO;
+    }
+  if (_debug == YES)
+    {
+      NSLog(@"%@ reused connection was closed ... retrying", self);
+    }
+  [GSSocketStreamPair stale];
+  [self _disconnect: 0.0];
+  DESTROY(_writeData);
+  [_body close];
+  DESTROY(_body);
+  _writeOffset = 0;
+  [self _connect];
+  return YES;
+}
+
 - (void) stream: (NSStream*) stream handleEvent: (NSStreamEvent) event
 {
   /* Make sure no action triggered by anything else destroys us prematurely.
@@ -1622,6 +2000,10 @@ static NSURLProtocol	*placeholder = nil;
     {
       NSError	*error = [[[stream streamError] retain] autorelease];
 
+      if (YES == [self _retryStale])
+	{
+	  return;
+	}
       [self stopLoading];
       [this->client URLProtocol: self didFailWithError: error];
     }
@@ -31,6 +31,7 @@
 #define	EXPOSE_NSUserDefaults_IVARS	1
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #import "Foundation/NSUserDefaults.h"
 #import "Foundation/NSArchiver.h"
@@ -103,6 +104,255 @@ static BOOL		hasSharedDefaults = NO;
  */
 static BOOL	flags[GSUserDefaultMaxFlag] = { 0 };
 
+/*
+ *	Setup for inline operation of the index of a snapshot, mapping keys
+ *	(retained) to values.
+ */
+#define	GSI_MAP_KTYPES	GSUNION_OBJ
+#define	GSI_MAP_VTYPES	GSUNION_PTR
+#define	GSI_MAP_RETAIN_VAL(M, X)
+#define	GSI_MAP_RELEASE_VAL(M, X)
+
+#include "GNUstepBase/GSIMap.h"
+
+/* Lookups are made in a snapshot of the merged contents of the domains
+ * in the search list.  A snapshot is built (with the instance locked)
+ * when first needed after a change, and is never modified, so it is read
+ * without locking.
+ * A replaced snapshot may still be in use by a reader, so it is kept on
+ * the retired list until no reader which could be using it is active
+ * (see snapshotReclaim() below).
+ */
+typedef struct {
+  BOOL		boolValue;
+  NSInteger	integerValue;
+  double	doubleValue;
+  float		floatValue;
+} GSDefaultsScalars;
+
+typedef struct {
+  id			object;
+  GSDefaultsScalars	*scalars;	/* Set when first needed.	*/
+} GSDefaultsValue;
+
+@interface	GSDefaultsSnapshot : NSDictionary
+{
+@public
+  GSDefaultsSnapshot	*retired;	/* Next on the retired list.	*/
+  GSIMapTable_t		map;		/* Key to value.		*/
+  GSDefaultsValue	*values;
+  NSArray		*keys;
+}
+@end
+
+/* Readers of snapshots are counted in one of two epochs, each split into
+ * shards (chosen by thread) in separate cache lines so that readers on
+ * different cores rarely touch the same counter.  A retired snapshot is
+ * put on the retired list; the list is later taken as the waiting list
+ * and the epoch switched, after which no new reader is counted in the
+ * old epoch, so the waiting snapshots are freed once the old epoch has
+ * no readers.  This happens in whichever of snapshotRetire() and
+ * snapshotLeave() finds the old epoch empty, so writers never wait and
+ * retired snapshots are freed even if readers are always active.
+ */
+#define	SNAPSHOT_SHARD_BITS	4
+#define	SNAPSHOT_SHARDS		(1 << SNAPSHOT_SHARD_BITS)
+typedef struct {
+  volatile int	count;		/* Number of active readers.	*/
+  char		pad[60];	/* Keep shards in separate cache lines. */
+} GSDefaultsReaders;
+
+static GSDefaultsSnapshot	*retiredSnapshots = nil;
+static GSDefaultsSnapshot	*waitingSnapshots = nil;
+static volatile unsigned	snapshotEpoch = 0;
+static GSDefaultsReaders	snapshotReaders[2][SNAPSHOT_SHARDS];
+static pthread_mutex_t		snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static GSDefaultsScalars	noScalars = { 0 };
+
+/* The shared instance while it is being set up, during which time its
+ * snapshots are not kept, so other threads wait (on the lock) for the
+ * setup to be completed.
+ */
+static NSUserDefaults		*settingUp = nil;
+
+static BOOL
+snapshotQuiet(unsigned epoch)
+{
+  unsigned	i;
+
+  for (i = 0; i < SNAPSHOT_SHARDS; i++)
+    {
+      if (snapshotReaders[epoch][i].count != 0)
+	{
+	  return NO;
+	}
+    }
+  __sync_synchronize();
+  return YES;
+}
+
+static void
+snapshotFree(GSDefaultsSnapshot *list)
+{
+  while (list != nil)
+    {
+      GSDefaultsSnapshot	*s = list;
+
+      list = s->retired;
+      RELEASE(s);
+    }
+}
+
+/* Frees the waiting snapshots if no reader can be using them, then makes
+ * the retired snapshots wait for the readers of the current epoch.  If
+ * another thread is doing this already, it is left to that thread.
+ */
+static void
+snapshotReclaim(void)
+{
+  GSDefaultsSnapshot	*list = nil;
+
+  if (pthread_mutex_trylock(&snapshotLock) != 0)
+    {
+      return;
+    }
+  if (waitingSnapshots != nil && YES == snapshotQuiet(snapshotEpoch ^ 1))
+    {
+      list = waitingSnapshots;
+      waitingSnapshots = nil;
+    }
+  if (nil == waitingSnapshots && retiredSnapshots != nil)
+    {
+      /* A reader which started after a snapshot was retired can't be
+       * using it, so only those counted in the epoch before the switch
+       * need to finish.
+       */
+      waitingSnapshots = __sync_lock_test_and_set(&retiredSnapshots, nil);
+      __sync_synchronize();
+      snapshotEpoch ^= 1;
+      __sync_synchronize();
+      if (YES == snapshotQuiet(snapshotEpoch ^ 1))
+	{
+	  GSDefaultsSnapshot	*w = waitingSnapshots;
+
+	  while (w->retired != nil)
+	    {
+	      w = w->retired;
+	    }
+	  w->retired = list;
+	  list = waitingSnapshots;
+	  waitingSnapshots = nil;
+	}
+    }
+  pthread_mutex_unlock(&snapshotLock);
+  snapshotFree(list);
+}
+
+/* Starts reading a snapshot.  Returns the reader counter to be passed to
+ * snapshotLeave().
+ */
+static inline volatile int *
+snapshotEnter(void)
+{
+  unsigned	shard;
+
+  shard = ((unsigned)((uintptr_t)pthread_self() >> 4) * 2654435761U)
+    >> (32 - SNAPSHOT_SHARD_BITS);
+  for (;;)
+    {
+      unsigned		epoch = snapshotEpoch;
+      volatile int	*counter = &snapshotReaders[epoch][shard].count;
+
+      __sync_fetch_and_add(counter, 1);
+      /* If the epoch changed before we were counted, the snapshots we
+       * find may be freed without waiting for us, so try again.
+       */
+      if (snapshotEpoch == epoch)
+	{
+	  return counter;
+	}
+      __sync_fetch_and_sub(counter, 1);
+    }
+}
+
+static inline void
+snapshotLeave(volatile int *counter)
+{
+  if (__sync_sub_and_fetch(counter, 1) == 0
+    && (waitingSnapshots != nil || retiredSnapshots != nil))
+    {
+      snapshotReclaim();
+    }
+}
+
+/* Adds a snapshot which is no longer the current one to the retired list
+ * then frees whatever retired snapshots no reader can be using.
+ */
+static void
+snapshotRetire(GSDefaultsSnapshot *s)
+{
+  if (s != nil)
+    {
+      do
+	{
+	  s->retired = retiredSnapshots;
+	}
+      while (NO == __sync_bool_compare_and_swap(&retiredSnapshots,
+	s->retired, s));
+    }
+  snapshotReclaim();
+}
+
+/* Returns the scalar values for a default, working them out if this is
+ * the first time they are needed.  Readers racing to do this all get the
+ * same result, so the first to store it wins.
+ */
+static GSDefaultsScalars *
+snapshotScalars(GSDefaultsValue *v)
+{
+  GSDefaultsScalars	*sv = v->scalars;
+
+  if (0 == sv)
+    {
+      id	o = v->object;
+
+      if ([o isKindOfClass: NSStringClass] || [o isKindOfClass: NSNumberClass])
+	{
+	  sv = NSZoneMalloc(NSDefaultMallocZone(), sizeof(GSDefaultsScalars));
+	  sv->boolValue = [o boolValue];
+	  sv->integerValue = [o integerValue];
+	  sv->doubleValue = [o doubleValue];
+	  sv->floatValue = [o floatValue];
+	}
+      else
+	{
+	  sv = &noScalars;
+	}
+      if (NO == __sync_bool_compare_and_swap(&v->scalars, 0, sv))
+	{
+	  if (sv != &noScalars)
+	    {
+	      NSZoneFree(NSDefaultMallocZone(), sv);
+	    }
+	  sv = v->scalars;
+	}
+    }
+  return sv;
+}
+
+static inline GSDefaultsValue *
+snapshotValue(GSDefaultsSnapshot *s, NSString *key)
+{
+  GSIMapNode	node;
+
+  if (nil == key)
+    {
+      return 0;
+    }
+  node = GSIMapNodeForKey(&s->map, (GSIMapKey)key);
+  return (0 == node) ? 0 : (GSDefaultsValue*)node->value.ptr;
+}
+
 /* An instance of the GSPersistentDomain class is used to encapsulate
  * a single persistent domain (represented as a property list file in
  * the defaults directory.
@@ -434,6 +684,8 @@ newLanguages(NSArray *oldNames)
 - (BOOL) _readDefaults;
 - (BOOL) _readOnly;
 - (void) _unlockDefaultsFile;
+- (void) _discardSnapshot;
+- (GSDefaultsSnapshot*) _snapshot: (volatile int**)reader;
 @end
 
 /**
@@ -539,6 +791,27 @@ newLanguages(NSArray *oldNames)
  *   that it is thread-safe while Apple's (as of MacOS-X 10.1) is not.
  * </p>
  */
+static GSDefaultsSnapshot *
+snapshotNew(NSDictionary *merged)
+{
+  GSDefaultsSnapshot	*s = [GSDefaultsSnapshot new];
+  NSUInteger		count = [merged count];
+  NSUInteger		i;
+
+  s->keys = [[merged allKeys] retain];
+  s->values = NSZoneCalloc(NSDefaultMallocZone(),
+    (count > 0 ? count : 1), sizeof(GSDefaultsValue));
+  GSIMapInitWithZoneAndCapacity(&s->map, NSDefaultMallocZone(), count);
+  for (i = 0; i < count; i++)
+    {
+      NSString	*key = [s->keys objectAtIndex: i];
+
+      s->values[i].object = RETAIN([merged objectForKey: key]);
+      GSIMapAddPair(&s->map, (GSIMapKey)key, (GSIMapVal)(void*)&s->values[i]);
+    }
+  return s;
+}
+
 @implementation NSUserDefaults: NSObject
 
 + (void) atExit
@@ -617,6 +890,7 @@ newLanguages(NSArray *oldNames)
 	{
 	  [sharedDefaults->_tempDomains setObject: regDefs
 	    forKey: NSRegistrationDomain];
+	  [sharedDefaults _discardSnapshot];
 	}
     }
 }
@@ -790,6 +1064,7 @@ newLanguages(NSArray *oldNames)
 	    {
 	      hasSharedDefaults = YES;
 	      sharedDefaults = [defs retain];
+	      settingUp = defs;
 	    }
           else
 	    {
@@ -1043,11 +1318,13 @@ newLanguages(NSArray *oldNames)
           /* FIXME - should we set this as volatile domain for English ? */
           [defs registerDefaults: [self _unlocalizedDefaults]];
         }
+      settingUp = nil;
       updateCache(sharedDefaults);
       [defs->_lock unlock];
     }
   NS_HANDLER
     {
+      settingUp = nil;
       if (nil != defs)
 	{
 	  [defs->_lock unlock];
@@ -1190,7 +1467,7 @@ newLanguages(NSArray *oldNames)
   RELEASE(_persDomains);
   RELEASE(_tempDomains);
   RELEASE(_changedDomains);
-  RELEASE(_dictionaryRep);
+  snapshotRetire((GSDefaultsSnapshot*)_dictionaryRep);
   RELEASE(_fileLock);
   RELEASE(_lock);
   [super dealloc];
@@ -1230,7 +1507,7 @@ newLanguages(NSArray *oldNames)
   [_lock lock];
   NS_DURING
     {
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       [_searchList removeObject: aName];
       index = [_searchList indexOfObject: processName];
       index = (index == NSNotFound) ? 0 : (index + 1);
@@ -1260,14 +1537,17 @@ newLanguages(NSArray *oldNames)
 
 - (BOOL) boolForKey: (NSString*)defaultName
 {
-  id	obj = [self objectForKey: defaultName];
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
+  GSDefaultsValue	*v = snapshotValue(s, defaultName);
+  BOOL			result = NO;
 
-  if (obj != nil && ([obj isKindOfClass: NSStringClass]
-    || [obj isKindOfClass: NSNumberClass]))
+  if (v != 0)
     {
-      return [obj boolValue];
+      result = snapshotScalars(v)->boolValue;
     }
-  return NO;
+  snapshotLeave(reader);
+  return result;
 }
 
 - (NSData*) dataForKey: (NSString*)defaultName
@@ -1292,79 +1572,61 @@ newLanguages(NSArray *oldNames)
 
 - (double) doubleForKey: (NSString*)defaultName
 {
-  id	obj = [self objectForKey: defaultName];
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
+  GSDefaultsValue	*v = snapshotValue(s, defaultName);
+  double		result = 0.0;
 
-  if (obj != nil && ([obj isKindOfClass: NSStringClass]
-    || [obj isKindOfClass: NSNumberClass]))
+  if (v != 0)
     {
-      return [obj doubleValue];
+      result = snapshotScalars(v)->doubleValue;
     }
-  return 0.0;
+  snapshotLeave(reader);
+  return result;
 }
 
 - (float) floatForKey: (NSString*)defaultName
 {
-  id	obj = [self objectForKey: defaultName];
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
+  GSDefaultsValue	*v = snapshotValue(s, defaultName);
+  float			result = 0.0;
 
-  if (obj != nil && ([obj isKindOfClass: NSStringClass]
-    || [obj isKindOfClass: NSNumberClass]))
+  if (v != 0)
     {
-      return [obj floatValue];
+      result = snapshotScalars(v)->floatValue;
     }
-  return 0.0;
+  snapshotLeave(reader);
+  return result;
 }
 
 - (NSInteger) integerForKey: (NSString*)defaultName
 {
-  id	obj = [self objectForKey: defaultName];
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
+  GSDefaultsValue	*v = snapshotValue(s, defaultName);
+  NSInteger		result = 0;
 
-  if (obj != nil && ([obj isKindOfClass: NSStringClass]
-    || [obj isKindOfClass: NSNumberClass]))
+  if (v != 0)
     {
-      return [obj integerValue];
+      result = snapshotScalars(v)->integerValue;
     }
-  return 0;
+  snapshotLeave(reader);
+  return result;
 }
 
 - (id) objectForKey: (NSString*)defaultName
 {
-  NSEnumerator	*enumerator;
-  IMP		nImp;
-  id		object = nil;
-  id		dN;
-  IMP		pImp;
-  IMP		tImp;
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
+  GSDefaultsValue	*v = snapshotValue(s, defaultName);
+  id			object = nil;
 
-  [_lock lock];
-  NS_DURING
+  if (v != 0)
     {
-      enumerator = [_searchList objectEnumerator];
-      nImp = [enumerator methodForSelector: nextObjectSel];
-      object = nil;
-      pImp = [_persDomains methodForSelector: objectForKeySel];
-      tImp = [_tempDomains methodForSelector: objectForKeySel];
-
-      while ((dN = (*nImp)(enumerator, nextObjectSel)) != nil)
-        {
-	  GSPersistentDomain	*pd;
-          NSDictionary		*td;
-
-          pd = (*pImp)(_persDomains, objectForKeySel, dN);
-          if (pd != nil && (object = [pd->contents objectForKey: defaultName]))
-	    break;
-          td = (*tImp)(_tempDomains, objectForKeySel, dN);
-          if (td != nil && (object = [td objectForKey: defaultName]))
-	    break;
-        }
-      IF_NO_GC([object retain];)
-      [_lock unlock];
-    }
-  NS_HANDLER
-    {
-      [_lock unlock];
-      [localException raise];
+      object = [v->object retain];
     }
-  NS_ENDHANDLER
+  snapshotLeave(reader);
   return AUTORELEASE(object);
 }
 
@@ -1593,7 +1855,7 @@ static BOOL isPlistObject(id o)
       NSEnumerator	*e;
       NSString		*n;
 
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       RELEASE(_searchList);
       _searchList = [newList mutableCopy];
       /* Ensure that any domains we need are loaded.
@@ -1811,7 +2073,7 @@ static BOOL isPlistObject(id o)
 	      haveChange = [self _readDefaults];
 	      if (YES == haveChange)
 		{
-		  DESTROY(_dictionaryRep);
+		  [self _discardSnapshot];
 		}
 
 	      mgr = [NSFileManager defaultManager];
@@ -1907,7 +2169,7 @@ static BOOL isPlistObject(id o)
   [_lock lock];
   NS_DURING
     {
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       [_tempDomains removeObjectForKey: domainName];
       [_lock unlock];
     }
@@ -1940,7 +2202,7 @@ static BOOL isPlistObject(id o)
 	    format: @"the volatile domain %@ already exists", domainName];
         }
 
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       domain = [domain mutableCopy];
       [_tempDomains setObject: domain forKey: domainName];
       RELEASE(domain);
@@ -1994,64 +2256,12 @@ static BOOL isPlistObject(id o)
 
 - (NSDictionary*) dictionaryRepresentation
 {
-  NSDictionary	*rep;
-
-  [_lock lock];
-  NS_DURING
-    {
-      if (_dictionaryRep == nil)
-        {
-          NSEnumerator		*enumerator;
-          NSMutableDictionary	*dictRep;
-          id			obj;
-          id			dict;
-          IMP			nImp;
-          IMP			pImp;
-          IMP			tImp;
-          IMP			addImp;
-
-          pImp = [_persDomains methodForSelector: objectForKeySel];
-          tImp = [_tempDomains methodForSelector: objectForKeySel];
-
-          enumerator = [_searchList reverseObjectEnumerator];
-          nImp = [enumerator methodForSelector: nextObjectSel];
-
-          dictRep = [NSMutableDictionaryClass alloc];
-          dictRep = [dictRep initWithCapacity: 512];
-          addImp = [dictRep methodForSelector: addSel];
+  volatile int		*reader;
+  GSDefaultsSnapshot	*s = [self _snapshot: &reader];
 
-          while ((obj = (*nImp)(enumerator, nextObjectSel)) != nil)
-	    {
-	      GSPersistentDomain	*pd;
-
-	      pd = (*pImp)(_persDomains, objectForKeySel, obj);
-	      if (nil != pd)
-		{
-		  dict = pd->contents;
-		}
-	      else
-		{
-	          dict = (*tImp)(_tempDomains, objectForKeySel, obj);
-		}
-	      if (nil != dict)
-                {
-                  (*addImp)(dictRep, addSel, dict);
-                }
-	    }
-          [dictRep makeImmutableCopyOnFail: NO];
-          _dictionaryRep = dictRep;
-        }
-      rep = [[_dictionaryRep retain] autorelease];
-      [_lock unlock];
-    }
-  NS_HANDLER
-    {
-      rep = nil;
-      [_lock unlock];
-      [localException raise];
-    }
-  NS_ENDHANDLER
-  return rep;
+  [s retain];
+  snapshotLeave(reader);
+  return AUTORELEASE(s);
 }
 
 - (void) registerDefaults: (NSDictionary*)newVals
@@ -2068,7 +2278,7 @@ static BOOL isPlistObject(id o)
 	    dictionaryWithCapacity: [newVals count]];
           [_tempDomains setObject: regDefs forKey: NSRegistrationDomain];
         }
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       [regDefs addEntriesFromDictionary: newVals];
       [_lock unlock];
     }
@@ -2090,7 +2300,7 @@ static BOOL isPlistObject(id o)
   [_lock lock];
   NS_DURING
     {
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       [_searchList removeObject: aName];
       [_lock unlock];
     }
@@ -2255,7 +2465,7 @@ NSDictionary *GSPrivateDefaultLocale()
   [_lock lock];
   NS_DURING
     {
-      DESTROY(_dictionaryRep);
+      [self _discardSnapshot];
       if (_changedDomains == nil)
         {
           _changedDomains = [[NSMutableArray alloc] initWithObjects: &domainName
@@ -2284,6 +2494,20 @@ NSDictionary *GSPrivateDefaultLocale()
   return _defaultsDatabase;
 }
 
+- (void) _discardSnapshot
+{
+  GSDefaultsSnapshot	*s;
+
+  [_lock lock];
+  s = (GSDefaultsSnapshot*)_dictionaryRep;
+  if (nil != s)
+    {
+      _dictionaryRep = nil;
+      snapshotRetire(s);
+    }
+  [_lock unlock];
+}
+
 static BOOL isLocked = NO;
 - (BOOL) _lockDefaultsFile: (BOOL*)wasLocked
 {
@@ -2397,6 +2621,99 @@ static BOOL isLocked = NO;
   return (nil == _fileLock) ? YES : NO;
 }
 
+/* Returns the current snapshot, building it if necessary.  This calls
+ * snapshotEnter() so the snapshot remains valid until the caller passes
+ * the counter returned in *reader to snapshotLeave().
+ */
+- (GSDefaultsSnapshot*) _snapshot: (volatile int**)reader
+{
+  GSDefaultsSnapshot	*s;
+
+  *reader = snapshotEnter();
+  s = *(GSDefaultsSnapshot * volatile *)&_dictionaryRep;
+  if (nil != s)
+    {
+      return s;
+    }
+  snapshotLeave(*reader);
+
+  [_lock lock];
+  NS_DURING
+    {
+      s = (GSDefaultsSnapshot*)_dictionaryRep;
+      if (nil == s)
+        {
+          NSEnumerator		*enumerator;
+          NSMutableDictionary	*dictRep;
+          id			obj;
+          id			dict;
+          IMP			nImp;
+          IMP			pImp;
+          IMP			tImp;
+          IMP			addImp;
+
+          pImp = [_persDomains methodForSelector: objectForKeySel];
+          tImp = [_tempDomains methodForSelector: objectForKeySel];
+
+          enumerator = [_searchList reverseObjectEnumerator];
+          nImp = [enumerator methodForSelector: nextObjectSel];
+
+          dictRep = [NSMutableDictionaryClass alloc];
+          dictRep = [dictRep initWithCapacity: 512];
+          addImp = [dictRep methodForSelector: addSel];
+
+          /* Domains earlier in the search list override later ones, and
+           * a persistent domain overrides a volatile one of the same name.
+           */
+          while ((obj = (*nImp)(enumerator, nextObjectSel)) != nil)
+	    {
+	      GSPersistentDomain	*pd;
+
+	      dict = (*tImp)(_tempDomains, objectForKeySel, obj);
+	      if (nil != dict)
+                {
+                  (*addImp)(dictRep, addSel, dict);
+                }
+	      pd = (*pImp)(_persDomains, objectForKeySel, obj);
+	      if (nil != pd && nil != pd->contents)
+		{
+                  (*addImp)(dictRep, addSel, pd->contents);
+		}
+	    }
+          s = snapshotNew(dictRep);
+          RELEASE(dictRep);
+          if (self == settingUp)
+            {
+              /* Not kept while setting up, so other threads wait.
+               */
+              AUTORELEASE(s);
+            }
+          else
+            {
+              /* Make sure the snapshot is complete before other threads
+               * can see it.
+               */
+              __sync_synchronize();
+              _dictionaryRep = s;
+              [[s retain] autorelease];
+            }
+        }
+      else
+        {
+          [[s retain] autorelease];
+        }
+      [_lock unlock];
+    }
+  NS_HANDLER
+    {
+      [_lock unlock];
+      [localException raise];
+    }
+  NS_ENDHANDLER
+  *reader = snapshotEnter();
+  return s;
+}
+
 - (void) _unlockDefaultsFile
 {
   NS_DURING
@@ -2562,3 +2879,47 @@ static BOOL isLocked = NO;
 
 @end
 
+@implementation	GSDefaultsSnapshot
+
+- (id) copyWithZone: (NSZone*)z
+{
+  return RETAIN(self);
+}
+
+- (NSUInteger) count
+{
+  return map.nodeCount;
+}
+
+- (void) dealloc
+{
+  NSUInteger	i = map.nodeCount;
+
+  while (i-- > 0)
+    {
+      if (values[i].scalars != 0 && values[i].scalars != &noScalars)
+	{
+	  NSZoneFree(NSDefaultMallocZone(), values[i].scalars);
+	}
+      RELEASE(values[i].object);
+    }
+  GSIMapEmptyMap(&map);
+  NSZoneFree(NSDefaultMallocZone(), values);
+  RELEASE(keys);
+  [super dealloc];
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+  return [keys objectEnumerator];
+}
+
+- (id) objectForKey: (id)aKey
+{
+  GSDefaultsValue	*v = snapshotValue(self, aKey);
+
+  return (0 == v) ? nil : v->object;
+}
+
+@end
+
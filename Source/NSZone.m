@@ -65,8 +65,10 @@
    the size of memory requested plus one (a guard byte), all rounded up
    to a multiple of the granularity.
 
-   - For nonfreeable zones, worst-like fit is used.  This is OK since
-   we don't have to worry about memory fragmentation. */
+   - Nonfreeable zones are arenas: memory is allocated by moving up
+   the top of the current block (without locking), and is returned to
+   the system only when the whole zone is recycled.  This makes them
+   suitable for groups of objects which are all discarded together. */
 
 /* Other information:
 
@@ -590,6 +592,7 @@ GSPrivateIsCollectable(const void *ptr)
 #define DEFBLOCK 16384 /* Default granularity. */
 #define BUFFER 4 /* Buffer size.  FIXME?: Is this a reasonable optimum. */
 #define MAX_SEG 16 /* Segregated list size. */
+#define NF_MAXBLOCK (1024*1024) /* Maximum nonfreeable block size. */
 #define FBSZ sizeof(ff_block)
 #define NBSZ sizeof(nf_chunk)
 
@@ -818,11 +821,13 @@ chunkPrev(ff_block *ptr)
 struct _nfree_zone_struct
 {
   NSZone common;
-  pthread_mutex_t lock;
-  /* Linked list of blocks in decreasing order of free space,
-     except maybe for the first block. */
-  nf_block *blocks;
-  size_t use;
+  pthread_mutex_t lock; // Held while adding a block
+  /* Linked list of blocks, the one being allocated from first. */
+  nf_block *volatile blocks;
+  size_t next_size; // Size of next block to add
+  void *low; // Start of lowest block
+  void *high; // End of highest block
+  size_t use; // Number of allocations
 };
 
 /* Memory management functions for freeable zones. */
@@ -855,7 +860,6 @@ static void* rmalloc (NSZone *zone, size_t size);
 static void rrecycle (NSZone *zone);
 static void* rrealloc (NSZone *zone, void *ptr, size_t size);
 static void rffree (NSZone *zone, void *ptr);
-static void rnfree (NSZone *zone, void *ptr);
 
 /*
  *	Lists of zones to be used to determine if a pointer is in a zone.
@@ -1631,114 +1635,108 @@ flush_buf (ffree_zone *zone)
   zone->bufsize = 0;
 }
 
-/* If the first block in block list has enough space, use that space.
-   Otherwise, sort the block list in decreasing free space order (only
-   the first block needs to be put in its appropriate place since
-   the rest of the list is already sorted).  Then check if the first
-   block has enough space for the request.  If it does, use it.  If it
-   doesn't, get more memory from the default zone, since none of the
-   other blocks in the block list could have enough memory. */
+/* Adds a block big enough for a chunk of chunksize bytes to the zone
+   and allocates the chunk from it.  Blocks double in size (up to
+   NF_MAXBLOCK) as the zone grows, so there are few of them to search
+   when looking up a pointer.  A chunk too big for the next block gets a
+   block of its own, which goes after the current block so that the
+   space left in that is still used. */
 static void*
-nmalloc (NSZone *zone, size_t size)
+nnewblock (nfree_zone *zptr, size_t chunksize)
 {
-  nfree_zone *zptr = (nfree_zone*)zone;
-  size_t chunksize = roundupto(size, ALIGN);
-  size_t freesize;
-  void *chunkhead;
+  NSZone *zone = (NSZone*)zptr;
+  nf_block *current;
   nf_block *block;
-  size_t top;
+  size_t blocksize;
+  void *chunkhead;
 
   pthread_mutex_lock(&(zptr->lock));
-  block = zptr->blocks;
-  top = block->top;
-  freesize = block->size-top;
-  if (freesize >= chunksize)
+  current = zptr->blocks;
+  if (current->size - current->top >= chunksize)
+    {
+      /* Another thread added a block while we waited for the lock. */
+      pthread_mutex_unlock(&(zptr->lock));
+      return NULL;
+    }
+  blocksize = roundupto(chunksize+NF_HEAD, zone->gran);
+  if (blocksize < zptr->next_size)
+    {
+      blocksize = zptr->next_size;
+    }
+  block = malloc(blocksize);
+  if (block == NULL)
+    {
+      pthread_mutex_unlock(&(zptr->lock));
+      if (zone->name != nil)
+        [NSException raise: NSMallocException
+                    format: @"Zone %@ has run out of memory",
+                     zone->name];
+      else
+        [NSException raise: NSMallocException
+                    format: @"Out of memory"];
+    }
+  block->size = blocksize;
+  block->top = NF_HEAD + chunksize;
+  chunkhead = (void*)block + NF_HEAD;
+  if ((void*)block < zptr->low)
+    zptr->low = block;
+  if ((void*)block + blocksize > zptr->high)
+    zptr->high = (void*)block + blocksize;
+  if (blocksize > zptr->next_size)
     {
-      chunkhead = (void*)(block)+top;
-      block->top += chunksize;
+      block->next = current->next;
+      __sync_synchronize();
+      current->next = block;
     }
   else
     {
-      nf_block *preblock;
-
-      /* First, get the block list in decreasing free size order. */
-      preblock = NULL;
-      while ((block->next != NULL)
-        && (freesize < block->next->size-block->next->top))
-        {
-          preblock = block;
-          block = block->next;
-        }
-      if (preblock != NULL)
-        {
-          preblock->next = zptr->blocks;
-          zptr->blocks = zptr->blocks->next;
-          preblock->next->next = block;
-        }
-      if (zptr->blocks->size-zptr->blocks->top < chunksize)
-        /* Get new block. */
-        {
-          size_t blocksize = roundupto(chunksize+NF_HEAD, zone->gran);
-
-          block = malloc(blocksize);
-          if (block == NULL)
-            {
-              pthread_mutex_unlock(&(zptr->lock));
-              if (zone->name != nil)
-                [NSException raise: NSMallocException
-                            format: @"Zone %@ has run out of memory",
-                             zone->name];
-              else
-                [NSException raise: NSMallocException
-                            format: @"Out of memory"];
-            }
-          block->next = zptr->blocks;
-          block->size = blocksize;
-          block->top = NF_HEAD;
-          zptr->blocks = block;
-        }
-      chunkhead = (void*)block+block->top;
-      block->top += chunksize;
+      if (zptr->next_size < NF_MAXBLOCK)
+        zptr->next_size *= 2;
+      block->next = current;
+      __sync_synchronize();
+      zptr->blocks = block;
     }
-  zptr->use++;
   pthread_mutex_unlock(&(zptr->lock));
   return chunkhead;
 }
 
-/* Return the blocks to the default zone, then deallocate mutex, and
-   then release zone name if it exists. */
-static BOOL
-nrecycle1 (NSZone *zone)
+/* Allocation is by moving the top of the current block up, which is done
+   without locking.  Only when the current block is full do we lock to
+   add another. */
+static void*
+nmalloc (NSZone *zone, size_t size)
 {
   nfree_zone *zptr = (nfree_zone*)zone;
+  size_t chunksize = roundupto(size, ALIGN);
+  void *chunkhead = NULL;
 
-  pthread_mutex_lock(&(zptr->lock));
-  if (zptr->use == 0)
+  while (chunkhead == NULL)
     {
-      nf_block *nextblock;
       nf_block *block = zptr->blocks;
+      size_t top = block->top;
 
-      while (block != NULL)
-	{
-	  nextblock = block->next;
-	  free(block);
-	  block = nextblock;
-	}
-      zptr->blocks = 0;
-    }
-  pthread_mutex_unlock(&(zptr->lock));
-  if (zptr->blocks == 0)
-    {
-      pthread_mutex_destroy(&(zptr->lock));
-      return YES;
+      if (block->size - top < chunksize)
+        {
+          chunkhead = nnewblock(zptr, chunksize);
+        }
+      else if (__sync_bool_compare_and_swap(&(block->top), top,
+        top + chunksize))
+        {
+          chunkhead = (void*)block + top;
+        }
     }
-  return NO;
+  __sync_fetch_and_add(&(zptr->use), 1);
+  return chunkhead;
 }
 
-/* Recycle the zone. */
+/* Return all the blocks to the system at once.  Any memory still in use
+   in the zone becomes invalid. */
 static void
 nrecycle (NSZone *zone)
 {
+  nfree_zone *zptr = (nfree_zone*)zone;
+  nf_block *block;
+
   [gnustep_global_lock lock];
   if (zone->name != nil)
     {
@@ -1746,15 +1744,16 @@ nrecycle (NSZone *zone)
       zone->name = nil;
       [name release];
     }
-  if (nrecycle1(zone) == YES)
-    destroy_zone(zone);
-  else
+  block = zptr->blocks;
+  while (block != NULL)
     {
-      zone->malloc = rmalloc;
-      zone->realloc = rrealloc;
-      zone->free = rnfree;
-      zone->recycle = rrecycle;
+      nf_block *nextblock = block->next;
+
+      free(block);
+      block = nextblock;
     }
+  pthread_mutex_destroy(&(zptr->lock));
+  destroy_zone(zone);
   [gnustep_global_lock unlock];
 }
 
@@ -1766,60 +1765,34 @@ nrealloc (NSZone *zone, void *ptr, size_t size)
 
   if (ptr != 0)
     {
-      pthread_mutex_lock(&(zptr->lock));
-      if (tmp)
-	{
-	  nf_block *block;
-	  size_t old = 0;
+      nf_block *block;
+      size_t old = 0;
 
-	  for (block = zptr->blocks; block != NULL; block = block->next) {
-	    if (ptr >= (void*)block && ptr < ((void*)block)+block->size) {
-		old = ((void*)block)+block->size - ptr;
-		break;
-	    }
-	  }
-	  if (old > 0)
-	    {
-	      if (size < old)
-		old = size;
-	      memcpy(tmp, ptr, old);
-	    }
-	}
-      zptr->use--;
-      pthread_mutex_unlock(&(zptr->lock));
+      /* We don't know the size of the old chunk, but it can't extend
+         beyond the memory allocated from its block. */
+      for (block = zptr->blocks; block != NULL; block = block->next)
+        {
+          if (ptr >= (void*)block && ptr < ((void*)block)+block->size)
+            {
+              old = ((void*)block)+block->top - ptr;
+              break;
+            }
+        }
+      if (size < old)
+        old = size;
+      memcpy(tmp, ptr, old);
     }
   return tmp;
 }
 
 /*
- *	The OpenStep spec says we don't release memory - but we have to do
- *	some minimal bookkeeping so that, when the zone is recycled, we can
- *	determine if all the allocated memory has been freed.  Until it is
- *	all freed, we can't actually destroy the zone!
+ *	The OpenStep spec says we don't release memory.  The memory of a
+ *	nonfreeable zone is returned to the system only when the zone is
+ *	recycled, so freeing is a no-op.
  */
 static void
 nfree (NSZone *zone, void *ptr)
 {
-  nfree_zone *zptr = (nfree_zone*)zone;
-
-  pthread_mutex_lock(&(zptr->lock));
-  zptr->use--;
-  pthread_mutex_unlock(&(zptr->lock));
-}
-
-static void
-rnfree (NSZone *zone, void *ptr)
-{
-  nfree_zone *zptr = (nfree_zone*)zone;
-
-  nfree(zone, ptr);
-  if (zptr->use == 0)
-    {
-      [gnustep_global_lock lock];
-      nrecycle1(zone);
-      destroy_zone(zone);
-      [gnustep_global_lock unlock];
-    }
 }
 
 /* Check integrity of a nonfreeable zone.  Doesn't have to
@@ -1834,14 +1807,15 @@ ncheck (NSZone *zone)
   block = zptr->blocks;
   while (block != NULL)
     {
-      if (block->size < block->top)
+      if (block->size < block->top
+        || (void*)block < zptr->low
+        || (void*)block + block->size > zptr->high)
         {
           pthread_mutex_unlock(&(zptr->lock));
           return NO;
         }
       block = block->next;
     }
-  /* FIXME: Do more checking? */
   pthread_mutex_unlock(&(zptr->lock));
   return YES;
 }
@@ -1851,23 +1825,27 @@ nlookup (NSZone *zone, void *ptr)
 {
   nfree_zone *zptr = (nfree_zone*)zone;
   nf_block *block;
-  BOOL found = NO;
 
-  pthread_mutex_lock(&(zptr->lock));
+  if (ptr < zptr->low || ptr >= zptr->high)
+    {
+      return NO;
+    }
+  /* Blocks are only ever added (with the new block complete before it
+     is linked in), so the list can be searched without locking. */
   for (block = zptr->blocks; block != NULL; block = block->next)
     {
-      if (ptr >= (void*)block &&  ptr < ((void*)block)+block->size)
+      if (ptr >= (void*)block && ptr < ((void*)block)+block->size)
 	{
-	  found = YES;
-	  break;
+	  return YES;
 	}
     }
-  pthread_mutex_unlock(&(zptr->lock));
-  return found;
+  return NO;
 }
 
-/* Return statistics for a nonfreeable zone.  Doesn't have to
-   particularly efficient. */
+/* Return statistics for a nonfreeable zone.  The chunks used are the
+   allocations made, and each block with space left counts as a free
+   chunk.  As for freeable zones, the overhead (here the block headers)
+   counts as used, so the used and free bytes add up to the total. */
 static struct NSZoneStats
 nstats (NSZone *zone)
 {
@@ -1876,7 +1854,7 @@ nstats (NSZone *zone)
   nf_block *block;
 
   stats.bytes_total = 0;
-  stats.chunks_used = 0;
+  stats.chunks_used = zptr->use;
   stats.bytes_used = 0;
   stats.chunks_free = 0;
   stats.bytes_free = 0;
@@ -1884,20 +1862,14 @@ nstats (NSZone *zone)
   block = zptr->blocks;
   while (block != NULL)
     {
-      size_t *chunk;
+      size_t top = block->top;
 
       stats.bytes_total += block->size;
-      chunk = (void*)block+NF_HEAD;
-      while ((void*)chunk < (void*)block+block->top)
-        {
-          stats.chunks_used++;
-          stats.bytes_used += *chunk;
-          chunk = (void*)chunk+(*chunk);
-        }
-      if (block->size != block->top)
+      stats.bytes_used += top;
+      if (block->size != top)
         {
           stats.chunks_free++;
-          stats.bytes_free += block->size-block->top;
+          stats.bytes_free += block->size - top;
         }
       block = block->next;
     }
@@ -1929,8 +1901,6 @@ rrealloc (NSZone *zone, void *ptr, size_t size)
   return 0;
 }
 
-static void rnfree (NSZone *zone, void *ptr);
-
 GS_DECLARE NSZone*
 NSZoneFromPointer(void *ptr)
 {
@@ -2044,9 +2014,9 @@ NSCreateZone (NSUInteger start, NSUInteger gran, BOOL canFree)
       zone->common.gran = granularity;
       zone->common.name = nil;
       GS_INIT_RECURSIVE_MUTEX(zone->lock);
-      zone->blocks = malloc(startsize);
+      block = malloc(startsize);
       zone->use = 0;
-      if (zone->blocks == NULL)
+      if (block == NULL)
         {
           pthread_mutex_destroy(&(zone->lock));
           free(zone);
@@ -2054,10 +2024,15 @@ NSCreateZone (NSUInteger start, NSUInteger gran, BOOL canFree)
                        format: @"No memory to create zone"];
         }
 
-      block = zone->blocks;
       block->next = NULL;
       block->size = startsize;
       block->top = NF_HEAD;
+      zone->blocks = block;
+      zone->next_size = (startsize > granularity) ? startsize : granularity;
+      if (zone->next_size < DEFBLOCK)
+        zone->next_size = DEFBLOCK;
+      zone->low = block;
+      zone->high = (void*)block + startsize;
       newZone = (NSZone*)zone;
     }
 
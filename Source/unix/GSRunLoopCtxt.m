@@ -26,6 +26,10 @@
 #ifdef HAVE_POLL_F
 #include <poll.h>
 #endif
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <fcntl.h>
+#endif
 
 #define	FDCOUNT	1024
 
@@ -74,8 +78,18 @@ static const NSMapTableValueCallBacks WatcherMapValueCallBacks =
   RELEASE(mode);
   GSIArrayEmpty(performers);
   NSZoneFree(performers->zone, (void*)performers);
-  GSIArrayEmpty(timers);
-  NSZoneFree(timers->zone, (void*)timers);
+  while (timerCount > 0)
+    {
+      RELEASE(timers[--timerCount].timer);
+    }
+  if (timers != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), (void*)timers);
+    }
+  if (timerMap != 0)
+    {
+      NSFreeMapTable(timerMap);
+    }
   GSIArrayEmpty(watchers);
   NSZoneFree(watchers->zone, (void*)watchers);
   if (_efdMap != 0)
@@ -97,6 +111,25 @@ static const NSMapTableValueCallBacks WatcherMapValueCallBacks =
     {
       NSZoneFree(NSDefaultMallocZone(), pollfds);
     }
+#endif
+#ifdef	HAVE_EPOLL
+  if (_epfd >= 0)
+    {
+      close(_epfd);
+    }
+  NSFreeMapTable(_efdStatic);
+  NSFreeMapTable(_rfdStatic);
+  NSFreeMapTable(_wfdStatic);
+  NSFreeMapTable(_epollWant);
+  NSFreeMapTable(_epollHad);
+  NSFreeMapTable(_epollMask);
+  NSFreeMapTable(_epollFiles);
+  GSIArrayEmpty(_dynamic);
+  NSZoneFree(_dynamic->zone, (void*)_dynamic);
+  if (_epollEvents != 0)
+    {
+      NSZoneFree(NSDefaultMallocZone(), _epollEvents);
+    }
 #endif
   [super dealloc];
 }
@@ -179,18 +212,15 @@ static const NSMapTableValueCallBacks WatcherMapValueCallBacks =
 #if	GS_WITH_GC
       z = (NSZone*)1;
       performers = NSAllocateCollectable(sizeof(GSIArray_t), NSScannedOption);
-      timers = NSAllocateCollectable(sizeof(GSIArray_t), NSScannedOption);
       watchers = NSAllocateCollectable(sizeof(GSIArray_t), NSScannedOption);
       _trigger = NSAllocateCollectable(sizeof(GSIArray_t), NSScannedOption);
 #else
       z = [self zone];
       performers = NSZoneMalloc(z, sizeof(GSIArray_t));
-      timers = NSZoneMalloc(z, sizeof(GSIArray_t));
       watchers = NSZoneMalloc(z, sizeof(GSIArray_t));
       _trigger = NSZoneMalloc(z, sizeof(GSIArray_t));
 #endif
       GSIArrayInitWithZoneAndCapacity(performers, z, 8);
-      GSIArrayInitWithZoneAndCapacity(timers, z, 8);
       GSIArrayInitWithZoneAndCapacity(watchers, z, 8);
       GSIArrayInitWithZoneAndCapacity(_trigger, z, 8);
 
@@ -200,12 +230,468 @@ static const NSMapTableValueCallBacks WatcherMapValueCallBacks =
 				      WatcherMapValueCallBacks, 0);
       _wfdMap = NSCreateMapTable (NSIntegerMapKeyCallBacks,
 				      WatcherMapValueCallBacks, 0);
+#ifdef	HAVE_EPOLL
+#if	GS_WITH_GC
+      _dynamic = NSAllocateCollectable(sizeof(GSIArray_t), NSScannedOption);
+#else
+      _dynamic = NSZoneMalloc(z, sizeof(GSIArray_t));
+#endif
+      GSIArrayInitWithZoneAndCapacity(_dynamic, z, 8);
+      /* The watchers array retains the watchers, so these don't need to.
+       */
+      _efdStatic = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				     NSNonOwnedPointerMapValueCallBacks, 0);
+      _rfdStatic = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				     NSNonOwnedPointerMapValueCallBacks, 0);
+      _wfdStatic = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				     NSNonOwnedPointerMapValueCallBacks, 0);
+      _epollWant = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				     NSIntegerMapValueCallBacks, 0);
+      _epollHad = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				    NSIntegerMapValueCallBacks, 0);
+      _epollMask = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				     NSIntegerMapValueCallBacks, 0);
+      _epollFiles = NSCreateMapTable (NSIntegerMapKeyCallBacks,
+				      NSIntegerMapValueCallBacks, 0);
+      _epfd = epoll_create(64);
+      if (_epfd < 0)
+	{
+	  NSLog(@"epoll_create() error in -initWithMode:extra: '%@'",
+	    [NSError _last]);
+	  abort();
+	}
+      fcntl(_epfd, F_SETFD, FD_CLOEXEC);
+#endif
     }
   return self;
 }
 
 #ifdef	HAVE_POLL_F
 
+#ifdef	HAVE_EPOLL
+
+/* With epoll each context keeps a persistent set of descriptors registered
+ * with the kernel.  Watchers which simply wait on a descriptor are added
+ * to that set when they are added to the run loop and removed from it
+ * when they are removed, so a poll only needs to look at the descriptors
+ * which are actually ready.  Watchers which need to be asked whether the
+ * loop should block (or whose descriptors may change, like ports) are
+ * 'dynamic' and are examined at each poll as before, the descriptors
+ * they want being merged into the registered set.
+ * NB. The epoll event bits have the same values as the poll() ones, so
+ * the ready descriptors are returned in the pollfds array and handled
+ * by the same code as when using poll().
+ */
+
+static inline NSMapTable *
+staticMap(GSRunLoopCtxt *ctxt, GSRunLoopWatcher *watcher)
+{
+  if (watcher->checkBlocking == NO)
+    {
+      switch (watcher->type)
+	{
+	  case ET_EDESC:	return ctxt->_efdStatic;
+	  case ET_RDESC:	return ctxt->_rfdStatic;
+	  case ET_WDESC:	return ctxt->_wfdStatic;
+	  default:		break;
+	}
+    }
+  return 0;
+}
+
+/* Make the events registered for a descriptor match those wanted by the
+ * static and dynamic watchers.
+ */
+static void
+epollSync(GSRunLoopCtxt *ctxt, int fd)
+{
+  void			*k = (void*)(intptr_t)fd;
+  uint32_t		want;
+  uint32_t		have;
+  struct epoll_event	ev;
+  int			result;
+
+  want = (uint32_t)(uintptr_t)NSMapGet(ctxt->_epollWant, k);
+  if (NSMapGet(ctxt->_efdStatic, k) != 0)
+    {
+      want |= EPOLLPRI;
+    }
+  if (NSMapGet(ctxt->_rfdStatic, k) != 0)
+    {
+      want |= EPOLLIN;
+    }
+  if (NSMapGet(ctxt->_wfdStatic, k) != 0)
+    {
+      want |= EPOLLOUT;
+    }
+
+  if (NSMapGet(ctxt->_epollFiles, k) != 0)
+    {
+      if (want == 0)
+	{
+	  NSMapRemove(ctxt->_epollFiles, k);
+	}
+      else
+	{
+	  NSMapInsert(ctxt->_epollFiles, k, (void*)(uintptr_t)want);
+	}
+      return;
+    }
+
+  have = (uint32_t)(uintptr_t)NSMapGet(ctxt->_epollMask, k);
+  if (want == have)
+    {
+      return;
+    }
+  memset(&ev, '\0', sizeof(ev));
+  if (want == 0)
+    {
+      /* This fails harmlessly if the descriptor has been closed (EBADF)
+       * or closed and reused (ENOENT), the kernel having already dropped
+       * it from the set.
+       */
+      NSMapRemove(ctxt->_epollMask, k);
+      if (epoll_ctl(ctxt->_epfd, EPOLL_CTL_DEL, fd, &ev) < 0
+	&& (errno == EBADF || errno == ENOENT))
+	{
+	  NSDebugFLLog(@"NSRunLoop", @"watched descriptor %d was closed", fd);
+	}
+      return;
+    }
+  ev.events = want;
+  ev.data.fd = fd;
+  result = epoll_ctl(ctxt->_epfd,
+    (have == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+  if (result < 0 && errno == EEXIST)
+    {
+      /* The descriptor was closed and reused without being removed.
+       */
+      result = epoll_ctl(ctxt->_epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+  else if (result < 0 && errno == ENOENT)
+    {
+      /* The descriptor was closed (so the kernel removed it) and reused.
+       */
+      result = epoll_ctl(ctxt->_epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+  if (result < 0)
+    {
+      /* epoll can't watch this descriptor (eg. it is a regular file or
+       * it has been closed), so we use poll() for it, which will report
+       * it ready/invalid just as it did before we used epoll.
+       */
+      NSDebugFLLog(@"NSRunLoop", @"epoll_ctl() failed for %d '%@'",
+	fd, [NSError _last]);
+      NSMapRemove(ctxt->_epollMask, k);
+      NSMapInsert(ctxt->_epollFiles, k, (void*)(uintptr_t)want);
+      return;
+    }
+  NSMapInsert(ctxt->_epollMask, k, (void*)(uintptr_t)want);
+}
+
+/* Record that a dynamic watcher wants to wait for an event on fd.
+ */
+static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
+{
+  void		*k = (void*)(intptr_t)fd;
+  uintptr_t	mask = (uintptr_t)NSMapGet(ctxt->_epollWant, k);
+
+  NSMapInsert(ctxt->_epollWant, k, (void*)(mask | event));
+}
+
+/* Bring the registered set up to date with the descriptors wanted by the
+ * dynamic watchers at this poll, and with those which were wanted at the
+ * last poll but are not wanted now.
+ */
+static void
+epollUpdate(GSRunLoopCtxt *ctxt)
+{
+  NSMapEnumerator	enumerator;
+  void			*k;
+  void			*v;
+
+  enumerator = NSEnumerateMapTable(ctxt->_epollWant);
+  while (NSNextMapEnumeratorPair(&enumerator, &k, &v))
+    {
+      epollSync(ctxt, (int)(intptr_t)k);
+    }
+  NSEndMapTableEnumeration(&enumerator);
+  enumerator = NSEnumerateMapTable(ctxt->_epollHad);
+  while (NSNextMapEnumeratorPair(&enumerator, &k, &v))
+    {
+      if (NSMapGet(ctxt->_epollWant, k) == 0)
+	{
+	  epollSync(ctxt, (int)(intptr_t)k);
+	}
+    }
+  NSEndMapTableEnumeration(&enumerator);
+}
+
+/* Put the static watchers for a ready descriptor into the maps used to
+ * dispatch events for this poll (unless a dynamic watcher is there).
+ */
+static inline void
+epollReady(GSRunLoopCtxt *ctxt, int fd)
+{
+  void			*k = (void*)(intptr_t)fd;
+  GSRunLoopWatcher	*w;
+
+  if ((w = NSMapGet(ctxt->_efdStatic, k)) != nil
+    && NSMapGet(ctxt->_efdMap, k) == nil)
+    {
+      NSMapInsert(ctxt->_efdMap, k, w);
+    }
+  if ((w = NSMapGet(ctxt->_rfdStatic, k)) != nil
+    && NSMapGet(ctxt->_rfdMap, k) == nil)
+    {
+      NSMapInsert(ctxt->_rfdMap, k, w);
+    }
+  if ((w = NSMapGet(ctxt->_wfdStatic, k)) != nil
+    && NSMapGet(ctxt->_wfdMap, k) == nil)
+    {
+      NSMapInsert(ctxt->_wfdMap, k, w);
+    }
+}
+
+/* Re-arm the registered descriptors to find any which have been closed.
+ * The kernel silently drops a closed descriptor from the epoll set, so a
+ * watcher for it would never be told.  A closed descriptor (EBADF) is
+ * moved to the set handled by poll(), which reports it invalid just as
+ * it would have been without epoll, while one which was closed and then
+ * reused (ENOENT) is registered again.
+ * This costs a system call per registered descriptor, so it is only done
+ * when a wait has timed out with nothing ready.
+ * Returns the number of descriptors moved to the poll() set.
+ */
+static unsigned
+epollCheck(GSRunLoopCtxt *ctxt)
+{
+  unsigned		count = NSCountMapTable(ctxt->_epollMask);
+  unsigned		n = 0;
+  unsigned		i;
+  NSMapEnumerator	enumerator;
+  void			*k;
+  void			*v;
+
+  if (count == 0)
+    {
+      return 0;
+    }
+  GS_BEGINITEMBUF(bad, count, struct epoll_event)
+  enumerator = NSEnumerateMapTable(ctxt->_epollMask);
+  while (NSNextMapEnumeratorPair(&enumerator, &k, &v))
+    {
+      struct epoll_event	*ev = &bad[n];
+      int			fd = (int)(intptr_t)k;
+
+      memset(ev, '\0', sizeof(*ev));
+      ev->events = (uint32_t)(uintptr_t)v;
+      ev->data.fd = fd;
+      if (epoll_ctl(ctxt->_epfd, EPOLL_CTL_MOD, fd, ev) < 0
+	&& (errno != ENOENT
+	|| epoll_ctl(ctxt->_epfd, EPOLL_CTL_ADD, fd, ev) < 0))
+	{
+	  n++;
+	}
+    }
+  NSEndMapTableEnumeration(&enumerator);
+  for (i = 0; i < n; i++)
+    {
+      void	*b = (void*)(intptr_t)bad[i].data.fd;
+
+      NSDebugFLLog(@"NSRunLoop", @"watched descriptor %d was closed",
+	bad[i].data.fd);
+      NSMapRemove(ctxt->_epollMask, b);
+      NSMapInsert(ctxt->_epollFiles, b, (void*)(uintptr_t)bad[i].events);
+    }
+  GS_ENDITEMBUF()
+  return n;
+}
+
+/* Wait for events, placing the ready descriptors in the pollfds array.
+ * Returns the number of ready descriptors, or -1 on error (as poll()).
+ * A descriptor reporting a hangup or error is checked, and reported as
+ * invalid (as poll() would) if it has been closed.  If a wait times out
+ * with nothing ready, the registered descriptors are checked in case one
+ * was closed without an event, and any found are reported at once.
+ */
+static int
+epollWait(GSRunLoopCtxt *ctxt, int milliseconds)
+{
+  unsigned		files;
+  unsigned		maxevents;
+  unsigned		size;
+  struct epoll_event	*events;
+  struct pollfd		*pf;
+  int			count;
+  int			i;
+
+again:
+  files = NSCountMapTable(ctxt->_epollFiles);
+  maxevents = NSCountMapTable(ctxt->_epollMask) + 1;
+  size = maxevents + files + 1;
+
+  if (ctxt->pollfds_capacity < size)
+    {
+      ctxt->pollfds_capacity = size;
+#if	GS_WITH_GC
+      ctxt->pollfds = NSReallocateCollectable(ctxt->pollfds,
+	size * sizeof(*ctxt->pollfds), 0);
+#else
+      ctxt->pollfds = NSZoneRealloc(NSDefaultMallocZone(),
+	ctxt->pollfds, size * sizeof(*ctxt->pollfds));
+#endif
+    }
+  if (ctxt->_epollCapacity < maxevents)
+    {
+      ctxt->_epollCapacity = maxevents;
+#if	GS_WITH_GC
+      ctxt->_epollEvents = NSReallocateCollectable(ctxt->_epollEvents,
+	maxevents * sizeof(*ctxt->_epollEvents), 0);
+#else
+      ctxt->_epollEvents = NSZoneRealloc(NSDefaultMallocZone(),
+	ctxt->_epollEvents, maxevents * sizeof(*ctxt->_epollEvents));
+#endif
+    }
+  events = ctxt->_epollEvents;
+  pf = ctxt->pollfds;
+  ctxt->pollfds_count = 0;
+
+  if (files == 0)
+    {
+      count = epoll_wait(ctxt->_epfd, events, maxevents, milliseconds);
+      if (count < 0)
+	{
+	  return count;
+	}
+    }
+  else
+    {
+      struct pollfd	*fpf = pf + maxevents;
+      NSMapEnumerator	enumerator;
+      void		*k;
+      void		*v;
+      int		n = 1;
+
+      /* Poll the descriptors epoll can't handle along with the epoll
+       * instance itself.  These go at the end of the pollfds array so
+       * that ready ones can be moved down after the epoll results.
+       */
+      fpf[0].fd = ctxt->_epfd;
+      fpf[0].events = POLLIN;
+      fpf[0].revents = 0;
+      enumerator = NSEnumerateMapTable(ctxt->_epollFiles);
+      while (NSNextMapEnumeratorPair(&enumerator, &k, &v))
+	{
+	  fpf[n].fd = (int)(intptr_t)k;
+	  fpf[n].events = (short)(uintptr_t)v;
+	  fpf[n].revents = 0;
+	  n++;
+	}
+      NSEndMapTableEnumeration(&enumerator);
+      count = poll(fpf, n, milliseconds);
+      if (count < 0)
+	{
+	  return count;
+	}
+      count = 0;
+      if (fpf[0].revents != 0)
+	{
+	  count = epoll_wait(ctxt->_epfd, events, maxevents, 0);
+	  if (count < 0)
+	    {
+	      return count;
+	    }
+	}
+      for (i = 1; i < n; i++)
+	{
+	  if (fpf[i].revents != 0)
+	    {
+	      pf[count + ctxt->pollfds_count++] = fpf[i];
+	    }
+	}
+    }
+
+  if (count == 0 && ctxt->pollfds_count == 0 && milliseconds != 0
+    && epollCheck(ctxt) > 0)
+    {
+      milliseconds = 0;
+      goto again;
+    }
+  for (i = 0; i < count; i++)
+    {
+      pf[i].fd = events[i].data.fd;
+      pf[i].events = 0;
+      pf[i].revents = (short)events[i].events;
+      if ((events[i].events & (EPOLLHUP | EPOLLERR)) != 0
+	&& fcntl(pf[i].fd, F_GETFD) < 0 && errno == EBADF)
+	{
+	  void	*b = (void*)(intptr_t)pf[i].fd;
+	  void	*m = NSMapGet(ctxt->_epollMask, b);
+
+	  /* The descriptor was closed while another reference to its file
+	   * kept it in the epoll set.  Report it as poll() would and stop
+	   * asking epoll about it.
+	   */
+	  NSDebugFLLog(@"NSRunLoop", @"watched descriptor %d was closed",
+	    pf[i].fd);
+	  pf[i].revents = POLLNVAL;
+	  if (m != 0)
+	    {
+	      NSMapRemove(ctxt->_epollMask, b);
+	      NSMapInsert(ctxt->_epollFiles, b, m);
+	    }
+	}
+    }
+  ctxt->pollfds_count += count;
+  for (i = 0; i < ctxt->pollfds_count; i++)
+    {
+      epollReady(ctxt, pf[i].fd);
+    }
+  return ctxt->pollfds_count;
+}
+
+- (void) addWatcher: (GSRunLoopWatcher*)watcher
+{
+  NSMapTable	*map = staticMap(self, watcher);
+
+  if (map == 0)
+    {
+      GSIArrayAddItem(_dynamic, (GSIArrayItem)((id)watcher));
+    }
+  else
+    {
+      NSMapInsert(map, watcher->data, watcher);
+      epollSync(self, (int)(intptr_t)watcher->data);
+    }
+}
+
+- (void) removeWatcher: (GSRunLoopWatcher*)watcher
+{
+  NSMapTable	*map = staticMap(self, watcher);
+
+  if (map == 0)
+    {
+      unsigned	i = GSIArrayCount(_dynamic);
+
+      while (i-- > 0)
+	{
+	  if (GSIArrayItemAtIndex(_dynamic, i).obj == (id)watcher)
+	    {
+	      GSIArrayRemoveItemAtIndex(_dynamic, i);
+	      break;
+	    }
+	}
+    }
+  else if (NSMapGet(map, watcher->data) == (void*)watcher)
+    {
+      NSMapRemove(map, watcher->data);
+      epollSync(self, (int)(intptr_t)watcher->data);
+    }
+}
+
+#else
+
 static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
 {
   int		index;
@@ -267,6 +753,8 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
   pollfds[index].events |= event;
 }
 
+#endif	/* HAVE_EPOLL */
+
 /**
  * Perform a poll for the specified runloop context.
  * If the method has been called re-entrantly, the contexts stack
@@ -284,8 +772,7 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
   unsigned	count;
   unsigned int	i;
   BOOL		immediate = NO;
-
-  i = GSIArrayCount(watchers);
+  GSIArray	list;
 
   /*
    * Get ready to listen to file descriptors.
@@ -296,6 +783,24 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
   NSResetMapTable(_wfdMap);
   GSIArrayRemoveAllItems(_trigger);
 
+#ifdef	HAVE_EPOLL
+  /*
+   * Only the dynamic watchers need to be looked at, the others being
+   * permanently registered with the epoll instance.
+   */
+  {
+    NSMapTable	*m = _epollHad;
+
+    _epollHad = _epollWant;
+    _epollWant = m;
+    NSResetMapTable(_epollWant);
+  }
+  list = _dynamic;
+  i = GSIArrayCount(list);
+#else
+  list = watchers;
+  i = GSIArrayCount(list);
+
   /*
    * Do the pre-listening set-up for the file descriptors of this mode.
    */
@@ -325,6 +830,7 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
     }
   pollfds_count = 0;
   ((pollextra*)extra)->limit = 0;
+#endif
 
   /* Watch for signals from other threads.
    */
@@ -335,10 +841,10 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
       GSRunLoopWatcher	*info;
       BOOL		trigger;
 
-      info = GSIArrayItemAtIndex(watchers, i).obj;
+      info = GSIArrayItemAtIndex(list, i).obj;
       if (info->_invalidated == YES)
 	{
-	  GSIArrayRemoveItemAtIndex(watchers, i);
+	  GSIArrayRemoveItemAtIndex(list, i);
 	}
       else if ([info runLoopShouldBlock: &trigger] == NO)
 	{
@@ -406,6 +912,9 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
 	    }
 	}
     }
+#ifdef	HAVE_EPOLL
+  epollUpdate(self);
+#endif
 
   /*
    * If there are notifications in the 'idle' queue, we try an
@@ -427,7 +936,11 @@ static void setPollfd(int fd, int event, GSRunLoopCtxt *ctxt)
   fprintf(stderr, "\n");
 }
 #endif
+#ifdef	HAVE_EPOLL
+  poll_return = epollWait(self, milliseconds);
+#else
   poll_return = poll (pollfds, pollfds_count, milliseconds);
+#endif
 #if 0
 {
   unsigned int i;
@@ -0,0 +1,230 @@
+#import "Testing.h"
+#import <Foundation/NSAutoreleasePool.h>
+
+/* A map with the open addressing layout.  The hash ignores the low bits
+ * of keys so that groups of sixteen keys collide, making lookups probe
+ * past full slots and slots whose nodes were removed.
+ */
+#define	GSI_MAP_OPEN	1
+#define	GSI_MAP_KTYPES	GSUNION_NSINT
+#define	GSI_MAP_VTYPES	GSUNION_NSINT
+#define	GSI_MAP_RETAIN_KEY(M, X)
+#define	GSI_MAP_RELEASE_KEY(M, X)
+#define	GSI_MAP_RETAIN_VAL(M, X)
+#define	GSI_MAP_RELEASE_VAL(M, X)
+#define	GSI_MAP_HASH(M, X)	((X).nsu >> 4)
+#define	GSI_MAP_EQUAL(M, X, Y)	((X).nsu == (Y).nsu)
+#define	GSI_MAP_NOCLEAN	1
+
+#include <GNUstepBase/GSIMap.h>
+
+#define	COUNT	1000
+
+/* Returns the number of slots with the control byte b.
+ */
+static NSUInteger
+slots(GSIMapTable map, uint8_t b)
+{
+  NSUInteger	n = 0;
+  NSUInteger	i;
+
+  for (i = 0; i < map->bucketCount; i++)
+    {
+      if (map->ctrl[i] == b)
+	{
+	  n++;
+	}
+    }
+  return n;
+}
+
+/* Returns YES if exactly the keys from 1 to COUNT for which want() is
+ * YES are in the map, each with its value being twice the key.
+ */
+static BOOL
+holds(GSIMapTable map, BOOL (*want)(NSUInteger))
+{
+  NSUInteger	n = 0;
+  NSUInteger	k;
+
+  for (k = 1; k <= COUNT; k++)
+    {
+      GSIMapNode	node = GSIMapNodeForKey(map, (GSIMapKey)k);
+
+      if (YES == (*want)(k))
+	{
+	  if (0 == node || node->value.nsu != 2 * k)
+	    {
+	      return NO;
+	    }
+	  n++;
+	}
+      else if (node != 0)
+	{
+	  return NO;
+	}
+    }
+  return (n == map->nodeCount) ? YES : NO;
+}
+
+static BOOL
+all(NSUInteger k)
+{
+  return YES;
+}
+
+static BOOL
+odd(NSUInteger k)
+{
+  return (k % 2) ? YES : NO;
+}
+
+static BOOL
+oddNotFive(NSUInteger k)
+{
+  return (k % 2 && k % 5) ? YES : NO;
+}
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  GSIMapTable_t		map;
+  GSIMapTable_t		small;
+  GSIMapEnumerator_t	e;
+  GSIMapNode		node;
+  NSUInteger		sizes = 0;
+  NSUInteger		size;
+  NSUInteger		empty;
+  NSUInteger		left;
+  NSUInteger		seen;
+  NSUInteger		k;
+  BOOL			ok;
+
+  GSIMapInitWithZoneAndCapacity(&map, NSDefaultMallocZone(), 0);
+  PASS(map.nodeCount == 0
+    && GSIMapNodeForKey(&map, (GSIMapKey)(NSUInteger)1) == 0,
+    "new map is empty");
+
+  ok = YES;
+  size = map.bucketCount;
+  for (k = 1; k <= COUNT; k++)
+    {
+      GSIMapAddPair(&map, (GSIMapKey)k, (GSIMapVal)(2 * k));
+      if (map.bucketCount != size)
+	{
+	  if (map.bucketCount < size
+	    || (map.bucketCount & (map.bucketCount - 1)) != 0)
+	    {
+	      ok = NO;
+	    }
+	  size = map.bucketCount;
+	  sizes++;
+	}
+      if (map.nodeCount > map.bucketCount - map.bucketCount / 8)
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok && sizes > 1, "map grows in powers of two and is never too full");
+  PASS(holds(&map, all), "every key added is found after growth");
+  PASS(GSIMapNodeForKey(&map, (GSIMapKey)(NSUInteger)(COUNT + 1)) == 0
+    && GSIMapNodeForKey(&map, (GSIMapKey)(NSUInteger)0) == 0,
+    "keys not added are not found");
+
+  ok = YES;
+  for (k = 2; k <= COUNT; k += 2)
+    {
+      if (NO == GSIMapRemoveKey(&map, (GSIMapKey)k))
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok, "added keys are removed");
+  PASS(NO == GSIMapRemoveKey(&map, (GSIMapKey)(NSUInteger)2),
+    "removing a key twice fails");
+  PASS(holds(&map, odd), "only the keys not removed are found");
+  PASS(slots(&map, GSI_MAP_DELETED) == COUNT / 2,
+    "removed nodes leave deleted slots");
+
+  /* A key goes in the first free slot of its probe sequence, and every
+   * slot before the one a removed key had was in use when it was added,
+   * so keys added back almost always reuse the slots of removed nodes.
+   */
+  size = map.bucketCount;
+  for (k = 2; k <= COUNT; k += 2)
+    {
+      GSIMapAddPair(&map, (GSIMapKey)k, (GSIMapVal)(2 * k));
+    }
+  PASS(holds(&map, all), "removed keys are added back");
+  PASS(slots(&map, GSI_MAP_DELETED) < COUNT / 20 && map.bucketCount == size,
+    "keys added back reuse the slots of removed nodes");
+
+  /* Keys with the same hash fill consecutive slots, and a new one takes
+   * the slot of a removed one rather than an empty slot.
+   */
+  GSIMapInitWithZoneAndCapacity(&small, NSDefaultMallocZone(), 0);
+  for (k = 1; k <= 10; k++)
+    {
+      GSIMapAddPair(&small, (GSIMapKey)k, (GSIMapVal)(2 * k));
+    }
+  node = GSIMapNodeForKey(&small, (GSIMapKey)(NSUInteger)5);
+  empty = slots(&small, GSI_MAP_EMPTY);
+  left = small.growthLeft;
+  GSIMapRemoveKey(&small, (GSIMapKey)(NSUInteger)5);
+  PASS(slots(&small, GSI_MAP_DELETED) == 1
+    && GSIMapNodeForKey(&small, (GSIMapKey)(NSUInteger)6) != 0,
+    "keys after a removed one in the probe sequence are found");
+  PASS(GSIMapAddPair(&small, (GSIMapKey)(NSUInteger)11,
+    (GSIMapVal)(NSUInteger)22) == node && slots(&small, GSI_MAP_DELETED) == 0
+    && slots(&small, GSI_MAP_EMPTY) == empty && small.growthLeft == left,
+    "slot of a removed node is reused");
+  GSIMapEmptyMap(&small);
+
+  /* Adding and removing keys does not make the map grow without limit.
+   */
+  for (k = COUNT + 1; k <= 100 * COUNT; k++)
+    {
+      GSIMapAddPair(&map, (GSIMapKey)k, (GSIMapVal)(2 * k));
+      GSIMapRemoveKey(&map, (GSIMapKey)k);
+    }
+  PASS(map.bucketCount <= 2 * size && holds(&map, all),
+    "map with many removals is rebuilt rather than grown");
+
+  /* The node last returned by an enumerator may be removed.
+   */
+  seen = 0;
+  e = GSIMapEnumeratorForMap(&map);
+  while ((node = GSIMapEnumeratorNextNode(&e)) != 0)
+    {
+      seen++;
+      if (node->key.nsu % 2 == 0)
+	{
+	  GSIMapRemoveNode(&map, node);
+	}
+    }
+  GSIMapEndEnumerator(&e);
+  PASS(seen == COUNT && holds(&map, odd),
+    "every node is enumerated while removing some of them");
+
+  seen = 0;
+  e = GSIMapEnumeratorForMap(&map);
+  while ((node = GSIMapEnumeratorNextNode(&e)) != 0)
+    {
+      seen++;
+      if (node->key.nsu % 5 == 0)
+	{
+	  GSIMapRemoveNode(&map, node);
+	}
+    }
+  GSIMapEndEnumerator(&e);
+  PASS(seen == COUNT / 2 && holds(&map, oddNotFive),
+    "removed nodes are not enumerated");
+
+  GSIMapEmptyMap(&map);
+  PASS(map.nodeCount == 0
+    && GSIMapNodeForKey(&map, (GSIMapKey)(NSUInteger)1) == 0,
+    "emptied map has no keys");
+
+  [arp release]; arp = nil;
+  return 0;
+}
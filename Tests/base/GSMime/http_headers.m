@@ -0,0 +1,73 @@
+#if     defined(GNUSTEP_BASE_LIBRARY)
+#import <Foundation/Foundation.h>
+#import <GNUstepBase/GSMime.h>
+#import "Testing.h"
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  const char		*text;
+  NSData		*data;
+  NSData		*body;
+  GSMimeParser		*parser;
+  GSMimeDocument	*doc;
+  GSMimeHeader		*hdr;
+
+  text = "HTTP/1.1 200 OK\r\n"
+    "Content-Length: 5\r\n"
+    "Connection:close\r\n"
+    "X-Custom-Header: Some Value \r\n"
+    "Transfer-Encoding: Chunked\r\n"
+    "Content-Type: text/plain; charset=utf-8\r\n"
+    "X-Folded: first\r\n second\r\n"
+    "Server: caf\351\r\n"
+    "X-Empty:\r\n"
+    "\r\n"
+    "hello";
+  data = [NSData dataWithBytes: text length: strlen(text)];
+  parser = [[GSMimeParser new] autorelease];
+  PASS([parser parseHeaders: data remaining: &body] == NO
+    && NO == [parser isInHeaders], "parsed HTTP response headers");
+  PASS_EQUAL(body, [NSData dataWithBytes: "hello" length: 5],
+    "body follows the headers");
+  doc = [parser mimeDocument];
+
+  hdr = [doc headerNamed: @"content-length"];
+  PASS_EQUAL([hdr value], @"5", "Content-Length value is correct");
+  PASS_EQUAL([hdr name], @"content-length", "Content-Length name is lowercase");
+  PASS_EQUAL([hdr namePreservingCase: YES], @"Content-Length",
+    "Content-Length name preserves case");
+  PASS_EQUAL([[doc headerNamed: @"Connection"] value], @"close",
+    "Connection value without space is correct");
+  hdr = [doc headerNamed: @"x-custom-header"];
+  PASS_EQUAL([hdr value], @"Some Value ", "unknown header value is correct");
+  PASS_EQUAL([hdr namePreservingCase: YES], @"X-Custom-Header",
+    "unknown header name preserves case");
+  PASS_EQUAL([[doc headerNamed: @"transfer-encoding"] value], @"chunked",
+    "Transfer-Encoding value is a lowercase token");
+  hdr = [doc headerNamed: @"content-type"];
+  PASS_EQUAL([hdr value], @"text/plain", "Content-Type value is correct");
+  PASS_EQUAL([hdr parameterForKey: @"charset"], @"utf-8",
+    "Content-Type parameter is correct");
+  PASS_EQUAL([[doc headerNamed: @"x-folded"] value], @"first second",
+    "folded header is unfolded");
+  PASS_EQUAL([[doc headerNamed: @"server"] value],
+    [NSString stringWithUTF8String: "caf\303\251"],
+    "HTTP header value is latin1");
+  PASS_EQUAL([[doc headerNamed: @"x-empty"] value], @"",
+    "empty header value is correct");
+  PASS_EQUAL([[[doc headerNamed: @"http"]
+    objectForKey: NSHTTPPropertyStatusCodeKey] description], @"200",
+    "status line is parsed");
+  PASS([[[doc headerNamed: @"connection"] rawMimeData] length] > 0,
+    "header created from raw bytes can be written");
+
+  [arp release]; arp = nil;
+  return 0;
+}
+#else
+int main(int argc,char **argv)
+{
+  return 0;
+}
+#endif
@@ -0,0 +1,148 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSKeyValueCoding.h>
+#import <Foundation/NSKeyValueObserving.h>
+#import <Foundation/NSValue.h>
+#import <GNUstepBase/GSObjCRuntime.h>
+
+@interface Cached : NSObject
+{
+  NSString	*name;
+  int		count;
+  id		thing;
+}
+- (void) setThing: (id)t;
+- (id) thing;
+@end
+
+@implementation Cached
+- (void) dealloc
+{
+  [name release];
+  [thing release];
+  [super dealloc];
+}
+- (void) setThing: (id)t
+{
+  [t retain];
+  [thing release];
+  thing = t;
+}
+- (id) thing
+{
+  return thing;
+}
+@end
+
+@interface OtherCached : NSObject
+- (id) thing;
+@end
+
+@implementation OtherCached
+- (id) thing
+{
+  return @"other";
+}
+@end
+
+@interface Extra : NSObject
+- (NSString*) name;
+@end
+
+@implementation Extra
+- (NSString*) name
+{
+  return @"method";
+}
+@end
+
+@interface Watcher : NSObject
+{
+@public
+  int	seen;
+}
+@end
+
+@implementation Watcher
+- (void) observeValueForKeyPath: (NSString*)path
+		       ofObject: (id)object
+			 change: (NSDictionary*)change
+			context: (void*)context
+{
+  seen++;
+}
+@end
+
+static id
+replacedThing(id self, SEL _cmd)
+{
+  return @"replaced";
+}
+
+static id
+getThing(id self, SEL _cmd)
+{
+  return @"getThing";
+}
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  Cached		*c = [[Cached new] autorelease];
+  OtherCached		*o = [[OtherCached new] autorelease];
+  Watcher		*w = [[Watcher new] autorelease];
+  unsigned		methodCount;
+  Method		*methods;
+  BOOL			ok;
+  int			i;
+
+  ok = YES;
+  for (i = 0; i < 100; i++)
+    {
+      NSString	*s = [NSString stringWithFormat: @"%d", i];
+
+      [c setValue: s forKey: @"name"];
+      [c setValue: [NSNumber numberWithInt: i] forKey: @"count"];
+      [c setValue: s forKey: @"thing"];
+      if (NO == [[c valueForKey: @"name"] isEqual: s]
+	|| [[c valueForKey: @"count"] intValue] != i
+	|| NO == [[c valueForKey: @"thing"] isEqual: s])
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok, "repeated access through variables and methods works");
+
+  PASS_EQUAL([o valueForKey: @"thing"], @"other",
+    "the same key of another class uses that class's accessor");
+  PASS_EQUAL([c valueForKey: @"thing"], @"99",
+    "the accessor of the first class is unaffected");
+
+  [c addObserver: w forKeyPath: @"thing" options: 0 context: 0];
+  [c setValue: @"observed" forKey: @"thing"];
+  PASS(w->seen > 0, "setting a value notifies an observer added later");
+  PASS_EQUAL([c valueForKey: @"thing"], @"observed",
+    "value set while observed is correct");
+  [c removeObserver: w forKeyPath: @"thing"];
+
+  methods = class_copyMethodList([Extra class], &methodCount);
+  GSObjCAddMethods([Cached class], methods, NO);
+  free(methods);
+  PASS_EQUAL([c valueForKey: @"name"], @"method",
+    "a method added to the class replaces a cached variable");
+
+  /* Methods changed directly through the runtime are noticed too.
+   */
+  PASS_EQUAL([o valueForKey: @"thing"], @"other", "accessor is cached");
+  class_replaceMethod([OtherCached class], @selector(thing),
+    (IMP)replacedThing, "@@:");
+  PASS_EQUAL([o valueForKey: @"thing"], @"replaced",
+    "a method replaced using the runtime is used");
+  class_addMethod([OtherCached class], sel_registerName("getThing"),
+    (IMP)getThing, "@@:");
+  PASS_EQUAL([o valueForKey: @"thing"], @"getThing",
+    "a method added using the runtime which takes precedence is used");
+
+  [arp release]; arp = nil;
+  return 0;
+}
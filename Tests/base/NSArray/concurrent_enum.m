@@ -0,0 +1,127 @@
+#import "Testing.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSDictionary.h>
+#import <Foundation/NSIndexSet.h>
+#import <Foundation/NSLock.h>
+#import <Foundation/NSSet.h>
+#import <Foundation/NSValue.h>
+
+int main()
+{
+  START_SET("Concurrent enumeration")
+# ifndef __has_feature
+# define __has_feature(x) 0
+# endif
+# if __has_feature(blocks)
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSMutableArray	*numbers = [NSMutableArray array];
+  NSMutableDictionary	*dict = [NSMutableDictionary dictionary];
+  NSMutableIndexSet	*indexes = [NSMutableIndexSet indexSet];
+  NSIndexSet		*found;
+  NSSet			*set;
+  NSSet			*keys;
+  NSLock		*lock = [[NSLock new] autorelease];
+  __block NSUInteger	total;
+  NSUInteger		count = 10000;
+  NSUInteger		expected = 0;
+  NSUInteger		i;
+  BOOL			ok;
+
+  for (i = 0; i < count; i++)
+    {
+      NSNumber	*n = [NSNumber numberWithUnsignedInteger: i];
+
+      [numbers addObject: n];
+      [dict setObject: n forKey: [n stringValue]];
+      expected += i;
+    }
+  set = [NSSet setWithArray: numbers];
+
+  total = 0;
+  [numbers enumerateObjectsWithOptions: NSEnumerationConcurrent
+    usingBlock: ^(id obj, NSUInteger idx, BOOL *stop) {
+      [lock lock];
+      total += idx + [obj unsignedIntegerValue];
+      [lock unlock];
+    }];
+  PASS(total == 2 * expected, "concurrent array enumeration visits each object");
+
+  found = [numbers indexesOfObjectsWithOptions: NSEnumerationConcurrent
+    passingTest: ^ BOOL (id obj, NSUInteger idx, BOOL *stop) {
+      return (idx % 3 == 0 || (idx >= 5000 && idx < 6000)) ? YES : NO;
+    }];
+  ok = YES;
+  for (i = 0; i < count; i++)
+    {
+      if ([found containsIndex: i]
+	!= ((i % 3 == 0 || (i >= 5000 && i < 6000)) ? YES : NO))
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok, "concurrent indexesOfObjectsWithOptions:passingTest: works");
+
+  PASS([numbers indexOfObjectWithOptions: NSEnumerationConcurrent
+    passingTest: ^ BOOL (id obj, NSUInteger idx, BOOL *stop) {
+      return [obj unsignedIntegerValue] == 7777 ? YES : NO;
+    }] == 7777, "concurrent indexOfObjectWithOptions:passingTest: works");
+  PASS([numbers indexOfObjectWithOptions: NSEnumerationConcurrent
+    passingTest: ^ BOOL (id obj, NSUInteger idx, BOOL *stop) {
+      return NO;
+    }] == NSNotFound, "concurrent indexOfObjectWithOptions: can fail");
+
+  total = 0;
+  [dict enumerateKeysAndObjectsWithOptions: NSEnumerationConcurrent
+    usingBlock: ^(id key, id obj, BOOL *stop) {
+      [lock lock];
+      total += [key intValue] + [obj unsignedIntegerValue];
+      [lock unlock];
+    }];
+  PASS(total == 2 * expected, "concurrent dictionary enumeration works");
+
+  keys = [dict keysOfEntriesWithOptions: NSEnumerationConcurrent
+    passingTest: ^ BOOL (id key, id obj, BOOL *stop) {
+      return [obj unsignedIntegerValue] % 2 == 0 ? YES : NO;
+    }];
+  PASS([keys count] == count / 2 && [keys containsObject: @"9998"]
+    && NO == [keys containsObject: @"9999"],
+    "concurrent keysOfEntriesWithOptions:passingTest: works");
+
+  total = 0;
+  [set enumerateObjectsWithOptions: NSEnumerationConcurrent
+    usingBlock: ^(id obj, BOOL *stop) {
+      [lock lock];
+      total += [obj unsignedIntegerValue];
+      [lock unlock];
+    }];
+  PASS(total == expected, "concurrent set enumeration works");
+
+  PASS([[set objectsWithOptions: NSEnumerationConcurrent
+    passingTest: ^ BOOL (id obj, BOOL *stop) {
+      return [obj unsignedIntegerValue] < 100 ? YES : NO;
+    }] count] == 100, "concurrent objectsWithOptions:passingTest: works");
+
+  [indexes addIndexesInRange: NSMakeRange(10, 5000)];
+  [indexes addIndexesInRange: NSMakeRange(6000, 3000)];
+  [indexes addIndex: 20000];
+  total = 0;
+  [indexes enumerateIndexesInRange: NSMakeRange(100, 15000)
+    options: NSEnumerationConcurrent
+    usingBlock: ^(NSUInteger idx, BOOL *stop) {
+      [lock lock];
+      total += idx;
+      [lock unlock];
+    }];
+  expected = 0;
+  for (i = 100; i < 5010; i++) expected += i;
+  for (i = 6000; i < 9000; i++) expected += i;
+  PASS(total == expected, "concurrent index set enumeration works in a range");
+
+  [arp release]; arp = nil;
+# else
+  SKIP("No Blocks support in the compiler.")
+# endif
+  END_SET("Concurrent enumeration")
+  return 0;
+}
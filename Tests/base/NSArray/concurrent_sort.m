@@ -0,0 +1,100 @@
+#import "Testing.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSException.h>
+#import <Foundation/NSSet.h>
+#import <Foundation/NSValue.h>
+
+int main()
+{
+  START_SET("NSArray concurrent sorting")
+# ifndef __has_feature
+# define __has_feature(x) 0
+# endif
+# if __has_feature(blocks)
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSMutableArray	*pairs = [NSMutableArray array];
+  NSArray		*sorted;
+  NSComparator		byKey;
+  NSUInteger		count = 100000;
+  NSUInteger		i;
+  BOOL			ordered;
+  BOOL			stable;
+  BOOL			raised;
+
+  /* Pairs of (key, position) with many duplicate keys, in a large enough
+   * array for the work to be split between threads.
+   */
+  srandom(1);
+  for (i = 0; i < count; i++)
+    {
+      [pairs addObject: [NSArray arrayWithObjects:
+	[NSNumber numberWithInteger: random() % 1000],
+	[NSNumber numberWithUnsignedInteger: i], nil]];
+    }
+  byKey = ^ NSComparisonResult (id a, id b) {
+    return [[a objectAtIndex: 0] compare: [b objectAtIndex: 0]];
+  };
+
+  sorted = [pairs sortedArrayWithOptions: NSSortConcurrent | NSSortStable
+			 usingComparator: byKey];
+  ordered = ([sorted count] == count);
+  stable = YES;
+  for (i = 1; i < [sorted count]; i++)
+    {
+      NSComparisonResult	r = byKey([sorted objectAtIndex: i - 1],
+	[sorted objectAtIndex: i]);
+
+      if (r == NSOrderedDescending)
+	{
+	  ordered = NO;
+	}
+      else if (r == NSOrderedSame
+	&& [[[sorted objectAtIndex: i - 1] objectAtIndex: 1]
+	  compare: [[sorted objectAtIndex: i] objectAtIndex: 1]]
+	  != NSOrderedAscending)
+	{
+	  stable = NO;
+	}
+    }
+  PASS(ordered, "concurrent stable sort orders a large array");
+  PASS(stable, "concurrent stable sort keeps equal objects in order");
+
+  sorted = [pairs sortedArrayWithOptions: NSSortConcurrent
+			 usingComparator: byKey];
+  ordered = ([sorted count] == count);
+  for (i = 1; i < [sorted count]; i++)
+    {
+      if (byKey([sorted objectAtIndex: i - 1], [sorted objectAtIndex: i])
+	== NSOrderedDescending)
+	{
+	  ordered = NO;
+	}
+    }
+  PASS(ordered, "concurrent unstable sort orders a large array");
+  PASS([[NSSet setWithArray: sorted] count] == count,
+    "concurrent unstable sort keeps every object");
+
+  raised = NO;
+  NS_DURING
+    {
+      [pairs sortedArrayWithOptions: NSSortConcurrent | NSSortStable
+		    usingComparator: ^ NSComparisonResult (id a, id b) {
+	[NSException raise: NSGenericException format: @"comparison"];
+	return NSOrderedSame;
+      }];
+    }
+  NS_HANDLER
+    {
+      raised = [[localException reason] isEqual: @"comparison"];
+    }
+  NS_ENDHANDLER
+  PASS(raised, "exception in a concurrent comparison reaches the caller");
+
+  [arp release]; arp = nil;
+# else
+  SKIP("No Blocks support in the compiler.")
+# endif
+  END_SET("NSArray concurrent sorting")
+  return 0;
+}
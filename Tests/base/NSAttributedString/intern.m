@@ -0,0 +1,112 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAttributedString.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSDictionary.h>
+#import <Foundation/NSLock.h>
+#import <Foundation/NSThread.h>
+#import <Foundation/NSValue.h>
+
+static NSConditionLock	*done = nil;
+static BOOL		failed = NO;
+
+@interface	Builder : NSObject
+- (void) run: (id)arg;
+@end
+
+@implementation	Builder
+- (void) run: (id)arg
+{
+  NSAutoreleasePool		*arp = [NSAutoreleasePool new];
+  NSMutableAttributedString	*m;
+  unsigned			i;
+
+  m = [[[NSMutableAttributedString alloc] initWithString: @""
+					      attributes: nil] autorelease];
+  for (i = 0; i < 2000; i++)
+    {
+      NSDictionary		*d;
+      NSAttributedString	*a;
+
+      d = [NSDictionary dictionaryWithObject: [NSNumber numberWithInt: i % 7]
+				      forKey: @"key"];
+      a = [[NSAttributedString alloc] initWithString: @"ab" attributes: d];
+      [m appendAttributedString: a];
+      [a release];
+    }
+  for (i = 0; i < 2000; i++)
+    {
+      NSDictionary	*d = [m attributesAtIndex: i * 2 + 1 effectiveRange: 0];
+
+      if ([[d objectForKey: @"key"] intValue] != (int)(i % 7))
+	{
+	  failed = YES;
+	}
+    }
+  [done lock];
+  [done unlockWithCondition: [done condition] + 1];
+  [arp release];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool		*arp = [NSAutoreleasePool new];
+  Builder			*b = [[Builder new] autorelease];
+  NSMutableDictionary		*d1;
+  NSDictionary			*d2;
+  NSAttributedString		*s1;
+  NSAttributedString		*s2;
+  NSMutableAttributedString	*m;
+  NSRange			r;
+  unsigned			i;
+
+  d1 = [NSMutableDictionary dictionary];
+  [d1 setObject: @"one" forKey: @"a"];
+  [d1 setObject: [NSNumber numberWithInt: 2] forKey: @"b"];
+  d2 = [NSDictionary dictionaryWithObjectsAndKeys:
+    [NSNumber numberWithInt: 2], @"b", @"one", @"a", nil];
+  s1 = [[[NSAttributedString alloc] initWithString: @"x" attributes: d1]
+    autorelease];
+  s2 = [[[NSAttributedString alloc] initWithString: @"y" attributes: d2]
+    autorelease];
+  PASS([s1 attributesAtIndex: 0 effectiveRange: 0]
+    == [s2 attributesAtIndex: 0 effectiveRange: 0],
+    "equal attributes are shared between strings");
+  [d1 setObject: @"two" forKey: @"a"];
+  PASS_EQUAL([[s1 attributesAtIndex: 0 effectiveRange: 0] objectForKey: @"a"],
+    @"one", "attributes are copied when interned");
+
+  m = [[[NSMutableAttributedString alloc] initWithString: @"" attributes: nil]
+    autorelease];
+  for (i = 0; i < 1000; i++)
+    {
+      [m appendAttributedString: (i % 2) ? s1 : s2];
+    }
+  r = NSMakeRange(0, 0);
+  [m attributesAtIndex: 500 effectiveRange: &r];
+  PASS(r.location == 0 && r.length == 1000,
+    "adjacent runs with equal attributes are merged");
+  [m addAttribute: @"c" value: @"x" range: NSMakeRange(100, 10)];
+  [m attributesAtIndex: 105 effectiveRange: &r];
+  PASS(r.location == 100 && r.length == 10, "a run is split by a change");
+  [m attributesAtIndex: 999 effectiveRange: &r];
+  PASS(r.location == 110 && r.length == 890, "the run after a change");
+  PASS_EQUAL([[[m attributedSubstringFromRange: NSMakeRange(95, 20)]
+    attributesAtIndex: 10 effectiveRange: 0] objectForKey: @"c"], @"x",
+    "a substring copies the runs of its range");
+
+  done = [[NSConditionLock alloc] initWithCondition: 0];
+  for (i = 0; i < 4; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(run:)
+			       toTarget: b
+			     withObject: nil];
+    }
+  [done lockWhenCondition: 4];
+  [done unlock];
+  [done release];
+  PASS(NO == failed, "strings built concurrently have the right attributes");
+
+  [arp release]; arp = nil;
+  return 0;
+}
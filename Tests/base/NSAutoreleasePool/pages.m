@@ -0,0 +1,77 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSObject.h>
+
+static unsigned	released;
+@interface Counted : NSObject @end
+@implementation Counted
+- (oneway void) release
+{
+  released++;
+  [super release];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSAutoreleasePool	*inner;
+  Counted		*a = [Counted new];
+  Counted		*b = [Counted new];
+  void			*token;
+  unsigned		i;
+
+  /* Enough objects to fill several pages, in runs of the same object.
+   */
+  inner = [NSAutoreleasePool new];
+  for (i = 0; i < 10000; i++)
+    {
+      [[a retain] autorelease];
+      if (i % 7 == 0)
+	{
+	  [[b retain] autorelease];
+	}
+    }
+  PASS([inner autoreleaseCount] == 10000 + 1429,
+    "objects are counted across pages");
+  PASS([NSAutoreleasePool autoreleaseCountForObject: a] == 10000,
+    "count for an object is correct across pages");
+  released = 0;
+  [inner emptyPool];
+  PASS(released == 10000 + 1429, "every object is released on emptying");
+  PASS([a retainCount] == 1 && [b retainCount] == 1,
+    "runs of an object are released the right number of times");
+  PASS([inner autoreleaseCount] == 0, "emptied pool is empty");
+  [[a retain] autorelease];
+  PASS([inner autoreleaseCount] == 1, "emptied pool may be reused");
+  [inner release];
+  PASS([a retainCount] == 1, "reused pool releases its objects");
+
+  token = GSAutoreleasePoolPush();
+  PASS(token != 0 && token == (void*)[NSAutoreleasePool currentPool],
+    "GSAutoreleasePoolPush() makes a current pool");
+  for (i = 0; i < 5000; i++)
+    {
+      [[b retain] autorelease];
+    }
+  inner = [NSAutoreleasePool new];
+  [[a retain] autorelease];
+  GSAutoreleasePoolPop(token);
+  PASS([a retainCount] == 1 && [b retainCount] == 1,
+    "GSAutoreleasePoolPop() releases objects in the pool and its children");
+  PASS([NSAutoreleasePool currentPool] == arp,
+    "GSAutoreleasePoolPop() restores the previous pool");
+
+  for (i = 0; i < 100; i++)
+    {
+      token = GSAutoreleasePoolPush();
+      [[a retain] autorelease];
+      GSAutoreleasePoolPop(token);
+    }
+  PASS([a retainCount] == 1, "nested push and pop are balanced");
+
+  [a release];
+  [b release];
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,137 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSCache.h>
+#import <Foundation/NSLock.h>
+#import <Foundation/NSThread.h>
+#import <Foundation/NSValue.h>
+
+@interface	Watcher : NSObject <NSCacheDelegate>
+{
+@public
+  NSMutableArray	*evicted;
+}
+@end
+
+@implementation	Watcher
+- (void) cache: (NSCache*)cache willEvictObject: (id)obj
+{
+  [evicted addObject: obj];
+}
+- (void) dealloc
+{
+  [evicted release];
+  [super dealloc];
+}
+- (id) init
+{
+  evicted = [NSMutableArray new];
+  return self;
+}
+@end
+
+static NSCache		*shared = nil;
+static NSLock		*lock = nil;
+static unsigned		finished = 0;
+static BOOL		consistent = YES;
+
+@interface	Worker : NSObject
++ (void) run: (NSNumber*)n;
+@end
+
+@implementation	Worker
++ (void) run: (NSNumber*)n
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  int			base = [n intValue] * 1000;
+  int			i;
+
+  for (i = 0; i < 20000; i++)
+    {
+      NSNumber	*k = [NSNumber numberWithInt: base + i % 500];
+      id	o = [shared objectForKey: k];
+
+      if (nil == o)
+	{
+	  [shared setObject: k forKey: k];
+	}
+      else if (NO == [o isEqual: k])
+	{
+	  consistent = NO;
+	}
+      if (i % 7 == 0)
+	{
+	  [shared removeObjectForKey: k];
+	}
+    }
+  [lock lock];
+  finished++;
+  [lock unlock];
+  [arp release];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSCache		*c = [[NSCache new] autorelease];
+  Watcher		*w = [[Watcher new] autorelease];
+  int			i;
+
+  [c setDelegate: w];
+  [c setCountLimit: 3];
+  [c setObject: @"A" forKey: @"a"];
+  [c setObject: @"B" forKey: @"b"];
+  [c setObject: @"C" forKey: @"c"];
+  [c setObject: @"D" forKey: @"d"];
+  PASS([c objectForKey: @"a"] == nil, "least recently used object is evicted");
+  PASS_EQUAL(w->evicted, [NSArray arrayWithObject: @"A"],
+    "delegate is told of the eviction");
+  PASS_EQUAL([c objectForKey: @"b"], @"B", "other objects remain");
+  [c setObject: @"E" forKey: @"e"];
+  PASS([c objectForKey: @"c"] == nil && [c objectForKey: @"b"] != nil,
+    "using an object keeps it in the cache");
+  PASS([c evictionCount] == 2, "evictions are counted");
+  PASS([c hitCount] == 2 && [c missCount] == 2, "hits and misses are counted");
+
+  [c removeAllObjects];
+  PASS([c objectForKey: @"b"] == nil, "objects are removed");
+  [c setCountLimit: 0];
+  [c setTotalCostLimit: 10];
+  [c setObject: @"X" forKey: @"x" cost: 6];
+  [c setObject: @"Y" forKey: @"y" cost: 3];
+  [c setObject: @"Z" forKey: @"z" cost: 4];
+  PASS([c objectForKey: @"x"] == nil && [c objectForKey: @"y"] != nil
+    && [c objectForKey: @"z"] != nil, "total cost limit is kept");
+  [c setObject: @"Y2" forKey: @"y" cost: 1];
+  PASS_EQUAL([c objectForKey: @"y"], @"Y2", "object for a key is replaced");
+  [c setTotalCostLimit: 0];
+  for (i = 0; i < 1000; i++)
+    {
+      [c setObject: @"V" forKey: [NSNumber numberWithInt: i]];
+    }
+  PASS([c objectForKey: [NSNumber numberWithInt: 0]] != nil
+    && [c objectForKey: [NSNumber numberWithInt: 999]] != nil,
+    "a cache without limits keeps all its objects");
+
+  shared = [NSCache new];
+  [shared setCountLimit: 2000];
+  lock = [NSLock new];
+  for (i = 0; i < 4; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(run:)
+			       toTarget: [Worker class]
+			     withObject: [NSNumber numberWithInt: i]];
+    }
+  while (finished < 4)
+    {
+      [NSThread sleepForTimeInterval: 0.01];
+    }
+  PASS(consistent, "threads using a cache at once find their own objects");
+  PASS([shared hitCount] + [shared missCount] == 80000,
+    "every lookup from every thread is counted");
+  [shared release];
+  [lock release];
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,155 @@
+#import <Foundation/Foundation.h>
+#import "ObjectTesting.h"
+
+static NSData *
+utf8(NSString *s)
+{
+  return [s dataUsingEncoding: NSUTF8StringEncoding];
+}
+
+int main(void)
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSMutableString       *lines = [NSMutableString string];
+  NSMutableArray        *values;
+  NSInputStream         *is;
+  GSJSONReader          *r;
+  GSJSONToken           t;
+  id                    obj;
+  int                   i;
+
+  r = [[GSJSONReader alloc] initWithData:
+    utf8(@"{\"a\": [1, \"two\", true, null], \"b\": {}}") options: 0];
+  PASS([r nextToken] == GSJSONTokenStartObject, "start of object");
+  PASS([r nextToken] == GSJSONTokenKey && [[r value] isEqual: @"a"],
+    "key of member");
+  PASS([r nextToken] == GSJSONTokenStartArray
+    && [[r keyPath] isEqual: @"a"], "start of array has its key path");
+  PASS([r nextToken] == GSJSONTokenNumber && [[r value] intValue] == 1,
+    "number");
+  PASS([r nextToken] == GSJSONTokenString && [[r value] isEqual: @"two"],
+    "string");
+  PASS([r nextToken] == GSJSONTokenBoolean && [[r value] boolValue] == YES,
+    "boolean");
+  PASS([r nextToken] == GSJSONTokenNull && [r value] == [NSNull null],
+    "null");
+  PASS([r nextToken] == GSJSONTokenEndArray && [r depth] == 1, "end of array");
+  PASS([r nextToken] == GSJSONTokenKey && [[r key] isEqual: @"b"],
+    "second key");
+  PASS([r nextToken] == GSJSONTokenStartObject, "start of empty object");
+  PASS([r nextToken] == GSJSONTokenEndObject, "end of empty object");
+  PASS([r nextToken] == GSJSONTokenEndObject && [r depth] == 0,
+    "end of top level object");
+  PASS([r nextToken] == GSJSONTokenNone && [r error] == nil,
+    "end of input without error");
+  [r release];
+
+  r = [[GSJSONReader alloc] initWithData:
+    utf8(@"[{\"x\": [1, [2, {\"y\": \"}\"}]]}, {\"x\": 3}]") options: 0];
+  PASS([r nextToken] == GSJSONTokenStartArray, "outer array");
+  PASS([r nextToken] == GSJSONTokenStartObject, "first element");
+  [r skipValue];
+  PASS([r nextToken] == GSJSONTokenStartObject, "skipped to next element");
+  PASS_EQUAL([r readValue], [NSDictionary dictionaryWithObject:
+    [NSNumber numberWithInt: 3] forKey: @"x"], "element read as a whole");
+  PASS([r nextToken] == GSJSONTokenEndArray, "end after reading value");
+  [r release];
+
+  r = [[GSJSONReader alloc] initWithData:
+    utf8(@"{\"meta\": {\"big\": [1, 2, 3]}, \"items\": [{\"id\": 1, \"n\": 2},"
+      @" {\"id\": 2, \"n\": \"x\"}], \"id\": 9}") options: 0];
+  [r setKeyPaths: [NSArray arrayWithObject: @"items.id"]];
+  values = [NSMutableArray array];
+  while ((t = [r nextToken]) != GSJSONTokenNone)
+    {
+      PASS(t == GSJSONTokenKey || t == GSJSONTokenNumber,
+        "only tokens within the key path are returned");
+      if (t == GSJSONTokenNumber)
+        {
+          [values addObject: [r value]];
+          PASS_EQUAL([r keyPath], @"items.id", "value has wanted key path");
+        }
+    }
+  PASS_EQUAL(values, ([NSArray arrayWithObjects:
+    [NSNumber numberWithInt: 1], [NSNumber numberWithInt: 2], nil]),
+    "key path filter finds values in arrays of objects");
+  PASS([r error] == nil, "filtering parses without error");
+  [r release];
+
+  /* Newline delimited JSON from a stream, with values straddling the
+   * buffers read from the stream.
+   */
+  for (i = 0; i < 20000; i++)
+    {
+      [lines appendFormat: @"{\"n\": %d, \"s\": \"line %d \\u00e9\"}\n", i, i];
+    }
+  is = [NSInputStream inputStreamWithData: utf8(lines)];
+  [is open];
+  r = [[GSJSONReader alloc] initWithStream: is options: 0];
+  [r setKeyPaths: [NSArray arrayWithObject: @"n"]];
+  i = 0;
+  while ((t = [r nextToken]) != GSJSONTokenNone)
+    {
+      if (t == GSJSONTokenNumber && [[r value] intValue] == i)
+        {
+          i++;
+        }
+    }
+  PASS(20000 == i && [r error] == nil, "every document in a stream is read");
+  [r release];
+  [is close];
+
+  is = [NSInputStream inputStreamWithData: utf8(lines)];
+  [is open];
+  r = [[GSJSONReader alloc] initWithStream: is options: 0];
+  i = 0;
+  while ((t = [r nextToken]) != GSJSONTokenNone)
+    {
+      obj = [r readValue];
+      if ([[obj objectForKey: @"s"] isEqual:
+        [NSString stringWithFormat: @"line %d %C", i, (unichar)0xe9]])
+        {
+          i++;
+        }
+    }
+  PASS(20000 == i && [r error] == nil, "documents are read as a whole");
+  [r release];
+  [is close];
+
+  /* A single value much larger than the buffer is read whole.
+   */
+  [lines setString: @"["];
+  for (i = 0; i < 200000; i++)
+    {
+      [lines appendFormat: @"%s{\"n\": %d}", (i > 0 ? "," : ""), i];
+    }
+  [lines appendString: @"]"];
+  is = [NSInputStream inputStreamWithData: utf8(lines)];
+  [is open];
+  r = [[GSJSONReader alloc] initWithStream: is options: 0];
+  obj = [r readValue];
+  PASS([obj count] == 200000
+    && [[[obj lastObject] objectForKey: @"n"] intValue] == 199999
+    && [r error] == nil, "a value larger than the buffer is read");
+  [r release];
+  [is close];
+
+  r = [[GSJSONReader alloc] initWithData:
+    [@"[\"utf16\"]" dataUsingEncoding: NSUTF16LittleEndianStringEncoding]
+    options: 0];
+  PASS([r nextToken] == GSJSONTokenStartArray, "UTF-16 input is read");
+  PASS([r nextToken] == GSJSONTokenString && [[r value] isEqual: @"utf16"],
+    "UTF-16 string value");
+  [r release];
+
+  r = [[GSJSONReader alloc] initWithData: utf8(@"[1, tru]") options: 0];
+  [r nextToken];
+  [r nextToken];
+  PASS([r nextToken] == GSJSONTokenNone && [r error] != nil,
+    "an error ends parsing");
+  PASS([r nextToken] == GSJSONTokenNone, "parsing stays stopped after error");
+  [r release];
+
+  [arp release]; arp = nil;
+  return 0;
+}
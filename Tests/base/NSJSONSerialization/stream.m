@@ -0,0 +1,74 @@
+#import <Foundation/Foundation.h>
+#import "ObjectTesting.h"
+
+int main(void)
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSMutableArray        *big = [NSMutableArray array];
+  NSOutputStream        *os;
+  NSDictionary          *obj;
+  NSString              *s;
+  NSData                *data;
+  NSData                *streamed;
+  NSError               *error;
+  NSInteger             written;
+  unichar               u[] = { 'a', 0, 0xd83d, 0xde00, 0xd800, 'b' };
+  int                   i;
+
+  for (i = 0; i < 5000; i++)
+    {
+      [big addObject: [NSString stringWithFormat: @"item %d \"quoted\"\n", i]];
+    }
+  s = [NSString stringWithCharacters: u length: 6];
+  obj = [NSDictionary dictionaryWithObjectsAndKeys:
+    big, @"big",
+    @"café", @"latin1",
+    @"中文", @"unicode",
+    s, @"awkward",
+    @"tab\there", @"escapes",
+    [NSNumber numberWithDouble: 1.5], @"number",
+    [NSNull null], @"null",
+    nil];
+
+  data = [NSJSONSerialization dataWithJSONObject: obj options: 0 error: 0];
+  PASS_EQUAL([NSJSONSerialization JSONObjectWithData: data
+                                             options: 0
+                                               error: 0], obj,
+    "document round trips through data");
+
+  os = [NSOutputStream outputStreamToMemory];
+  [os open];
+  written = [NSJSONSerialization writeJSONObject: obj
+                                        toStream: os
+                                         options: 0
+                                           error: &error];
+  streamed = [os propertyForKey: NSStreamDataWrittenToMemoryStreamKey];
+  [os close];
+  PASS(written == (NSInteger)[data length] && nil == error,
+    "writing to a stream reports the number of bytes written");
+  PASS_EQUAL(streamed, data, "stream gets the same bytes as data");
+
+  os = [NSOutputStream outputStreamToMemory];
+  [os open];
+  written = [NSJSONSerialization writeJSONObject:
+    [NSArray arrayWithObject: [NSDate date]]
+                                        toStream: os
+                                         options: 0
+                                           error: &error];
+  streamed = [os propertyForKey: NSStreamDataWrittenToMemoryStreamKey];
+  [os close];
+  PASS(0 == written && nil != error && 0 == [streamed length],
+    "nothing is written for an invalid object");
+  PASS(NO == [NSJSONSerialization isValidJSONObject:
+    [NSArray arrayWithObject: [NSDate date]]],
+    "an array containing an invalid object is invalid");
+
+  data = [NSJSONSerialization dataWithJSONObject:
+    [NSArray arrayWithObject: @"a\"b\\c/d\001"] options: 0 error: 0];
+  PASS_EQUAL([[[NSString alloc] initWithData: data
+    encoding: NSUTF8StringEncoding] autorelease],
+    @"[\"a\\\"b\\\\c/d\\u0001\"]", "characters are escaped as before");
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,79 @@
+#import <Foundation/Foundation.h>
+#import "ObjectTesting.h"
+
+/* UTF-8 data is parsed directly from its bytes, other encodings through
+ * the character buffer, so check that both get the same results.
+ */
+static id
+parse(NSString *json, NSStringEncoding enc, NSJSONReadingOptions opt)
+{
+  NSData        *data = [json dataUsingEncoding: enc];
+
+  return [NSJSONSerialization JSONObjectWithData: data options: opt error: 0];
+}
+
+int main(void)
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSMutableString       *long1 = [NSMutableString string];
+  NSString              *json;
+  NSData                *data;
+  NSError               *error;
+  id                    obj;
+  int                   i;
+
+  for (i = 0; i < 200; i++)
+    {
+      [long1 appendString: @"abc\\n\\\"\\u00e9\\u4e2d"];
+    }
+  json = [NSString stringWithFormat: @"{\"plain\": \"a plain ascii string "
+    @"long enough to need more than one block\", \"escapes\": \"%@\", "
+    @"\"utf8\": \"café 中文 \U0001F600\", "
+    @"\"pair\": \"\\ud83d\\ude00\", \"lone\": \"x\\ud800y\", "
+    @"\"numbers\": [0, -1, 12345678901234567, 123456789012345678901, "
+    @"1.5, -2.5e3, 1E-2], \"literals\": [true, false, null], "
+    @"\"trailing\": [1, 2,], }", long1];
+
+  obj = parse(json, NSUTF8StringEncoding, 0);
+  PASS(obj != nil && [obj count] == 8, "UTF-8 document was parsed");
+  PASS_EQUAL(obj, parse(json, NSUTF16LittleEndianStringEncoding, 0),
+    "UTF-8 and UTF-16 input give the same result");
+  PASS_EQUAL([obj objectForKey: @"utf8"], @"café 中文 \U0001F600",
+    "non-ASCII characters are decoded");
+  PASS_EQUAL([obj objectForKey: @"pair"], @"\U0001F600",
+    "escaped surrogate pair is decoded");
+  PASS([[obj objectForKey: @"lone"] length] == 3
+    && [[obj objectForKey: @"lone"] characterAtIndex: 1] == 0xd800,
+    "escaped lone surrogate is kept");
+  PASS([[obj objectForKey: @"escapes"] length] == 1400,
+    "long string with escapes is decoded");
+  PASS_EQUAL([[obj objectForKey: @"numbers"] objectAtIndex: 2],
+    [NSNumber numberWithDouble: 12345678901234567.0],
+    "large integer is parsed");
+  PASS_EQUAL([[obj objectForKey: @"numbers"] objectAtIndex: 5],
+    [NSNumber numberWithDouble: -2500.0], "exponent is parsed");
+
+  obj = parse(@"[\"abc\"]", NSUTF8StringEncoding,
+    NSJSONReadingMutableLeaves);
+  [[obj objectAtIndex: 0] appendString: @"def"];
+  PASS_EQUAL([obj objectAtIndex: 0], @"abcdef",
+    "mutable leaves are created from bytes");
+
+  data = [NSData dataWithBytes: "[\"\xff\xfe\"]" length: 6];
+  error = nil;
+  obj = [NSJSONSerialization JSONObjectWithData: data options: 0 error: &error];
+  PASS(nil == obj && nil != error, "invalid UTF-8 is a parse error");
+
+  data = [NSData dataWithBytes: "{\"a\": \"unterminated" length: 19];
+  error = nil;
+  obj = [NSJSONSerialization JSONObjectWithData: data options: 0 error: &error];
+  PASS(nil == obj && nil != error, "unterminated string is a parse error");
+
+  data = [NSData dataWithBytes: "\xef\xbb\xbf[12]" length: 7];
+  obj = [NSJSONSerialization JSONObjectWithData: data options: 0 error: 0];
+  PASS_EQUAL(obj, [NSArray arrayWithObject: [NSNumber numberWithInt: 12]],
+    "byte order mark is skipped");
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,143 @@
+#import <Foundation/Foundation.h>
+#import "ObjectTesting.h"
+
+#define	THREADS		4
+#define	POSTS		10000
+
+static NSString	*names[THREADS];
+static unsigned	received[THREADS];
+static unsigned	finished = 0;
+static NSLock	*lock = nil;
+
+@interface	Counter : NSObject
+{
+@public
+  unsigned	index;
+}
+- (void) count: (NSNotification*)n;
+@end
+
+@implementation	Counter
+- (void) count: (NSNotification*)n
+{
+  received[index]++;
+}
+@end
+
+@interface	Poster : NSObject
+- (void) post: (NSNumber*)index;
+- (void) churn: (id)ignored;
+@end
+
+@implementation	Poster
+- (void) post: (NSNumber*)index
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  NSString		*name = names[[index intValue]];
+  unsigned		i;
+
+  for (i = 0; i < POSTS; i++)
+    {
+      [nc postNotificationName: name object: self];
+    }
+  [lock lock];
+  finished++;
+  [lock unlock];
+  [arp release];
+}
+
+/* Add and remove observers of other names while notifications are
+ * being posted.
+ */
+- (void) churn: (id)ignored
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  BOOL			done = NO;
+
+  while (NO == done)
+    {
+      Counter	*c = [Counter new];
+      unsigned	i;
+
+      for (i = 0; i < 10; i++)
+	{
+	  [nc addObserver: c
+		 selector: @selector(count:)
+		     name: [NSString stringWithFormat: @"Churn%u", i]
+		   object: nil];
+	}
+      [nc removeObserver: c];
+      [c release];
+      [lock lock];
+      done = (finished == THREADS) ? YES : NO;
+      [lock unlock];
+    }
+  [arp release];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSNotificationCenter	*nc = [NSNotificationCenter defaultCenter];
+  Poster		*poster = [[Poster new] autorelease];
+  Counter		*counters[THREADS];
+  BOOL			ok;
+  unsigned		i;
+
+  lock = [NSLock new];
+  for (i = 0; i < THREADS; i++)
+    {
+      names[i] = [[NSString alloc] initWithFormat: @"Thread%u", i];
+      counters[i] = [Counter new];
+      counters[i]->index = i;
+      [nc addObserver: counters[i]
+	     selector: @selector(count:)
+		 name: names[i]
+	       object: nil];
+    }
+  [NSThread detachNewThreadSelector: @selector(churn:)
+			   toTarget: poster
+			 withObject: nil];
+  for (i = 0; i < THREADS; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(post:)
+			       toTarget: poster
+			     withObject: [NSNumber numberWithInt: i]];
+    }
+  while (1)
+    {
+      unsigned	f;
+
+      [lock lock];
+      f = finished;
+      [lock unlock];
+      if (f == THREADS)
+	{
+	  break;
+	}
+      [NSThread sleepForTimeInterval: 0.01];
+    }
+  ok = YES;
+  for (i = 0; i < THREADS; i++)
+    {
+      if (received[i] != POSTS)
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok, "notifications posted concurrently are all delivered");
+
+  for (i = 0; i < THREADS; i++)
+    {
+      [nc removeObserver: counters[i]];
+      [counters[i] release];
+    }
+  [nc postNotificationName: names[0] object: nil];
+  PASS(received[0] == POSTS, "removed observer gets no notifications");
+
+  [arp release]; arp = nil;
+  return 0;
+}
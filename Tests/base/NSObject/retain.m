@@ -0,0 +1,135 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSLock.h>
+#import <Foundation/NSThread.h>
+
+/* The count at which NSObject.m moves part of an extra reference count
+ * into its spill table.
+ */
+#define	SPILL_LIMIT	0x40000000
+
+static NSObject		*shared = nil;
+static NSConditionLock	*done = nil;
+static unsigned		depth = 1;
+
+@interface	Worker : NSObject
+- (void) run: (id)arg;
+@end
+
+@implementation	Worker
+- (void) run: (id)arg
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  unsigned		i;
+
+  unsigned		j;
+
+  for (i = 0; i < 100000 / depth; i++)
+    {
+      for (j = 0; j < depth; j++)
+	{
+	  [shared retain];
+	}
+      for (j = 0; j < depth; j++)
+	{
+	  [shared release];
+	}
+    }
+  [done lock];
+  [done unlockWithCondition: [done condition] + 1];
+  [arp release];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  Worker		*w = [[Worker new] autorelease];
+  NSObject		*o = [NSObject new];
+  NSUInteger		count;
+  NSUInteger		n;
+  unsigned		i;
+
+  for (i = 0; i < 1000; i++)
+    {
+      [o retain];
+    }
+  PASS([o retainCount] == 1001, "retain count is incremented");
+  for (i = 0; i < 1000; i++)
+    {
+      [o release];
+    }
+  PASS([o retainCount] == 1, "retain count is decremented");
+  PASS(NSExtraRefCount(o) == 0, "extra reference count is zero");
+  NSIncrementExtraRefCount(o);
+  PASS(NSDecrementExtraRefCountWasZero(o) == NO,
+    "decrementing a non-zero count returns NO");
+  PASS(NSDecrementExtraRefCountWasZero(o) == YES,
+    "decrementing a zero count returns YES");
+  PASS([o retainCount] == 1, "a zero count is left unchanged");
+  [o release];
+
+  shared = [NSObject new];
+  done = [[NSConditionLock alloc] initWithCondition: 0];
+  for (i = 0; i < 4; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(run:)
+			       toTarget: w
+			     withObject: nil];
+    }
+  [done lockWhenCondition: 4];
+  [done unlock];
+  PASS([shared retainCount] == 1,
+    "retain count is correct after concurrent retains and releases");
+  [shared release];
+  [done release];
+
+  /* A count past the limit moves into the spill table and back.
+   * Concurrent retains and releases just below the limit may be the
+   * ones that take the count over it.
+   */
+  o = [NSObject new];
+  count = SPILL_LIMIT - 100;
+  for (n = 0; n < count; n++)
+    {
+      NSIncrementExtraRefCount(o);
+    }
+  shared = o;
+  done = [[NSConditionLock alloc] initWithCondition: 0];
+  depth = 50;
+  for (i = 0; i < 4; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(run:)
+			       toTarget: w
+			     withObject: nil];
+    }
+  [done lockWhenCondition: 4];
+  [done unlock];
+  [done release];
+  PASS(NSExtraRefCount(o) == count,
+    "retain count is correct after concurrent retains and releases"
+    " at the spill limit");
+  for (n = 0; n < 110; n++)
+    {
+      NSIncrementExtraRefCount(o);
+    }
+  count += 110;
+  PASS(NSExtraRefCount(o) == count && [o retainCount] == count + 1,
+    "retain count spilled from the object is counted");
+
+  for (n = 0; n < count - 10; n++)
+    {
+      NSDecrementExtraRefCountWasZero(o);
+    }
+  PASS([o retainCount] == 11, "spilled retain count is drained");
+  for (n = 0; n < 10; n++)
+    {
+      NSDecrementExtraRefCountWasZero(o);
+    }
+  PASS([o retainCount] == 1 && NSExtraRefCount(o) == 0,
+    "spill table is emptied");
+  [o release];
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,139 @@
+#import <Foundation/NSArray.h>
+#import <Foundation/NSKeyValueObserving.h>
+#import <Foundation/NSOperation.h>
+#import <Foundation/NSThread.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import "ObjectTesting.h"
+
+@interface      Watcher : NSObject
+{
+@public
+  unsigned      finished;
+  unsigned      counts;
+}
+@end
+@implementation Watcher
+- (void) observeValueForKeyPath: (NSString *)keyPath
+                       ofObject: (id)object
+                         change: (NSDictionary *)change
+                        context: (void *)context
+{
+  if ([keyPath isEqualToString: @"isFinished"])
+    finished++;
+  else if ([keyPath isEqualToString: @"operationCount"])
+    counts++;
+}
+@end
+
+@interface      Gate : NSOperation
+{
+@public
+  BOOL          opened;
+  BOOL          ran;
+}
+- (void) open;
+@end
+@implementation Gate
+- (BOOL) isReady
+{
+  return opened && [super isReady];
+}
+- (void) main
+{
+  ran = YES;
+}
+- (void) open
+{
+  [self willChangeValueForKey: @"isReady"];
+  opened = YES;
+  [self didChangeValueForKey: @"isReady"];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSOperationQueue      *q = [NSOperationQueue new];
+  NSOperationQueue      *q2 = [NSOperationQueue new];
+  Watcher               *w = [Watcher new];
+  NSOperation           *op1;
+  NSOperation           *op2;
+
+  op1 = [NSOperation new];
+  op2 = [NSOperation new];
+  [op2 addDependency: op1];
+  PASS(NO == [op2 isReady], "operation with unfinished dependency not ready");
+  [op1 addObserver: w
+        forKeyPath: @"isFinished"
+           options: NSKeyValueObservingOptionNew
+           context: 0];
+  [q addObserver: w
+      forKeyPath: @"operationCount"
+         options: NSKeyValueObservingOptionNew
+         context: 0];
+  [q addOperation: op2];
+  [q addOperation: op1];
+  PASS_EXCEPTION([q2 addOperation: op2];, NSInvalidArgumentException,
+    "adding an operation to a second queue raises");
+  [q waitUntilAllOperationsAreFinished];
+  PASS([op1 isFinished] && [op2 isFinished],
+    "dependency graph resolves without observers on the dependency");
+  PASS(1 == w->finished, "external isFinished observer is notified once");
+  PASS(w->counts >= 3, "external operationCount observer is notified");
+  PASS(0 == [q operationCount], "finished operations are removed");
+  [op1 removeObserver: w forKeyPath: @"isFinished"];
+  [q removeObserver: w forKeyPath: @"operationCount"];
+
+  [op1 release];
+  [op2 release];
+  op1 = [NSOperation new];
+  op2 = [NSOperation new];
+  [op2 addDependency: op1];
+  [op2 removeDependency: op1];
+  PASS(YES == [op2 isReady], "removing the dependency makes operation ready");
+  [op2 addDependency: op1];
+  [op2 cancel];
+  PASS(YES == [op2 isReady], "cancelling the operation makes it ready");
+
+  [op1 release];
+  [op2 release];
+  {
+    Gate        *g = [Gate new];
+
+    op1 = [NSOperation new];
+    [g addDependency: op1];
+    [q addOperation: g];
+    [q addOperation: op1];
+    [op1 waitUntilFinished];
+    [NSThread sleepForTimeInterval: 0.1];
+    PASS(NO == g->ran,
+      "operation overriding -isReady does not start when its dependency"
+      " finishes");
+    [g open];
+    [g waitUntilFinished];
+    PASS(YES == g->ran, "operation overriding -isReady starts when ready");
+    [op1 release];
+    [g release];
+  }
+
+  op1 = [NSOperation new];
+  op2 = [NSOperation new];
+  [q2 setSuspended: YES];
+  [q2 addOperation: op2];
+  PASS_EXCEPTION([q addOperations: [NSArray arrayWithObjects: op1, op2, nil]
+                waitUntilFinished: NO];, NSInvalidArgumentException,
+    "adding operations when one is in another queue raises");
+  PASS(0 == [q operationCount], "no operations are added when one raises");
+  [q addOperation: op1];
+  [q waitUntilAllOperationsAreFinished];
+  PASS(YES == [op1 isFinished], "operation can be added after the raise");
+  [q2 setSuspended: NO];
+  [q2 waitUntilAllOperationsAreFinished];
+  [op1 release];
+  [op2 release];
+  [w release];
+  [q release];
+  [q2 release];
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,160 @@
+#import <Foundation/NSArray.h>
+#import <Foundation/NSLock.h>
+#import <Foundation/NSOperation.h>
+#import <Foundation/NSThread.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import "ObjectTesting.h"
+
+static NSLock           *lock = nil;
+static unsigned         ran = 0;
+
+@interface      OpCount : NSOperation
+@end
+@implementation OpCount
+- (void) main
+{
+  [lock lock];
+  ran++;
+  [lock unlock];
+}
+@end
+
+/* An operation which adds more operations to its own queue, so that they
+ * go on to the deque of the worker running it and may be stolen.
+ */
+@interface      OpSpawn : OpCount
+{
+  NSOperationQueue      *queue;
+}
+- (id) initWithQueue: (NSOperationQueue*)q;
+@end
+@implementation OpSpawn
+- (id) initWithQueue: (NSOperationQueue*)q
+{
+  if ((self = [super init]) != nil)
+    {
+      queue = q;
+    }
+  return self;
+}
+- (void) main
+{
+  unsigned      i;
+
+  [super main];
+  for (i = 0; i < 10; i++)
+    {
+      NSOperation       *op = [OpCount new];
+
+      [queue addOperation: op];
+      [op release];
+    }
+}
+@end
+
+/* An operation which records the order in which operations run.
+ */
+@interface      OpOrder : NSOperation
+{
+  NSMutableArray        *order;
+}
+- (id) initWithOrder: (NSMutableArray*)a;
+@end
+@implementation OpOrder
+- (id) initWithOrder: (NSMutableArray*)a
+{
+  if ((self = [super init]) != nil)
+    {
+      order = a;
+    }
+  return self;
+}
+- (void) main
+{
+  [lock lock];
+  [order addObject: self];
+  [lock unlock];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSOperationQueue      *q;
+  NSMutableArray        *a;
+  id                    obj;
+  id                    old;
+  unsigned              i;
+
+  lock = [NSLock new];
+  q = [NSOperationQueue new];
+  PASS([q scheduler] == GSOperationQueueSchedulerPool,
+    "default scheduler is the thread pool");
+  [q setScheduler: GSOperationQueueSchedulerWorkStealing];
+
+  a = [NSMutableArray array];
+  for (i = 0; i < 1000; i++)
+    {
+      obj = [OpCount new];
+      [a addObject: obj];
+      [obj release];
+    }
+  [q addOperations: a waitUntilFinished: YES];
+  PASS(1000 == ran, "work stealing scheduler runs all operations");
+  PASS(0 == [q operationCount], "queue is empty after operations ran");
+
+  ran = 0;
+  [a removeAllObjects];
+  for (i = 0; i < 20; i++)
+    {
+      obj = [[OpSpawn alloc] initWithQueue: q];
+      [a addObject: obj];
+      [obj release];
+    }
+  [q addOperations: a waitUntilFinished: NO];
+  [q waitUntilAllOperationsAreFinished];
+  PASS(220 == ran, "operations added from worker threads all run");
+
+  [a removeAllObjects];
+  [q setSuspended: YES];
+  old = [OpCount new];
+  [a addObject: old];
+  [old release];
+  obj = [OpCount new];
+  [a addObject: obj];
+  [obj release];
+  [old addDependency: obj];
+  [q setSuspended: NO];
+  [q addOperations: a waitUntilFinished: YES];
+  PASS([old isFinished] && [obj isFinished],
+    "dependencies work with the work stealing scheduler");
+
+  [q release];
+
+  /* Changing the priority of a waiting operation changes when it runs.
+   */
+  q = [NSOperationQueue new];
+  [q setMaxConcurrentOperationCount: 1];
+  [q setSuspended: YES];
+  a = [NSMutableArray array];
+  for (i = 0; i < 3; i++)
+    {
+      obj = [[OpOrder alloc] initWithOrder: a];
+      [q addOperation: obj];
+      [obj release];
+    }
+  obj = [[q operations] lastObject];
+  [obj setQueuePriority: NSOperationQueuePriorityVeryHigh];
+  old = [[q operations] objectAtIndex: 0];
+  [old setQueuePriority: NSOperationQueuePriorityVeryLow];
+  [q setSuspended: NO];
+  [q waitUntilAllOperationsAreFinished];
+  PASS(3 == [a count] && [a objectAtIndex: 0] == obj
+    && [a lastObject] == old,
+    "changing the priority of a waiting operation reorders it");
+  [q release];
+
+  [lock release];
+  [arp release]; arp = nil;
+  return 0;
+}
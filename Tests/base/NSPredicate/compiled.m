@@ -0,0 +1,151 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSDictionary.h>
+#import <Foundation/NSPredicate.h>
+#import <Foundation/NSSet.h>
+#import <Foundation/NSString.h>
+#import <Foundation/NSValue.h>
+#import <GNUstepBase/GSObjCRuntime.h>
+
+/* Filtering a collection evaluates a compiled form of the predicate,
+ * so check that it gets the same results as evaluating the predicate
+ * on each object in turn.
+ */
+@interface      Record : NSObject
+{
+  int           age;            // Read directly as an ivar
+  double        _score;
+  NSString      *name;
+  Record        *parent;
+}
+- (id) initWithAge: (int)a score: (double)s name: (NSString*)n;
+- (unsigned long long) big;
+- (NSNumber*) boxed;
+- (double) score;
+- (void) setParent: (Record*)p;
+@end
+
+@implementation Record
+- (id) initWithAge: (int)a score: (double)s name: (NSString*)n
+{
+  if ((self = [super init]) != nil)
+    {
+      age = a;
+      _score = s;
+      name = [n copy];
+    }
+  return self;
+}
+- (unsigned long long) big
+{
+  return (unsigned long long)age * 1000000000000ULL;
+}
+- (NSNumber*) boxed
+{
+  return [NSNumber numberWithInt: age];
+}
+- (void) dealloc
+{
+  [name release];
+  [parent release];
+  [super dealloc];
+}
+- (double) score
+{
+  return _score;
+}
+- (void) setParent: (Record*)p
+{
+  [parent release];
+  parent = [p retain];
+}
+@end
+
+static void
+check(NSArray *a, NSString *format)
+{
+  NSPredicate           *p = [NSPredicate predicateWithFormat: format];
+  NSMutableArray        *expect = [NSMutableArray array];
+  NSMutableArray        *m;
+  NSUInteger            i;
+
+  for (i = 0; i < [a count]; i++)
+    {
+      id        o = [a objectAtIndex: i];
+
+      if ([p evaluateWithObject: o])
+        {
+          [expect addObject: o];
+        }
+    }
+  PASS_EQUAL([a filteredArrayUsingPredicate: p], expect,
+    "filteredArrayUsingPredicate: with '%s'", [format UTF8String]);
+  m = [[a mutableCopy] autorelease];
+  [m filterUsingPredicate: p];
+  PASS_EQUAL(m, expect,
+    "filterUsingPredicate: with '%s'", [format UTF8String]);
+  PASS_EQUAL([[NSSet setWithArray: a] filteredSetUsingPredicate: p],
+    [NSSet setWithArray: expect],
+    "filteredSetUsingPredicate: with '%s'", [format UTF8String]);
+}
+
+static double
+zeroScore(id self, SEL _cmd)
+{
+  return 0.0;
+}
+
+int main()
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSMutableArray        *records = [NSMutableArray array];
+  NSMutableArray        *dicts = [NSMutableArray array];
+  Record                *parent;
+  unsigned              i;
+
+  parent = [[[Record alloc] initWithAge: 60 score: 1.5 name: @"Pat"]
+    autorelease];
+  for (i = 0; i < 100; i++)
+    {
+      Record    *r;
+      NSString  *n = [NSString stringWithFormat: @"Name%u", i];
+
+      r = [[Record alloc] initWithAge: i score: i / 4.0 name: n];
+      if (i % 3 == 0)
+        {
+          [r setParent: parent];
+        }
+      [records addObject: r];
+      [r release];
+      [dicts addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+        [NSNumber numberWithInt: i], @"age", n, @"name", nil]];
+    }
+
+  check(records, @"age > 50");
+  check(records, @"age <= 10 OR age == 99");
+  check(records, @"10 < age AND score >= 20.5");
+  check(records, @"big > 50000000000000");
+  check(records, @"boxed != 7");
+  check(records, @"name BEGINSWITH 'Name9' AND age != 9");
+  check(records, @"parent.age == 60 AND NOT (age < 30)");
+  check(records, @"parent.name == 'Pat' OR name ENDSWITH '5'");
+  check(records, @"1 + 2 == 3 AND age < 5");
+  check(records, @"TRUEPREDICATE AND 1 == 2");
+  check(records, @"FALSEPREDICATE OR name LIKE 'Name1?'");
+  check(dicts, @"age >= 95 OR name == 'Name3'");
+  check(dicts, @"age.intValue < 3");
+
+  /* The compiled predicate uses the accessor key-value coding uses, so
+   * it sees a method replaced using the runtime.
+   */
+  check(records, @"score > 1");
+  class_replaceMethod([Record class], @selector(score),
+    (IMP)zeroScore, "d@:");
+  PASS(0 == [[records filteredArrayUsingPredicate:
+    [NSPredicate predicateWithFormat: @"score > 1"]] count],
+    "compiled predicate uses a method replaced using the runtime");
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,49 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSPredicate.h>
+#import <Foundation/NSString.h>
+
+int main()
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSMutableArray        *a;
+  NSArray               *r;
+  NSPredicate           *p;
+  NSPredicate           *c;
+  unsigned              i;
+
+  a = [NSMutableArray array];
+  for (i = 0; i < 1000; i++)
+    {
+      [a addObject: [NSString stringWithFormat: @"item%u", i]];
+    }
+
+  p = [NSPredicate predicateWithFormat: @"SELF MATCHES %@", @"item[0-9]*5"];
+  r = [a filteredArrayUsingPredicate: p];
+  PASS([r count] == 100, "constant MATCHES pattern filters an array");
+  PASS([p evaluateWithObject: @"item15"]
+    && ![p evaluateWithObject: @"item16"],
+    "constant MATCHES pattern is reusable after filtering");
+
+  c = [[p copy] autorelease];
+  PASS([c evaluateWithObject: @"item25"]
+    && ![c evaluateWithObject: @"xitem25"],
+    "copy of a MATCHES predicate evaluates independently");
+
+  p = [NSPredicate predicateWithFormat: @"SELF LIKE[c] %@", @"ITEM?9*"];
+  r = [a filteredArrayUsingPredicate: p];
+  PASS([r count] == 199, "constant LIKE pattern filters an array");
+
+  p = [NSPredicate predicateWithFormat: @"SELF MATCHES SELF"];
+  PASS([p evaluateWithObject: @"abc"],
+    "MATCHES with a non-constant pattern still works");
+
+  p = [NSPredicate predicateWithFormat: @"SELF MATCHES %@", @"(unclosed"];
+  PASS(![p evaluateWithObject: @"(unclosed"]
+    && ![p evaluateWithObject: @"(unclosed"],
+    "an invalid pattern never matches");
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,113 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSArray.h>
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSRunLoop.h>
+#import <Foundation/NSTimer.h>
+
+@interface      Recorder : NSObject
+{
+@public
+  NSMutableArray        *fired;
+}
+- (void) fire: (NSTimer*)t;
+@end
+@implementation Recorder
+- (id) init
+{
+  if ((self = [super init]) != nil)
+    {
+      fired = [NSMutableArray new];
+    }
+  return self;
+}
+- (void) dealloc
+{
+  [fired release];
+  [super dealloc];
+}
+- (void) fire: (NSTimer*)t
+{
+  [fired addObject: [t userInfo]];
+}
+@end
+
+static NSTimer *
+timer(Recorder *r, NSTimeInterval delay, NSString *name, NSRunLoop *l)
+{
+  NSTimer       *t;
+
+  t = [NSTimer timerWithTimeInterval: delay
+                              target: r
+                            selector: @selector(fire:)
+                            userInfo: name
+                             repeats: NO];
+  [l addTimer: t forMode: NSDefaultRunLoopMode];
+  return t;
+}
+
+int main()
+{
+  NSAutoreleasePool     *arp = [NSAutoreleasePool new];
+  NSRunLoop             *run = [NSRunLoop currentRunLoop];
+  Recorder              *r = [[Recorder new] autorelease];
+  NSTimer               *t;
+  NSArray               *expect;
+
+  /* Timers fire in date order, not the order in which they were added.
+   */
+  timer(r, 0.3, @"c", run);
+  timer(r, 0.1, @"a", run);
+  t = timer(r, 0.2, @"b", run);
+  /* Adding a timer a second time has no effect. */
+  [run addTimer: t forMode: NSDefaultRunLoopMode];
+  [run runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.5]];
+  expect = [NSArray arrayWithObjects: @"a", @"b", @"c", nil];
+  PASS_EQUAL(r->fired, expect, "timers fire in order of date");
+
+  /* Invalidated timers don't fire, and moving a date earlier is noticed.
+   */
+  [r->fired removeAllObjects];
+  t = timer(r, 0.1, @"x", run);
+  [t invalidate];
+  timer(r, 0.3, @"z", run);
+  t = timer(r, 10.0, @"y", run);
+  [t setFireDate: [NSDate dateWithTimeIntervalSinceNow: 0.2]];
+  [run runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.5]];
+  expect = [NSArray arrayWithObjects: @"y", @"z", nil];
+  PASS_EQUAL(r->fired, expect,
+    "invalidated timer is dropped and rescheduled timer fires at new date");
+
+  /* A timer moved earlier fires once, even if it is in several modes,
+   * and moving many timers at once (more than the run loop keeps track
+   * of individually) is noticed.
+   */
+  [r->fired removeAllObjects];
+  t = timer(r, 10.0, @"m", run);
+  [run addTimer: t forMode: @"OtherMode"];
+  [t setFireDate: [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+  [t setFireDate: [NSDate dateWithTimeIntervalSinceNow: 0.05]];
+  [run runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.3]];
+  expect = [NSArray arrayWithObjects: @"m", nil];
+  PASS_EQUAL(r->fired, expect, "timer moved earlier twice fires once");
+
+  [r->fired removeAllObjects];
+  {
+    NSMutableArray      *a = [NSMutableArray array];
+    unsigned            i;
+
+    for (i = 0; i < 100; i++)
+      {
+        [a addObject: timer(r, 10.0, @"n", run)];
+      }
+    for (i = 0; i < 100; i++)
+      {
+        [[a objectAtIndex: i] setFireDate:
+          [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+      }
+    [run runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.3]];
+    PASS(100 == [r->fired count], "many timers moved earlier all fire once");
+  }
+
+  [arp release]; arp = nil;
+  return 0;
+}
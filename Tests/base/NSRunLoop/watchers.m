@@ -0,0 +1,154 @@
+#import "Testing.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSDate.h>
+#import <Foundation/NSRunLoop.h>
+#import <Foundation/NSString.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+
+#define	PIPES	200
+
+@interface	Watcher : NSObject <RunLoopEvents>
+{
+@public
+  unsigned	events[PIPES];
+  unsigned	total;
+}
+@end
+
+@implementation	Watcher
+- (void) receivedEvent: (void*)data
+		  type: (RunLoopEventType)type
+		 extra: (void*)extra
+	       forMode: (NSString*)mode
+{
+  int	fd = (int)(intptr_t)extra;
+
+  if (fd >= 0 && fd < PIPES)
+    {
+      events[fd]++;
+    }
+  total++;
+}
+@end
+
+static void
+runOnce(NSRunLoop *run, NSString *mode)
+{
+  [run runMode: mode
+    beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+}
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSRunLoop		*run = [NSRunLoop currentRunLoop];
+  NSString		*other = @"OtherMode";
+  Watcher		*w = [[Watcher new] autorelease];
+  int			rfd[PIPES];
+  int			wfd[PIPES];
+  int			count;
+  int			fd;
+  int			i;
+
+  for (count = 0; count < PIPES; count++)
+    {
+      int	p[2];
+
+      if (pipe(p) < 0 || p[0] >= PIPES || p[1] >= PIPES)
+	{
+	  break;
+	}
+      rfd[count] = p[0];
+      wfd[count] = p[1];
+      [run addEvent: (void*)(intptr_t)p[0]
+	       type: ET_RDESC
+	    watcher: w
+	    forMode: NSDefaultRunLoopMode];
+    }
+  PASS(count > 10, "created pipes to watch");
+
+  write(wfd[count/2], "x", 1);
+  runOnce(run, NSDefaultRunLoopMode);
+  PASS(w->total == 1 && w->events[rfd[count/2]] == 1,
+    "only the watcher for the ready descriptor is told of an event");
+
+  runOnce(run, NSDefaultRunLoopMode);
+  PASS(w->events[rfd[count/2]] == 2,
+    "watcher is told again while the descriptor remains readable");
+
+  [run removeEvent: (void*)(intptr_t)rfd[count/2]
+	      type: ET_RDESC
+	   forMode: NSDefaultRunLoopMode
+	       all: YES];
+  w->total = 0;
+  write(wfd[0], "x", 1);
+  runOnce(run, NSDefaultRunLoopMode);
+  PASS(w->total == 1 && w->events[rfd[0]] == 1,
+    "removed watcher is not told of events");
+
+  w->total = 0;
+  runOnce(run, other);
+  PASS(w->total == 0, "watcher is not told of events in another mode");
+  [run addEvent: (void*)(intptr_t)rfd[0]
+	   type: ET_RDESC
+	watcher: w
+	forMode: other];
+  runOnce(run, other);
+  PASS(w->total == 1, "watcher is told of events in a mode it was added to");
+
+  /* A regular file is always readable.
+   */
+  fd = open("watchers.m", O_RDONLY);
+  if (fd >= 0 && fd < PIPES)
+    {
+      w->total = 0;
+      [run addEvent: (void*)(intptr_t)fd
+	       type: ET_RDESC
+	    watcher: w
+	    forMode: other];
+      runOnce(run, other);
+      PASS(w->events[fd] == 1, "watcher is told a regular file is readable");
+      [run removeEvent: (void*)(intptr_t)fd
+		  type: ET_RDESC
+	       forMode: other
+		   all: YES];
+      close(fd);
+    }
+
+  /* A descriptor closed while it is watched is reported, rather than
+   * being waited for forever.
+   */
+  memset(w->events, 0, sizeof(w->events));
+  w->total = 0;
+  close(rfd[1]);
+  runOnce(run, NSDefaultRunLoopMode);
+  PASS(w->events[rfd[1]] > 0,
+    "watcher is told when its descriptor is closed");
+  [run removeEvent: (void*)(intptr_t)rfd[1]
+	      type: ET_RDESC
+	   forMode: NSDefaultRunLoopMode
+	       all: YES];
+  write(wfd[2], "x", 1);
+  runOnce(run, NSDefaultRunLoopMode);
+  PASS(w->events[rfd[2]] == 1,
+    "other watchers are told of events after a descriptor is closed");
+
+  for (i = 0; i < count; i++)
+    {
+      [run removeEvent: (void*)(intptr_t)rfd[i]
+		  type: ET_RDESC
+	       forMode: NSDefaultRunLoopMode
+		   all: YES];
+      [run removeEvent: (void*)(intptr_t)rfd[i]
+		  type: ET_RDESC
+	       forMode: other
+		   all: YES];
+      close(rfd[i]);
+      close(wfd[i]);
+    }
+  [arp release]; arp = nil;
+  return 0;
+}
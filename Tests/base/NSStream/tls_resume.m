@@ -0,0 +1,269 @@
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+
+#if     GNUSTEP && defined(GS_USE_GNUTLS) && GS_USE_GNUTLS
+#import <GNUstepBase/NSStream+GNUstepBase.h>
+
+/* A TLS server run in a thread of the test process.  It sends 'hello'
+ * on each connection it accepts once the handshake is complete, and
+ * closes the connection when the client does.
+ */
+@interface	Server : NSObject
+{
+@public
+  GSServerStream	*listener;
+  NSMutableArray	*connections;
+  NSString		*cert;
+  NSString		*key;
+  BOOL			ready;
+}
+- (void) run: (id)ignored;
+@end
+
+@interface	Connection : NSObject
+{
+@public
+  Server		*server;
+  NSInputStream		*ip;
+  NSOutputStream	*op;
+  BOOL			sent;
+}
+- (void) finish;
+@end
+
+@implementation	Connection
+
+- (void) dealloc
+{
+  [ip release];
+  [op release];
+  [super dealloc];
+}
+
+- (void) finish
+{
+  NSRunLoop	*loop = [NSRunLoop currentRunLoop];
+
+  [[self retain] autorelease];
+  [ip setDelegate: nil];
+  [op setDelegate: nil];
+  [ip removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [op removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [ip close];
+  [op close];
+  [server->connections removeObjectIdenticalTo: self];
+}
+
+- (void) stream: (NSStream*)stream handleEvent: (NSStreamEvent)event
+{
+  if (NSStreamEventHasSpaceAvailable == event)
+    {
+      if (NO == sent)
+	{
+	  sent = YES;
+	  [op write: (const uint8_t*)"hello" maxLength: 5];
+	}
+    }
+  else if (NSStreamEventHasBytesAvailable == event)
+    {
+      uint8_t	buf[BUFSIZ];
+
+      if ([ip read: buf maxLength: sizeof(buf)] <= 0)
+	{
+	  [self finish];
+	}
+    }
+  else if (NSStreamEventEndEncountered == event
+    || NSStreamEventErrorOccurred == event)
+    {
+      [self finish];
+    }
+}
+@end
+
+@implementation	Server
+
+- (void) run: (id)ignored
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSRunLoop		*loop = [NSRunLoop currentRunLoop];
+
+  connections = [NSMutableArray new];
+  listener = [GSServerStream serverStreamToAddr: @"127.0.0.1" port: 4326];
+  [listener setDelegate: self];
+  [listener scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [listener open];
+  ready = YES;
+  for (;;)
+    {
+      NSAutoreleasePool	*pool = [NSAutoreleasePool new];
+
+      [loop runMode: NSDefaultRunLoopMode
+	 beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+      [pool release];
+    }
+  [arp release];
+}
+
+- (void) stream: (NSStream*)stream handleEvent: (NSStreamEvent)event
+{
+  if (NSStreamEventHasBytesAvailable == event)
+    {
+      NSRunLoop		*loop = [NSRunLoop currentRunLoop];
+      Connection	*c = [[Connection new] autorelease];
+      NSInputStream	*i = nil;
+      NSOutputStream	*o = nil;
+
+      [listener acceptWithInputStream: &i outputStream: &o];
+      if (nil == i || nil == o)
+	{
+	  return;
+	}
+      [i setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
+	      forKey: NSStreamSocketSecurityLevelKey];
+      [i setProperty: cert forKey: @"GSTLSCertificateFile"];
+      [i setProperty: key forKey: @"GSTLSCertificateKeyFile"];
+      c->server = self;
+      c->ip = [i retain];
+      c->op = [o retain];
+      [connections addObject: c];
+      [i setDelegate: c];
+      [o setDelegate: c];
+      [i scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+      [o scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+      [i open];
+      [o open];
+    }
+}
+@end
+
+/* Connects to the server, reads its greeting and closes the connection.
+ */
+@interface	Client : NSObject
+{
+@public
+  NSMutableData	*received;
+  BOOL		failed;
+}
+- (BOOL) fetch;
+@end
+
+@implementation	Client
+
+- (void) dealloc
+{
+  [received release];
+  [super dealloc];
+}
+
+- (BOOL) fetch
+{
+  NSRunLoop		*loop = [NSRunLoop currentRunLoop];
+  NSInputStream		*ip = nil;
+  NSOutputStream	*op = nil;
+  NSDate		*limit;
+
+  [received release];
+  received = [NSMutableData new];
+  failed = NO;
+  [NSStream getStreamsToHost: [NSHost hostWithAddress: @"127.0.0.1"]
+			port: 4326
+		 inputStream: &ip
+		outputStream: &op];
+  [op setProperty: NSStreamSocketSecurityLevelNegotiatedSSL
+	   forKey: NSStreamSocketSecurityLevelKey];
+  [op setProperty: @"NO" forKey: @"GSTLSVerify"];
+  [ip setDelegate: self];
+  [op setDelegate: self];
+  [ip scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [op scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [ip open];
+  [op open];
+  limit = [NSDate dateWithTimeIntervalSinceNow: 10.0];
+  while (NO == failed && [received length] < 5
+    && [limit timeIntervalSinceNow] > 0.0)
+    {
+      [loop runMode: NSDefaultRunLoopMode beforeDate: limit];
+    }
+  [ip setDelegate: nil];
+  [op setDelegate: nil];
+  [ip removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [op removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [ip close];
+  [op close];
+  return [received isEqual: [NSData dataWithBytes: "hello" length: 5]];
+}
+
+- (void) stream: (NSStream*)stream handleEvent: (NSStreamEvent)event
+{
+  if (NSStreamEventHasBytesAvailable == event)
+    {
+      uint8_t	buf[BUFSIZ];
+      int	len = [(NSInputStream*)stream read: buf maxLength: sizeof(buf)];
+
+      if (len > 0)
+	{
+	  [received appendBytes: buf length: len];
+	}
+    }
+  else if (NSStreamEventEndEncountered == event
+    || NSStreamEventErrorOccurred == event)
+    {
+      failed = YES;
+    }
+}
+@end
+
+static NSUInteger
+tlsCount(NSString *key)
+{
+  return [[[NSStream tlsSessionStatistics] objectForKey: key]
+    unsignedIntegerValue];
+}
+#endif
+
+int main()
+{
+#if     GNUSTEP && defined(GS_USE_GNUTLS) && GS_USE_GNUTLS
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSString		*dir = [[NSFileManager defaultManager]
+    currentDirectoryPath];
+  Server		*server = [[Server new] autorelease];
+  Client		*client = [[Client new] autorelease];
+  NSDate		*limit;
+  NSUInteger		clientFull;
+  NSUInteger		clientResumed;
+  NSUInteger		serverResumed;
+
+  server->cert = [dir stringByAppendingPathComponent: @"tls-test.crt"];
+  server->key = [dir stringByAppendingPathComponent: @"tls-test.key"];
+  [NSThread detachNewThreadSelector: @selector(run:)
+			   toTarget: server
+			 withObject: nil];
+  limit = [NSDate dateWithTimeIntervalSinceNow: 5.0];
+  while (NO == server->ready && [limit timeIntervalSinceNow] > 0.0)
+    {
+      [NSThread sleepUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.01]];
+    }
+  PASS(YES == server->ready, "local TLS server started");
+
+  clientFull = tlsCount(@"clientFull");
+  clientResumed = tlsCount(@"clientResumed");
+  serverResumed = tlsCount(@"serverResumed");
+  PASS([client fetch], "first TLS connection works");
+  PASS(tlsCount(@"clientFull") - clientFull == 1
+    && tlsCount(@"clientResumed") == clientResumed,
+    "first connection needs a full handshake");
+  PASS(tlsCount(@"cached") > 0, "session is cached after the connection");
+
+  PASS([client fetch], "second TLS connection works");
+  PASS(tlsCount(@"clientResumed") - clientResumed == 1
+    && tlsCount(@"clientFull") - clientFull == 1,
+    "second connection resumes the session");
+  PASS(tlsCount(@"serverResumed") - serverResumed == 1,
+    "server counts the resumed session");
+
+  [arp release]; arp = nil;
+#endif
+  return 0;
+}
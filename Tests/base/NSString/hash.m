@@ -0,0 +1,91 @@
+#import "Testing.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSString.h>
+
+/* A string which has none of the concrete string classes' own code, so
+ * that its hash is produced by NSString from its characters.
+ */
+@interface PlainString : NSString
+{
+  NSString	*s;
+}
+- (id) initWithString: (NSString*)str;
+@end
+
+@implementation PlainString
+- (unichar) characterAtIndex: (NSUInteger)i
+{
+  return [s characterAtIndex: i];
+}
+- (void) dealloc
+{
+  [s release];
+  [super dealloc];
+}
+- (id) initWithString: (NSString*)str
+{
+  s = [str copy];
+  return self;
+}
+- (NSUInteger) length
+{
+  return [s length];
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSMutableString	*m = [NSMutableString string];
+  BOOL			same = YES;
+  BOOL			differ = YES;
+  NSUInteger		last = 0;
+  int			i;
+
+  for (i = 0; i < 300; i++)
+    {
+      NSString		*latin1;
+      NSString		*wide;
+      NSString		*plain;
+      unichar		*u;
+      NSUInteger	h;
+
+      [m appendFormat: @"%c", 'a' + (i * 7) % 26];
+      if (i % 50 == 49)
+	{
+	  [m appendFormat: @"%C", (unichar)0xe9];
+	}
+      latin1 = [NSString stringWithString: m];
+      u = malloc([m length] * sizeof(unichar));
+      [m getCharacters: u];
+      wide = [NSString stringWithCharacters: u length: [m length]];
+      free(u);
+      plain = [[[PlainString alloc] initWithString: m] autorelease];
+
+      h = [latin1 hash];
+      if (h != [wide hash] || h != [plain hash] || h != [m hash])
+	{
+	  same = NO;
+	}
+      if (h == last)
+	{
+	  differ = NO;
+	}
+      last = h;
+    }
+  PASS(same, "strings with the same characters have the same hash"
+    " however they are stored");
+  PASS(differ, "strings which differ in their last character have"
+    " different hashes");
+
+  PASS([@"hello world" hash]
+    == [[NSString stringWithUTF8String: "hello world"] hash],
+    "constant strings hash as other strings");
+  PASS([@"long constant string which is more than sixty four characters long"
+    hash] == [[NSString stringWithUTF8String: "long constant string which"
+    " is more than sixty four characters long"] hash],
+    "long constant strings hash as other strings");
+
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,264 @@
+#import <Foundation/Foundation.h>
+#import "ObjectTesting.h"
+
+@interface	NSURLCache (Testing)
+- (void) _flush;
+@end
+
+static NSCachedURLResponse *
+cached(NSString *url, NSString *body, NSDictionary *headers,
+  NSURLCacheStoragePolicy policy)
+{
+  NSHTTPURLResponse	*r;
+
+  r = [[[NSHTTPURLResponse alloc] initWithURL: [NSURL URLWithString: url]
+				   statusCode: 200
+				  HTTPVersion: @"HTTP/1.1"
+				 headerFields: headers] autorelease];
+  return [[[NSCachedURLResponse alloc]
+    initWithResponse: r
+		data: [body dataUsingEncoding: NSUTF8StringEncoding]
+	    userInfo: nil
+       storagePolicy: policy] autorelease];
+}
+
+static NSURLRequest *
+request(NSString *url)
+{
+  return [NSURLRequest requestWithURL: [NSURL URLWithString: url]];
+}
+
+static NSString *
+body(NSURLCache *c, NSString *url)
+{
+  NSCachedURLResponse	*r = [c cachedResponseForRequest: request(url)];
+
+  if (nil == r)
+    {
+      return nil;
+    }
+  return [[[NSString alloc] initWithData: [r data]
+				encoding: NSUTF8StringEncoding] autorelease];
+}
+
+static void
+store(NSURLCache *c, NSString *url, NSString *text)
+{
+  [c storeCachedResponse: cached(url, text, nil, NSURLCacheStorageAllowed)
+	      forRequest: request(url)];
+}
+
+/* Changes the byte at offset (from the end of the file if negative).
+ */
+static void
+damage(NSString *file, long long offset)
+{
+  NSFileHandle	*h = [NSFileHandle fileHandleForUpdatingAtPath: file];
+  NSData	*d;
+  uint8_t	b;
+
+  if (offset < 0)
+    {
+      offset += [h seekToEndOfFile];
+    }
+  [h seekToFileOffset: offset];
+  d = [h readDataOfLength: 1];
+  b = *(const uint8_t*)[d bytes] ^ 0xff;
+  [h seekToFileOffset: offset];
+  [h writeData: [NSData dataWithBytes: &b length: 1]];
+  [h closeFile];
+}
+
+static BOOL
+waitForDisk(NSURLCache *c, NSUInteger usage)
+{
+  int	i;
+
+  for (i = 0; i < 500 && [c currentDiskUsage] < usage; i++)
+    {
+      [NSThread sleepForTimeInterval: 0.01];
+    }
+  return [c currentDiskUsage] >= usage;
+}
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSString		*path;
+  NSURLCache		*c;
+  NSURLRequest		*req;
+  NSMutableURLRequest	*post;
+  NSCachedURLResponse	*r;
+  NSDictionary		*h;
+  NSString		*file;
+  NSString		*big;
+  NSFileHandle		*fh;
+  unsigned long long	len;
+
+  path = [NSTemporaryDirectory() stringByAppendingPathComponent:
+    [NSString stringWithFormat: @"URLCache%d",
+    [[NSProcessInfo processInfo] processIdentifier]]];
+  [[NSFileManager defaultManager] removeFileAtPath: path handler: nil];
+
+  h = [NSDictionary dictionaryWithObjectsAndKeys:
+    @"\"abc\"", @"ETag", @"max-age=60", @"Cache-Control", nil];
+  req = [NSURLRequest requestWithURL:
+    [NSURL URLWithString: @"http://www.gnustep.org/a"]];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 1024 * 1024
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  [c storeCachedResponse: cached(@"http://www.gnustep.org/a", @"first", h,
+    NSURLCacheStorageAllowed) forRequest: req];
+  PASS_EQUAL([[[NSString alloc] initWithData:
+    [[c cachedResponseForRequest: req] data]
+    encoding: NSUTF8StringEncoding] autorelease], @"first",
+    "stored response is returned at once");
+  PASS(waitForDisk(c, 1), "response is written to disk");
+
+  post = [NSMutableURLRequest requestWithURL:
+    [NSURL URLWithString: @"http://www.gnustep.org/b"]];
+  [post setHTTPMethod: @"POST"];
+  [c storeCachedResponse: cached(@"http://www.gnustep.org/b", @"post", nil,
+    NSURLCacheStorageAllowed) forRequest: post];
+  PASS(nil == [c cachedResponseForRequest: post],
+    "response to POST is not cached");
+
+  req = [NSURLRequest requestWithURL:
+    [NSURL URLWithString: @"http://www.gnustep.org/c"]];
+  [c storeCachedResponse: cached(@"http://www.gnustep.org/c", @"secret",
+    [NSDictionary dictionaryWithObject: @"no-store" forKey: @"Cache-Control"],
+    NSURLCacheStorageAllowed) forRequest: req];
+  PASS(nil == [c cachedResponseForRequest: req],
+    "response with Cache-Control no-store is not cached");
+  [c _flush];
+  [c release];
+
+  /* A new cache using the same directory has the responses on disk.
+   */
+  req = [NSURLRequest requestWithURL:
+    [NSURL URLWithString: @"http://www.gnustep.org/a"]];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 1024 * 1024
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  PASS([c currentDiskUsage] > 0, "disk usage is restored");
+  r = [c cachedResponseForRequest: req];
+  PASS_EQUAL([[[NSString alloc] initWithData: [r data]
+    encoding: NSUTF8StringEncoding] autorelease], @"first",
+    "response is read back from disk");
+  PASS_EQUAL([[(NSHTTPURLResponse*)[r response] allHeaderFields]
+    objectForKey: @"ETag"], @"\"abc\"", "ETag header is kept");
+  PASS([(NSHTTPURLResponse*)[r response] statusCode] == 200,
+    "status code is kept");
+
+  [c removeCachedResponseForRequest: req];
+  PASS(nil == [c cachedResponseForRequest: req], "response is removed");
+  [c _flush];
+  [c release];
+
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 1024 * 1024
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  PASS(nil == [c cachedResponseForRequest: req],
+    "removal is kept on disk");
+  [c release];
+  [[NSFileManager defaultManager] removeFileAtPath: path handler: nil];
+
+  /* A record cut short (as by a crash while writing) is dropped when the
+   * cache is opened, and the records before it are kept.
+   */
+  file = [path stringByAppendingPathComponent: @"cache.db"];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 0
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  store(c, @"http://www.gnustep.org/d", @"kept");
+  [c _flush];
+  store(c, @"http://www.gnustep.org/e", @"lost");
+  [c _flush];
+  [c release];
+  fh = [NSFileHandle fileHandleForUpdatingAtPath: file];
+  len = [fh seekToEndOfFile];
+  [fh truncateFileAtOffset: len - 3];
+  [fh closeFile];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 0
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/d"), @"kept",
+    "record before a truncated one is kept");
+  PASS(nil == body(c, @"http://www.gnustep.org/e"),
+    "truncated record is dropped");
+  store(c, @"http://www.gnustep.org/f", @"after");
+  [c _flush];
+  [c release];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 0
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/f"), @"after",
+    "records are written after recovering from truncation");
+
+  /* A record damaged while the cache is open is not returned.
+   */
+  damage(file, -1);
+  PASS(nil == body(c, @"http://www.gnustep.org/f"),
+    "record damaged on disk is not returned");
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/d"), @"kept",
+    "undamaged record is still returned");
+  [c _flush];
+  [c release];
+
+  /* A record damaged while the cache was closed is dropped on opening.
+   */
+  damage(file, -2);
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 0
+				    diskCapacity: 1024 * 1024
+					diskPath: path];
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/d"), @"kept",
+    "record before a damaged one is kept");
+  PASS(nil == body(c, @"http://www.gnustep.org/f"),
+    "damaged record is dropped on opening");
+
+  /* Only one cache may use a directory; another keeps its responses in
+   * memory.
+   */
+  {
+    NSURLCache	*other;
+
+    other = [[NSURLCache alloc] initWithMemoryCapacity: 1024 * 1024
+					  diskCapacity: 1024 * 1024
+					      diskPath: path];
+    PASS([other currentDiskUsage] == 0,
+      "second cache for a directory does not use the disk");
+    store(other, @"http://www.gnustep.org/g", @"memory");
+    PASS_EQUAL(body(other, @"http://www.gnustep.org/g"), @"memory",
+      "second cache for a directory keeps responses in memory");
+    [other release];
+  }
+  [c _flush];
+  [c release];
+  [[NSFileManager defaultManager] removeFileAtPath: path handler: nil];
+
+  /* The least recently used record is removed when the disk is full.
+   */
+  big = [@"" stringByPaddingToLength: 2000 withString: @"x" startingAtIndex: 0];
+  c = [[NSURLCache alloc] initWithMemoryCapacity: 0
+				    diskCapacity: 5000
+					diskPath: path];
+  store(c, @"http://www.gnustep.org/h", big);
+  store(c, @"http://www.gnustep.org/i", big);
+  [c _flush];
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/h"), big,
+    "first record is read from disk");
+  store(c, @"http://www.gnustep.org/j", big);
+  [c _flush];
+  PASS(nil == body(c, @"http://www.gnustep.org/i"),
+    "least recently used record is evicted");
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/h"), big,
+    "recently read record is kept");
+  PASS_EQUAL(body(c, @"http://www.gnustep.org/j"), big,
+    "new record is kept");
+  PASS([c currentDiskUsage] <= 5000, "disk usage is within capacity");
+  [c _flush];
+  [c release];
+  [[NSFileManager defaultManager] removeFileAtPath: path handler: nil];
+  [arp release]; arp = nil;
+  return 0;
+}
@@ -0,0 +1,328 @@
+#import <Foundation/Foundation.h>
+#import "Testing.h"
+#import "ObjectTesting.h"
+
+#if     GNUSTEP
+#import <GNUstepBase/NSStream+GNUstepBase.h>
+
+/* A minimal HTTP server run in a thread of the test process.  It keeps
+ * connections open between requests, and closes a connection after
+ * responding to a request whose path begins '/drop' (without telling
+ * the client it is going to).
+ */
+@interface	Server : NSObject
+{
+@public
+  GSServerStream	*listener;
+  NSMutableArray	*connections;
+  NSUInteger		accepted;
+  BOOL			ready;
+}
+- (void) run: (id)ignored;
+@end
+
+@interface	Connection : NSObject
+{
+@public
+  Server		*server;
+  NSInputStream		*ip;
+  NSOutputStream	*op;
+  NSMutableData		*received;
+  NSMutableData		*pending;
+  BOOL			drop;
+}
+- (void) finish;
+- (void) flush;
+@end
+
+/* Returns the length of the first request (the headers up to the empty
+ * line) in the data, or zero if the data does not hold a whole request.
+ */
+static NSUInteger
+endOfRequest(NSData *d)
+{
+  const char	*b = [d bytes];
+  NSUInteger	l = [d length];
+  NSUInteger	i;
+
+  for (i = 3; i < l; i++)
+    {
+      if (memcmp(b + i - 3, "\r\n\r\n", 4) == 0)
+	{
+	  return i + 1;
+	}
+    }
+  return 0;
+}
+
+@implementation	Connection
+
+- (void) dealloc
+{
+  [ip release];
+  [op release];
+  [received release];
+  [pending release];
+  [super dealloc];
+}
+
+- (void) finish
+{
+  NSRunLoop	*loop = [NSRunLoop currentRunLoop];
+
+  [[self retain] autorelease];
+  [ip setDelegate: nil];
+  [op setDelegate: nil];
+  [ip removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [op removeFromRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [ip close];
+  [op close];
+  [server->connections removeObjectIdenticalTo: self];
+}
+
+- (void) flush
+{
+  while ([pending length] > 0)
+    {
+      int	written = [op write: [pending bytes] maxLength: [pending length]];
+
+      if (written <= 0)
+	{
+	  return;	// Wait for space
+	}
+      [pending replaceBytesInRange: NSMakeRange(0, written)
+			 withBytes: 0
+			    length: 0];
+    }
+  if (YES == drop)
+    {
+      [self finish];
+    }
+}
+
+- (void) stream: (NSStream*)stream handleEvent: (NSStreamEvent)event
+{
+  if (NSStreamEventHasBytesAvailable == event)
+    {
+      uint8_t		buf[BUFSIZ];
+      int		len = [ip read: buf maxLength: sizeof(buf)];
+      NSUInteger	used;
+
+      if (len <= 0)
+	{
+	  [self finish];
+	  return;
+	}
+      [received appendBytes: buf length: len];
+      while ((used = endOfRequest(received)) > 0)
+	{
+	  if ([received length] > 10
+	    && memcmp([received bytes], "GET /drop", 9) == 0)
+	    {
+	      drop = YES;
+	    }
+	  [received replaceBytesInRange: NSMakeRange(0, used)
+			      withBytes: 0
+				 length: 0];
+	  [pending appendBytes: "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n"
+	    "hello" length: 43];
+	}
+      [self flush];
+    }
+  else if (NSStreamEventHasSpaceAvailable == event)
+    {
+      [self flush];
+    }
+  else if (NSStreamEventEndEncountered == event
+    || NSStreamEventErrorOccurred == event)
+    {
+      [self finish];
+    }
+}
+@end
+
+@implementation	Server
+
+- (void) run: (id)ignored
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSRunLoop		*loop = [NSRunLoop currentRunLoop];
+
+  connections = [NSMutableArray new];
+  listener = [GSServerStream serverStreamToAddr: @"127.0.0.1" port: 4325];
+  [listener setDelegate: self];
+  [listener scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+  [listener open];
+  ready = YES;
+  for (;;)
+    {
+      NSAutoreleasePool	*pool = [NSAutoreleasePool new];
+
+      [loop runMode: NSDefaultRunLoopMode
+	 beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.1]];
+      [pool release];
+    }
+  [arp release];
+}
+
+- (void) stream: (NSStream*)stream handleEvent: (NSStreamEvent)event
+{
+  if (NSStreamEventHasBytesAvailable == event)
+    {
+      NSRunLoop		*loop = [NSRunLoop currentRunLoop];
+      Connection	*c = [[Connection new] autorelease];
+      NSInputStream	*i = nil;
+      NSOutputStream	*o = nil;
+
+      [listener acceptWithInputStream: &i outputStream: &o];
+      if (nil == i || nil == o)
+	{
+	  return;
+	}
+      accepted++;
+      c->server = self;
+      c->ip = [i retain];
+      c->op = [o retain];
+      c->received = [NSMutableData new];
+      c->pending = [NSMutableData new];
+      [connections addObject: c];
+      [i setDelegate: c];
+      [o setDelegate: c];
+      [i scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+      [o scheduleInRunLoop: loop forMode: NSDefaultRunLoopMode];
+      [i open];
+      [o open];
+    }
+}
+@end
+
+/* Collects the results of asynchronous loads.
+ */
+@interface	Loader : NSObject
+{
+@public
+  NSUInteger	finished;
+  NSUInteger	failed;
+}
+@end
+
+@implementation	Loader
+- (void) connection: (NSURLConnection*)c didFailWithError: (NSError*)e
+{
+  failed++;
+}
+- (void) connectionDidFinishLoading: (NSURLConnection*)c
+{
+  finished++;
+}
+@end
+
+static NSData *
+fetch(NSString *path)
+{
+  NSURLRequest	*r;
+  NSURLResponse	*response = nil;
+  NSError	*error = nil;
+
+  r = [NSURLRequest requestWithURL: [NSURL URLWithString:
+    [@"http://127.0.0.1:4325" stringByAppendingString: path]]];
+  return [NSURLConnection sendSynchronousRequest: r
+			       returningResponse: &response
+					   error: &error];
+}
+
+static NSUInteger
+poolCount(NSString *key)
+{
+  return [[[NSURLProtocol connectionPoolStatistics] objectForKey: key]
+    unsignedIntegerValue];
+}
+#endif
+
+int main()
+{
+#if     GNUSTEP
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSData		*hello = [NSData dataWithBytes: "hello" length: 5];
+  Server		*server = [[Server new] autorelease];
+  Loader		*loader = [[Loader new] autorelease];
+  NSURLRequest		*r;
+  NSDate		*limit;
+  NSUInteger		hits;
+  NSUInteger		misses;
+  NSUInteger		stale;
+  NSUInteger		waits;
+  BOOL			ok;
+  int			i;
+
+  [NSThread detachNewThreadSelector: @selector(run:)
+			   toTarget: server
+			 withObject: nil];
+  limit = [NSDate dateWithTimeIntervalSinceNow: 5.0];
+  while (NO == server->ready && [limit timeIntervalSinceNow] > 0.0)
+    {
+      [NSThread sleepUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.01]];
+    }
+  PASS(YES == server->ready, "local HTTP server started");
+
+  hits = poolCount(@"hits");
+  misses = poolCount(@"misses");
+  ok = YES;
+  for (i = 0; i < 3; i++)
+    {
+      if (NO == [fetch(@"/keep") isEqual: hello])
+	{
+	  ok = NO;
+	}
+    }
+  PASS(ok, "requests on a pooled connection get their responses");
+  PASS(1 == server->accepted, "requests to a host share one connection");
+  PASS(poolCount(@"misses") - misses == 1 && poolCount(@"hits") - hits == 2,
+    "pool statistics count one miss and two hits");
+  PASS(poolCount(@"idle") == 1, "connection is idle in the pool after use");
+
+  /* The server closes the connection after this response, so the next
+   * request finds the pooled connection closed and must retry.
+   */
+  PASS_EQUAL(fetch(@"/drop"), hello, "response before the server closes");
+  stale = poolCount(@"stale");
+  PASS_EQUAL(fetch(@"/keep"), hello,
+    "request on a connection closed by the server is retried");
+  PASS(poolCount(@"stale") - stale == 1, "stale pooled connection is counted");
+  PASS(2 == server->accepted, "a new connection replaces the stale one");
+
+  /* With one connection per host, concurrent requests wait their turn.
+   */
+  [NSURLProtocol setConnectionPoolMaximumPerHost: 1];
+  waits = poolCount(@"waits");
+  r = [NSURLRequest requestWithURL:
+    [NSURL URLWithString: @"http://127.0.0.1:4325/keep"]];
+  for (i = 0; i < 3; i++)
+    {
+      [NSURLConnection connectionWithRequest: r delegate: loader];
+    }
+  limit = [NSDate dateWithTimeIntervalSinceNow: 10.0];
+  while (loader->finished + loader->failed < 3
+    && [limit timeIntervalSinceNow] > 0.0)
+    {
+      [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+			       beforeDate: limit];
+    }
+  PASS(3 == loader->finished, "concurrent requests with a limit complete");
+  PASS(poolCount(@"waits") > waits, "requests waited for the host limit");
+  PASS(2 == server->accepted, "the host limit is respected");
+  [NSURLProtocol setConnectionPoolMaximumPerHost: 6];
+
+  /* With no idle time, connections are not reused.
+   */
+  [NSURLProtocol setConnectionPoolIdleTimeout: 0.0];
+  misses = poolCount(@"misses");
+  fetch(@"/keep");	// Last use of the pooled connection
+  fetch(@"/keep");
+  PASS(poolCount(@"misses") - misses == 1 && poolCount(@"idle") == 0,
+    "connections are not pooled with a zero idle timeout");
+
+  [arp release]; arp = nil;
+#endif
+  return 0;
+}
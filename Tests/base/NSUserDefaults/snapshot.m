@@ -0,0 +1,97 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSDictionary.h>
+#import <Foundation/NSThread.h>
+#import <Foundation/NSUserDefaults.h>
+#import <Foundation/NSValue.h>
+
+static volatile BOOL	done = NO;
+static volatile BOOL	bad = NO;
+
+@interface	Reader : NSObject
+@end
+
+@implementation	Reader
+- (void) run: (NSUserDefaults*)defs
+{
+  while (NO == done)
+    {
+      NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+      NSInteger		i = [defs integerForKey: @"snapCount"];
+
+      if (i < 0 || [defs boolForKey: @"snapFlag"] == NO)
+	{
+	  bad = YES;
+	}
+      [arp release];
+    }
+}
+@end
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSUserDefaults	*defs = [NSUserDefaults standardUserDefaults];
+  NSDictionary		*rep;
+  int			i;
+
+  [defs registerDefaults: [NSDictionary dictionaryWithObjectsAndKeys:
+    @"YES", @"snapFlag", @"12", @"snapCount", nil]];
+  PASS([defs boolForKey: @"snapFlag"] == YES, "registered default is seen");
+  PASS([defs integerForKey: @"snapCount"] == 12,
+    "string default is parsed as an integer");
+  PASS([defs doubleForKey: @"snapCount"] == 12.0,
+    "string default is parsed as a double");
+
+  [defs setInteger: 7 forKey: @"snapCount"];
+  PASS([defs integerForKey: @"snapCount"] == 7,
+    "persistent value overrides registered one");
+  rep = [defs dictionaryRepresentation];
+  PASS_EQUAL([rep objectForKey: @"snapCount"], [NSNumber numberWithInt: 7],
+    "dictionary representation has the new value");
+
+  [defs setVolatileDomain: [NSDictionary dictionaryWithObject: @"99"
+    forKey: @"snapCount"] forName: @"SnapDomain"];
+  [defs addSuiteNamed: @"SnapDomain"];
+  PASS([defs integerForKey: @"snapCount"] == 7,
+    "suite comes after the application domain");
+  [defs removeObjectForKey: @"snapCount"];
+  PASS([defs integerForKey: @"snapCount"] == 99,
+    "removing a value exposes one from a later domain");
+  [defs removeSuiteNamed: @"SnapDomain"];
+  [defs removeVolatileDomainForName: @"SnapDomain"];
+  PASS([defs integerForKey: @"snapCount"] == 12,
+    "removing a domain is seen at once");
+  PASS_EQUAL([rep objectForKey: @"snapCount"], [NSNumber numberWithInt: 7],
+    "an earlier dictionary representation is unchanged");
+
+  PASS([defs objectForKey: @"snapMissing"] == nil
+    && [defs boolForKey: @"snapMissing"] == NO
+    && [defs integerForKey: @"snapMissing"] == 0,
+    "missing default has no value");
+  [defs setObject: [NSArray array] forKey: @"snapArray"];
+  PASS([defs integerForKey: @"snapArray"] == 0,
+    "non scalar default has no integer value");
+  [defs removeObjectForKey: @"snapArray"];
+
+  /* Readers run while the defaults are changed.
+   */
+  for (i = 0; i < 4; i++)
+    {
+      [NSThread detachNewThreadSelector: @selector(run:)
+			       toTarget: [[Reader new] autorelease]
+			     withObject: defs];
+    }
+  for (i = 0; i < 2000; i++)
+    {
+      [defs setInteger: i forKey: @"snapCount"];
+    }
+  done = YES;
+  [NSThread sleepForTimeInterval: 0.1];
+  PASS(NO == bad, "readers see consistent values while defaults change");
+  PASS([defs integerForKey: @"snapCount"] == 1999, "last value is seen");
+  [defs removeObjectForKey: @"snapCount"];
+
+  [arp release]; arp = nil;
+  return 0;
+}
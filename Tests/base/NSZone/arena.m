@@ -0,0 +1,67 @@
+#import "ObjectTesting.h"
+#import <Foundation/NSAutoreleasePool.h>
+#import <Foundation/NSString.h>
+#import <Foundation/NSZone.h>
+
+int main()
+{
+  NSAutoreleasePool	*arp = [NSAutoreleasePool new];
+  NSZone		*zone;
+  struct NSZoneStats	stats;
+  NSObject		*o;
+  char			*p;
+  BOOL			ok;
+  int			i;
+
+  zone = NSCreateZone(1024, 1024, NO);
+  PASS(zone != 0 && zone != NSDefaultMallocZone(),
+    "a non-freeable zone is a zone of its own");
+
+  o = [[NSObject allocWithZone: zone] init];
+  PASS([o zone] == zone, "object allocated in a zone is in that zone");
+  PASS([[[NSObject new] autorelease] zone] == NSDefaultMallocZone(),
+    "other objects are in the default zone");
+
+  ok = YES;
+  for (i = 1; i < 10000; i++)
+    {
+      p = NSZoneMalloc(zone, i % 100 + 1);
+      if (((uintptr_t)p % sizeof(double)) != 0
+	|| NSZoneFromPointer(p) != zone)
+	{
+	  ok = NO;
+	}
+      memset(p, 0xff, i % 100 + 1);
+    }
+  p = NSZoneMalloc(zone, 100000);
+  memset(p, 0, 100000);
+  PASS(ok && NSZoneFromPointer(p) == zone,
+    "allocations are aligned and found in the zone");
+  PASS(NSZoneCheck(zone), "zone is consistent");
+
+  p = NSZoneRealloc(zone, p, 10);
+  PASS(p != 0 && NSZoneFromPointer(p) == zone, "realloc stays in the zone");
+
+  stats = NSZoneStats(zone);
+  PASS(stats.chunks_used == 10002, "stats count allocations");
+  PASS(stats.bytes_used >= 100000 && stats.bytes_used <= stats.bytes_total
+    && stats.bytes_used + stats.bytes_free == stats.bytes_total,
+    "stats count bytes");
+
+  [o release];
+  NSRecycleZone(zone);
+
+  zone = NSCreateZone(1024, 1024, NO);
+  stats = NSZoneStats(zone);
+  PASS(stats.bytes_used + stats.bytes_free == stats.bytes_total,
+    "stats of a new zone add up");
+  NSZoneMalloc(zone, 8);
+  stats = NSZoneStats(zone);
+  PASS(stats.chunks_used == 1 && stats.bytes_used > 8
+    && stats.bytes_used + stats.bytes_free == stats.bytes_total,
+    "block headers count as used bytes");
+  NSRecycleZone(zone);
+
+  [arp release]; arp = nil;
+  return 0;
+}